@@ -0,0 +1,797 @@
+// Performance benchmarks for the RexConsoleEngine, run in Release
+#include "RexConsoleEngine.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace RexConsoleEngine;
+
+// Average time of a call to function, in milliseconds
+template<class Function>
+double Measure(int iterations, Function&& function)
+{
+	function(); // Warm up
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		function();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+// Print a result line
+void Report(const std::string& name, double ms, const std::string& extra = "")
+{
+	std::cout << std::left << std::setw(40) << name << std::right << std::setw(10) << std::fixed << std::setprecision(3) << ms << " ms  " << extra << std::endl;
+}
+
+
+/* ----- JobSystem ----- */
+
+// Some float math per entity, like an AI or physics update
+struct Entity { float x, y, vx, vy; };
+
+void UpdateEntity(Entity& e)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		float d = std::sqrt(e.x * e.x + e.y * e.y) + 1.0f;
+		e.vx -= e.x / d * 0.01f;
+		e.vy -= e.y / d * 0.01f;
+		e.x += e.vx * 0.016f;
+		e.y += e.vy * 0.016f;
+	}
+}
+
+void BenchmarkJobSystem()
+{
+	std::cout << "--- JobSystem scaling ---" << std::endl;
+
+	std::vector<Entity> entities(1 << 20);
+	for (auto& e : entities)
+		e = { Random::Get(-100.0f, 100.0f), Random::Get(-100.0f, 100.0f), 0.0f, 0.0f };
+
+	double parallelForBase = 0.0, graphBase = 0.0;
+	for (unsigned int threads = 1; threads <= 32; threads *= 2)
+	{
+		JobSystem::Start(threads);
+
+		// ParallelFor over all the entities
+		double parallelFor = Measure(10, [&]
+		{
+			JobSystem::ParallelFor(0, (int)entities.size(), 4096, [&](int i) { UpdateEntity(entities[i]); });
+		});
+
+		// Task graph : 64 independent chains of 16 jobs, joined by a final job
+		double graph = Measure(10, [&]
+		{
+			std::vector<JobSystem::Handle> chains;
+			for (int chain = 0; chain < 64; chain++)
+			{
+				JobSystem::Handle last;
+				for (int link = 0; link < 16; link++)
+				{
+					const size_t first = (size_t)(chain * 16 + link) * 1024;
+					last = JobSystem::Run([&, first] { for (size_t i = first; i < first + 1024; i++) UpdateEntity(entities[i]); }, { last });
+				}
+				chains.push_back(last);
+			}
+
+			JobGroup join;
+			for (auto& chain : chains)
+				join.Run([] {}, { chain });
+			join.Wait();
+		});
+
+		if (threads == 1)
+		{
+			parallelForBase = parallelFor;
+			graphBase = graph;
+		}
+
+		std::ostringstream speedup;
+		speedup << std::setprecision(2) << std::fixed << "x" << parallelForBase / parallelFor;
+		Report("ParallelFor 1M entities, " + std::to_string(threads) + " threads", parallelFor, speedup.str());
+		speedup.str("");
+		speedup << "x" << graphBase / graph;
+		Report("Task graph 1024 jobs, " + std::to_string(threads) + " threads", graph, speedup.str());
+	}
+
+	JobSystem::Start(); // Back to one thread per core
+}
+
+
+/* ----- Renderer3D ----- */
+
+void BenchmarkRenderer3D()
+{
+	std::cout << "--- Renderer3D spinning torus ---" << std::endl;
+
+	const int frames = 200;
+	Mesh torus = Mesh::Torus(1.0f, 0.4f, 64, 32, Console::Color::Cyan);
+	UINT64 rasterized = 0;
+	double ms;
+
+	{
+		// The console takes over the screen while it exists, the results are printed after
+		Console console(200, 100, "Renderer3D benchmark");
+		Renderer3D renderer;
+		renderer.SetCamera(Matrix4::LookAt({ 0.0f, 1.0f, 3.5f }, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }), Matrix4::Perspective(1.0f, 2.0f, 0.1f, 100.0f));
+		renderer.SetLight({ -1.0f, -1.0f, -1.0f });
+
+		int frame = 0;
+		ms = Measure(frames, [&]
+		{
+			console.Clear(Console::Color::Black);
+			renderer.Begin(console);
+			renderer.DrawMesh(console, torus, Matrix4::RotationY(frame * 0.02f) * Matrix4::RotationX(frame * 0.013f));
+			rasterized += renderer.TrianglesDrawn();
+			frame++;
+		});
+	}
+
+	double seconds = ms / 1000.0;
+	Report("Torus " + std::to_string(torus.TriangleCount()) + " triangles, 200x100", ms,
+		std::to_string((UINT64)(torus.TriangleCount() / seconds)) + " triangles/s submitted, " + std::to_string((UINT64)(rasterized / (frames + 1) / seconds)) + " triangles/s rasterized");
+}
+
+
+/* ----- FrameBuffer ----- */
+
+// Full screen clears plus a sprite-like pattern of short rows, in the given cell format
+template<class Cell>
+double MeasureFrameBuffer(int width, int height)
+{
+	FrameBuffer<Cell> buffer(width, height);
+	const Cell background = FrameBuffer<Cell>::MakeCell(0x2588, (UINT16)Console::Color::Dark_Blue);
+	const Cell foreground = FrameBuffer<Cell>::MakeCell(0x2588, (UINT16)Console::Color::Yellow);
+
+	return Measure(200, [&]
+	{
+		FrameBuffer<Cell>::FillRow(buffer.Data(), buffer.Size(), background);
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = y % 16; x + 12 <= width; x += 16)
+				FrameBuffer<Cell>::FillRow(&buffer[y * width + x], 12, foreground);
+		}
+		buffer.Present();
+	});
+}
+
+void BenchmarkFrameBuffer()
+{
+	std::cout << "--- FrameBuffer cell formats (draw + present), hash, remap ---" << std::endl;
+
+	for (int size : { 200, 400, 800 })
+	{
+		const int width = size, height = size / 2;
+		const std::string name = std::to_string(width) + "x" + std::to_string(height);
+		Report("CHAR_INFO " + name, MeasureFrameBuffer<CHAR_INFO>(width, height), std::to_string(width * height * sizeof(CHAR_INFO) / 1024) + " KB");
+		Report("CompactCell " + name, MeasureFrameBuffer<CompactCell>(width, height), std::to_string(width * height * sizeof(CompactCell) / 1024) + " KB");
+
+		// Cost of the idle rendering check, paid by every frame
+		FrameBuffer<CHAR_INFO> buffer(width, height);
+		volatile UINT64 hash = 0;
+		Report("Hash " + name, Measure(200, [&] { hash = buffer.Hash(); }));
+
+		// Full screen color effect applied at present
+		std::vector<CHAR_INFO> remapped((size_t)width * height);
+		const ColorRemap fade = ColorRemap::Lerp(ColorRemap::Grayscale(), ColorRemap::FadeToBlack(1.0f), 0.5f);
+		Report("ColorRemap " + name, Measure(200, [&] { fade.Apply(buffer.Present(), remapped.data(), width * height); }));
+	}
+}
+
+
+/* ----- ParticleSystem ----- */
+
+void BenchmarkParticleSystem()
+{
+	std::cout << "--- ParticleSystem fountain ---" << std::endl;
+
+	ParticleSystem particles;
+	ParticleSystem::Emitter emitter;
+	emitter.angleMin = -2.0f;
+	emitter.angleMax = -1.14f;
+	emitter.speedMin = 40.0f;
+	emitter.speedMax = 80.0f;
+	emitter.lifeMin = 2.0f;
+	emitter.lifeMax = 3.0f;
+	emitter.colors = { Console::Color::White, Console::Color::Yellow, Console::Color::Red, Console::Color::Dark_Red };
+	emitter.rate = 50000.0f; // About 125k alive particles
+	const int fountain = particles.AddEmitter(emitter);
+	particles.SetForces(0.0f, 40.0f, 0.1f);
+
+	const float deltaTime = 1.0f / 60.0f;
+	for (int i = 0; i < 180; i++) // Reach the steady state
+	{
+		particles.Emit(fountain, 100.0f, 95.0f, deltaTime);
+		particles.Update(deltaTime);
+	}
+
+	double update, draw;
+	{
+		Console console(200, 100, "ParticleSystem benchmark");
+		update = Measure(200, [&]
+		{
+			particles.Emit(fountain, 100.0f, 95.0f, deltaTime);
+			particles.Update(deltaTime);
+		});
+		draw = Measure(200, [&] { console.Draw(0, 0, particles); });
+	}
+
+	Report("Update " + std::to_string(particles.Count()) + " particles", update);
+	Report("Draw " + std::to_string(particles.Count()) + " particles, 200x100", draw);
+}
+
+
+/* ----- Pool ----- */
+
+// A short lived game object
+struct Bullet { float x, y, vx, vy; int owner; };
+
+// Frames where random bullets are destroyed and the same number fired, then all of them move. Create and destroy are given the allocation to compare
+template<class Create, class Destroy>
+double MeasureBullets(const std::vector<int>& victims, int alive, int churn, Create&& create, Destroy&& destroy)
+{
+	std::vector<Bullet*> bullets;
+	for (int i = 0; i < alive; i++)
+		bullets.push_back(create());
+
+	size_t next = 0;
+	const double ms = Measure(200, [&]
+	{
+		for (int i = 0; i < churn; i++)
+		{
+			const int victim = victims[next++ % victims.size()];
+			destroy(bullets[victim]);
+			bullets[victim] = create();
+		}
+		for (Bullet* bullet : bullets)
+		{
+			bullet->x += bullet->vx;
+			bullet->y += bullet->vy;
+		}
+	});
+
+	for (Bullet* bullet : bullets)
+		destroy(bullet);
+	return ms;
+}
+
+void BenchmarkPool()
+{
+	std::cout << "--- Pool (4096 bullets alive, 1024 random ones replaced per frame) ---" << std::endl;
+
+	const int alive = 4096, churn = 1024;
+	std::vector<int> victims(1 << 16);
+	for (int& victim : victims)
+		victim = Random::Get(0, alive - 1);
+	auto bullet = [] { return Bullet { Random::Get(0.0f, 200.0f), Random::Get(0.0f, 100.0f), Random::Get(-1.0f, 1.0f), Random::Get(-1.0f, 1.0f), 0 }; };
+
+	Pool<Bullet> pool(alive);
+	const double pooled = MeasureBullets(victims, alive, churn, [&] { return pool.Create(bullet()); }, [&](Bullet* b) { pool.Destroy(b); });
+	const double heap = MeasureBullets(victims, alive, churn, [&] { return new Bullet(bullet()); }, [](Bullet* b) { delete b; });
+
+	std::ostringstream speedup;
+	speedup << std::setprecision(2) << std::fixed << "x" << heap / pooled << ", " << pool.Size() << " still in use";
+	Report("Pool<Bullet>", pooled, speedup.str());
+	Report("new / delete", heap);
+}
+
+
+/* ----- BitmapFont ----- */
+
+void BenchmarkBitmapFont()
+{
+	std::cout << "--- BitmapFont text ---" << std::endl;
+
+	const BitmapFont& font = BitmapFont::Default();
+	double title, scoreboard;
+	{
+		Console console(200, 100, "BitmapFont benchmark");
+		const BitmapText text(font, "Snake", Console::Color::Green, 3); // Layout made once
+		title = Measure(1000, [&] { console.Draw(10, 10, text); });
+		scoreboard = Measure(1000, [&]
+		{
+			for (int i = 0; i < 10; i++)
+				font.Draw(console, 10, 40 + i * 8, "Player " + std::to_string(i) + "  " + std::to_string(1000 - i * 37), Console::Color::White, Console::Color::Black);
+		});
+	}
+
+	Report("Title, scale 3", title);
+	Report("Scoreboard, 10 lines", scoreboard, "layout of every line made by the draw");
+}
+
+
+/* ----- Animator ----- */
+
+void BenchmarkAnimator()
+{
+	std::cout << "--- Animator ---" << std::endl;
+
+	// 8 frames of 4x4 in a row
+	Sprite atlas;
+	atlas.m_width = 32;
+	atlas.m_height = 4;
+	atlas.m_colors = new Console::Color[atlas.m_width * atlas.m_height];
+	for (UINT32 i = 0; i < atlas.m_width * atlas.m_height; i++)
+		atlas.m_colors[i] = (Console::Color)(i % atlas.m_width / 4 + 1);
+
+	Animator animator;
+	const int walk = animator.AddClip(atlas, 4, 4, 0, 8, 12.0f, Animator::Mode::Loop);
+	const int idle = animator.AddClip(atlas, 4, 4, 0, 4, 6.0f, Animator::Mode::PingPong);
+	animator.AddEvent(walk, 2, 0); // Footsteps
+	animator.AddEvent(walk, 6, 0);
+
+	const int count = 100000;
+	for (int i = 0; i < count; i++)
+		animator.Create(i % 2 ? walk : idle, Random::Get(0.5f, 1.5f));
+
+	const float deltaTime = 1.0f / 60.0f;
+	size_t events = 0;
+	double update = Measure(200, [&]
+	{
+		animator.Update(deltaTime);
+		events += animator.Events().size();
+	});
+
+	Report("Update " + std::to_string(count) + " instances", update, std::to_string(events / 201) + " events per update");
+}
+
+
+/* ----- Spectators ----- */
+
+void BenchmarkSpectators()
+{
+	std::cout << "--- Spectator streaming (game thread cost) ---" << std::endl;
+
+	const int width = 200, height = 100, spectators = 32;
+	SpectatorServer server;
+	if (!server.Start(0))
+	{
+		std::cout << "Could not open a port" << std::endl;
+		return;
+	}
+
+	// The spectators read on their own thread, like separate processes would
+	std::vector<SpectatorClient> clients(spectators);
+	for (auto& client : clients)
+		client.Connect(server.Port());
+	while (server.Spectators() < spectators)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	std::atomic_bool watching(true);
+	std::thread reader([&]
+	{
+		while (watching)
+		{
+			for (auto& client : clients)
+				client.Receive();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
+
+	// About 2% of the cells change every frame, only Publish() is timed
+	std::vector<CHAR_INFO> frame((size_t)width * height);
+	for (auto& cell : frame)
+		cell = { { L' ' }, 0 };
+	const int frames = 300;
+	double publish = 0.0;
+	for (int f = 0; f < frames; f++)
+	{
+		for (int i = 0; i < 400; i++)
+		{
+			CHAR_INFO& cell = frame[Random::Get(0, width * height - 1)];
+			cell.Char.UnicodeChar = (WCHAR)Random::Get((int)'a', (int)'z');
+			cell.Attributes = (WORD)Random::Get(0, 255);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		server.Publish(frame.data(), width, height);
+		publish += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::this_thread::sleep_for(std::chrono::milliseconds(16)); // Leave time to stream, like a 60 fps game
+	}
+	publish /= frames;
+
+	watching = false;
+	reader.join();
+
+	std::ostringstream share;
+	share << std::setprecision(2) << std::fixed << publish / 16.6 * 100.0 << "% of a 60 fps frame";
+	Report("Publish 200x100, " + std::to_string(spectators) + " spectators", publish, share.str());
+}
+
+/* ----- Capture ----- */
+
+void BenchmarkCapture()
+{
+	std::cout << "--- GIF capture (game thread cost) ---" << std::endl;
+
+	const int width = 200, height = 100;
+	auto recorder = std::make_unique<FrameRecorder>();
+	const std::string path = "RexConsoleEngine_Benchmark.gif";
+	if (!recorder->StartAnimation(path))
+	{
+		std::cout << "Could not create " << path << std::endl;
+		return;
+	}
+
+	// Same frames as the spectators, only Publish() is timed, the encoding is on the thread of the recorder
+	std::vector<CHAR_INFO> frame((size_t)width * height);
+	for (auto& cell : frame)
+		cell = { { L' ' }, 0 };
+	const int frames = 120;
+	double publish = 0.0;
+	for (int f = 0; f < frames; f++)
+	{
+		for (int i = 0; i < 400; i++)
+		{
+			CHAR_INFO& cell = frame[Random::Get(0, width * height - 1)];
+			cell.Char.UnicodeChar = (WCHAR)Random::Get((int)'a', (int)'z');
+			cell.Attributes = (WORD)Random::Get(0, 255);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		recorder->Publish(frame.data(), width, height);
+		publish += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::this_thread::sleep_for(std::chrono::milliseconds(16));
+	}
+	publish /= frames;
+
+	const UINT64 dropped = recorder->DroppedFrames();
+
+	// The destructor waits for the encoder to write the queued frames
+	auto start = std::chrono::steady_clock::now();
+	recorder.reset();
+	const double finish = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::remove(path.c_str());
+
+	std::ostringstream share;
+	share << std::setprecision(2) << std::fixed << publish / 16.6 * 100.0 << "% of a 60 fps frame, " << dropped << " dropped";
+	Report("Publish 200x100 to a GIF", publish, share.str());
+	Report("Finish the GIF", finish);
+}
+
+
+/* ----- PostProcess ----- */
+
+// Run a chain on a buffer of random cells, the result is put back for the next run like in Console::BlipToScreen()
+template<class Cell>
+double MeasurePostProcess(PostProcess::Chain<Cell>& chain, int width, int height)
+{
+	FrameBuffer<Cell> buffer(width, height);
+	for (int i = 0; i < width * height; i++)
+		buffer[i] = FrameBuffer<Cell>::MakeCell(Random::Get(0, 1) ? L' ' : 0x2588, (UINT16)Random::Get(0, 255));
+
+	return Measure(200, [&] { chain.Run(buffer, width, height, 0.016f); chain.Restore(buffer); });
+}
+
+void BenchmarkPostProcess()
+{
+	std::cout << "--- PostProcess (scanlines + vignette + noise, budget 1 ms) ---" << std::endl;
+
+	for (int size : { 200, 400 })
+	{
+		const int width = size, height = size / 2;
+		const std::string name = std::to_string(width) + "x" + std::to_string(height);
+		for (int bandHeight : { 0, 16 })
+		{
+			PostProcess::Chain<CHAR_INFO> chain;
+			chain.Add<PostProcess::Scanlines>();
+			chain.Add<PostProcess::Vignette>();
+			chain.Add<PostProcess::Noise>();
+			chain.SetParallel(bandHeight);
+			Report(std::string(bandHeight ? "Parallel " : "Serial ") + name, MeasurePostProcess(chain, width, height));
+		}
+
+		PostProcess::Chain<CHAR_INFO> blur;
+		blur.Add<PostProcess::ShadeBlur>();
+		Report("ShadeBlur " + name, MeasurePostProcess(blur, width, height));
+
+		PostProcess::Chain<CompactCell> compact;
+		compact.Add<PostProcess::Scanlines>();
+		compact.Add<PostProcess::Vignette>();
+		compact.Add<PostProcess::Noise>();
+		Report("Serial CompactCell " + name, MeasurePostProcess(compact, width, height));
+	}
+}
+
+
+/* ----- Pathfinding ----- */
+
+void BenchmarkPathfinding()
+{
+	std::cout << "--- Pathfinding 512x512, 256 queries ---" << std::endl;
+
+	// Random walls of up to 16x16 cells over about a fifth of the map
+	const int size = 512;
+	OccupancyGrid walls(size, size);
+	for (int i = 0; i < 400; i++)
+		walls.SetRect(Random::Get(0, size - 1), Random::Get(0, size - 1), Random::Get(1, 16), Random::Get(1, 16));
+
+	// Paths that exist : the cells connected to the center, the searches that fail visit every connected cell
+	walls.Reset(size / 2, size / 2);
+	FlowField connected(walls);
+	connected.Build({ size / 2, size / 2 });
+	auto randomCell = [&]
+	{
+		Pathfinder::Point cell;
+		do
+			cell = { Random::Get(0, size - 1), Random::Get(0, size - 1) };
+		while (connected.Distance(cell.x, cell.y) == FlowField::Unreachable);
+		return cell;
+	};
+
+	std::vector<Pathfinder::Query> queries;
+	while (queries.size() < 256)
+		queries.push_back({ randomCell(), randomCell() });
+
+	std::vector<std::vector<Pathfinder::Point>> paths;
+	for (Pathfinder::Moves moves : { Pathfinder::Moves::Four, Pathfinder::Moves::Eight })
+	{
+		Pathfinder pathfinder(walls, moves);
+		const std::string name = moves == Pathfinder::Moves::Four ? " 4 moves" : " 8 moves";
+		std::vector<Pathfinder::Algorithm> algorithms = { Pathfinder::Algorithm::AStar };
+		if (moves == Pathfinder::Moves::Eight)
+			algorithms.push_back(Pathfinder::Algorithm::JumpPoint);
+
+		for (Pathfinder::Algorithm algorithm : algorithms)
+		{
+			const std::string algorithmName = algorithm == Pathfinder::Algorithm::AStar ? "A*" : "JPS";
+			std::vector<Pathfinder::Point> path;
+			const double serial = Measure(2, [&] { for (const auto& query : queries) pathfinder.FindPath(query.start, query.goal, path, algorithm); });
+			const double parallel = Measure(2, [&] { pathfinder.FindPaths(queries, paths, algorithm); });
+
+			std::ostringstream perQuery;
+			perQuery << std::setprecision(3) << std::fixed << serial / queries.size() << " ms per query";
+			Report(algorithmName + name, serial, perQuery.str());
+			Report(algorithmName + name + " batch", parallel, std::to_string(JobSystem::ThreadCount()) + " threads");
+		}
+
+		FlowField field(walls, moves);
+		Report("FlowField" + name, Measure(5, [&] { field.Build(queries[0].goal); }));
+	}
+}
+
+
+/* ----- ChunkStreamer ----- */
+
+void BenchmarkChunkStreamer()
+{
+	std::cout << "--- ChunkStreamer (camera moving 2 tiles per frame, 32x32 chunks, radius 3) ---" << std::endl;
+
+	// Made by the generator, nothing is modified so no file is written while moving
+	const std::string directory = "RexConsoleEngine_Benchmark_Chunks";
+	auto terrain = [](int chunkX, int chunkY, CHAR_INFO* tiles)
+	{
+		for (int i = 0; i < 32 * 32; i++)
+			tiles[i] = { { (WCHAR)(((chunkX * 31 + chunkY * 17 + i) % 7) == 0 ? L'^' : L'.') }, (WORD)Console::Color::Dark_Green };
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	auto streamer = std::make_unique<ChunkStreamer<CHAR_INFO>>(directory, 32, 128, terrain);
+	Report("Startup", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), "does not depend on the world size");
+
+	// First chunks around the camera, like a loading screen
+	start = std::chrono::steady_clock::now();
+	streamer->Update(0, 0, 3);
+	while (!streamer->Ready())
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+		streamer->Update(0, 0, 3);
+	}
+	Report("First 49 chunks ready", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+	// Game thread cost while moving, the loads happen on the I/O thread
+	const int frames = 2000;
+	double total = 0.0, worst = 0.0;
+	int missing = 0; // Frames where the chunk under the camera was not loaded yet
+	for (int f = 0; f < frames; f++)
+	{
+		const int x = f * 2, y = (int)(std::sin(f * 0.01) * 500.0);
+		auto frameStart = std::chrono::steady_clock::now();
+		streamer->Update(x, y, 3);
+		const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+		total += ms;
+		worst = (std::max)(worst, ms);
+		if (streamer->GetTile(x, y) == nullptr)
+			missing++;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	std::ostringstream details;
+	details << "worst " << std::setprecision(3) << std::fixed << worst << " ms, " << streamer->Generated() << " chunks made, " << missing << " frames without the camera chunk";
+	Report("Update while moving", total / frames, details.str());
+	streamer.reset();
+
+	// Shutdown : edit every chunk around the camera and destroy the streamer at once, the destructor saves them
+	streamer = std::make_unique<ChunkStreamer<CHAR_INFO>>(directory, 32, 128, terrain);
+	do
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+		streamer->Update(0, 0, 3);
+	} while (!streamer->Ready());
+	for (int cy = -3; cy <= 3; cy++)
+		for (int cx = -3; cx <= 3; cx++)
+			streamer->SetTile(cx * 32, cy * 32, { { (WCHAR)L'#' }, (WORD)Console::Color::Red });
+	start = std::chrono::steady_clock::now();
+	streamer.reset();
+	const double shutdown = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// Read them back without a generator : a chunk that was not saved comes back empty
+	streamer = std::make_unique<ChunkStreamer<CHAR_INFO>>(directory, 32, 128);
+	do
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+		streamer->Update(0, 0, 3);
+	} while (!streamer->Ready());
+	int saved = 0;
+	for (int cy = -3; cy <= 3; cy++)
+		for (int cx = -3; cx <= 3; cx++)
+			saved += streamer->GetTile(cx * 32, cy * 32)->Char.UnicodeChar == L'#';
+	Report("Shutdown after editing 49 chunks", shutdown, std::to_string(saved) + " of 49 chunks saved" + (saved == 49 ? "" : ", EDITS LOST"));
+
+	streamer.reset();
+	for (int cy = -3; cy <= 3; cy++)
+		for (int cx = -3; cx <= 3; cx++)
+			DeleteFile(StringToWString(directory + "\\" + std::to_string(cx) + "_" + std::to_string(cy) + ".chunk").c_str());
+	RemoveDirectory(StringToWString(directory).c_str());
+}
+
+
+/* ----- Leaderboard ----- */
+
+void BenchmarkLeaderboard()
+{
+	std::cout << "--- Leaderboard (1M players) ---" << std::endl;
+
+	const int players = 1000000;
+	const std::wstring path = Archive::GetFolder("Benchmarks") + L"\\Leaderboard" + StringToWString(Leaderboard::m_fileExtension);
+	DeleteFile(path.c_str());
+
+	// Every submit appends a record to the file
+	auto board = std::make_unique<Leaderboard>("Benchmarks", "Leaderboard");
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < players; i++)
+		board->Submit("Player" + std::to_string(i), Random::Get(0, 100000));
+	Report("1M submits, new players", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), "every one appended to the file");
+
+	// The records are in submit order : sorted once, then rewritten in rank order
+	board.reset();
+	start = std::chrono::steady_clock::now();
+	board = std::make_unique<Leaderboard>("Benchmarks", "Leaderboard");
+	Report("Open, records in submit order", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), "and rewrite them in rank order");
+
+	board.reset();
+	start = std::chrono::steady_clock::now();
+	board = std::make_unique<Leaderboard>("Benchmarks", "Leaderboard");
+	Report("Open, records in rank order", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), "no sorting");
+
+	const int queries = 100000;
+	std::vector<Leaderboard::Entry> entries;
+	start = std::chrono::steady_clock::now();
+	size_t checksum = 0;
+	for (int i = 0; i < queries; i++)
+	{
+		board->Top(10, entries);
+		checksum += entries.size();
+	}
+	Report("100k top 10", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < queries; i++)
+		checksum += (size_t)board->Rank("Player" + std::to_string(Random::Get(0, players - 1)));
+	Report("100k ranks of a player", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < queries; i++)
+		checksum += board->Submit("Player" + std::to_string(Random::Get(0, players - 1)), 100000 + i);
+	std::ostringstream details;
+	details << "appended to the file (" << checksum << ")";
+	Report("100k submits, better scores", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), details.str());
+
+	board.reset();
+	DeleteFile(path.c_str());
+}
+
+
+/* ----- Collisions ----- */
+
+// A disc of the color on a transparent background, like a ball or a bullet sprite
+std::vector<Console::Color> Disc(int size, Console::Color color)
+{
+	std::vector<Console::Color> colors((size_t)size * size, Console::Color::Black);
+	const float radius = size * 0.5f;
+	for (int y = 0; y < size; y++)
+		for (int x = 0; x < size; x++)
+			if ((x + 0.5f - radius) * (x + 0.5f - radius) + (y + 0.5f - radius) * (y + 0.5f - radius) <= radius * radius)
+				colors[y * size + x] = color;
+	return colors;
+}
+
+void BenchmarkCollisions()
+{
+	std::cout << "--- Pixel perfect collisions ---" << std::endl;
+
+	// Exact tests of two 16x16 discs at random offsets where their boxes overlap
+	const int size = 16, tests = 1000000;
+	const std::vector<Console::Color> disc = Disc(size, Console::Color::Red);
+	const CollisionMask mask(size, size, disc.data(), Console::Color::Black);
+	std::vector<std::pair<int, int>> offsets(tests);
+	for (auto& offset : offsets)
+		offset = { Random::Get(-size + 1, size - 1), Random::Get(-size + 1, size - 1) };
+
+	int maskHits = 0, colorHits = 0;
+	const double masks = Measure(1, [&] { for (const auto& offset : offsets) maskHits += CollisionMask::Overlaps(mask, 0, 0, mask, offset.first, offset.second); });
+
+	// The same tests comparing the colors pixel by pixel
+	const double colors = Measure(1, [&]
+	{
+		for (const auto& offset : offsets)
+		{
+			bool hit = false;
+			for (int y = (std::max)(0, offset.second); y < (std::min)(size, size + offset.second) && !hit; y++)
+				for (int x = (std::max)(0, offset.first); x < (std::min)(size, size + offset.first) && !hit; x++)
+					hit = disc[y * size + x] != Console::Color::Black && disc[(y - offset.second) * size + x - offset.first] != Console::Color::Black;
+			colorHits += hit;
+		}
+	});
+
+	std::ostringstream speedup;
+	speedup << std::setprecision(1) << std::fixed << colors / masks << "x faster than comparing colors, " << maskHits / 2 << " hits";
+	Report("1M mask tests 16x16", masks, speedup.str());
+	Report("1M color tests 16x16", colors, std::to_string(colorHits / 2) + " hits");
+
+	// Broadphase : bullets and enemies moving on a 400x200 screen
+	const std::vector<Console::Color> bullet = Disc(4, Console::Color::Yellow);
+	const CollisionMask bulletMask(4, 4, bullet.data(), Console::Color::Black);
+	CollisionWorld world;
+	struct Mover { float x, y, vx, vy; };
+	std::vector<Mover> movers(4000);
+	for (auto& mover : movers)
+		mover = { (float)Random::Get(0, 400), (float)Random::Get(0, 200), Random::Get(-1.0f, 1.0f), Random::Get(-1.0f, 1.0f) };
+
+	size_t pairs = 0;
+	const double frame = Measure(100, [&]
+	{
+		world.Clear();
+		for (int i = 0; i < (int)movers.size(); i++)
+		{
+			Mover& mover = movers[i];
+			mover.x = std::fmod(mover.x + mover.vx + 400.0f, 400.0f);
+			mover.y = std::fmod(mover.y + mover.vy + 200.0f, 200.0f);
+			if (i < 1000) // Enemies collide with the bullets, bullets do not collide with each other
+				world.Add(i, mask, (int)mover.x, (int)mover.y, 1, 2);
+			else
+				world.Add(i, bulletMask, (int)mover.x, (int)mover.y, 2, 1);
+		}
+		pairs = world.FindPairs().size();
+	});
+	Report("1000 enemies, 3000 bullets", frame, std::to_string(world.Tests()) + " mask tests, " + std::to_string(pairs) + " hits");
+}
+
+
+int main()
+{
+	BenchmarkJobSystem();
+	BenchmarkRenderer3D();
+	BenchmarkFrameBuffer();
+	BenchmarkParticleSystem();
+	BenchmarkPool();
+	BenchmarkBitmapFont();
+	BenchmarkAnimator();
+	BenchmarkSpectators();
+	BenchmarkCapture();
+	BenchmarkPostProcess();
+	BenchmarkPathfinding();
+	BenchmarkChunkStreamer();
+	BenchmarkCollisions();
+	BenchmarkLeaderboard();
+
+	std::cout << "Press enter to exit" << std::endl;
+	std::cin.get();
+	return 0;
+}
@@ -14,6 +14,7 @@ int main()
 	sprite.LoadBMP("Test.bmp");
 	// Create a 200x100 console titled Example
 	Console* c = new Console(200,100, "Example");
+	c->SetIdleRendering(true); // Nothing moves : wait for inputs instead of showing the same frame again
 
 	int scrollPos = 0; // Position changed by the mouse scroll wheel
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <winsock2.h> // Before windows.h, which includes the older winsock.h
 #include <Shlobj.h>
 #if _WIN32_WINNT != 0x0500
 	#ifdef _WIN32_WINNT
@@ -7,15 +8,41 @@
 	#define _WIN32_WINNT 0x0500
 #endif
 #include <windows.h>
+#include <emmintrin.h> // SSE2
+#include <tmmintrin.h> // SSSE3 (_mm_shuffle_epi8)
+#ifdef _MSC_VER
+	#include <intrin.h> // __popcnt
+	#pragma comment(lib, "Ws2_32.lib") // SpectatorServer
+#endif
+#ifdef _DEBUG
+	#include <crtdbg.h> // _CrtSetAllocHook
+#endif
 
+#include <algorithm>
 #include <atomic>
+#include <charconv>
 #include <chrono>
+#include <climits>
+#include <condition_variable>
+#ifdef __cpp_impl_coroutine
+	#include <coroutine> // Script
+#endif
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <random>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #pragma warning(disable:4996) // fopen
 
@@ -23,113 +50,3346 @@
 
 namespace RexConsoleEngine
 {
+	/// <summary>
+	/// <para>UTF-8 decoding for the text drawing : one UTF-16 glyph per console cell</para>
+	/// <para>ASCII is checked and widened 16 bytes at a time, wide characters (CJK, fullwidth...) take 2 cells and combining marks take none</para>
+	/// </summary>
+	class Utf8
+	{
+	public:
+		static constexpr UINT16 WideTrail = 0xFFFF; // Marks the second cell of a wide character (U+FFFF is not a character)
+
+		// Are all the bytes < 0x80 ?
+		static bool IsAscii(const char* str, size_t length)
+		{
+			size_t i = 0;
+			__m128i bits = _mm_setzero_si128();
+			for (; i + 16 <= length; i += 16)
+				bits = _mm_or_si128(bits, _mm_loadu_si128((const __m128i*)(str + i)));
+			if (_mm_movemask_epi8(bits) != 0)
+				return false;
+
+			for (; i < length; i++)
+			{
+				if ((UINT8)str[i] >= 0x80)
+					return false;
+			}
+			return true;
+		}
+
+		// Zero extend length ASCII bytes to UTF-16
+		static void Widen(const char* str, size_t length, UINT16* out)
+		{
+			size_t i = 0;
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 16 <= length; i += 16)
+			{
+				__m128i bytes = _mm_loadu_si128((const __m128i*)(str + i));
+				_mm_storeu_si128((__m128i*)(out + i), _mm_unpacklo_epi8(bytes, zero));
+				_mm_storeu_si128((__m128i*)(out + i + 8), _mm_unpackhi_epi8(bytes, zero));
+			}
+			for (; i < length; i++)
+				out[i] = (UINT8)str[i];
+		}
+
+		// Decode the code point at str and move str after it, invalid sequences give U+FFFD and skip one byte
+		static UINT32 Next(const char*& str, const char* end)
+		{
+			const UINT8 lead = (UINT8)*str++;
+			if (lead < 0x80)
+				return lead;
+
+			int extra;
+			UINT32 codePoint, minimum;
+			if ((lead & 0xE0) == 0xC0) { extra = 1; codePoint = lead & 0x1F; minimum = 0x80; }
+			else if ((lead & 0xF0) == 0xE0) { extra = 2; codePoint = lead & 0x0F; minimum = 0x800; }
+			else if ((lead & 0xF8) == 0xF0) { extra = 3; codePoint = lead & 0x07; minimum = 0x10000; }
+			else
+				return 0xFFFD;
+
+			if (end - str < extra)
+				return 0xFFFD;
+			for (int i = 0; i < extra; i++)
+			{
+				if (((UINT8)str[i] & 0xC0) != 0x80)
+					return 0xFFFD;
+				codePoint = (codePoint << 6) | ((UINT8)str[i] & 0x3F);
+			}
+
+			if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) // Overlong, out of range, surrogate
+				return 0xFFFD;
+			str += extra;
+			return codePoint;
+		}
+
+		// Number of cells taken by a code point : 0 (combining marks, zero width spaces), 1 or 2 (East Asian wide and fullwidth)
+		static int Width(UINT32 codePoint)
+		{
+			static constexpr UINT32 ZeroWidth[][2] = {
+				{ 0x0300, 0x036F }, { 0x0483, 0x0489 }, { 0x0591, 0x05BD }, { 0x0610, 0x061A }, { 0x064B, 0x065F }, { 0x0E31, 0x0E31 },
+				{ 0x0E34, 0x0E3A }, { 0x0E47, 0x0E4E }, { 0x1AB0, 0x1AFF }, { 0x1DC0, 0x1DFF }, { 0x200B, 0x200F }, { 0x202A, 0x202E },
+				{ 0x2060, 0x2064 }, { 0x20D0, 0x20FF }, { 0xFE00, 0xFE0F }, { 0xFE20, 0xFE2F }, { 0xFEFF, 0xFEFF }, { 0xE0100, 0xE01EF } };
+			static constexpr UINT32 Wide[][2] = {
+				{ 0x1100, 0x115F }, { 0x2E80, 0x303E }, { 0x3041, 0x33FF }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF },
+				{ 0xA960, 0xA97F }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF }, { 0xFE10, 0xFE19 }, { 0xFE30, 0xFE6F }, { 0xFF00, 0xFF60 },
+				{ 0xFFE0, 0xFFE6 }, { 0x1F300, 0x1F64F }, { 0x1F900, 0x1F9FF }, { 0x20000, 0x3FFFD } };
+
+			if (codePoint < 0x0300)
+				return 1;
+			if (InRanges(ZeroWidth, codePoint))
+				return 0;
+			return InRanges(Wide, codePoint) ? 2 : 1;
+		}
+
+		// Decode str to cells : a glyph per cell, '\n' for new lines and WideTrail after wide characters
+		// Code points outside of UTF-16's first plane can not be shown by the console and become U+FFFD
+		static void ToCells(const char* str, size_t length, std::vector<UINT16>& out)
+		{
+			out.resize(length); // There are never more cells than bytes
+			const char* end = str + length;
+			const __m128i zero = _mm_setzero_si128();
+			size_t count = 0;
+			while (str < end)
+			{
+				if (end - str >= 16) // 16 ASCII bytes at once
+				{
+					__m128i bytes = _mm_loadu_si128((const __m128i*)str);
+					if (_mm_movemask_epi8(bytes) == 0)
+					{
+						_mm_storeu_si128((__m128i*)&out[count], _mm_unpacklo_epi8(bytes, zero));
+						_mm_storeu_si128((__m128i*)&out[count + 8], _mm_unpackhi_epi8(bytes, zero));
+						str += 16;
+						count += 16;
+						continue;
+					}
+				}
+
+				UINT32 codePoint = Next(str, end);
+				int width = Width(codePoint);
+				if (width == 0)
+					continue;
+
+				if (codePoint > 0xFFFF || codePoint == WideTrail)
+				{
+					codePoint = 0xFFFD;
+					width = 1;
+				}
+				out[count++] = (UINT16)codePoint;
+				if (width == 2)
+					out[count++] = WideTrail;
+			}
+			out.resize(count);
+		}
+
+		// Size of a string in cells, \n starts a new line
+		static void Size(const char* str, size_t length, int& width, int& height)
+		{
+			width = 0;
+			height = 1;
+			const char* end = str + length;
+			int lineLength = 0;
+			while (str < end)
+			{
+				UINT32 codePoint = (UINT8)*str < 0x80 ? (UINT8)*str++ : Next(str, end);
+				if (codePoint == '\n')
+				{
+					height++;
+					lineLength = 0;
+				}
+				else
+				{
+					lineLength += codePoint > 0xFFFF ? 1 : Width(codePoint);
+					width = (std::max)(width, lineLength);
+				}
+			}
+		}
+
+	private:
+		template<size_t Count>
+		static bool InRanges(const UINT32 (&ranges)[Count][2], UINT32 codePoint)
+		{
+			size_t low = 0, high = Count; // Binary search of the last range starting at or before codePoint
+			while (low < high)
+			{
+				size_t middle = (low + high) / 2;
+				if (ranges[middle][0] <= codePoint)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+			return low > 0 && codePoint <= ranges[low - 1][1];
+		}
+	};
+
+	/// <summary>
+	/// <para>Cache of the cells of the non ASCII strings drawn recently (ex : a name or localized UI redrawn every frame)</para>
+	/// <para>A hit costs a hash and a compare of the bytes, like the ASCII path. The entries are reused, so a warm cache does not allocate</para>
+	/// </summary>
+	class TextCache
+	{
+	private:
+		struct Entry
+		{
+			UINT64 hash = 0;
+			bool used = false;
+			std::string source;
+			std::vector<UINT16> cells;
+		};
+
+		std::vector<Entry> m_entries; // Direct mapped, the size is a power of 2
+
+	public:
+		TextCache(size_t entries = 64)
+		{
+			size_t size = 1;
+			while (size < entries)
+				size *= 2;
+			m_entries.resize(size);
+		}
+
+		// Cells of str, see Utf8::ToCells(). The vector is valid until the next call
+		const std::vector<UINT16>& Get(const char* str, size_t length)
+		{
+			// FNV-1a style hash, 8 bytes at a time
+			UINT64 hash = 14695981039346656037ull ^ length;
+			size_t i = 0;
+			for (; i + 8 <= length; i += 8)
+			{
+				UINT64 word;
+				memcpy(&word, str + i, 8);
+				hash = (hash ^ word) * 1099511628211ull;
+				hash ^= hash >> 29;
+			}
+			for (; i < length; i++)
+				hash = (hash ^ (UINT8)str[i]) * 1099511628211ull;
+
+			Entry& entry = m_entries[(hash ^ (hash >> 32)) & (m_entries.size() - 1)];
+			if (entry.used && entry.hash == hash && entry.source.length() == length && memcmp(entry.source.data(), str, length) == 0)
+				return entry.cells;
+
+			entry.used = true;
+			entry.hash = hash;
+			entry.source.assign(str, length);
+			Utf8::ToCells(str, length, entry.cells);
+			return entry.cells;
+		}
+	};
+
 	// Convert string to wstring
 	inline static std::wstring StringToWString(const std::string& str)
 	{
-		int count = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, nullptr, 0);
-		wchar_t* wstr = new wchar_t[count]; // + 1 because of null termination
-		MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, wstr, count);
-		std::wstring wString(wstr);
-		delete[] wstr;
+		std::wstring wString(str.length(), L'\0'); // UTF-16 never has more code units than UTF-8 has bytes
+		if (Utf8::IsAscii(str.c_str(), str.length()))
+		{
+			if constexpr (sizeof(wchar_t) == sizeof(UINT16))
+				Utf8::Widen(str.c_str(), str.length(), (UINT16*)&wString[0]);
+			else
+				std::copy(str.begin(), str.end(), wString.begin());
+			return wString;
+		}
+
+		// One conversion pass, in place
+		int count = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.length(), &wString[0], (int)wString.length());
+		wString.resize((std::max)(count, 0));
 		return wString;
 	}
-	
+
 
 	/// <summary>
-	/// Class to handle input and output operations with the console
+	/// <para>Counts the heap allocations of the program, only in debug builds (with the CRT debug heap hook)</para>
+	/// <para>Used to check that a frame does no allocation once the game runs (see Console::FrameAllocations())</para>
 	/// </summary>
-	class Console
+	class AllocationCounter
 	{
 	public:
-		enum class Color : short {
-			Black = 0x0000,
-			Dark_Blue = 0x0001,
-			Dark_Green = 0x0002,
-			Dark_Cyan = 0x0003,
-			Dark_Red = 0x0004,
-			Dark_Magenta = 0x0005,
-			Dark_Yellow = 0x0006,
-			Grey = 0x0007,
-			Dark_Grey = 0x0008,
-			Blue = 0x0009,
-			Green = 0x000A,
-			Cyan = 0x000B,
-			Red = 0x000C,
-			Magenta = 0x000D,
-			Yellow = 0x000E,
-			White = 0x000F,
+#ifdef _DEBUG
+		static constexpr bool Enabled = true;
+#else
+		static constexpr bool Enabled = false;
+#endif
+
+		// Number of heap allocations since the start of the program, always 0 when not Enabled
+		static UINT64 Count() { return m_count.load(std::memory_order_relaxed); }
+
+	private:
+		inline static std::atomic<UINT64> m_count { 0 };
+
+#ifdef _DEBUG
+		static const bool m_installed;
+		inline static _CRT_ALLOC_HOOK m_previousHook = nullptr;
+
+		static bool Install()
+		{
+			m_previousHook = _CrtSetAllocHook(Hook);
+			return true;
+		}
+
+		static int __cdecl Hook(int allocType, void* userData, size_t size, int blockType, long requestNumber, const unsigned char* fileName, int lineNumber)
+		{
+			if ((allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC) && blockType != _CRT_BLOCK) // _CRT_BLOCK : internal allocations of the CRT
+				m_count.fetch_add(1, std::memory_order_relaxed);
+			return m_previousHook ? m_previousHook(allocType, userData, size, blockType, requestNumber, fileName, lineNumber) : TRUE;
+		}
+#endif
+	};
+#ifdef _DEBUG
+	inline const bool AllocationCounter::m_installed = AllocationCounter::Install();
+#endif
+
+	/// <summary>
+	/// <para>Bump allocator : allocating is moving an offset, everything is freed at once by Reset()</para>
+	/// <para>Only for trivially destructible types, nothing is destroyed. See Console::FrameArena() for the arena reset every frame</para>
+	/// </summary>
+	class Arena
+	{
+	private:
+		struct Block
+		{
+			std::unique_ptr<char[]> memory;
+			size_t size;
 		};
 
-		struct Pixel
+		std::vector<Block> m_blocks; // The last one is the one being filled
+		size_t m_offset; // In the last block
+		size_t m_used; // Bytes allocated since the last Reset()
+		size_t m_blockSize;
+
+	public:
+		Arena(size_t blockSize = 64 * 1024) : m_offset(0), m_used(0), m_blockSize((std::max)(blockSize, (size_t)64)) {}
+
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		// Uninitialized memory, alignment must be a power of 2
+		void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t))
 		{
-			enum class Type : short { Empty = 0x0000, Full = 0x2588, ThreeQuarters = 0x2593, Half = 0x2592, Quarter = 0x2591 };
-			Type type;
+			if (!m_blocks.empty())
+			{
+				Block& block = m_blocks.back();
+				size_t address = (size_t)block.memory.get() + m_offset;
+				size_t padding = (alignment - (address & (alignment - 1))) & (alignment - 1);
+				if (m_offset + padding + size <= block.size)
+				{
+					m_offset += padding + size;
+					m_used += padding + size;
+					return (void*)(address + padding);
+				}
+			}
 
-			Console::Color color;
+			// New block, big enough for this allocation
+			size_t blockSize = (std::max)(m_blockSize, size + alignment);
+			m_blocks.push_back({ std::unique_ptr<char[]>(new char[blockSize]), blockSize });
+			m_offset = 0;
+			return Allocate(size, alignment);
+		}
 
-			Pixel(Console::Color foreground, Type t) : type(t), color(foreground) {}
-			Pixel(Console::Color foreground, Console::Color background, Type t) : Pixel((Console::Color)((short)foreground | ((short)background << 4)), t) {}
+		// Uninitialized array of count T
+		template<class T>
+		T* Allocate(size_t count)
+		{
+			static_assert(std::is_trivially_destructible_v<T>, "The arena never calls destructors");
+			return (T*)Allocate(sizeof(T) * count, alignof(T));
+		}
 
-			Pixel(Console::Color c) : Pixel(c, Type::Full) {}
+		// Construct a T in the arena
+		template<class T, class... Args>
+		T* New(Args&&... args)
+		{
+			static_assert(std::is_trivially_destructible_v<T>, "The arena never calls destructors");
+			return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		}
 
-			Pixel(Console::Color c, char character) : Pixel(c, (Type)character) {}
-			Pixel(Console::Color foreground, Console::Color background, char character) : Pixel(foreground, background, (Type)character) {}
-		};
+		// Copy of a string (null terminated)
+		const char* Copy(const char* str, size_t length)
+		{
+			char* copy = Allocate<char>(length + 1);
+			memcpy(copy, str, length);
+			copy[length] = '\0';
+			return copy;
+		}
 
-		/// <summary>
-		/// A drawable object
-		/// </summary>
-		class Drawable
+		// Free everything. If the arena had to grow, its blocks are merged so the next frames fit in one block
+		void Reset()
+		{
+			if (m_blocks.size() > 1)
+			{
+				size_t total = 0;
+				for (const Block& block : m_blocks)
+					total += block.size;
+				m_blocks.clear();
+				m_blocks.push_back({ std::unique_ptr<char[]>(new char[total]), total });
+			}
+			m_offset = 0;
+			m_used = 0;
+		}
+
+		// Bytes allocated since the last Reset()
+		size_t Used() const { return m_used; }
+
+		// Total size of the blocks
+		size_t Capacity() const
+		{
+			size_t total = 0;
+			for (const Block& block : m_blocks)
+				total += block.size;
+			return total;
+		}
+	};
+
+	/// <summary>
+	/// Allocator for the std containers using an Arena, deallocate() does nothing : the memory is freed by Arena::Reset()
+	/// </summary>
+	template<class T>
+	class ArenaAllocator
+	{
+		template<class U> friend class ArenaAllocator;
+
+	private:
+		Arena* m_arena;
+
+	public:
+		using value_type = T;
+
+		ArenaAllocator(Arena& arena) : m_arena(&arena) {}
+		template<class U>
+		ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.m_arena) {}
+
+		T* allocate(size_t count) { return (T*)m_arena->Allocate(sizeof(T) * count, alignof(T)); }
+		void deallocate(T*, size_t) {}
+
+		template<class U>
+		bool operator==(const ArenaAllocator<U>& other) const { return m_arena == other.m_arena; }
+		template<class U>
+		bool operator!=(const ArenaAllocator<U>& other) const { return m_arena != other.m_arena; }
+	};
+
+	/// <summary>
+	/// <para>Fixed capacity pool of objects, allocated once (ex : the bullets of a shooter) : Create() and Destroy() reuse the free slots</para>
+	/// <para>Create() returns nullptr when the pool is full</para>
+	/// </summary>
+	template<class T>
+	class Pool
+	{
+	private:
+		struct alignas(T) Slot { unsigned char storage[sizeof(T)]; };
+
+		std::unique_ptr<Slot[]> m_slots;
+		std::unique_ptr<UINT32[]> m_free; // Stack of the free slots
+		std::unique_ptr<bool[]> m_alive;
+		size_t m_capacity, m_freeCount;
+
+	public:
+		Pool(size_t capacity)
+			: m_slots(new Slot[capacity]), m_free(new UINT32[capacity]), m_alive(new bool[capacity]()), m_capacity(capacity), m_freeCount(capacity)
+		{
+			for (size_t i = 0; i < capacity; i++)
+				m_free[i] = (UINT32)(capacity - 1 - i); // Slot 0 is used first
+		}
+
+		~Pool()
+		{
+			for (size_t i = 0; i < m_capacity; i++)
+			{
+				if (m_alive[i])
+					((T*)&m_slots[i])->~T();
+			}
+		}
+
+		Pool(const Pool&) = delete;
+		Pool& operator=(const Pool&) = delete;
+
+		template<class... Args>
+		T* Create(Args&&... args)
+		{
+			if (m_freeCount == 0)
+				return nullptr;
+
+			UINT32 slot = m_free[--m_freeCount];
+			T* object = new (&m_slots[slot]) T(std::forward<Args>(args)...);
+			m_alive[slot] = true;
+			return object;
+		}
+
+		// object must come from this pool
+		void Destroy(T* object)
+		{
+			if (object == nullptr)
+				return;
+
+			size_t slot = (Slot*)object - m_slots.get();
+			object->~T();
+			m_alive[slot] = false;
+			m_free[m_freeCount++] = (UINT32)slot;
+		}
+
+		size_t Size() const { return m_capacity - m_freeCount; }
+		size_t Capacity() const { return m_capacity; }
+	};
+
+	/// <summary>
+	/// <para>Fixed capacity double ended queue, allocated once (ex : the body of a snake, the last N events)</para>
+	/// <para>The capacity is rounded up to a power of 2, PushBack() and PushFront() return false when it is full</para>
+	/// </summary>
+	template<class T>
+	class RingBuffer
+	{
+	private:
+		std::unique_ptr<T[]> m_items;
+		size_t m_mask; // Capacity - 1
+		size_t m_first, m_size;
+
+	public:
+		class Iterator
 		{
+		private:
+			const RingBuffer* m_buffer;
+			size_t m_index;
+
 		public:
-			virtual void Draw(int x, int y, Console& console) const = 0;
+			Iterator(const RingBuffer* buffer, size_t index) : m_buffer(buffer), m_index(index) {}
+			const T& operator*() const { return (*m_buffer)[m_index]; }
+			const T* operator->() const { return &(*m_buffer)[m_index]; }
+			Iterator& operator++() { m_index++; return *this; }
+			bool operator==(const Iterator& other) const { return m_index == other.m_index; }
+			bool operator!=(const Iterator& other) const { return m_index != other.m_index; }
 		};
 
-		enum class Key
+		RingBuffer(size_t capacity) : m_first(0), m_size(0)
 		{
-			MouseLeft = VK_LBUTTON,
-			MouseRight = VK_RBUTTON,
-			MouseMiddle = VK_MBUTTON,
-			MouseBackward = VK_XBUTTON1,
-			MouseForward = VK_XBUTTON2,
-			Backspace = VK_BACK,
-			Tab = VK_TAB,
-			Enter = VK_RETURN,
-			Shift = VK_SHIFT,
-			Control = VK_CONTROL,
-			Alt = VK_MENU,
-			Pause = VK_PAUSE,
-			CapsLock = VK_CAPITAL,
-			Escape = VK_ESCAPE,
-			Space = VK_SPACE,
-			PageUp = VK_PRIOR,
-			PageDown = VK_NEXT,
-			End = VK_END,
-			Home = VK_HOME,
-			Left = VK_LEFT,
-			Up = VK_UP,
-			Right = VK_RIGHT,
-			Down = VK_DOWN,
-			Print = VK_PRINT,
-			PrintScreen = VK_SNAPSHOT,
-			Insert = VK_INSERT,
-			Delete = VK_DELETE,
-			Alpha0 = 0x30,
-			Alpha1 = 0x31,
-			Alpha2 = 0x32,
-			Alpha3 = 0x33,
-			Alpha4 = 0x34,
-			Alpha5 = 0x35,
-			Alpha6 = 0x36,
-			Alpha7 = 0x37,
-			Alpha8 = 0x38,
-			Alpha9 = 0x39,
-			A = 0x41,
-			B = 0x42,
-			C = 0x43,
-			D = 0x44,
-			E = 0x45,
-			F = 0x46,
+			size_t size = 1;
+			while (size < capacity)
+				size *= 2;
+			m_items.reset(new T[size]);
+			m_mask = size - 1;
+		}
+
+		bool PushBack(const T& item)
+		{
+			if (Full())
+				return false;
+			m_items[(m_first + m_size++) & m_mask] = item;
+			return true;
+		}
+
+		bool PushFront(const T& item)
+		{
+			if (Full())
+				return false;
+			m_first = (m_first - 1) & m_mask;
+			m_items[m_first] = item;
+			m_size++;
+			return true;
+		}
+
+		void PopFront()
+		{
+			if (m_size == 0)
+				return;
+			m_first = (m_first + 1) & m_mask;
+			m_size--;
+		}
+
+		void PopBack()
+		{
+			if (m_size > 0)
+				m_size--;
+		}
+
+		void Clear() { m_first = m_size = 0; }
+
+		T& Front() { return m_items[m_first]; }
+		const T& Front() const { return m_items[m_first]; }
+		T& Back() { return m_items[(m_first + m_size - 1) & m_mask]; }
+		const T& Back() const { return m_items[(m_first + m_size - 1) & m_mask]; }
+
+		// index 0 is the front
+		T& operator[](size_t index) { return m_items[(m_first + index) & m_mask]; }
+		const T& operator[](size_t index) const { return m_items[(m_first + index) & m_mask]; }
+
+		size_t Size() const { return m_size; }
+		size_t Capacity() const { return m_mask + 1; }
+		bool Empty() const { return m_size == 0; }
+		bool Full() const { return m_size == m_mask + 1; }
+
+		Iterator begin() const { return Iterator(this, 0); }
+		Iterator end() const { return Iterator(this, m_size); }
+	};
+
+	/// <summary>
+	/// <para>Fixed capacity queue between two threads without locks : one thread pushes, the other pops (ex : work handed to an I/O thread and its results)</para>
+	/// <para>The capacity is rounded up to a power of 2, Push() returns false when it is full and Pop() when it is empty</para>
+	/// </summary>
+	template<class T>
+	class SpscQueue
+	{
+	private:
+		std::unique_ptr<T[]> m_items;
+		size_t m_mask; // Capacity - 1
+		alignas(64) std::atomic<size_t> m_head; // Next item to pop, written by the consumer
+		alignas(64) std::atomic<size_t> m_tail; // Next item to push, written by the producer, on its own cache line
+
+	public:
+		SpscQueue(size_t capacity) : m_head(0), m_tail(0)
+		{
+			size_t size = 1;
+			while (size < capacity)
+				size *= 2;
+			m_items.reset(new T[size]);
+			m_mask = size - 1;
+		}
+
+		// Producer thread
+		bool Push(const T& item)
+		{
+			const size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+				return false;
+			m_items[tail & m_mask] = item;
+			m_tail.store(tail + 1, std::memory_order_release); // The item is written before it can be popped
+			return true;
+		}
+
+		// Consumer thread
+		bool Pop(T& item)
+		{
+			const size_t head = m_head.load(std::memory_order_relaxed);
+			if (head == m_tail.load(std::memory_order_acquire))
+				return false;
+			item = m_items[head & m_mask];
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		size_t Capacity() const { return m_mask + 1; }
+	};
+	
+
+	/// <summary>
+	/// <para> A work-stealing thread pool owned by the engine, shared by the engine (ex : parallel rendering) and the game code. </para>
+	/// <para> Every worker has its own queue and steals from the others when it is empty, threads that wait on a job help run the queued jobs. </para>
+	/// <para> The pool is started with one thread per core on first use, see Start() to choose the thread count. </para>
+	/// </summary>
+	class JobSystem
+	{
+	public:
+		struct Job
+		{
+			std::function<void()> function;
+			std::atomic<int> waiting = 1; // Unfinished dependencies + 1 until the job is submitted
+			std::atomic_bool done = false;
+			std::mutex mutex; // Protects next
+			std::vector<std::shared_ptr<Job>> next; // Jobs that depend on this one
+		};
+		using Handle = std::shared_ptr<Job>;
+
+	private:
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<Handle> jobs; // The owner works on the back, thieves take the front
+		};
+
+		struct State
+		{
+			std::vector<std::unique_ptr<Queue>> queues; // 0 is shared by the threads that are not workers, i + 1 is owned by worker i
+			std::vector<std::thread> workers;
+			std::mutex sleepMutex;
+			std::condition_variable wake;
+			std::atomic<int> pending = 0; // Number of jobs in the queues
+			std::atomic<int> sleeping = 0; // Number of workers waiting on wake
+			bool stop = false;
+			std::atomic_bool started = false;
+			std::recursive_mutex startMutex;
+
+			~State()
+			{
+				{
+					std::lock_guard<std::mutex> lock(sleepMutex);
+					stop = true;
+				}
+				wake.notify_all();
+				for (auto& worker : workers)
+					worker.join();
+			}
+		};
+
+		static thread_local int m_queueIndex; // Queue of the calling thread
+
+		static State& Data()
+		{
+			static State state;
+			return state;
+		}
+
+	public:
+		// Start the pool with threadCount threads including the calling thread (0 = one per core), restarts it if it is running
+		static void Start(unsigned int threadCount = 0)
+		{
+			State& state = Data();
+			std::lock_guard<std::recursive_mutex> lock(state.startMutex);
+			Stop();
+
+			if (threadCount == 0)
+				threadCount = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+			state.queues.clear();
+			for (unsigned int i = 0; i < threadCount; i++)
+				state.queues.push_back(std::make_unique<Queue>());
+			state.started = true;
+
+			for (unsigned int i = 1; i < threadCount; i++)
+				state.workers.emplace_back(&JobSystem::WorkerLoop, (int)i);
+		}
+
+		// Run the remaining jobs and stop the workers
+		static void Stop()
+		{
+			State& state = Data();
+			std::lock_guard<std::recursive_mutex> lock(state.startMutex);
+			if (!state.started)
+				return;
+
+			while (RunOne()) {}
+
+			{
+				std::lock_guard<std::mutex> sleepLock(state.sleepMutex);
+				state.stop = true;
+			}
+			state.wake.notify_all();
+			for (auto& worker : state.workers)
+				worker.join();
+			state.workers.clear();
+			state.stop = false;
+			state.started = false;
+		}
+
+		// Number of threads running jobs, including the one waiting on them
+		static unsigned int ThreadCount()
+		{
+			EnsureStarted();
+			return (unsigned int)Data().queues.size();
+		}
+
+		// Run a function once all its dependencies are done. Without workers (single thread) the job is run right away
+		static Handle Run(std::function<void()> function, std::initializer_list<Handle> dependencies = {})
+		{
+			EnsureStarted();
+			Handle job = std::make_shared<Job>();
+			job->function = std::move(function);
+
+			for (const Handle& dependency : dependencies)
+			{
+				if (dependency == nullptr)
+					continue;
+				std::lock_guard<std::mutex> lock(dependency->mutex);
+				if (!dependency->done)
+				{
+					job->waiting++;
+					dependency->next.push_back(job);
+				}
+			}
+
+			if (--job->waiting == 0)
+				Push(job);
+			return job;
+		}
+
+		static bool IsDone(const Handle& job) { return job == nullptr || job->done; }
+
+		// Wait for a job to be done, the calling thread runs other jobs in the meantime
+		static void Wait(const Handle& job)
+		{
+			while (!IsDone(job))
+			{
+				if (!RunOne())
+					std::this_thread::yield();
+			}
+		}
+
+		// Call function(i) for every i in [begin, end), in chunks of grainSize indices spread over the threads. Returns when all the calls are done
+		template<class Function>
+		static void ParallelFor(int begin, int end, int grainSize, Function&& function)
+		{
+			if (begin >= end)
+				return;
+
+			grainSize = (std::max)(grainSize, 1);
+			const int chunkCount = (end - begin + grainSize - 1) / grainSize;
+			const int runnerCount = (std::min)(chunkCount, (int)ThreadCount());
+			std::atomic<int> nextChunk = 0, finished = 0;
+
+			// Every runner takes chunks until there are none left
+			auto runner = [&]()
+			{
+				for (int chunk = nextChunk.fetch_add(1); chunk < chunkCount; chunk = nextChunk.fetch_add(1))
+				{
+					const int chunkEnd = (std::min)(begin + (chunk + 1) * grainSize, end);
+					for (int i = begin + chunk * grainSize; i < chunkEnd; i++)
+						function(i);
+				}
+				finished.fetch_add(1);
+			};
+
+			for (int i = 1; i < runnerCount; i++)
+				Run(runner);
+			runner();
+
+			while (finished.load() < runnerCount)
+			{
+				if (!RunOne())
+					std::this_thread::yield();
+			}
+		}
+
+	private:
+		static void EnsureStarted()
+		{
+			State& state = Data();
+			if (!state.started)
+			{
+				std::lock_guard<std::recursive_mutex> lock(state.startMutex);
+				if (!state.started)
+					Start();
+			}
+		}
+
+		// Queue a job that is ready to run
+		static void Push(const Handle& job)
+		{
+			State& state = Data();
+			if (state.workers.empty())
+			{
+				Execute(job);
+				return;
+			}
+
+			Queue& queue = *state.queues[m_queueIndex];
+			{
+				std::lock_guard<std::mutex> lock(queue.mutex);
+				queue.jobs.push_back(job);
+			}
+			state.pending.fetch_add(1);
+
+			if (state.sleeping.load() > 0)
+			{
+				std::lock_guard<std::mutex> lock(state.sleepMutex);
+				state.wake.notify_one();
+			}
+		}
+
+		// Run one job from the thread's queue or stolen from another queue, returns false if all the queues were empty
+		static bool RunOne()
+		{
+			State& state = Data();
+			const int queueCount = (int)state.queues.size();
+			if (queueCount == 0 || state.pending.load() == 0)
+				return false;
+
+			Handle job;
+			{
+				Queue& own = *state.queues[m_queueIndex];
+				std::lock_guard<std::mutex> lock(own.mutex);
+				if (!own.jobs.empty())
+				{
+					job = std::move(own.jobs.back());
+					own.jobs.pop_back();
+				}
+			}
+
+			for (int i = 1; job == nullptr && i < queueCount; i++)
+			{
+				Queue& victim = *state.queues[(m_queueIndex + i) % queueCount];
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (!victim.jobs.empty())
+				{
+					job = std::move(victim.jobs.front());
+					victim.jobs.pop_front();
+				}
+			}
+
+			if (job == nullptr)
+				return false;
+
+			state.pending.fetch_sub(1);
+			Execute(job);
+			return true;
+		}
+
+		// Run the job and submit the jobs that were only waiting on it
+		static void Execute(const Handle& job)
+		{
+			job->function();
+			job->function = nullptr; // Release the captures
+
+			std::vector<Handle> next;
+			{
+				std::lock_guard<std::mutex> lock(job->mutex);
+				job->done = true;
+				next.swap(job->next);
+			}
+
+			for (const Handle& dependent : next)
+			{
+				if (--dependent->waiting == 0)
+					Push(dependent);
+			}
+		}
+
+		static void WorkerLoop(int queueIndex)
+		{
+			m_queueIndex = queueIndex;
+			State& state = Data();
+			while (true)
+			{
+				if (RunOne())
+					continue;
+
+				std::unique_lock<std::mutex> lock(state.sleepMutex);
+				if (state.stop)
+					return;
+
+				state.sleeping.fetch_add(1);
+				state.wake.wait(lock, [&] { return state.stop || state.pending.load() > 0; });
+				state.sleeping.fetch_sub(1);
+			}
+		}
+	};
+	inline thread_local int JobSystem::m_queueIndex = 0;
+
+	/// <summary>
+	/// Fork/join helper : run jobs with Run() and wait for all of them with Wait() (ex : the update work of a frame)
+	/// </summary>
+	class JobGroup
+	{
+	private:
+		std::vector<JobSystem::Handle> m_jobs;
+
+	public:
+		~JobGroup() { Wait(); }
+
+		JobSystem::Handle Run(std::function<void()> function, std::initializer_list<JobSystem::Handle> dependencies = {})
+		{
+			m_jobs.push_back(JobSystem::Run(std::move(function), dependencies));
+			return m_jobs.back();
+		}
+
+		// Wait for all the jobs of the group, the group can then be reused
+		void Wait()
+		{
+			for (auto& job : m_jobs)
+				JobSystem::Wait(job);
+			m_jobs.clear();
+		}
+	};
+
+	/// <summary>
+	/// <para>Timers in a hierarchical wheel : 4 levels of 256 slots, a slot of a level spans all the slots of the level below</para>
+	/// <para>A timer is stored in the lowest level that covers its delay and moves down when the wheel reaches its slot, so Advance() only touches the slots it passes and the timers that expire or move down</para>
+	/// </summary>
+	class TimerWheel
+	{
+	public:
+		static constexpr int Levels = 4, SlotBits = 8, Slots = 1 << SlotBits;
+		static constexpr UINT64 MaxDelay = (1ull << (Levels * SlotBits)) - 1; // In ticks, longer delays are shortened
+
+	private:
+		static constexpr UINT32 None = UINT32_MAX;
+
+		struct TimerData
+		{
+			UINT64 expiry; // Tick
+			UINT32 value;
+			UINT32 slot; // None when the timer is free
+			UINT32 previous, next; // In the list of the slot, next is the next free timer when free
+		};
+
+		std::vector<TimerData> m_timers;
+		UINT32 m_free;
+		UINT32 m_slots[Levels * Slots]; // First timer of each slot
+		int m_levelCounts[Levels]; // Timers in each level
+		UINT64 m_now;
+		int m_count;
+
+	public:
+		TimerWheel(UINT64 now = 0) : m_free(None), m_now(now), m_count(0)
+		{
+			std::fill(std::begin(m_slots), std::end(m_slots), None);
+			std::fill(std::begin(m_levelCounts), std::end(m_levelCounts), 0);
+		}
+
+		// The last tick reached by Advance()
+		UINT64 Now() const { return m_now; }
+
+		// Number of timers waiting
+		int Count() const { return m_count; }
+
+		// Add a timer expiring at tick expiry (the next tick if it is already reached), returns its handle. The handle can be given to a new timer once this one expired or was canceled
+		UINT32 Schedule(UINT64 expiry, UINT32 value)
+		{
+			UINT32 timer = m_free;
+			if (timer != None)
+				m_free = m_timers[timer].next;
+			else
+			{
+				timer = (UINT32)m_timers.size();
+				m_timers.emplace_back();
+			}
+
+			m_timers[timer].expiry = (std::min)((std::max)(expiry, m_now + 1), m_now + MaxDelay);
+			m_timers[timer].value = value;
+			Link(timer);
+			m_count++;
+			return timer;
+		}
+
+		// Remove a timer before it expires
+		void Cancel(UINT32 timer)
+		{
+			if (timer >= m_timers.size() || m_timers[timer].slot == None)
+				return;
+
+			Unlink(timer);
+			Free(timer);
+		}
+
+		// Turn the wheel up to tick now, the values of the timers that expire are added to expired, by expiry
+		void Advance(UINT64 now, std::vector<UINT32>& expired)
+		{
+			while (m_now < now)
+			{
+				if (m_count == 0)
+				{
+					m_now = now;
+					return;
+				}
+
+				// Skip to the next slot of the lowest level with timers, the levels below are empty
+				int lowest = 0;
+				while (m_levelCounts[lowest] == 0)
+					lowest++;
+				if (lowest > 0)
+				{
+					const UINT64 next = ((m_now >> (lowest * SlotBits)) + 1) << (lowest * SlotBits);
+					m_now = (std::min)(next - 1, now);
+					if (m_now == now)
+						return;
+				}
+
+				m_now++;
+
+				// The wheel reached the next slot of the levels above : their timers move down
+				for (int level = 1; level < Levels && (m_now & ((1ull << (level * SlotBits)) - 1)) == 0; level++)
+				{
+					UINT32 timer = Detach(level * Slots + (UINT32)((m_now >> (level * SlotBits)) & (Slots - 1)));
+					while (timer != None)
+					{
+						const UINT32 next = m_timers[timer].next;
+						m_levelCounts[level]--;
+						Link(timer);
+						timer = next;
+					}
+				}
+
+				UINT32 timer = Detach((UINT32)(m_now & (Slots - 1)));
+				while (timer != None)
+				{
+					const UINT32 next = m_timers[timer].next;
+					expired.push_back(m_timers[timer].value);
+					m_levelCounts[0]--;
+					Free(timer);
+					timer = next;
+				}
+			}
+		}
+
+		// Remove every timer
+		void Clear()
+		{
+			m_timers.clear();
+			m_free = None;
+			m_count = 0;
+			std::fill(std::begin(m_slots), std::end(m_slots), None);
+			std::fill(std::begin(m_levelCounts), std::end(m_levelCounts), 0);
+		}
+
+	private:
+		// Add a timer to the slot of its expiry
+		void Link(UINT32 timer)
+		{
+			TimerData& data = m_timers[timer];
+			const UINT64 delay = data.expiry > m_now ? data.expiry - m_now : 0;
+			int level = 0;
+			while (level < Levels - 1 && delay >= (1ull << ((level + 1) * SlotBits)))
+				level++;
+
+			data.slot = level * Slots + (UINT32)((data.expiry >> (level * SlotBits)) & (Slots - 1));
+			m_levelCounts[level]++;
+			data.previous = None;
+			data.next = m_slots[data.slot];
+			if (data.next != None)
+				m_timers[data.next].previous = timer;
+			m_slots[data.slot] = timer;
+		}
+
+		void Unlink(UINT32 timer)
+		{
+			const TimerData& data = m_timers[timer];
+			m_levelCounts[data.slot / Slots]--;
+			if (data.previous != None)
+				m_timers[data.previous].next = data.next;
+			else
+				m_slots[data.slot] = data.next;
+			if (data.next != None)
+				m_timers[data.next].previous = data.previous;
+		}
+
+		// Empty a slot, returns its first timer
+		UINT32 Detach(UINT32 slot)
+		{
+			const UINT32 first = m_slots[slot];
+			m_slots[slot] = None;
+			return first;
+		}
+
+		void Free(UINT32 timer)
+		{
+			m_timers[timer].slot = None;
+			m_timers[timer].next = m_free;
+			m_free = timer;
+			m_count--;
+		}
+	};
+
+	/// <summary>
+	/// <para>Compact screen cell : 2 bytes instead of the 4 of a CHAR_INFO</para>
+	/// <para>The attributes fit in a byte (foreground | background << 4) and the character is an index in the glyph table of FrameBuffer</para>
+	/// </summary>
+	struct CompactCell
+	{
+		UINT8 glyph; // Index in the glyph table
+		UINT8 attributes;
+	};
+
+	/// <summary>
+	/// <para>The cells drawn by the Console, Cell is CHAR_INFO (the output format) or CompactCell</para>
+	/// <para>Draw calls write cells in the Cell format, they are only expanded to CHAR_INFO by Present() (in BlipToScreen())</para>
+	/// </summary>
+	template<class Cell>
+	class FrameBuffer
+	{
+		static_assert(std::is_same_v<Cell, CHAR_INFO> || std::is_same_v<Cell, CompactCell>, "Cell must be CHAR_INFO or CompactCell");
+		static constexpr bool Compact = std::is_same_v<Cell, CompactCell>;
+
+	private:
+		Cell* m_cells;
+		CHAR_INFO* m_output; // Expanded cells, only used by CompactCell
+		int m_size;
+
+		// Glyph table of CompactCell, shared by all the buffers : index -> character and character -> index (0 = not assigned yet)
+		inline static WCHAR m_glyphs[256] = {};
+		inline static std::atomic<UINT8> m_glyphIndex[65536] = {};
+		inline static std::mutex m_glyphMutex;
+		inline static int m_glyphCount = 0;
+
+	public:
+		FrameBuffer(int width, int height) : m_output(nullptr), m_size(width * height)
+		{
+			m_cells = new Cell[m_size];
+			memset(m_cells, 0, sizeof(Cell) * m_size);
+			if constexpr (Compact)
+				m_output = new CHAR_INFO[m_size];
+		}
+
+		~FrameBuffer()
+		{
+			delete[] m_cells;
+			delete[] m_output;
+		}
+
+		FrameBuffer(const FrameBuffer&) = delete;
+		FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+		Cell& operator[](int index) { return m_cells[index]; }
+		const Cell& operator[](int index) const { return m_cells[index]; }
+		Cell* Data() { return m_cells; }
+		int Size() const { return m_size; }
+
+		// Build a cell from a character and attributes
+		static Cell MakeCell(WCHAR character, UINT16 attributes)
+		{
+			Cell cell;
+			if constexpr (Compact)
+			{
+				cell.glyph = GlyphIndex(character);
+				cell.attributes = (UINT8)attributes;
+			}
+			else
+			{
+				cell.Char.UnicodeChar = character;
+				cell.Attributes = attributes;
+			}
+			return cell;
+		}
+
+		// Character of a cell
+		static WCHAR Character(const Cell& cell)
+		{
+			if constexpr (Compact)
+				return m_glyphs[cell.glyph];
+			else
+				return cell.Char.UnicodeChar;
+		}
+
+		// Attributes of a cell
+		static UINT16 Attributes(const Cell& cell)
+		{
+			if constexpr (Compact)
+				return cell.attributes;
+			else
+				return cell.Attributes;
+		}
+
+		// Write the same cell in count consecutive cells, 16 bytes per store
+		static void FillRow(Cell* row, int count, const Cell& cell)
+		{
+			constexpr int PerStore = 16 / sizeof(Cell);
+			__m128i cells;
+			if constexpr (Compact)
+				cells = _mm_set1_epi16((short)(cell.glyph | (cell.attributes << 8)));
+			else
+			{
+				int value;
+				memcpy(&value, &cell, sizeof(value));
+				cells = _mm_set1_epi32(value);
+			}
+
+			int i = 0;
+			for (; i + PerStore <= count; i += PerStore)
+				_mm_storeu_si128((__m128i*)(row + i), cells);
+			for (; i < count; i++)
+				row[i] = cell;
+		}
+
+		// Copy count cells in the output format to row
+		static void CopyRow(Cell* row, const CHAR_INFO* cells, int count)
+		{
+			if constexpr (Compact)
+			{
+				for (int i = 0; i < count; i++)
+					row[i] = MakeCell(cells[i].Char.UnicodeChar, cells[i].Attributes);
+			}
+			else
+				memcpy(row, cells, sizeof(CHAR_INFO) * count);
+		}
+
+		// The cells in the output format, CompactCell is expanded here and only here
+		const CHAR_INFO* Present()
+		{
+			if constexpr (Compact)
+			{
+				// 8 cells at a time : the glyphs are looked up one by one, the attributes are widened and interleaved with them
+				int i = 0;
+				for (; i + 8 <= m_size; i += 8)
+				{
+					const __m128i cells = _mm_loadu_si128((const __m128i*)(m_cells + i));
+					const __m128i attributes = _mm_srli_epi16(cells, 8);
+
+					__m128i glyphs = _mm_setzero_si128();
+					glyphs = _mm_insert_epi16(glyphs, m_glyphs[m_cells[i + 0].glyph], 0);
+					glyphs = _mm_insert_epi16(glyphs, m_glyphs[m_cells[i + 1].glyph], 1);
+					glyphs = _mm_insert_epi16(glyphs, m_glyphs[m_cells[i + 2].glyph], 2);
+					glyphs = _mm_insert_epi16(glyphs, m_glyphs[m_cells[i + 3].glyph], 3);
+					glyphs = _mm_insert_epi16(glyphs, m_glyphs[m_cells[i + 4].glyph], 4);
+					glyphs = _mm_insert_epi16(glyphs, m_glyphs[m_cells[i + 5].glyph], 5);
+					glyphs = _mm_insert_epi16(glyphs, m_glyphs[m_cells[i + 6].glyph], 6);
+					glyphs = _mm_insert_epi16(glyphs, m_glyphs[m_cells[i + 7].glyph], 7);
+
+					_mm_storeu_si128((__m128i*)(m_output + i), _mm_unpacklo_epi16(glyphs, attributes));
+					_mm_storeu_si128((__m128i*)(m_output + i + 4), _mm_unpackhi_epi16(glyphs, attributes));
+				}
+				for (; i < m_size; i++)
+				{
+					m_output[i].Char.UnicodeChar = m_glyphs[m_cells[i].glyph];
+					m_output[i].Attributes = m_cells[i].attributes;
+				}
+				return m_output;
+			}
+			else
+				return m_cells;
+		}
+
+		// 64 bits hash of the cells, to tell if the frame changed (see Console::SetIdleRendering()). A change of a single cell always changes the hash
+		UINT64 Hash() const
+		{
+			// 4 independent lanes of 8 bytes : xor, multiply and shift are all bijective, the lanes are only combined at the end
+			constexpr UINT64 Prime = 0x9E3779B97F4A7C15ull;
+			const UINT8* bytes = (const UINT8*)m_cells;
+			const size_t size = sizeof(Cell) * (size_t)m_size;
+			auto mix = [](UINT64 lane, const UINT8* data)
+			{
+				UINT64 value;
+				memcpy(&value, data, sizeof(value));
+				lane = (lane ^ value) * Prime;
+				return lane ^ (lane >> 29);
+			};
+
+			UINT64 lane0 = Prime, lane1 = Prime * 3, lane2 = Prime * 5, lane3 = Prime * 7; // In registers
+			size_t i = 0;
+			for (; i + 32 <= size; i += 32)
+			{
+				lane0 = mix(lane0, bytes + i);
+				lane1 = mix(lane1, bytes + i + 8);
+				lane2 = mix(lane2, bytes + i + 16);
+				lane3 = mix(lane3, bytes + i + 24);
+			}
+
+			UINT64 hash = size;
+			for (; i < size; i++)
+				hash = (hash ^ bytes[i]) * Prime;
+			for (UINT64 lane : { lane0, lane1, lane2, lane3 })
+			{
+				hash = (hash ^ lane) * Prime;
+				hash ^= hash >> 32;
+			}
+			return hash;
+		}
+
+	private:
+		// Index of a character in the glyph table, the characters are added the first time they are used ('?' when the table is full)
+		static UINT8 GlyphIndex(WCHAR character)
+		{
+			UINT8 index = m_glyphIndex[(UINT16)character].load(std::memory_order_acquire);
+			if (index != 0 || character == 0)
+				return index;
+
+			std::lock_guard<std::mutex> lock(m_glyphMutex);
+			if (m_glyphCount == 0) // First use : ASCII keeps its code, then the block characters of the engine
+			{
+				for (int c = 0; c < 128; c++)
+					AddGlyph((WCHAR)c);
+				for (WCHAR c : { 0x2588, 0x2593, 0x2592, 0x2591, 0x2580, 0x2584, 0x258C, 0x2590 })
+					AddGlyph(c);
+				for (WCHAR c = 0x2596; c <= 0x259F; c++) // Quadrants
+					AddGlyph(c);
+			}
+
+			index = m_glyphIndex[(UINT16)character].load(std::memory_order_relaxed);
+			if (index == 0 && character != 0)
+				index = m_glyphCount < 256 ? AddGlyph(character) : (UINT8)'?';
+			return index;
+		}
+
+		static UINT8 AddGlyph(WCHAR character)
+		{
+			UINT8 index = (UINT8)m_glyphCount++;
+			m_glyphs[index] = character;
+			m_glyphIndex[(UINT16)character].store(index, std::memory_order_release);
+			return index;
+		}
+	};
+
+	// Cell format of the Console, define REXCONSOLEENGINE_COMPACT_CELLS before including the engine to use CompactCell
+#ifdef REXCONSOLEENGINE_COMPACT_CELLS
+	using ScreenCell = CompactCell;
+#else
+	using ScreenCell = CHAR_INFO;
+#endif
+
+	/// <summary>
+	/// <para> Streams the frames of a Console to spectators on a loopback TCP port, see Console::StartStreaming() and SpectatorClient. </para>
+	/// <para> A spectator gets a keyframe, then deltas : the runs of cells that changed since the last frame it was sent. </para>
+	/// <para> The game thread only copies the frame (when someone is watching), a thread of the server encodes and sends it. </para>
+	/// <para> A spectator still receiving a frame skips the next ones and its next delta covers them, a slow spectator never blocks the game. </para>
+	/// </summary>
+	class SpectatorServer
+	{
+	public:
+		static constexpr UINT16 DefaultPort = 7341;
+		static constexpr UINT16 Magic = 0x5852; // "RX"
+
+		enum class Message : UINT8 { Keyframe, Delta };
+
+		// Start of every message, followed by size bytes : the cells (Keyframe) or runs (Delta)
+		struct Header
+		{
+			UINT16 magic;
+			Message type;
+			UINT8 reserved;
+			UINT16 width, height;
+			UINT32 size;
+		};
+
+		// Run of changed cells in a Delta, followed by count cells
+		struct Run { UINT32 start, count; };
+
+	private:
+		struct Client
+		{
+			SOCKET socket;
+			std::vector<char> pending; // Message being sent
+			size_t sent; // Bytes of pending already sent
+			std::vector<CHAR_INFO> base; // Last frame queued, the next delta is computed from it
+			UINT64 baseFrame; // Its number, 0 before the keyframe
+			int baseWidth;
+		};
+
+		static constexpr int MaxGap = 2; // Unchanged cells kept inside a run, a Run costs as much as 2 cells
+
+		SOCKET m_listen;
+		std::thread m_thread;
+		std::atomic_bool m_running;
+		std::atomic<int> m_spectators;
+		std::atomic_bool m_newSpectator; // A spectator connected, it needs a frame even if the game shows none (idle rendering)
+		HANDLE m_wakeEvent; // Set when a spectator connects, NULL for none
+
+		// Shared with the game thread
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::vector<CHAR_INFO> m_latest; // Last frame published
+		int m_latestWidth, m_latestHeight;
+		UINT64 m_latestFrame;
+
+		// Server thread only
+		std::vector<CHAR_INFO> m_frame; // Frame being sent
+		int m_width, m_height;
+		UINT64 m_frameNumber;
+		std::vector<Client> m_clients;
+		std::vector<char> m_delta; // Delta of m_frame from the frame m_deltaBase, shared by the spectators that are up to date
+		UINT64 m_deltaBase, m_deltaFrame;
+
+	public:
+		// wakeEvent is set when a spectator connects (ex : the event Console::Wake() sets), it must outlive the server
+		SpectatorServer(HANDLE wakeEvent = NULL)
+			: m_listen(INVALID_SOCKET), m_running(false), m_spectators(0), m_newSpectator(false), m_wakeEvent(wakeEvent), m_latestWidth(0), m_latestHeight(0), m_latestFrame(0),
+			m_width(0), m_height(0), m_frameNumber(0), m_deltaBase(0), m_deltaFrame(0) {}
+
+		~SpectatorServer() { Stop(); }
+
+		// Listen on the loopback port (0 picks a free one, see Port()), returns false if the port can not be opened
+		bool Start(UINT16 port = DefaultPort)
+		{
+			Stop();
+
+			WSADATA data;
+			if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+				return false;
+
+			sockaddr_in address {};
+			address.sin_family = AF_INET;
+			address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Local spectators only
+			address.sin_port = htons(port);
+			u_long nonBlocking = 1;
+
+			m_listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			if (m_listen == INVALID_SOCKET || bind(m_listen, (const sockaddr*)&address, sizeof(address)) == SOCKET_ERROR
+				|| listen(m_listen, SOMAXCONN) == SOCKET_ERROR || ioctlsocket(m_listen, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+			{
+				if (m_listen != INVALID_SOCKET)
+					closesocket(m_listen);
+				m_listen = INVALID_SOCKET;
+				WSACleanup();
+				return false;
+			}
+
+			m_running = true;
+			m_thread = std::thread([this] { Serve(); });
+			SetThreadPriority(m_thread.native_handle(), THREAD_PRIORITY_BELOW_NORMAL); // Never takes the core of the game thread when it publishes
+			return true;
+		}
+
+		// Disconnect every spectator and close the port
+		void Stop()
+		{
+			if (!m_thread.joinable())
+				return;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_running = false;
+			}
+			m_wake.notify_all();
+			m_thread.join();
+
+			for (Client& client : m_clients)
+				closesocket(client.socket);
+			m_clients.clear();
+			m_spectators = 0;
+			closesocket(m_listen);
+			m_listen = INVALID_SOCKET;
+			WSACleanup();
+		}
+
+		// Port the server listens on, 0 if it is not started
+		UINT16 Port() const
+		{
+			sockaddr_in address {};
+			int length = sizeof(address);
+			if (m_listen == INVALID_SOCKET || getsockname(m_listen, (sockaddr*)&address, &length) == SOCKET_ERROR)
+				return 0;
+			return ntohs(address.sin_port);
+		}
+
+		// Number of connected spectators
+		int Spectators() const { return m_spectators.load(std::memory_order_relaxed); }
+
+		// Did a spectator connect since the last call ? It gets nothing until the next Publish()
+		bool TakeNewSpectator() { return m_newSpectator.exchange(false); }
+
+		// Give a new frame to the server, called by Console::BlipToScreen(). Only copies the cells, nothing is done when nobody is watching
+		void Publish(const CHAR_INFO* cells, int width, int height)
+		{
+			if (m_spectators.load(std::memory_order_relaxed) == 0)
+				return;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_latest.assign(cells, cells + (size_t)width * height);
+				m_latestWidth = width;
+				m_latestHeight = height;
+				m_latestFrame++;
+			}
+			m_wake.notify_one();
+		}
+
+		// Write a Keyframe message
+		static void EncodeKeyframe(const CHAR_INFO* frame, int width, int height, std::vector<char>& out)
+		{
+			const Header header { Magic, Message::Keyframe, 0, (UINT16)width, (UINT16)height, (UINT32)((size_t)width * height * sizeof(CHAR_INFO)) };
+			out.clear();
+			Append(out, &header, sizeof(header));
+			Append(out, frame, header.size);
+		}
+
+		// Write a Delta message with the runs of cells that differ between base and frame, 4 cells are compared at a time
+		static void EncodeDelta(const CHAR_INFO* base, const CHAR_INFO* frame, int width, int height, std::vector<char>& out)
+		{
+			static_assert(sizeof(CHAR_INFO) == 4, "A cell is compared as a 32 bits value");
+
+			Header header { Magic, Message::Delta, 0, (UINT16)width, (UINT16)height, 0 };
+			out.clear();
+			Append(out, &header, sizeof(header));
+
+			const int count = width * height;
+			int i = 0;
+			while (i < count)
+			{
+				if (i + 4 <= count && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&base[i]), _mm_loadu_si128((const __m128i*)&frame[i]))) == 0xFFFF)
+				{
+					i += 4;
+					continue;
+				}
+				if (Same(base[i], frame[i]))
+				{
+					i++;
+					continue;
+				}
+
+				// The run ends after more than MaxGap unchanged cells
+				int last = i;
+				for (int j = i + 1; j < count && j - last <= MaxGap; j++)
+				{
+					if (!Same(base[j], frame[j]))
+						last = j;
+				}
+
+				const Run run { (UINT32)i, (UINT32)(last - i + 1) };
+				Append(out, &run, sizeof(run));
+				Append(out, &frame[i], run.count * sizeof(CHAR_INFO));
+				i = last + 1;
+			}
+
+			header.size = (UINT32)(out.size() - sizeof(header));
+			memcpy(out.data(), &header, sizeof(header));
+		}
+
+	private:
+		static bool Same(const CHAR_INFO& a, const CHAR_INFO& b) { return memcmp(&a, &b, sizeof(CHAR_INFO)) == 0; }
+
+		static void Append(std::vector<char>& out, const void* data, size_t size)
+		{
+			out.insert(out.end(), (const char*)data, (const char*)data + size);
+		}
+
+		// Server thread : take the last frame, accept the new spectators and send
+		void Serve()
+		{
+			while (m_running)
+			{
+				{
+					// Short wait while a spectator has bytes left to send, the socket is polled
+					bool sending = false;
+					for (const Client& client : m_clients)
+						sending |= client.sent < client.pending.size();
+
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wake.wait_for(lock, std::chrono::milliseconds(sending ? 1 : 20), [this] { return m_latestFrame != m_frameNumber || !m_running; });
+					if (m_latestFrame != m_frameNumber)
+					{
+						m_frame.swap(m_latest);
+						m_width = m_latestWidth;
+						m_height = m_latestHeight;
+						m_frameNumber = m_latestFrame;
+					}
+				}
+
+				Accept();
+				Send();
+			}
+		}
+
+		void Accept()
+		{
+			for (;;)
+			{
+				SOCKET socket = accept(m_listen, nullptr, nullptr);
+				if (socket == INVALID_SOCKET)
+					return;
+
+				u_long nonBlocking = 1;
+				BOOL noDelay = TRUE;
+				ioctlsocket(socket, FIONBIO, &nonBlocking);
+				setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+				m_clients.push_back({ socket, {}, 0, {}, 0, 0 });
+				m_spectators++;
+				m_newSpectator = true;
+				if (m_wakeEvent != NULL)
+					SetEvent(m_wakeEvent);
+			}
+		}
+
+		// Queue the current frame for the spectators that are done with their last one, and send what the sockets accept
+		void Send()
+		{
+			for (size_t i = 0; i < m_clients.size();)
+			{
+				Client& client = m_clients[i];
+				if (client.sent == client.pending.size() && client.baseFrame != m_frameNumber && m_frameNumber != 0)
+					Queue(client);
+
+				if (!Flush(client)) // Disconnected
+				{
+					closesocket(client.socket);
+					m_clients.erase(m_clients.begin() + i);
+					m_spectators--;
+					continue;
+				}
+				i++;
+			}
+		}
+
+		void Queue(Client& client)
+		{
+			if (client.baseFrame == 0 || client.baseWidth != m_width || client.base.size() != m_frame.size())
+				EncodeKeyframe(m_frame.data(), m_width, m_height, client.pending);
+			else
+			{
+				if (client.baseFrame != m_deltaBase || m_frameNumber != m_deltaFrame) // Most spectators share the same base
+				{
+					EncodeDelta(client.base.data(), m_frame.data(), m_width, m_height, m_delta);
+					m_deltaBase = client.baseFrame;
+					m_deltaFrame = m_frameNumber;
+				}
+				client.pending.assign(m_delta.begin(), m_delta.end());
+			}
+
+			client.sent = 0;
+			client.base.assign(m_frame.begin(), m_frame.end());
+			client.baseFrame = m_frameNumber;
+			client.baseWidth = m_width;
+		}
+
+		// Send the pending bytes until the socket is full, returns false if the spectator is gone
+		static bool Flush(Client& client)
+		{
+			while (client.sent < client.pending.size())
+			{
+				int sent = send(client.socket, client.pending.data() + client.sent, (int)(std::min)(client.pending.size() - client.sent, (size_t)INT_MAX), 0);
+				if (sent == SOCKET_ERROR)
+					return WSAGetLastError() == WSAEWOULDBLOCK;
+				client.sent += sent;
+			}
+			return true;
+		}
+	};
+
+	/// <summary>
+	/// <para> Receives the frames of a SpectatorServer, see the Viewer project. </para>
+	/// <para> The socket never blocks : Receive() reads what arrived and applies the complete messages to the cells. </para>
+	/// </summary>
+	class SpectatorClient
+	{
+	private:
+		SOCKET m_socket;
+		bool m_started; // Was WSAStartup() called ?
+		std::vector<char> m_received; // Bytes not applied yet
+		std::vector<CHAR_INFO> m_cells;
+		int m_width, m_height;
+
+	public:
+		SpectatorClient() : m_socket(INVALID_SOCKET), m_started(false), m_width(0), m_height(0) {}
+		~SpectatorClient() { Disconnect(); }
+
+		// Connect to a server on this computer, returns false if there is none on the port
+		bool Connect(UINT16 port = SpectatorServer::DefaultPort)
+		{
+			Disconnect();
+
+			WSADATA data;
+			if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+				return false;
+			m_started = true;
+
+			sockaddr_in address {};
+			address.sin_family = AF_INET;
+			address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			address.sin_port = htons(port);
+			u_long nonBlocking = 1;
+
+			m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+			if (m_socket == INVALID_SOCKET || connect(m_socket, (const sockaddr*)&address, sizeof(address)) == SOCKET_ERROR
+				|| ioctlsocket(m_socket, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+			{
+				Disconnect();
+				return false;
+			}
+			return true;
+		}
+
+		// Close the connection, the last frame is kept
+		void Disconnect()
+		{
+			if (m_socket != INVALID_SOCKET)
+				closesocket(m_socket);
+			if (m_started)
+				WSACleanup();
+			m_socket = INVALID_SOCKET;
+			m_started = false;
+			m_received.clear();
+		}
+
+		bool Connected() const { return m_socket != INVALID_SOCKET; }
+
+		// Read the messages that arrived, returns true if the cells changed. Disconnects when the server is gone or sends invalid data
+		bool Receive()
+		{
+			if (m_socket == INVALID_SOCKET)
+				return false;
+
+			const int chunk = 64 * 1024;
+			for (;;)
+			{
+				const size_t size = m_received.size();
+				m_received.resize(size + chunk);
+				int received = recv(m_socket, m_received.data() + size, chunk, 0);
+				m_received.resize(size + (std::max)(received, 0));
+				if (received > 0)
+					continue;
+
+				if (received == 0 || WSAGetLastError() != WSAEWOULDBLOCK)
+				{
+					Disconnect();
+					return false;
+				}
+				break;
+			}
+
+			bool changed = false;
+			size_t offset = 0;
+			while (m_received.size() - offset >= sizeof(SpectatorServer::Header))
+			{
+				SpectatorServer::Header header;
+				memcpy(&header, m_received.data() + offset, sizeof(header));
+				if (header.magic != SpectatorServer::Magic)
+				{
+					Disconnect();
+					return changed;
+				}
+				if (m_received.size() - offset - sizeof(header) < header.size) // Not all there yet
+					break;
+
+				if (!Apply(header, m_received.data() + offset + sizeof(header)))
+				{
+					Disconnect();
+					return changed;
+				}
+				offset += sizeof(header) + header.size;
+				changed = true;
+			}
+			m_received.erase(m_received.begin(), m_received.begin() + offset);
+			return changed;
+		}
+
+		// Size of the streamed frame, 0 before the first keyframe
+		int Width() const { return m_width; }
+		int Height() const { return m_height; }
+
+		// Cells of the last frame received, row major
+		const CHAR_INFO* Cells() const { return m_cells.data(); }
+
+	private:
+		// Apply a message to the cells, returns false if it is invalid
+		bool Apply(const SpectatorServer::Header& header, const char* payload)
+		{
+			const size_t count = (size_t)header.width * header.height;
+			if (header.type == SpectatorServer::Message::Keyframe)
+			{
+				if (header.size != count * sizeof(CHAR_INFO))
+					return false;
+
+				m_width = header.width;
+				m_height = header.height;
+				m_cells.resize(count);
+				memcpy(m_cells.data(), payload, header.size);
+				return true;
+			}
+
+			if (header.type != SpectatorServer::Message::Delta || header.width != m_width || header.height != m_height)
+				return false;
+
+			for (size_t offset = 0; offset < header.size;)
+			{
+				SpectatorServer::Run run;
+				if (header.size - offset < sizeof(run))
+					return false;
+				memcpy(&run, payload + offset, sizeof(run));
+				offset += sizeof(run);
+
+				if (run.start > count || run.count > count - run.start || (header.size - offset) / sizeof(CHAR_INFO) < run.count)
+					return false;
+				if (run.count == 0)
+					continue; // start can be one past the last cell
+
+				memcpy(&m_cells[run.start], payload + offset, run.count * sizeof(CHAR_INFO));
+				offset += run.count * sizeof(CHAR_INFO);
+			}
+			return true;
+		}
+	};
+
+	/// <summary>
+	/// <para> How the console looks, to turn cells into images : the RGB values of the 16 colors and an 8x8 bitmap of every glyph. </para>
+	/// <para> The bitmaps cover ASCII (the 5x7 font of BitmapFont::Default()) and the block elements used by Pixel and HiResCanvas, the other glyphs are drawn as a '?'. </para>
+	/// </summary>
+	class CellRaster
+	{
+	public:
+		static constexpr int CellSize = 8; // Pixels per cell, in both directions
+
+		// RGB of the colors, in Console::Color order
+		static constexpr UINT8 Palette[16][3] = {
+			{0,0,0}, // Black
+			{0,0,128}, // Dark Blue
+			{0,128,0}, // Dark Green
+			{0,128,128}, // Dark Cyan
+			{128,0,0}, // Dark Red
+			{128,0,128}, // Dark Magenta
+			{128,128,0}, // Dark Yellow
+			{192,192,192}, // Grey
+			{128,128,128}, // Dark Grey
+			{0,0,255}, // Bright Blue
+			{0,255,0}, // Bright Green
+			{0,255,255}, // Bright Cyan
+			{255,0,0}, // Bright Red
+			{255,0,255}, // Bright Magenta
+			{255,255,0}, // Bright Yellow
+			{255,255,255}, // White
+		};
+
+		// 5x7 glyphs of the characters 32 to 126, one byte per row, bit 4 is the left pixel
+		static constexpr UINT8 Ascii5x7[95][7] = {
+			{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x04, 0x04, 0x04, 0x04, 0x00, 0x00, 0x04 }, { 0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00 }, { 0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A },
+			{ 0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04 }, { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, { 0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D }, { 0x0C, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00 },
+			{ 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 }, { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 }, { 0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00 }, { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 },
+			{ 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 }, { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C }, { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },
+			{ 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E }, { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E }, { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F }, { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+			{ 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 }, { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E }, { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E }, { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+			{ 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E }, { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C }, { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 }, { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08 },
+			{ 0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02 }, { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 }, { 0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08 }, { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 },
+			{ 0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E }, { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 }, { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E }, { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E },
+			{ 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C }, { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F }, { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 }, { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F },
+			{ 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C }, { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },
+			{ 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F }, { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 }, { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 }, { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E },
+			{ 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 }, { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D }, { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 }, { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E },
+			{ 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 }, { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A },
+			{ 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 }, { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 }, { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F }, { 0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E },
+			{ 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 }, { 0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E }, { 0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F },
+			{ 0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F }, { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E }, { 0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E },
+			{ 0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F }, { 0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E }, { 0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08 }, { 0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E },
+			{ 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11 }, { 0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E }, { 0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C }, { 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12 },
+			{ 0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, { 0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11 }, { 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11 }, { 0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E },
+			{ 0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10 }, { 0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01 }, { 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10 }, { 0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E },
+			{ 0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06 }, { 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D }, { 0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04 }, { 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A },
+			{ 0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11 }, { 0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E }, { 0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F }, { 0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02 },
+			{ 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, { 0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08 }, { 0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00 },
+		};
+
+		// 8x8 bitmap of a glyph, one byte per row from the top, bit 7 is the left pixel
+		static void Glyph(WCHAR character, UINT8 rows[CellSize])
+		{
+			memset(rows, 0, CellSize);
+			if (character >= 33 && character <= 126) // Centered in the cell
+			{
+				for (int y = 0; y < 7; y++)
+					rows[y] = (UINT8)(Ascii5x7[character - 32][y] << 2);
+				return;
+			}
+
+			switch (character)
+			{
+			case 0: case ' ':
+				return;
+			case 0x2588: memset(rows, 0xFF, CellSize); return; // Full
+			case 0x2593: Pattern(rows, 0x77, 0xDD); return; // Three quarters
+			case 0x2592: Pattern(rows, 0xAA, 0x55); return; // Half
+			case 0x2591: Pattern(rows, 0x88, 0x22); return; // Quarter
+			case 0x2580: memset(rows, 0xFF, CellSize / 2); return; // Upper half
+			case 0x2584: memset(rows + CellSize / 2, 0xFF, CellSize / 2); return; // Lower half
+			case 0x258C: memset(rows, 0xF0, CellSize); return; // Left half
+			case 0x2590: memset(rows, 0x0F, CellSize); return; // Right half
+			}
+
+			if (character >= 0x2596 && character <= 0x259F) // Quadrants, bits : upper left, upper right, lower left, lower right
+			{
+				static constexpr UINT8 Quadrants[10] = { 0b0010, 0b0001, 0b1000, 0b1011, 0b1001, 0b1110, 0b1101, 0b0100, 0b0110, 0b0111 };
+				const UINT8 quadrants = Quadrants[character - 0x2596];
+				const UINT8 upper = (UINT8)((quadrants & 0b1000 ? 0xF0 : 0) | (quadrants & 0b0100 ? 0x0F : 0));
+				const UINT8 lower = (UINT8)((quadrants & 0b0010 ? 0xF0 : 0) | (quadrants & 0b0001 ? 0x0F : 0));
+				memset(rows, upper, CellSize / 2);
+				memset(rows + CellSize / 2, lower, CellSize / 2);
+				return;
+			}
+
+			Glyph('?', rows);
+		}
+
+		// Index of the color nearest to red,green,blue
+		static UINT8 Nearest(int red, int green, int blue)
+		{
+			int best = 0, bestDistance = INT_MAX;
+			for (int i = 0; i < 16; i++)
+			{
+				const int r = Palette[i][0] - red, g = Palette[i][1] - green, b = Palette[i][2] - blue;
+				const int distance = r * r + g * g + b * b;
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = i;
+				}
+			}
+			return (UINT8)best;
+		}
+
+		// Rasterize the cells x,y,width,height of a frame that is stride cells wide, one palette index per pixel
+		static void Rasterize(const CHAR_INFO* cells, int stride, int x, int y, int width, int height, UINT8* pixels)
+		{
+			const int pixelStride = width * CellSize;
+			UINT8 rows[CellSize];
+			for (int cy = 0; cy < height; cy++)
+			{
+				for (int cx = 0; cx < width; cx++)
+				{
+					const CHAR_INFO& cell = cells[(y + cy) * stride + x + cx];
+					const UINT8 foreground = cell.Attributes & 0xF, background = (cell.Attributes >> 4) & 0xF;
+					Glyph(cell.Char.UnicodeChar, rows);
+
+					UINT8* out = pixels + (size_t)cy * CellSize * pixelStride + cx * CellSize;
+					for (int row = 0; row < CellSize; row++, out += pixelStride)
+					{
+						for (int bit = 0; bit < CellSize; bit++)
+							out[bit] = (rows[row] << bit) & 0x80 ? foreground : background;
+					}
+				}
+			}
+		}
+
+	private:
+		// Rows alternating between two bytes
+		static void Pattern(UINT8 rows[CellSize], UINT8 even, UINT8 odd)
+		{
+			for (int y = 0; y < CellSize; y++)
+				rows[y] = y % 2 == 0 ? even : odd;
+		}
+	};
+
+	/// <summary>
+	/// <para> Saves the frames of a Console as images (8x8 pixels per cell, see CellRaster) : PPM or PNG stills and animated GIFs. </para>
+	/// <para> The game thread only copies the cells into a recycled buffer (Publish()), a thread of the recorder rasterizes and encodes them. </para>
+	/// <para> The frames of a GIF only store the rectangle that changed, frames closer than 20 ms are merged (GIF delays are in 1/100 s, most viewers slow down delays under 2). </para>
+	/// </summary>
+	class FrameRecorder
+	{
+	public:
+		enum class Format { Unknown, PPM, PNG, GIF };
+
+		static constexpr size_t MaxQueuedFrames = 120; // Frames of a GIF waiting for the encoder, more are dropped
+
+	private:
+		struct Job
+		{
+			enum class Type { Still, Start, Frame, Stop };
+			Type type;
+			std::string path; // Still
+			std::FILE* file; // Start
+			std::vector<CHAR_INFO> cells; // Still and Frame
+			int width, height;
+			double time; // Frame and Stop, in seconds
+		};
+
+		// Writes bits from the least significant, used by deflate and GIF LZW
+		struct BitWriter
+		{
+			std::vector<UINT8>& out;
+			UINT32 buffer = 0;
+			int count = 0;
+
+			void Write(UINT32 value, int length)
+			{
+				buffer |= value << count;
+				count += length;
+				for (; count >= 8; count -= 8, buffer >>= 8)
+					out.push_back((UINT8)buffer);
+			}
+
+			// Huffman codes are written from their most significant bit
+			void WriteCode(UINT32 code, int length)
+			{
+				UINT32 reversed = 0;
+				for (int i = 0; i < length; i++)
+					reversed = (reversed << 1) | ((code >> i) & 1);
+				Write(reversed, length);
+			}
+
+			void Flush()
+			{
+				if (count > 0)
+					out.push_back((UINT8)buffer);
+				buffer = 0;
+				count = 0;
+			}
+		};
+
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::deque<Job> m_jobs;
+		std::vector<std::vector<CHAR_INFO>> m_buffers; // Recycled cell buffers
+		bool m_running;
+		UINT64 m_dropped; // Frames dropped because the encoder was behind
+
+		// Game thread
+		std::string m_stillPath; // Set by CaptureFrame(), saved at the next Publish()
+		bool m_recording;
+		std::chrono::steady_clock::time_point m_start;
+
+		// Encoder thread
+		std::vector<UINT8> m_pixels;
+		std::vector<UINT16> m_lzwTree; // Code of (code, pixel) pairs, 0 when not in the table yet
+		std::FILE* m_gif;
+		int m_gifWidth, m_gifHeight; // In cells
+		std::vector<CHAR_INFO> m_written; // Cells of the last GIF frame written
+		std::vector<CHAR_INFO> m_pending; // Cells of the frame waiting for its delay
+		double m_pendingTime, m_startTime; // In seconds
+		int m_writtenDelay; // Sum of the delays written, in 1/100 s
+
+	public:
+		FrameRecorder()
+			: m_running(true), m_dropped(0), m_recording(false), m_gif(nullptr), m_gifWidth(0), m_gifHeight(0),
+			m_pendingTime(0.0), m_startTime(0.0), m_writtenDelay(0)
+		{
+			m_thread = std::thread([this] { Encode(); });
+			SetThreadPriority(m_thread.native_handle(), THREAD_PRIORITY_BELOW_NORMAL); // Never takes the core of the game thread
+		}
+
+		// Finishes the GIF and the files queued
+		~FrameRecorder()
+		{
+			StopAnimation();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_running = false;
+			}
+			m_wake.notify_all();
+			m_thread.join();
+		}
+
+		// Format from the extension of a path
+		static Format FormatOf(const std::string& path)
+		{
+			std::string extension = path.substr((std::min)(path.find_last_of('.'), path.length()));
+			std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+			return extension == ".ppm" ? Format::PPM : extension == ".png" ? Format::PNG : extension == ".gif" ? Format::GIF : Format::Unknown;
+		}
+
+		// Save the next published frame to a .ppm or .png file, returns false for other formats
+		bool CaptureFrame(const std::string& path)
+		{
+			const Format format = FormatOf(path);
+			if (format != Format::PPM && format != Format::PNG)
+				return false;
+
+			m_stillPath = path;
+			return true;
+		}
+
+		// Record the next published frames to a .gif file, returns false if it can not be created
+		bool StartAnimation(const std::string& path)
+		{
+			StopAnimation();
+			if (FormatOf(path) != Format::GIF)
+				return false;
+
+			std::FILE* file = std::fopen(path.c_str(), "wb");
+			if (file == nullptr)
+				return false;
+
+			m_recording = true;
+			m_start = std::chrono::steady_clock::now();
+			Push({ Job::Type::Start, {}, file, {}, 0, 0, 0.0 });
+			return true;
+		}
+
+		// Finish the GIF, it is written in the background
+		void StopAnimation()
+		{
+			if (!m_recording)
+				return;
+
+			m_recording = false;
+			Push({ Job::Type::Stop, {}, nullptr, {}, 0, 0, Now() });
+		}
+
+		bool IsRecording() const { return m_recording; }
+
+		// Frames that were not recorded because the encoder was behind
+		UINT64 DroppedFrames()
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_dropped;
+		}
+
+		// Give a frame to the recorder, called by Console::BlipToScreen(). Only copies the cells, nothing is done when nothing is captured
+		void Publish(const CHAR_INFO* cells, int width, int height)
+		{
+			if (m_stillPath.empty() && !m_recording)
+				return;
+
+			if (!m_stillPath.empty())
+			{
+				Push({ Job::Type::Still, std::move(m_stillPath), nullptr, Copy(cells, width, height), width, height, 0.0 });
+				m_stillPath.clear();
+			}
+
+			if (m_recording)
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				if (m_jobs.size() >= MaxQueuedFrames)
+				{
+					m_dropped++;
+					return;
+				}
+				lock.unlock();
+				Push({ Job::Type::Frame, {}, nullptr, Copy(cells, width, height), width, height, Now() });
+			}
+		}
+
+		// Write width*height palette indices as a binary PPM, returns false on errors
+		static bool WritePPM(const std::string& path, const UINT8* pixels, int width, int height)
+		{
+			std::FILE* file = std::fopen(path.c_str(), "wb");
+			if (file == nullptr)
+				return false;
+
+			std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+			std::vector<UINT8> row((size_t)width * 3);
+			for (int y = 0; y < height; y++)
+			{
+				for (int x = 0; x < width; x++)
+					memcpy(&row[x * 3], CellRaster::Palette[pixels[(size_t)y * width + x]], 3);
+				std::fwrite(row.data(), 1, row.size(), file);
+			}
+			return std::fclose(file) == 0;
+		}
+
+		// Write width*height palette indices as a 16 colors PNG, returns false on errors
+		static bool WritePNG(const std::string& path, const UINT8* pixels, int width, int height)
+		{
+			// Rows of 4 bits pixels, each after its filter type (0, none)
+			const size_t rowSize = 1 + ((size_t)width + 1) / 2;
+			std::vector<UINT8> raw(rowSize * height, 0);
+			for (int y = 0; y < height; y++)
+			{
+				UINT8* row = &raw[y * rowSize + 1];
+				for (int x = 0; x < width; x++)
+					row[x / 2] |= (UINT8)(pixels[(size_t)y * width + x] << (x % 2 == 0 ? 4 : 0));
+			}
+
+			std::vector<UINT8> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			std::vector<UINT8> data;
+			AppendBigEndian(data, (UINT32)width);
+			AppendBigEndian(data, (UINT32)height);
+			data.insert(data.end(), { 4, 3, 0, 0, 0 }); // 4 bits, palette, deflate, no filter, no interlacing
+			AppendChunk(png, "IHDR", data);
+
+			data.assign(&CellRaster::Palette[0][0], &CellRaster::Palette[0][0] + sizeof(CellRaster::Palette));
+			AppendChunk(png, "PLTE", data);
+
+			data.clear();
+			Compress(raw.data(), raw.size(), data);
+			AppendChunk(png, "IDAT", data);
+
+			data.clear();
+			AppendChunk(png, "IEND", data);
+
+			std::FILE* file = std::fopen(path.c_str(), "wb");
+			if (file == nullptr)
+				return false;
+			std::fwrite(png.data(), 1, png.size(), file);
+			return std::fclose(file) == 0;
+		}
+
+		// zlib stream of the data : LZ77 matches found with hash chains, coded with the fixed Huffman codes of deflate
+		static void Compress(const UINT8* data, size_t size, std::vector<UINT8>& out)
+		{
+			static constexpr int Window = 32768, HashSize = 1 << 15, MaxChain = 32, MinMatch = 3, MaxMatch = 258;
+			static constexpr UINT16 LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+			static constexpr UINT8 LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+			static constexpr UINT16 DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+			static constexpr UINT8 DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+			out.push_back(0x78); // zlib header : deflate, 32 KB window
+			out.push_back(0x01);
+			BitWriter bits { out };
+			bits.Write(1, 1); // Last block
+			bits.Write(1, 2); // Fixed Huffman codes
+
+			auto symbol = [&](int value) // Literal, end of block or length code
+			{
+				if (value < 144)
+					bits.WriteCode(0x30 + value, 8);
+				else if (value < 256)
+					bits.WriteCode(0x190 + value - 144, 9);
+				else if (value < 280)
+					bits.WriteCode(value - 256, 7);
+				else
+					bits.WriteCode(0xC0 + value - 280, 8);
+			};
+
+			std::vector<int> head(HashSize, -1), previous(Window, -1);
+			auto hash = [&](size_t i) { return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & (HashSize - 1); };
+			auto insert = [&](size_t i)
+			{
+				if (i + MinMatch > size)
+					return;
+				const int h = hash(i);
+				previous[i & (Window - 1)] = head[h];
+				head[h] = (int)i;
+			};
+
+			size_t i = 0;
+			while (i < size)
+			{
+				int bestLength = 0, bestDistance = 0;
+				if (i + MinMatch <= size)
+				{
+					const int maxLength = (int)(std::min)((size_t)MaxMatch, size - i);
+					int candidate = head[hash(i)];
+					for (int chain = 0; candidate >= 0 && (int)i - candidate <= Window && chain < MaxChain; chain++)
+					{
+						int length = 0;
+						while (length < maxLength && data[candidate + length] == data[i + length])
+							length++;
+						if (length > bestLength)
+						{
+							bestLength = length;
+							bestDistance = (int)i - candidate;
+							if (length == maxLength)
+								break;
+						}
+
+						const int next = previous[candidate & (Window - 1)];
+						if (next >= candidate) // Overwritten by a newer position
+							break;
+						candidate = next;
+					}
+				}
+
+				if (bestLength < MinMatch)
+				{
+					symbol(data[i]);
+					insert(i++);
+					continue;
+				}
+
+				int code = 28;
+				while (LengthBase[code] > bestLength)
+					code--;
+				symbol(257 + code);
+				bits.Write(bestLength - LengthBase[code], LengthExtra[code]);
+
+				code = 29;
+				while (DistanceBase[code] > bestDistance)
+					code--;
+				bits.WriteCode(code, 5);
+				bits.Write(bestDistance - DistanceBase[code], DistanceExtra[code]);
+
+				for (int j = 0; j < bestLength; j++)
+					insert(i++);
+			}
+			symbol(256); // End of block
+			bits.Flush();
+
+			UINT32 a = 1, b = 0; // Adler-32
+			for (size_t j = 0; j < size; j++)
+			{
+				a = (a + data[j]) % 65521;
+				b = (b + a) % 65521;
+			}
+			AppendBigEndian(out, (b << 16) | a);
+		}
+
+	private:
+		static double Now() { return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+		// A recycled buffer with a copy of the cells
+		std::vector<CHAR_INFO> Copy(const CHAR_INFO* cells, int width, int height)
+		{
+			std::vector<CHAR_INFO> buffer;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (!m_buffers.empty())
+				{
+					buffer = std::move(m_buffers.back());
+					m_buffers.pop_back();
+				}
+			}
+			buffer.assign(cells, cells + (size_t)width * height);
+			return buffer;
+		}
+
+		void Recycle(std::vector<CHAR_INFO>&& buffer)
+		{
+			if (buffer.capacity() == 0)
+				return;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_buffers.push_back(std::move(buffer));
+		}
+
+		void Push(Job&& job)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_jobs.push_back(std::move(job));
+			}
+			m_wake.notify_one();
+		}
+
+		// Encoder thread : run the jobs until the recorder is destroyed and the queue is empty
+		void Encode()
+		{
+			for (;;)
+			{
+				Job job;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wake.wait(lock, [this] { return !m_jobs.empty() || !m_running; });
+					if (m_jobs.empty())
+						return;
+					job = std::move(m_jobs.front());
+					m_jobs.pop_front();
+				}
+
+				switch (job.type)
+				{
+				case Job::Type::Still:
+					m_pixels.resize(job.cells.size() * CellRaster::CellSize * CellRaster::CellSize);
+					CellRaster::Rasterize(job.cells.data(), job.width, 0, 0, job.width, job.height, m_pixels.data());
+					if (FormatOf(job.path) == Format::PNG)
+						WritePNG(job.path, m_pixels.data(), job.width * CellRaster::CellSize, job.height * CellRaster::CellSize);
+					else
+						WritePPM(job.path, m_pixels.data(), job.width * CellRaster::CellSize, job.height * CellRaster::CellSize);
+					break;
+
+				case Job::Type::Start:
+					m_gif = job.file;
+					m_gifWidth = m_gifHeight = 0;
+					m_writtenDelay = 0;
+					Recycle(std::move(m_written));
+					Recycle(std::move(m_pending));
+					break;
+
+				case Job::Type::Frame:
+					AddFrame(job);
+					break;
+
+				case Job::Type::Stop:
+					if (m_gif == nullptr)
+						break;
+					if (!m_pending.empty())
+						WriteFrame((std::max)(job.time, m_pendingTime + 0.02));
+					std::fputc(0x3B, m_gif); // Trailer
+					std::fclose(m_gif);
+					m_gif = nullptr;
+					break;
+				}
+
+				Recycle(std::move(job.cells));
+			}
+		}
+
+		void AddFrame(Job& job)
+		{
+			if (m_gif == nullptr)
+				return;
+
+			if (m_gifWidth == 0) // First frame, it sets the size of the GIF
+			{
+				m_gifWidth = job.width;
+				m_gifHeight = job.height;
+				m_pendingTime = m_startTime = job.time;
+				WriteGifHeader();
+			}
+			if (job.width != m_gifWidth || job.height != m_gifHeight)
+				return;
+
+			if (!m_pending.empty() && job.time - m_pendingTime >= 0.02)
+			{
+				if (memcmp(job.cells.data(), m_pending.data(), m_pending.size() * sizeof(CHAR_INFO)) == 0)
+					return; // Same frame, the pending one lasts longer
+				WriteFrame(job.time);
+				m_pendingTime = job.time;
+			}
+
+			// Too close to the pending frame : replaces it, its changes are included in the next diff with m_written
+			Recycle(std::move(m_pending));
+			m_pending = std::move(job.cells);
+		}
+
+		// Write the pending frame, shown until time
+		void WriteFrame(double time)
+		{
+			// Rectangle of the cells that changed since the last frame written
+			int x1 = 0, y1 = 0, x2 = m_gifWidth, y2 = m_gifHeight;
+			if (!m_written.empty())
+			{
+				x1 = m_gifWidth;
+				y1 = m_gifHeight;
+				x2 = y2 = 0;
+				for (int y = 0; y < m_gifHeight; y++)
+				{
+					for (int x = 0; x < m_gifWidth; x++)
+					{
+						const size_t i = (size_t)y * m_gifWidth + x;
+						if (memcmp(&m_written[i], &m_pending[i], sizeof(CHAR_INFO)) != 0)
+						{
+							x1 = (std::min)(x1, x);
+							y1 = (std::min)(y1, y);
+							x2 = (std::max)(x2, x + 1);
+							y2 = (std::max)(y2, y + 1);
+						}
+					}
+				}
+				if (x1 >= x2) // Back to the last frame written, one cell keeps the delay
+				{
+					x1 = y1 = 0;
+					x2 = y2 = 1;
+				}
+			}
+
+			// Delays are rounded from the start of the GIF, so the rounding errors do not add up
+			const int total = (int)((time - m_startTime) * 100.0 + 0.5);
+			const int delay = (std::max)(total - m_writtenDelay, 2);
+			m_writtenDelay += delay;
+
+			const UINT8 control[8] = { 0x21, 0xF9, 4, 0x04, (UINT8)delay, (UINT8)(delay >> 8), 0, 0 }; // Keep the previous frame under this one
+			std::fwrite(control, 1, sizeof(control), m_gif);
+
+			const int cellSize = CellRaster::CellSize;
+			const int width = (x2 - x1) * cellSize, height = (y2 - y1) * cellSize;
+			const UINT8 descriptor[10] = { 0x2C, (UINT8)(x1 * cellSize), (UINT8)((x1 * cellSize) >> 8), (UINT8)(y1 * cellSize), (UINT8)((y1 * cellSize) >> 8),
+				(UINT8)width, (UINT8)(width >> 8), (UINT8)height, (UINT8)(height >> 8), 0 };
+			std::fwrite(descriptor, 1, sizeof(descriptor), m_gif);
+
+			m_pixels.resize((size_t)width * height);
+			CellRaster::Rasterize(m_pending.data(), m_gifWidth, x1, y1, x2 - x1, y2 - y1, m_pixels.data());
+			WriteLzw(m_pixels.data(), m_pixels.size());
+
+			m_written.swap(m_pending);
+		}
+
+		void WriteGifHeader()
+		{
+			const int width = m_gifWidth * CellRaster::CellSize, height = m_gifHeight * CellRaster::CellSize;
+			const UINT8 header[13] = { 'G', 'I', 'F', '8', '9', 'a', (UINT8)width, (UINT8)(width >> 8), (UINT8)height, (UINT8)(height >> 8),
+				0xB3, 0, 0 }; // Global palette of 16 colors
+			std::fwrite(header, 1, sizeof(header), m_gif);
+			std::fwrite(CellRaster::Palette, 1, sizeof(CellRaster::Palette), m_gif);
+
+			const UINT8 loop[19] = { 0x21, 0xFF, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 3, 1, 0, 0, 0 }; // Loop forever
+			std::fwrite(loop, 1, sizeof(loop), m_gif);
+		}
+
+		// LZW image data of 4 bits palette indices, in sub-blocks of 255 bytes
+		void WriteLzw(const UINT8* pixels, size_t count)
+		{
+			static constexpr int MinCodeSize = 4, ClearCode = 1 << MinCodeSize, MaxCode = 4095;
+
+			std::vector<UINT8> out;
+			BitWriter bits { out };
+			m_lzwTree.assign((MaxCode + 1) * 16, 0);
+			int codeSize = MinCodeSize + 1, lastCode = ClearCode + 1, current = -1;
+			bits.Write(ClearCode, codeSize);
+			for (size_t i = 0; i < count; i++)
+			{
+				const int pixel = pixels[i];
+				if (current < 0)
+					current = pixel;
+				else if (m_lzwTree[current * 16 + pixel] != 0)
+					current = m_lzwTree[current * 16 + pixel];
+				else
+				{
+					bits.Write(current, codeSize);
+					m_lzwTree[current * 16 + pixel] = (UINT16)++lastCode;
+					if (lastCode >= (1 << codeSize))
+						codeSize++;
+					if (lastCode == MaxCode) // Table full, start again
+					{
+						bits.Write(ClearCode, codeSize);
+						std::fill(m_lzwTree.begin(), m_lzwTree.end(), (UINT16)0);
+						codeSize = MinCodeSize + 1;
+						lastCode = ClearCode + 1;
+					}
+					current = pixel;
+				}
+			}
+			bits.Write(current, codeSize);
+			if (lastCode + 1 == (1 << codeSize)) // Decoders add a code for the last one too, the clear code can be one bit longer
+				codeSize++;
+			bits.Write(ClearCode, codeSize);
+			bits.Write(ClearCode + 1, MinCodeSize + 1); // End of information
+			bits.Flush();
+
+			std::fputc(MinCodeSize, m_gif);
+			for (size_t i = 0; i < out.size(); i += 255)
+			{
+				const size_t size = (std::min)(out.size() - i, (size_t)255);
+				std::fputc((int)size, m_gif);
+				std::fwrite(&out[i], 1, size, m_gif);
+			}
+			std::fputc(0, m_gif);
+		}
+
+		static void AppendBigEndian(std::vector<UINT8>& out, UINT32 value)
+		{
+			out.insert(out.end(), { (UINT8)(value >> 24), (UINT8)(value >> 16), (UINT8)(value >> 8), (UINT8)value });
+		}
+
+		// PNG chunk : size, type, data and CRC-32 of the type and data
+		static void AppendChunk(std::vector<UINT8>& png, const char* type, const std::vector<UINT8>& data)
+		{
+			static const auto table = []
+			{
+				std::vector<UINT32> crc(256);
+				for (UINT32 n = 0; n < 256; n++)
+				{
+					UINT32 c = n;
+					for (int k = 0; k < 8; k++)
+						c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+					crc[n] = c;
+				}
+				return crc;
+			}();
+
+			AppendBigEndian(png, (UINT32)data.size());
+			const size_t start = png.size();
+			png.insert(png.end(), type, type + 4);
+			png.insert(png.end(), data.begin(), data.end());
+
+			UINT32 crc = 0xFFFFFFFFu;
+			for (size_t i = start; i < png.size(); i++)
+				crc = table[(crc ^ png[i]) & 0xFF] ^ (crc >> 8);
+			AppendBigEndian(png, crc ^ 0xFFFFFFFFu);
+		}
+	};
+
+	/// <summary>
+	/// <para> Maps the attributes of the cells (foreground | background << 4) to other attributes when the frame is shown, see Console::SetColorRemap() : fades, flashes, tints or night modes without redrawing the cells. </para>
+	/// <para> The builders quantize to the 16 colors of the console. The tables that remap the foregrounds and the backgrounds separately (all the ones built here) are applied with SSSE3 shuffles, 4 cells at a time. </para>
+	/// </summary>
+	class ColorRemap
+	{
+	private:
+		UINT8 m_table[256];
+
+	public:
+		// Every attribute is kept
+		ColorRemap()
+		{
+			for (int i = 0; i < 256; i++)
+				m_table[i] = (UINT8)i;
+		}
+
+		UINT8& operator[](int attributes) { return m_table[attributes & 0xFF]; }
+		UINT8 operator[](int attributes) const { return m_table[attributes & 0xFF]; }
+
+		bool operator==(const ColorRemap& other) const { return memcmp(m_table, other.m_table, sizeof(m_table)) == 0; }
+		bool operator!=(const ColorRemap& other) const { return !(*this == other); }
+
+		bool IsIdentity() const { return *this == ColorRemap(); }
+
+		// Replace each color, in the foreground and the background, by the nearest color to function(rgb) (function changes the UINT8[3] it is given)
+		template<class Function>
+		static ColorRemap FromRGB(Function&& function)
+		{
+			UINT8 colors[16];
+			for (int i = 0; i < 16; i++)
+			{
+				UINT8 rgb[3] = { CellRaster::Palette[i][0], CellRaster::Palette[i][1], CellRaster::Palette[i][2] };
+				function(rgb);
+				colors[i] = CellRaster::Nearest(rgb[0], rgb[1], rgb[2]);
+			}
+
+			ColorRemap remap;
+			for (int i = 0; i < 256; i++)
+				remap.m_table[i] = (UINT8)(colors[i & 0xF] | (colors[i >> 4] << 4));
+			return remap;
+		}
+
+		// amount 0 keeps the colors, 1 turns them all black
+		static ColorRemap FadeToBlack(float amount)
+		{
+			const float scale = 1.0f - Saturate(amount);
+			return FromRGB([&](UINT8* rgb)
+			{
+				for (int c = 0; c < 3; c++)
+					rgb[c] = (UINT8)(rgb[c] * scale + 0.5f);
+			});
+		}
+
+		// amount 0 keeps the colors, 1 keeps only their luminance (black, greys and white)
+		static ColorRemap Grayscale(float amount = 1.0f)
+		{
+			const float t = Saturate(amount);
+			return FromRGB([&](UINT8* rgb)
+			{
+				const float luminance = 0.299f * rgb[0] + 0.587f * rgb[1] + 0.114f * rgb[2];
+				for (int c = 0; c < 3; c++)
+					rgb[c] = (UINT8)(rgb[c] + (luminance - rgb[c]) * t + 0.5f);
+			});
+		}
+
+		// Move the colors toward red,green,blue by amount (0 to 1), ex : a white flash or a dark blue night
+		static ColorRemap Tint(UINT8 red, UINT8 green, UINT8 blue, float amount)
+		{
+			const float t = Saturate(amount);
+			const UINT8 tint[3] = { red, green, blue };
+			return FromRGB([&](UINT8* rgb)
+			{
+				for (int c = 0; c < 3; c++)
+					rgb[c] = (UINT8)(rgb[c] + (tint[c] - rgb[c]) * t + 0.5f);
+			});
+		}
+
+		// Blend two tables, t from 0 (from) to 1 (to) : each attribute gets the nearest colors to the blend of the colors given by the two tables
+		static ColorRemap Lerp(const ColorRemap& from, const ColorRemap& to, float t)
+		{
+			t = Saturate(t);
+			UINT8 blends[16][16]; // Nearest color of the blend of two colors, only computed when used
+			memset(blends, 0xFF, sizeof(blends));
+			auto blend = [&](int a, int b)
+			{
+				UINT8& color = blends[a][b];
+				if (color == 0xFF)
+				{
+					int rgb[3];
+					for (int c = 0; c < 3; c++)
+						rgb[c] = (int)(CellRaster::Palette[a][c] + (CellRaster::Palette[b][c] - CellRaster::Palette[a][c]) * t + 0.5f);
+					color = CellRaster::Nearest(rgb[0], rgb[1], rgb[2]);
+				}
+				return color;
+			};
+
+			ColorRemap remap;
+			for (int i = 0; i < 256; i++)
+				remap.m_table[i] = (UINT8)(blend(from.m_table[i] & 0xF, to.m_table[i] & 0xF) | (blend(from.m_table[i] >> 4, to.m_table[i] >> 4) << 4));
+			return remap;
+		}
+
+		// Copy count cells to out with their attributes remapped, the high byte of the attributes (COMMON_LVB_...) is kept
+		void Apply(const CHAR_INFO* cells, CHAR_INFO* out, int count) const
+		{
+			alignas(16) UINT8 foreground[16], background[16];
+			int i = 0;
+			if (Separable(foreground, background))
+			{
+				// The attributes are the low byte of the second half of each CHAR_INFO, shuffles look up all the bytes and only those are kept
+				const __m128i foregrounds = _mm_load_si128((const __m128i*)foreground);
+				const __m128i backgrounds = _mm_slli_epi16(_mm_load_si128((const __m128i*)background), 4);
+				const __m128i nibble = _mm_set1_epi8(0x0F);
+				const __m128i attributeBytes = _mm_set1_epi32(0x00FF0000);
+				for (; i + 4 <= count; i += 4)
+				{
+					const __m128i source = _mm_loadu_si128((const __m128i*)(cells + i));
+					const __m128i attributes = _mm_or_si128(_mm_shuffle_epi8(foregrounds, _mm_and_si128(source, nibble)),
+						_mm_shuffle_epi8(backgrounds, _mm_and_si128(_mm_srli_epi16(source, 4), nibble)));
+					_mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(_mm_andnot_si128(attributeBytes, source), _mm_and_si128(attributeBytes, attributes)));
+				}
+			}
+
+			for (; i < count; i++)
+			{
+				out[i].Char.UnicodeChar = cells[i].Char.UnicodeChar;
+				out[i].Attributes = (cells[i].Attributes & 0xFF00) | m_table[cells[i].Attributes & 0xFF];
+			}
+		}
+
+		// Does the new foreground only depend on the foreground, and the background on the background ? Gives the two maps if so
+		bool Separable(UINT8 foreground[16], UINT8 background[16]) const
+		{
+			for (int c = 0; c < 16; c++)
+			{
+				foreground[c] = m_table[c] & 0xF;
+				background[c] = m_table[c << 4] >> 4;
+			}
+			for (int i = 0; i < 256; i++)
+			{
+				if (m_table[i] != (foreground[i & 0xF] | (background[i >> 4] << 4)))
+					return false;
+			}
+			return true;
+		}
+
+	private:
+		static float Saturate(float value) { return (std::min)((std::max)(value, 0.0f), 1.0f); }
+	};
+
+	/// <summary>
+	/// <para> Full screen effects run on the cells after the drawing and before they are shown, see Console::AddPostPass() : scanlines, vignette, shade blur, wave, shake and noise. </para>
+	/// <para> The passes are templates of the cell format and work on rows of cells with SSE2 (4 CHAR_INFO or 8 CompactCell at a time). Each pass reads the output of the previous one and can be split in bands of rows run in parallel. </para>
+	/// </summary>
+	class PostProcess
+	{
+	public:
+		// What a pass works on
+		template<class Cell>
+		struct Frame
+		{
+			const Cell* source; // Output of the previous pass
+			Cell* target; // Every cell of the rows given to the pass must be written
+			int width, height;
+			float time; // Seconds since the first frame
+			UINT32 index; // Frame number
+		};
+
+		/// <summary>
+		/// A post process pass
+		/// </summary>
+		template<class Cell>
+		class Pass
+		{
+		public:
+			bool enabled = true;
+
+			virtual ~Pass() = default;
+
+			// Called once per frame before Rows(), ex : to prepare the tables of a frame size
+			virtual void Begin(const Frame<Cell>& frame) {}
+
+			// Write the rows y1 to y2 (excluded) of the target, called at the same time from several threads for different rows
+			virtual void Rows(const Frame<Cell>& frame, int y1, int y2) = 0;
+		};
+
+		/// <summary>
+		/// The passes of a Console, run in order by Run() on the frame buffer, the frame drawn is put back by Restore()
+		/// </summary>
+		template<class Cell>
+		class Chain
+		{
+		private:
+			std::vector<std::unique_ptr<Pass<Cell>>> m_passes;
+			std::vector<Cell> m_drawn; // Frame before the passes
+			std::vector<Cell> m_scratch;
+			float m_time;
+			UINT32 m_index;
+			int m_bandHeight; // 0 : not parallel
+
+		public:
+			Chain() : m_time(0.0f), m_index(0), m_bandHeight(0) {}
+
+			template<template<class> class P, class... Args>
+			P<Cell>& Add(Args&&... args)
+			{
+				m_passes.push_back(std::make_unique<P<Cell>>(std::forward<Args>(args)...));
+				return static_cast<P<Cell>&>(*m_passes.back());
+			}
+
+			void Remove(const Pass<Cell>& pass)
+			{
+				m_passes.erase(std::remove_if(m_passes.begin(), m_passes.end(), [&](const std::unique_ptr<Pass<Cell>>& p) { return p.get() == &pass; }), m_passes.end());
+			}
+
+			void Clear() { m_passes.clear(); }
+
+			int Count() const { return (int)m_passes.size(); }
+
+			// Split the passes in bands of bandHeight rows run on the JobSystem (0 : not parallel)
+			void SetParallel(int bandHeight) { m_bandHeight = (std::max)(bandHeight, 0); }
+
+			// Run the enabled passes on the cells of the buffer, returns false if there are none (Restore() is then not needed)
+			bool Run(FrameBuffer<Cell>& buffer, int width, int height, float deltaTime)
+			{
+				m_time += deltaTime;
+				m_index++;
+				if (std::none_of(m_passes.begin(), m_passes.end(), [](const std::unique_ptr<Pass<Cell>>& pass) { return pass->enabled; }))
+					return false;
+
+				const size_t size = (size_t)width * height;
+				m_drawn.assign(buffer.Data(), buffer.Data() + size);
+				m_scratch.resize(size);
+
+				// The first pass reads the copy and writes the buffer, then they go back and forth between the buffer and the scratch cells
+				const Cell* source = m_drawn.data();
+				Cell* target = buffer.Data();
+				for (auto& pass : m_passes)
+				{
+					if (!pass->enabled)
+						continue;
+
+					const Frame<Cell> frame = { source, target, width, height, m_time, m_index };
+					pass->Begin(frame);
+					if (m_bandHeight > 0 && height > m_bandHeight)
+					{
+						const int bands = (height + m_bandHeight - 1) / m_bandHeight;
+						JobSystem::ParallelFor(0, bands, 1, [&](int band) { pass->Rows(frame, band * m_bandHeight, (std::min)((band + 1) * m_bandHeight, height)); });
+					}
+					else
+						pass->Rows(frame, 0, height);
+
+					source = target;
+					target = target == buffer.Data() ? m_scratch.data() : buffer.Data();
+				}
+
+				if (source != buffer.Data())
+					memcpy(buffer.Data(), source, sizeof(Cell) * size);
+				return true;
+			}
+
+			// Put back the frame drawn, so the effects are not applied again on the next frame
+			void Restore(FrameBuffer<Cell>& buffer) const
+			{
+				memcpy(buffer.Data(), m_drawn.data(), sizeof(Cell) * m_drawn.size());
+			}
+		};
+
+		/// <summary>
+		/// A ColorRemap ready to be applied to vectors of cells
+		/// </summary>
+		class RemapTable
+		{
+		private:
+			ColorRemap m_remap;
+			bool m_separable;
+			__m128i m_foregrounds, m_backgrounds; // Shuffle tables of the separable remaps
+
+		public:
+			RemapTable(const ColorRemap& remap = ColorRemap()) : m_remap(remap)
+			{
+				alignas(16) UINT8 foreground[16], background[16];
+				m_separable = remap.Separable(foreground, background);
+				m_foregrounds = _mm_load_si128((const __m128i*)foreground);
+				m_backgrounds = _mm_slli_epi16(_mm_load_si128((const __m128i*)background), 4);
+			}
+
+			// Remap the attributes of the cells of a vector
+			template<class Cell>
+			__m128i Apply(__m128i cells) const
+			{
+				if (!m_separable)
+				{
+					alignas(16) Cell lanes[16 / sizeof(Cell)];
+					_mm_store_si128((__m128i*)lanes, cells);
+					for (Cell& cell : lanes)
+						cell = Remap(cell);
+					return _mm_load_si128((const __m128i*)lanes);
+				}
+
+				const __m128i nibble = _mm_set1_epi8(0x0F);
+				const __m128i attributes = _mm_or_si128(_mm_shuffle_epi8(m_foregrounds, _mm_and_si128(cells, nibble)),
+					_mm_shuffle_epi8(m_backgrounds, _mm_and_si128(_mm_srli_epi16(cells, 4), nibble)));
+				const __m128i attributeBytes = Lanes<Cell>::Set(0xFFu << Lanes<Cell>::AttributeShift);
+				return _mm_or_si128(_mm_andnot_si128(attributeBytes, cells), _mm_and_si128(attributeBytes, attributes));
+			}
+
+			// Remap count cells
+			template<class Cell>
+			void Apply(const Cell* source, Cell* target, int count) const
+			{
+				int i = 0;
+				for (; i + Lanes<Cell>::Count <= count; i += Lanes<Cell>::Count)
+					_mm_storeu_si128((__m128i*)(target + i), Apply<Cell>(_mm_loadu_si128((const __m128i*)(source + i))));
+				for (; i < count; i++)
+					target[i] = Remap(source[i]);
+			}
+
+			template<class Cell>
+			Cell Remap(Cell cell) const
+			{
+				if constexpr (std::is_same_v<Cell, CompactCell>)
+					cell.attributes = m_remap[cell.attributes];
+				else
+					cell.Attributes = (cell.Attributes & 0xFF00) | m_remap[cell.Attributes];
+				return cell;
+			}
+		};
+
+		/// <summary>
+		/// Remap every period rows (the last row of each period) : dark lines like a CRT screen
+		/// </summary>
+		template<class Cell>
+		class Scanlines : public Pass<Cell>
+		{
+		private:
+			RemapTable m_table;
+			int m_period;
+
+		public:
+			Scanlines(const ColorRemap& remap = ColorRemap::FadeToBlack(0.5f), int period = 2) : m_table(remap), m_period((std::max)(period, 1)) {}
+
+			void Rows(const Frame<Cell>& frame, int y1, int y2) override
+			{
+				for (int y = y1; y < y2; y++)
+				{
+					const Cell* source = frame.source + (size_t)y * frame.width;
+					Cell* target = frame.target + (size_t)y * frame.width;
+					if (y % m_period == m_period - 1)
+						m_table.Apply(source, target, frame.width);
+					else
+						memcpy(target, source, sizeof(Cell) * frame.width);
+				}
+			}
+		};
+
+		/// <summary>
+		/// <para> Fade the cells to black toward the corners, in levels steps : strength is the fade of the corners. </para>
+		/// <para> The cells of a row with the same level are remapped together, the runs of each row are computed once per frame size. </para>
+		/// </summary>
+		template<class Cell>
+		class Vignette : public Pass<Cell>
+		{
+		private:
+			struct Run { int start, level; };
+
+			std::vector<RemapTable> m_tables; // Per level, 0 keeps the cells
+			float m_strength;
+			int m_width, m_height;
+			std::vector<std::vector<Run>> m_runs; // Per row
+
+		public:
+			Vignette(float strength = 0.75f, int levels = 4) : m_strength(strength), m_width(0), m_height(0)
+			{
+				levels = (std::max)(levels, 1);
+				for (int level = 0; level <= levels; level++)
+					m_tables.emplace_back(ColorRemap::FadeToBlack(strength * level / levels));
+			}
+
+			void Begin(const Frame<Cell>& frame) override
+			{
+				if (frame.width == m_width && frame.height == m_height)
+					return;
+
+				m_width = frame.width;
+				m_height = frame.height;
+				m_runs.assign(m_height, {});
+				const int levels = (int)m_tables.size() - 1;
+				for (int y = 0; y < m_height; y++)
+				{
+					const float ny = (y + 0.5f) / m_height * 2.0f - 1.0f;
+					for (int x = 0; x < m_width; x++)
+					{
+						const float nx = (x + 0.5f) / m_width * 2.0f - 1.0f;
+						const int level = (std::min)((int)((nx * nx + ny * ny) * 0.5f * levels + 0.5f), levels); // 0 at the center, levels at the corners
+						if (m_runs[y].empty() || m_runs[y].back().level != level)
+							m_runs[y].push_back({ x, level });
+					}
+				}
+			}
+
+			void Rows(const Frame<Cell>& frame, int y1, int y2) override
+			{
+				for (int y = y1; y < y2; y++)
+				{
+					const std::vector<Run>& runs = m_runs[y];
+					for (size_t i = 0; i < runs.size(); i++)
+					{
+						const int start = runs[i].start, end = i + 1 < runs.size() ? runs[i + 1].start : frame.width;
+						const size_t offset = (size_t)y * frame.width + start;
+						if (runs[i].level == 0)
+							memcpy(frame.target + offset, frame.source + offset, sizeof(Cell) * (end - start));
+						else
+							m_tables[runs[i].level].Apply(frame.source + offset, frame.target + offset, end - start);
+					}
+				}
+			}
+		};
+
+		/// <summary>
+		/// <para> Soften the horizontal edges between solid cells (spaces and full blocks, the Pixels of the console) : </para>
+		/// <para> a solid cell next to a solid cell of another color becomes a dark shade of its color over the other color. Text is not changed. </para>
+		/// </summary>
+		template<class Cell>
+		class ShadeBlur : public Pass<Cell>
+		{
+		public:
+			void Rows(const Frame<Cell>& frame, int y1, int y2) override
+			{
+				using L = Lanes<Cell>;
+				const Cell blockCell = FrameBuffer<Cell>::MakeCell(0x2588, 0), spaceCell = FrameBuffer<Cell>::MakeCell(L' ', 0), shadeCell = FrameBuffer<Cell>::MakeCell(0x2593, 0);
+				const __m128i characters = L::Set(L::CharacterMask);
+				const __m128i block = L::Set(L::Bits(blockCell)), space = L::Set(L::Bits(spaceCell)), shade = L::Set(L::Bits(shadeCell));
+				const __m128i nibble = L::Set(0xF);
+
+				// Color of the solid cells, its own color for the others
+				auto colors = [&](__m128i cells, __m128i self)
+				{
+					const __m128i character = _mm_and_si128(cells, characters);
+					const __m128i isBlock = L::Equal(character, block);
+					const __m128i isSpace = _mm_or_si128(L::Equal(character, space), L::Equal(character, _mm_setzero_si128()));
+					const __m128i foreground = _mm_and_si128(L::ShiftRight(cells, L::AttributeShift), nibble);
+					const __m128i background = _mm_and_si128(L::ShiftRight(cells, L::AttributeShift + 4), nibble);
+					const __m128i color = _mm_or_si128(_mm_and_si128(isBlock, foreground), _mm_and_si128(isSpace, background));
+					const __m128i solid = _mm_or_si128(isBlock, isSpace);
+					return std::make_pair(_mm_or_si128(_mm_and_si128(solid, color), _mm_andnot_si128(solid, self)), solid);
+				};
+
+				for (int y = y1; y < y2; y++)
+				{
+					const Cell* source = frame.source + (size_t)y * frame.width;
+					Cell* target = frame.target + (size_t)y * frame.width;
+					if (frame.width < L::Count + 2)
+					{
+						memcpy(target, source, sizeof(Cell) * frame.width);
+						continue;
+					}
+
+					// The first and last cells only have one neighbor and are kept
+					target[0] = source[0];
+					target[frame.width - 1] = source[frame.width - 1];
+					for (int x = 1; x < frame.width - 1; x += L::Count)
+					{
+						const int i = (std::min)(x, frame.width - 1 - L::Count); // The last vector overlaps the previous one, it writes the same values
+						const __m128i cells = _mm_loadu_si128((const __m128i*)(source + i));
+						auto [color, solid] = colors(cells, _mm_setzero_si128());
+						const __m128i left = colors(_mm_loadu_si128((const __m128i*)(source + i - 1)), color).first;
+						const __m128i right = colors(_mm_loadu_si128((const __m128i*)(source + i + 1)), color).first;
+
+						// The other color is the right one if it differs, else the left one
+						const __m128i rightDiffers = _mm_andnot_si128(L::Equal(right, color), L::Set(~0u));
+						const __m128i other = _mm_or_si128(_mm_and_si128(rightDiffers, right), _mm_andnot_si128(rightDiffers, left));
+						const __m128i changed = _mm_andnot_si128(L::Equal(other, color), solid);
+
+						const __m128i shaded = _mm_or_si128(shade, L::ShiftLeft(_mm_or_si128(color, L::ShiftLeft(other, 4)), L::AttributeShift));
+						_mm_storeu_si128((__m128i*)(target + i), _mm_or_si128(_mm_and_si128(changed, shaded), _mm_andnot_si128(changed, cells)));
+					}
+				}
+			}
+		};
+
+		/// <summary>
+		/// Shift the rows horizontally along a sine wave : offset = amplitude * sin(2 pi (y / wavelength + time * speed)), the edge cells fill the gaps
+		/// </summary>
+		template<class Cell>
+		class Wave : public Pass<Cell>
+		{
+		public:
+			float amplitude, wavelength, speed; // In cells, rows and waves per second
+
+			Wave(float amplitude = 2.0f, float wavelength = 16.0f, float speed = 1.0f) : amplitude(amplitude), wavelength(wavelength), speed(speed) {}
+
+			void Rows(const Frame<Cell>& frame, int y1, int y2) override
+			{
+				for (int y = y1; y < y2; y++)
+				{
+					const int offset = (int)floorf(amplitude * sinf(6.2831853f * (y / wavelength + frame.time * speed)) + 0.5f);
+					ShiftRow(frame.source + (size_t)y * frame.width, frame.target + (size_t)y * frame.width, frame.width, offset);
+				}
+			}
+		};
+
+		/// <summary>
+		/// Move the whole frame by a random offset of up to intensity cells, a new one every frame. Set intensity to 0 to stop shaking
+		/// </summary>
+		template<class Cell>
+		class Shake : public Pass<Cell>
+		{
+		private:
+			int m_x, m_y;
+
+		public:
+			float intensity; // In cells
+
+			Shake(float intensity = 1.0f) : m_x(0), m_y(0), intensity(intensity) {}
+
+			void Begin(const Frame<Cell>& frame) override
+			{
+				const int range = (int)intensity;
+				const UINT32 random = Hash(frame.index, 0x5348414B);
+				m_x = range > 0 ? (int)(random % (2 * range + 1)) - range : 0;
+				m_y = range > 0 ? (int)((random >> 16) % (2 * range + 1)) - range : 0;
+			}
+
+			void Rows(const Frame<Cell>& frame, int y1, int y2) override
+			{
+				for (int y = y1; y < y2; y++)
+				{
+					const int sourceY = (std::min)((std::max)(y - m_y, 0), frame.height - 1);
+					ShiftRow(frame.source + (size_t)sourceY * frame.width, frame.target + (size_t)y * frame.width, frame.width, m_x);
+				}
+			}
+		};
+
+		/// <summary>
+		/// Remap random cells, different ones every frame : density is the share of the cells changed. Ex : grey snow on a CRT
+		/// </summary>
+		template<class Cell>
+		class Noise : public Pass<Cell>
+		{
+		private:
+			RemapTable m_table;
+
+		public:
+			float density;
+
+			Noise(float density = 0.05f, const ColorRemap& remap = ColorRemap::Tint(192, 192, 192, 0.5f)) : m_table(remap), density(density) {}
+
+			void Rows(const Frame<Cell>& frame, int y1, int y2) override
+			{
+				using L = Lanes<Cell>;
+				if (density >= 1.0f) // Every cell, MaxRandom does not fit in a lane
+				{
+					for (int y = y1; y < y2; y++)
+						m_table.Apply(frame.source + (size_t)y * frame.width, frame.target + (size_t)y * frame.width, frame.width);
+					return;
+				}
+
+				const UINT32 threshold = (UINT32)((std::max)(0.0f, density) * L::MaxRandom); // 0 for NaN
+				const __m128i limit = L::Set(threshold ^ L::SignBit), sign = L::Set(L::SignBit);
+				for (int y = y1; y < y2; y++)
+				{
+					const Cell* source = frame.source + (size_t)y * frame.width;
+					Cell* target = frame.target + (size_t)y * frame.width;
+
+					// xorshift32 in each 32 bits lane, seeded by the frame and the row (CompactCell : 2 random 16 bits per lane)
+					__m128i state = _mm_setr_epi32(Hash(frame.index, y * 4 + 0) | 1, Hash(frame.index, y * 4 + 1) | 1, Hash(frame.index, y * 4 + 2) | 1, Hash(frame.index, y * 4 + 3) | 1);
+					int x = 0;
+					for (; x + L::Count <= frame.width; x += L::Count)
+					{
+						state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+						state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+						state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+
+						const __m128i cells = _mm_loadu_si128((const __m128i*)(source + x));
+						const __m128i noisy = L::Less(_mm_xor_si128(state, sign), limit); // Unsigned compare
+						_mm_storeu_si128((__m128i*)(target + x), _mm_or_si128(_mm_and_si128(noisy, m_table.Apply<Cell>(cells)), _mm_andnot_si128(noisy, cells)));
+					}
+					for (; x < frame.width; x++)
+						target[x] = Hash(frame.index ^ (y << 16), x) % L::MaxRandom < threshold ? m_table.Remap(source[x]) : source[x];
+				}
+			}
+		};
+
+	private:
+		// SSE2 operations on the cells of a vector : 4 CHAR_INFO in 32 bits lanes or 8 CompactCell in 16 bits lanes
+		template<class Cell>
+		struct Lanes
+		{
+			static constexpr bool Compact = std::is_same_v<Cell, CompactCell>;
+			static constexpr int Count = 16 / sizeof(Cell);
+			static constexpr int AttributeShift = Compact ? 8 : 16; // Position of the attribute bits in a lane
+			static constexpr UINT32 CharacterMask = Compact ? 0xFF : 0xFFFF;
+			static constexpr UINT32 SignBit = Compact ? 0x8000 : 0x80000000;
+			static constexpr UINT64 MaxRandom = Compact ? 0x10000ull : 0x100000000ull;
+
+			static __m128i Set(UINT32 value)
+			{
+				if constexpr (Compact)
+					return _mm_set1_epi16((short)value);
+				else
+					return _mm_set1_epi32((int)value);
+			}
+
+			static __m128i Equal(__m128i a, __m128i b)
+			{
+				if constexpr (Compact)
+					return _mm_cmpeq_epi16(a, b);
+				else
+					return _mm_cmpeq_epi32(a, b);
+			}
+
+			static __m128i Less(__m128i a, __m128i b) // Signed
+			{
+				if constexpr (Compact)
+					return _mm_cmplt_epi16(a, b);
+				else
+					return _mm_cmplt_epi32(a, b);
+			}
+
+			static __m128i ShiftLeft(__m128i a, int bits)
+			{
+				if constexpr (Compact)
+					return _mm_slli_epi16(a, bits);
+				else
+					return _mm_slli_epi32(a, bits);
+			}
+
+			static __m128i ShiftRight(__m128i a, int bits)
+			{
+				if constexpr (Compact)
+					return _mm_srli_epi16(a, bits);
+				else
+					return _mm_srli_epi32(a, bits);
+			}
+
+			// The bits of a cell, as in a lane
+			static UINT32 Bits(const Cell& cell)
+			{
+				if constexpr (Compact)
+					return cell.glyph | (cell.attributes << 8);
+				else
+					return cell.Char.UnicodeChar | ((UINT32)cell.Attributes << 16);
+			}
+		};
+
+		// Copy a row moved by offset cells to the right, the edge cells fill the gap
+		template<class Cell>
+		static void ShiftRow(const Cell* source, Cell* target, int width, int offset)
+		{
+			offset = (std::min)((std::max)(offset, -(width - 1)), width - 1);
+			if (offset >= 0)
+			{
+				memcpy(target + offset, source, sizeof(Cell) * (width - offset));
+				FrameBuffer<Cell>::FillRow(target, offset, source[0]);
+			}
+			else
+			{
+				memcpy(target, source - offset, sizeof(Cell) * (width + offset));
+				FrameBuffer<Cell>::FillRow(target + width + offset, -offset, source[width - 1]);
+			}
+		}
+
+		static UINT32 Hash(UINT32 a, UINT32 b)
+		{
+			UINT32 h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u + (a << 6) + (a >> 2));
+			h ^= h >> 16;
+			h *= 0x85EBCA6Bu;
+			h ^= h >> 13;
+			h *= 0xC2B2AE35u;
+			return h ^ (h >> 16);
+		}
+	};
+
+	class CommandBuffer;
+	class ParticleSystem;
+
+	/// <summary>
+	/// Class to handle input and output operations with the console
+	/// </summary>
+	class Console
+	{
+		friend class CommandBuffer;
+		friend class ParticleSystem;
+
+	public:
+		enum class Color : short {
+			Black = 0x0000,
+			Dark_Blue = 0x0001,
+			Dark_Green = 0x0002,
+			Dark_Cyan = 0x0003,
+			Dark_Red = 0x0004,
+			Dark_Magenta = 0x0005,
+			Dark_Yellow = 0x0006,
+			Grey = 0x0007,
+			Dark_Grey = 0x0008,
+			Blue = 0x0009,
+			Green = 0x000A,
+			Cyan = 0x000B,
+			Red = 0x000C,
+			Magenta = 0x000D,
+			Yellow = 0x000E,
+			White = 0x000F,
+		};
+
+		struct Pixel
+		{
+			enum class Type : short { Empty = 0x0000, Full = 0x2588, ThreeQuarters = 0x2593, Half = 0x2592, Quarter = 0x2591 };
+			Type type;
+
+			Console::Color color;
+
+			Pixel(Console::Color foreground, Type t) : type(t), color(foreground) {}
+			Pixel(Console::Color foreground, Console::Color background, Type t) : Pixel((Console::Color)((short)foreground | ((short)background << 4)), t) {}
+
+			Pixel(Console::Color c) : Pixel(c, Type::Full) {}
+
+			Pixel(Console::Color c, char character) : Pixel(c, (Type)character) {}
+			Pixel(Console::Color foreground, Console::Color background, char character) : Pixel(foreground, background, (Type)character) {}
+		};
+
+		/// <summary>
+		/// A drawable object
+		/// </summary>
+		class Drawable
+		{
+		public:
+			virtual void Draw(int x, int y, Console& console) const = 0;
+
+			// Size of the object in characters, used to cull it when it is off screen. Returns false if the size is unknown
+			virtual bool GetSize(int& width, int& height) const { return false; }
+		};
+
+		enum class Key
+		{
+			MouseLeft = VK_LBUTTON,
+			MouseRight = VK_RBUTTON,
+			MouseMiddle = VK_MBUTTON,
+			MouseBackward = VK_XBUTTON1,
+			MouseForward = VK_XBUTTON2,
+			Backspace = VK_BACK,
+			Tab = VK_TAB,
+			Enter = VK_RETURN,
+			Shift = VK_SHIFT,
+			Control = VK_CONTROL,
+			Alt = VK_MENU,
+			Pause = VK_PAUSE,
+			CapsLock = VK_CAPITAL,
+			Escape = VK_ESCAPE,
+			Space = VK_SPACE,
+			PageUp = VK_PRIOR,
+			PageDown = VK_NEXT,
+			End = VK_END,
+			Home = VK_HOME,
+			Left = VK_LEFT,
+			Up = VK_UP,
+			Right = VK_RIGHT,
+			Down = VK_DOWN,
+			Print = VK_PRINT,
+			PrintScreen = VK_SNAPSHOT,
+			Insert = VK_INSERT,
+			Delete = VK_DELETE,
+			Alpha0 = 0x30,
+			Alpha1 = 0x31,
+			Alpha2 = 0x32,
+			Alpha3 = 0x33,
+			Alpha4 = 0x34,
+			Alpha5 = 0x35,
+			Alpha6 = 0x36,
+			Alpha7 = 0x37,
+			Alpha8 = 0x38,
+			Alpha9 = 0x39,
+			A = 0x41,
+			B = 0x42,
+			C = 0x43,
+			D = 0x44,
+			E = 0x45,
+			F = 0x46,
 			G = 0x47,
 			H = 0x48,
 			I = 0x49,
@@ -199,849 +3459,5653 @@ namespace RexConsoleEngine
 			AngleBracket = VK_OEM_102
 		};
 
-	private:
-		struct KeyData
+	private:
+		struct KeyData
+		{
+			bool isDown = false;
+			bool justDown = false;
+			bool justUp = false;
+		};
+
+		// Graphics
+		HANDLE m_hPreviousConsole; // Handle to the initial console buffer
+		HANDLE m_hConsole; // Handle to the new console buffer (the one used)
+		HWND m_console; // Window index (actual window, not console)
+
+		FrameBuffer<ScreenCell> m_bufScreen; // The screen buffer, see ScreenCell
+		SMALL_RECT m_displaySize; // Size of the display area, used by WriteConsoleOutput()
+
+		int m_width, m_height; // the size of the screen, in characters
+		std::wstring m_title; // The title set by the user
+
+
+		// Inputs 
+		static const int KeyCount = 254; // max index of the Key enum
+		HANDLE m_hConsoleIn; // Handle to the input buffer
+		KeyData* m_keys; // Key data
+		int m_mouseDeltaX, m_mouseDeltaY, m_mouseX, m_mouseY;
+		int m_scrollDelta;
+
+
+		// Time
+		std::chrono::steady_clock::time_point m_timeLastDraw; // Time of the last draw call (used for m_deltaDrawTime)
+		float m_deltaDrawTime; // Delta time since last draw call, in seconds
+
+		// Close events
+		static std::atomic_bool m_shouldClose;
+		static std::mutex m_closeMutex;
+		static std::condition_variable m_closeCall;
+
+
+		// Parallel rendering
+		struct Rect { int x1, y1, x2, y2; }; // x2 and y2 are excluded
+
+		// A recorded draw call, see SetParallelRendering()
+		struct DrawCommand
+		{
+			enum class Type : UINT8 { Point, Line, Fill, Blit, Text, Cells };
+			Type type;
+			int x1, y1, x2, y2; // Point : x1,y1 | Line : from x1,y1 to x2,y2 | Fill : Rect | Blit and Cells : x,y,width,height | Text : x,y,offset,count of the cells in m_textStorage (or in the decoded string)
+			Pixel pixel; // Point, Line and Fill : the pixel to draw | Text : pixel.color is the attribute
+			const Color* colors; // Blit : the source colors
+			const CHAR_INFO* cells; // Cells : the source cells
+			UINT16 clip; // Parallel rendering : index of the clip rect in m_clipRects, 0 is the whole screen
+		};
+
+		bool m_deferred; // Are the draw calls recorded and rasterized in tiles at BlipToScreen() ?
+		int m_tileSize, m_tilesX, m_tilesY;
+		std::vector<DrawCommand> m_commands; // Recorded draw calls, in order
+		std::vector<std::vector<UINT32>> m_tileBins; // Index of the commands touching each tile, in order
+		std::vector<UINT16> m_textStorage; // Cells of the strings used by the Text commands, see Utf8::ToCells()
+		std::vector<Rect> m_clipRects; // Clip rects of the recorded commands, see DrawCommand::clip
+
+		// Clipping, see PushClip() and PushOffset()
+		Rect m_clip; // Active clip rect, in screen coordinates and always inside the screen
+		int m_offsetX, m_offsetY; // Added to the coordinates of every draw call
+		std::vector<Rect> m_clipStack;
+		std::vector<std::pair<int, int>> m_offsetStack;
+
+		// Text
+		TextCache m_textCache; // Cells of the non ASCII strings
+		std::vector<UINT16> m_textScratch; // Cells of the last ASCII string
+
+		// Shapes
+		std::vector<int> m_spanScratch; // Half width of every row of an ellipse, crossings of a polygon row
+
+		// Memory
+		Arena m_frameArena; // Reset at every BlipToScreen()
+		UINT64 m_allocationsAtBlip; // AllocationCounter::Count() at the last BlipToScreen()
+		UINT64 m_frameAllocations; // Heap allocations during the last frame
+
+		// Idle rendering, see SetIdleRendering()
+		bool m_idleRendering;
+		bool m_inputReceived; // Did the last PollInputs() read input events ?
+		bool m_forcePresent; // Show the next frame even if it did not change (first frame, new title)
+		bool m_frameSkipped; // Was the last frame skipped ?
+		UINT64 m_presentedHash; // FrameBuffer::Hash() of the last frame
+		float m_idleWake; // Longest wait of the next skipped frame, in seconds (< 0 : until an input)
+		HANDLE m_wakeEvent; // Set by Wake()
+		static HANDLE m_closeEvent; // Set by the close handler, ends the waits of idle rendering
+
+		// Color remap, see SetColorRemap()
+		ColorRemap m_colorRemap;
+		bool m_colorRemapped; // Is m_colorRemap not the identity ?
+		std::vector<CHAR_INFO> m_remappedCells; // Output of the remap, the cells drawn are not changed
+
+		// Post process passes, see AddPostPass()
+		PostProcess::Chain<ScreenCell> m_postProcess;
+
+		// Spectators
+		std::unique_ptr<SpectatorServer> m_spectatorServer; // Created by StartStreaming()
+		std::unique_ptr<FrameRecorder> m_recorder; // Created by CaptureFrame() or StartCapture()
+
+	public:
+
+		Console(unsigned int width, unsigned int height, const std::string& title)
+			: m_bufScreen(width, height), m_width(width), m_height(height),
+			m_displaySize({ 0, 0, (SHORT)width - 1, (SHORT)height - 1 }),
+			m_mouseDeltaX(0), m_mouseDeltaY(0), m_scrollDelta(0),
+			m_deferred(false), m_tileSize(0), m_tilesX(0), m_tilesY(0),
+			m_clipRects(1, { 0, 0, (int)width, (int)height }), m_clip({ 0, 0, (int)width, (int)height }), m_offsetX(0), m_offsetY(0),
+			m_allocationsAtBlip(AllocationCounter::Count()), m_frameAllocations(0),
+			m_idleRendering(false), m_inputReceived(false), m_forcePresent(true), m_frameSkipped(false), m_presentedHash(0), m_idleWake(-1.0f),
+			m_colorRemapped(false)
+		{
+			// Convert the title from string to wstring
+			m_title = StringToWString(title);
+
+			// Create the key array
+			m_keys = new KeyData[KeyCount];
+
+			// Get the window HWND
+			m_console = GetConsoleWindow();
+			if (m_console == NULL)
+				Error("Could not get the window HWND");
+
+			// Save the console handle for the destructor
+			m_hPreviousConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+			if (m_hPreviousConsole == INVALID_HANDLE_VALUE)
+				Error("Could not get the output handle");
+
+
+			// Create the new output buffer
+			m_hConsole = CreateConsoleScreenBuffer(GENERIC_READ | GENERIC_WRITE, 0, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
+			if (m_hConsole == INVALID_HANDLE_VALUE)
+				Error("Could not create the new output buffer");
+
+			if (!SetConsoleActiveScreenBuffer(m_hConsole))
+				Error("Could not set the screen buffer");
+
+			// Hack to be able to reduce the buffer size :
+			SMALL_RECT const minimalWindow = { 0, 0, 1, 1 };
+			if (!SetConsoleWindowInfo(m_hConsole, TRUE, &minimalWindow))
+				Error("Could not resize the window");
+
+			if (!SetConsoleScreenBufferSize(m_hConsole, { (SHORT)m_width, (SHORT)m_height }))
+				Error("Could not set the size of the screen buffer");
+
+			// Set font to 8x8 Terminal (Raster fonts) -> after resizing
+			CONSOLE_FONT_INFOEX font {0}; // {0} is to prevent Local variable is not initialized...
+			font.cbSize = sizeof(CONSOLE_FONT_INFOEX);
+			font.nFont = 0;
+			font.dwFontSize = { 8,8 };
+			font.FontFamily = FF_DONTCARE;
+			font.FontWeight = FW_NORMAL;
+			wcscpy_s(font.FaceName, L"Terminal");
+			if (!SetCurrentConsoleFontEx(m_hConsole, FALSE, &font))
+				Error("Could not set the font");
+
+			// Prevent user from resizing
+			if (!SetWindowLong(m_console, GWL_STYLE, GetWindowLong(m_console, GWL_STYLE) & ~WS_MAXIMIZEBOX & ~WS_SIZEBOX))
+				Error("Could not set the window parameters");
+
+			// Set the final size
+			SMALL_RECT const rectWindow = { 0, 0, (SHORT)m_width - 1, (SHORT)m_height - 1 };
+			if (!SetConsoleWindowInfo(m_hConsole, TRUE, &rectWindow))
+				Error("Could not set the window info");
+
+			// Init last draw time
+			m_timeLastDraw = std::chrono::high_resolution_clock::now();
+			m_deltaDrawTime = 0.0f;
+
+			// Inputs
+			m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
+			if (m_hConsoleIn == INVALID_HANDLE_VALUE)
+				Error("Could not get the input handle");
+			if (!SetConsoleMode(m_hConsoleIn, ENABLE_EXTENDED_FLAGS | ENABLE_MOUSE_INPUT)) // ENABLE_EXTENDED_FLAGS = no text selection with the mouse
+				Error("Could not set the console mode");
+
+			// Disable the cursor
+			CONSOLE_CURSOR_INFO cursorInfo {0}; // {0} is to prevent Local variable is not initialized...
+			cursorInfo.dwSize = 1;
+			cursorInfo.bVisible = false;
+			if (!SetConsoleCursorInfo(m_hConsole, &cursorInfo))
+				Error("Could not remove the cursor");
+
+			// Set the close button handler
+			if (!SetConsoleCtrlHandler((PHANDLER_ROUTINE)CloseHandler, TRUE))
+				Error("Could not set the close handler");
+
+			// Idle rendering
+			m_wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+			if (m_closeEvent == NULL)
+				m_closeEvent = CreateEvent(NULL, TRUE, FALSE, NULL); // Stays set, the app is closing
+			if (m_wakeEvent == NULL || m_closeEvent == NULL)
+				Error("Could not create the idle rendering events");
+		}
+
+		~Console()
+		{
+			if (!SetConsoleActiveScreenBuffer(m_hPreviousConsole))// Switch back to the old buffer
+				Error("Could not set the screen buffer");
+			if (!CloseHandle(m_hConsole)) // Close the new buffer that was opened 
+				Error("Could not delete the screen buffer");
+			delete[] m_keys;
+			m_spectatorServer.reset(); // Its thread sets m_wakeEvent
+			CloseHandle(m_wakeEvent);
+			m_closeCall.notify_all(); // Tell the close handler that it can close (if it was called)
+
+			// Wait for the close thread to finish
+			m_closeMutex.lock();
+			m_closeMutex.unlock();
+		}
+
+		// Width of the console, in characters
+		int Width() const { return m_width; }
+		// Height of the console, in characters
+		int Height() const { return m_height; }
+		// Time since the last BlipToScreen() call, in seconds
+		float DeltaTime() const { return m_deltaDrawTime; }
+
+		// Set the title of the window
+		void SetTitle(const std::string& title)
+		{
+			m_title = StringToWString(title);
+			m_forcePresent = true;
+		}
+
+		// Should the app close ? (ex : close button was pressed)
+		bool ShouldClose() const { return m_shouldClose.load(); }
+
+		// Memory for the temporaries of the current frame (ex : strings, vertices), it is all freed by BlipToScreen()
+		Arena& FrameArena() { return m_frameArena; }
+
+		// Heap allocations done during the last frame (between the last two BlipToScreen() calls), always 0 when AllocationCounter is not Enabled
+		UINT64 FrameAllocations() const { return m_frameAllocations; }
+
+		// Stream every frame to the spectators (SpectatorClient, see the Viewer project) on a loopback port, returns false if the port can not be opened
+		bool StartStreaming(UINT16 port = SpectatorServer::DefaultPort)
+		{
+			if (!m_spectatorServer)
+				m_spectatorServer = std::make_unique<SpectatorServer>(m_wakeEvent);
+			return m_spectatorServer->Start(port);
+		}
+
+		void StopStreaming() { m_spectatorServer.reset(); }
+
+		// Number of spectators watching the stream
+		int Spectators() const { return m_spectatorServer ? m_spectatorServer->Spectators() : 0; }
+
+		// Save the next frame shown to a .ppm or .png file (8x8 pixels per cell), in the background. Returns false for other formats
+		bool CaptureFrame(const std::string& path)
+		{
+			if (!m_recorder)
+				m_recorder = std::make_unique<FrameRecorder>();
+			if (!m_recorder->CaptureFrame(path))
+				return false;
+
+			m_forcePresent = true; // Idle rendering : the next frame is shown even if it did not change, to be saved
+			return true;
+		}
+
+		// Record the frames shown to an animated .gif file until StopCapture(), in the background. Returns false if the file can not be created
+		bool StartCapture(const std::string& path)
+		{
+			if (!m_recorder)
+				m_recorder = std::make_unique<FrameRecorder>();
+			if (!m_recorder->StartAnimation(path))
+				return false;
+
+			m_forcePresent = true; // Idle rendering : the first frame of the GIF
+			return true;
+		}
+
+		void StopCapture()
+		{
+			if (m_recorder)
+				m_recorder->StopAnimation();
+		}
+
+		bool IsCapturing() const { return m_recorder && m_recorder->IsRecording(); }
+
+
+
+		/* ----- Graphics ------ */
+
+		// Restrict the next draw calls to the rectangle x,y,width,height (moved by the offset), inside the current clip rect
+		void PushClip(int x, int y, int width, int height)
+		{
+			m_clipStack.push_back(m_clip);
+			x += m_offsetX;
+			y += m_offsetY;
+			m_clip.x1 = (std::max)(m_clip.x1, x);
+			m_clip.y1 = (std::max)(m_clip.y1, y);
+			m_clip.x2 = (std::max)((std::min)(m_clip.x2, x + (std::max)(width, 0)), m_clip.x1);
+			m_clip.y2 = (std::max)((std::min)(m_clip.y2, y + (std::max)(height, 0)), m_clip.y1);
+		}
+
+		// Go back to the clip rect before the last PushClip()
+		void PopClip()
+		{
+			if (m_clipStack.empty())
+				return;
+
+			m_clip = m_clipStack.back();
+			m_clipStack.pop_back();
+		}
+
+		// Move the next draw calls by x,y, on top of the current offset
+		void PushOffset(int x, int y)
+		{
+			m_offsetStack.push_back({ m_offsetX, m_offsetY });
+			m_offsetX += x;
+			m_offsetY += y;
+		}
+
+		// Go back to the offset before the last PushOffset()
+		void PopOffset()
+		{
+			if (m_offsetStack.empty())
+				return;
+
+			m_offsetX = m_offsetStack.back().first;
+			m_offsetY = m_offsetStack.back().second;
+			m_offsetStack.pop_back();
+		}
+
+		// Draw the next calls in a width*height window at x,y : 0,0 is its top left corner and nothing is drawn outside of it
+		void PushViewport(int x, int y, int width, int height)
+		{
+			PushOffset(x, y);
+			PushClip(0, 0, width, height);
+		}
+
+		void PopViewport()
+		{
+			PopClip();
+			PopOffset();
+		}
+
+		// Is a part of the rectangle x,y,width,height (moved by the offset) inside the clip rect ?
+		bool Visible(int x, int y, int width, int height) const
+		{
+			x += m_offsetX;
+			y += m_offsetY;
+			return width > 0 && height > 0 && x < m_clip.x2 && y < m_clip.y2 && x + width > m_clip.x1 && y + height > m_clip.y1;
+		}
+
+		// Fill the whole buffer with a pixel, the clip rect and the offset are ignored
+		void Clear(const Pixel& pixel)
+		{
+			if (m_deferred) // Everything recorded so far is hidden
+			{
+				ClearCommands();
+				Record({ DrawCommand::Type::Fill, 0, 0, m_width, m_height, pixel, nullptr }, { 0, 0, m_width, m_height });
+				return;
+			}
+
+			FillRow(m_bufScreen.Data(), m_width * m_height, pixel);
+		}
+
+		// Set a pixel at x,y
+		void Draw(int x, int y, const Pixel& pixel)
+		{
+			x += m_offsetX;
+			y += m_offsetY;
+			if (x >= m_clip.x1 && x < m_clip.x2 && y >= m_clip.y1 && y < m_clip.y2)
+			{
+				if (m_deferred)
+				{
+					Record({ DrawCommand::Type::Point, x, y, 0, 0, pixel, nullptr }, { x, y, x + 1, y + 1 });
+					return;
+				}
+
+				Set(x, y, pixel);
+			}
+		}
+
+		// Draw a drawable object at x,y
+		void Draw(int x, int y, const Drawable& drawable) { drawable.Draw(x,y, *this); }
+
+		// Draw a line from (x1,y1) to (x2,y2)
+		void DrawLine(int x1, int y1, int x2, int y2, const Pixel& pixel)
+		{
+			Submit({ DrawCommand::Type::Line, x1, y1, x2, y2, pixel, nullptr },
+				{ (std::min)(x1, x2), (std::min)(y1, y2), (std::max)(x1, x2) + 1, (std::max)(y1, y2) + 1 });
+		}
+
+		// Fill the area formed by x,y and width,height using the pixel
+		void Fill(int x, int y, int width, int height, const Pixel& pixel)
+		{
+			if (width > 0 && height > 0)
+				Submit({ DrawCommand::Type::Fill, x, y, x + width, y + height, pixel, nullptr }, { x, y, x + width, y + height });
+		}
+
+		// Fill a circle of radius r centered on x,y
+		void FillCircle(int x, int y, int r, const Pixel& pixel) { FillEllipse(x, y, r, r, pixel); }
+
+		// Draw the outline of a circle of radius r centered on x,y
+		void DrawCircle(int x, int y, int r, const Pixel& pixel) { DrawEllipse(x, y, r, r, pixel); }
+
+		// Fill an ellipse of radii rx,ry centered on x,y
+		void FillEllipse(int x, int y, int rx, int ry, const Pixel& pixel)
+		{
+			if (rx < 0 || ry < 0 || !Visible(x - rx, y - ry, 2 * rx + 1, 2 * ry + 1))
+				return;
+
+			x += m_offsetX;
+			y += m_offsetY;
+
+			// Widest point of every row, then one span per row
+			m_spanScratch.assign(ry + 1, -1);
+			Ellipse(rx, ry, [this](int dx, int dy) { m_spanScratch[dy] = (std::max)(m_spanScratch[dy], dx); });
+			for (int dy = 0; dy <= ry; dy++)
+			{
+				Span(y + dy, x - m_spanScratch[dy], x + m_spanScratch[dy], pixel);
+				if (dy != 0)
+					Span(y - dy, x - m_spanScratch[dy], x + m_spanScratch[dy], pixel);
+			}
+		}
+
+		// Draw the outline of an ellipse of radii rx,ry centered on x,y
+		void DrawEllipse(int x, int y, int rx, int ry, const Pixel& pixel)
+		{
+			if (rx < 0 || ry < 0 || !Visible(x - rx, y - ry, 2 * rx + 1, 2 * ry + 1))
+				return;
+
+			x += m_offsetX;
+			y += m_offsetY;
+
+			Ellipse(rx, ry, [&](int dx, int dy)
+			{
+				Span(y + dy, x - dx, x - dx, pixel);
+				Span(y + dy, x + dx, x + dx, pixel);
+				Span(y - dy, x - dx, x - dx, pixel);
+				Span(y - dy, x + dx, x + dx, pixel);
+			});
+		}
+
+		// Fill the triangle (x1,y1), (x2,y2), (x3,y3), a cell is filled if its center is inside
+		void FillTriangle(int x1, int y1, int x2, int y2, int x3, int y3, const Pixel& pixel)
+		{
+			const std::pair<int, int> points[3] = { { x1, y1 }, { x2, y2 }, { x3, y3 } };
+			FillPolygon(points, 3, pixel);
+		}
+
+		// Fill a polygon (even-odd rule, can be concave or self intersecting), a cell is filled if its center is inside
+		void FillPolygon(const std::vector<std::pair<int, int>>& points, const Pixel& pixel) { FillPolygon(points.data(), (int)points.size(), pixel); }
+
+		void FillPolygon(const std::pair<int, int>* points, int count, const Pixel& pixel)
+		{
+			if (count < 3)
+				return;
+
+			int minY = points[0].second, maxY = points[0].second;
+			for (int i = 1; i < count; i++)
+			{
+				minY = (std::min)(minY, points[i].second);
+				maxY = (std::max)(maxY, points[i].second);
+			}
+			minY += m_offsetY;
+			maxY += m_offsetY;
+
+			// Rows whose center is between minY and maxY, in screen coordinates
+			for (int y = (std::max)(minY, m_clip.y1); y < maxY && y < m_clip.y2; y++)
+			{
+				// Work in doubled coordinates so the cell centers (x + 0.5) are integers : 2x + 1
+				const INT64 rowCenter = 2 * (INT64)y + 1;
+				m_spanScratch.clear();
+				for (int i = 0; i < count; i++)
+				{
+					const std::pair<int, int>& a = points[i], &b = points[(i + 1) % count];
+					INT64 ax = 2 * ((INT64)a.first + m_offsetX), ay = 2 * ((INT64)a.second + m_offsetY);
+					INT64 bx = 2 * ((INT64)b.first + m_offsetX), by = 2 * ((INT64)b.second + m_offsetY);
+					if (ay > by)
+					{
+						Swap(ax, bx);
+						Swap(ay, by);
+					}
+					if (rowCenter < ay || rowCenter >= by) // Half open so a vertex is only counted once
+						continue;
+
+					// The edge crosses the row at ax + (rowCenter - ay) * (bx - ax) / (by - ay)
+					// Keep the first cell whose center is at or after the crossing : ceil((crossing - 1) / 2)
+					INT64 numerator = ax * (by - ay) + (rowCenter - ay) * (bx - ax) - (by - ay);
+					INT64 denominator = 2 * (by - ay);
+					INT64 cell = numerator >= 0 ? (numerator + denominator - 1) / denominator : -((-numerator) / denominator);
+					m_spanScratch.push_back((int)(std::max)((std::min)(cell, (INT64)m_width + 1), (INT64)-1));
+				}
+
+				std::sort(m_spanScratch.begin(), m_spanScratch.end());
+				for (size_t i = 0; i + 1 < m_spanScratch.size(); i += 2)
+					Span(y, m_spanScratch[i], m_spanScratch[i + 1] - 1, pixel);
+			}
+		}
+
+		// Draw a width*height block of colors (row major) at x,y
+		// With parallel rendering the colors are read at BlipToScreen(), they must stay valid until then
+		void Blit(int x, int y, int width, int height, const Color* colors)
+		{
+			if (width > 0 && height > 0)
+				Submit({ DrawCommand::Type::Blit, x, y, width, height, Pixel(Color::Black), colors }, { x, y, x + width, y + height });
+		}
+
+		// Copy a width*height block of cells (row major) at x,y
+		// With parallel rendering the cells are read at BlipToScreen(), they must stay valid until then
+		void DrawCells(int x, int y, int width, int height, const CHAR_INFO* cells)
+		{
+			if (width > 0 && height > 0)
+				Submit({ DrawCommand::Type::Cells, x, y, width, height, Pixel(Color::Black), nullptr, cells }, { x, y, x + width, y + height });
+		}
+
+		// Write a UTF-8 string at x,y, \n goes back to x on the next line
+		void Print(int x, int y, const std::string& str, Color foreground, Color background)
+		{
+			Print(x, y, str.c_str(), (int)str.length(), foreground, background);
+		}
+
+		// Write length bytes of the UTF-8 string str at x,y, \n goes back to x on the next line
+		void Print(int x, int y, const char* str, int length, Color foreground, Color background)
+		{
+			int width, height;
+			TextSize(str, length, width, height);
+			Submit({ DrawCommand::Type::Text, x, y, 0, length, Pixel(foreground, background, Pixel::Type::Empty), nullptr },
+				{ x, y, x + width, y + height }, str);
+		}
+
+		// Size of a UTF-8 string in cells, \n starts a new line
+		static void TextSize(const char* str, int length, int& width, int& height)
+		{
+			Utf8::Size(str, length, width, height);
+		}
+
+		/// <summary>
+		/// <para> When enabled, the draw calls are recorded and binned into tileSize*tileSize tiles, </para>
+		/// <para> BlipToScreen() then rasterizes the tiles in parallel on the JobSystem (one thread per tile), the output is the same as with serial drawing. </para>
+		/// </summary>
+		void SetParallelRendering(bool enabled, int tileSize = 32)
+		{
+			Flush();
+
+			m_deferred = enabled;
+			m_postProcess.SetParallel(enabled ? 16 : 0); // Bands of 16 rows
+			if (!enabled)
+				return;
+
+			m_tileSize = (std::max)(tileSize, 1);
+			m_tilesX = (m_width + m_tileSize - 1) / m_tileSize;
+			m_tilesY = (m_height + m_tileSize - 1) / m_tileSize;
+			m_tileBins.assign(m_tilesX * m_tilesY, {});
+		}
+
+		// Is parallel rendering enabled ? see SetParallelRendering()
+		bool IsParallelRendering() const { return m_deferred; }
+
+		/// <summary>
+		/// <para> When enabled, BlipToScreen() skips the frames that are the same as the last one (compared with FrameBuffer::Hash()) when PollInputs() read no input : </para>
+		/// <para> the screen and the title are not updated and BlipToScreen() waits for an input, Wake(), WakeIn() or the close button instead. A screen that does not change then uses no CPU. </para>
+		/// </summary>
+		void SetIdleRendering(bool enabled)
+		{
+			m_idleRendering = enabled;
+			m_forcePresent = true;
+		}
+
+		// Is idle rendering enabled ? see SetIdleRendering()
+		bool IsIdleRendering() const { return m_idleRendering; }
+
+		// Idle rendering : the next skipped frame waits at most seconds (ex : the next step of an animation)
+		void WakeIn(float seconds) { m_idleWake = m_idleWake < 0.0f ? (std::max)(seconds, 0.0f) : (std::min)(m_idleWake, (std::max)(seconds, 0.0f)); }
+
+		// Idle rendering : end the wait of a skipped frame, can be called from any thread (ex : when a job has new data to show)
+		void Wake() { SetEvent(m_wakeEvent); }
+
+		// Was the last frame skipped by idle rendering ?
+		bool FrameSkipped() const { return m_frameSkipped; }
+
+		// Remap the attributes of the cells when they are shown, the cells drawn do not change (ex : ColorRemap::FadeToBlack()). Cheap enough to change every frame, ex : ColorRemap::Lerp() for a fade
+		void SetColorRemap(const ColorRemap& remap)
+		{
+			if (remap != m_colorRemap)
+				m_forcePresent = true; // Idle rendering : the frame changes
+			m_colorRemap = remap;
+			m_colorRemapped = !remap.IsIdentity();
+		}
+
+		void ClearColorRemap() { SetColorRemap(ColorRemap()); }
+
+		const ColorRemap& GetColorRemap() const { return m_colorRemap; }
+
+		/// <summary>
+		/// <para> Add a post process pass, run on the whole screen after the drawing and before the cells are shown, ex : c->AddPostPass&lt;PostProcess::Scanlines&gt;(); </para>
+		/// <para> The passes are run in the order they were added, on bands of rows in parallel with SetParallelRendering(). The cells drawn are put back after the frame is shown. </para>
+		/// </summary>
+		template<template<class> class P, class... Args>
+		P<ScreenCell>& AddPostPass(Args&&... args)
+		{
+			m_forcePresent = true; // Idle rendering : the frame changes
+			return m_postProcess.Add<P>(std::forward<Args>(args)...);
+		}
+
+		// Remove a pass returned by AddPostPass()
+		void RemovePostPass(const PostProcess::Pass<ScreenCell>& pass)
+		{
+			m_forcePresent = true;
+			m_postProcess.Remove(pass);
+		}
+
+		void ClearPostPasses()
+		{
+			m_forcePresent = true;
+			m_postProcess.Clear();
+		}
+
+		// Print the buffer to screen
+		void BlipToScreen()
+		{
+			Flush();
+
+			// Delta time
+			auto now = std::chrono::high_resolution_clock::now();
+			m_deltaDrawTime = std::chrono::duration<float>(now - m_timeLastDraw).count();
+			m_timeLastDraw = now;
+
+			const bool postProcessed = m_postProcess.Run(m_bufScreen, m_width, m_height, m_deltaDrawTime);
+
+			// Idle rendering : nothing changed and no input to react to, wait for something to do instead of showing the same frame
+			m_frameSkipped = false;
+			if (m_idleRendering)
+			{
+				if (m_spectatorServer && m_spectatorServer->TakeNewSpectator())
+					m_forcePresent = true; // It needs a keyframe
+
+				const UINT64 hash = m_bufScreen.Hash();
+				m_frameSkipped = !m_forcePresent && !m_inputReceived && hash == m_presentedHash;
+				m_presentedHash = hash;
+				m_forcePresent = false;
+			}
+
+			if (m_frameSkipped)
+				WaitForWork();
+			else
+			{
+				// Title - fps
+				wchar_t s[256];
+				swprintf_s(s, 256, L"%s - %d fps", m_title.c_str(), (int)(1.0f / m_deltaDrawTime));
+				if (!SetConsoleTitle(s))
+					Error("Could not set the title");
+
+				// Blip tot screen
+				const CHAR_INFO* cells = m_bufScreen.Present();
+				if (m_colorRemapped)
+				{
+					m_remappedCells.resize((size_t)m_width * m_height);
+					m_colorRemap.Apply(cells, m_remappedCells.data(), m_width * m_height);
+					cells = m_remappedCells.data();
+				}
+				if (!WriteConsoleOutput(m_hConsole, cells, { (short)m_width, (short)m_height }, { 0,0 }, &m_displaySize))
+					Error("Could not write to the output buffer");
+
+				if (m_spectatorServer)
+					m_spectatorServer->Publish(cells, m_width, m_height);
+				if (m_recorder)
+					m_recorder->Publish(cells, m_width, m_height);
+			}
+			if (postProcessed)
+				m_postProcess.Restore(m_bufScreen);
+			m_idleWake = -1.0f;
+
+			// End of the frame
+			m_frameArena.Reset();
+			UINT64 allocations = AllocationCounter::Count();
+			m_frameAllocations = allocations - m_allocationsAtBlip;
+			m_allocationsAtBlip = allocations;
+		}
+
+
+
+		/* ----- Inputs ----- */
+
+		// Check for new inputs
+		void PollInputs()
+		{
+			m_scrollDelta = 0;
+
+			// Catch console events
+			int mx = m_mouseX, my = m_mouseY;
+			INPUT_RECORD inBuf[32];
+			DWORD events = 0;
+			if (!GetNumberOfConsoleInputEvents(m_hConsoleIn, &events))
+				Error("Could not get the number of input events");
+
+			m_inputReceived = events > 0;
+			if (events > 0)
+			{
+				if (!ReadConsoleInput(m_hConsoleIn, inBuf, events, &events))
+					Error("Could not read the input events");
+			}
+
+			for (DWORD i = 0; i < events; i++)
+			{
+				if (inBuf[i].EventType == MOUSE_EVENT) // Mouse
+				{
+					switch (inBuf[i].Event.MouseEvent.dwEventFlags)
+					{
+					case MOUSE_MOVED: // Mouse movements
+						m_mouseX = inBuf[i].Event.MouseEvent.dwMousePosition.X;
+						m_mouseY = inBuf[i].Event.MouseEvent.dwMousePosition.Y;
+						break;
+					case MOUSE_WHEELED: // Scroll wheel
+						m_scrollDelta = (int)inBuf[i].Event.MouseEvent.dwButtonState >> 16;
+						break;
+					case 0: // Mouse click
+						UpdateKey((int)Key::MouseLeft, inBuf[i].Event.MouseEvent.dwButtonState & FROM_LEFT_1ST_BUTTON_PRESSED);
+						UpdateKey((int)Key::MouseMiddle, inBuf[i].Event.MouseEvent.dwButtonState & FROM_LEFT_2ND_BUTTON_PRESSED);
+						UpdateKey((int)Key::MouseRight, inBuf[i].Event.MouseEvent.dwButtonState & RIGHTMOST_BUTTON_PRESSED);
+						// Mouse forward and backward are not creating an event ?
+						break;
+					default:
+						break;
+					}
+				}
+				else if (inBuf[i].EventType == KEY_EVENT) // Keyboard
+				{
+					UpdateKey(inBuf[i].Event.KeyEvent.wVirtualKeyCode, inBuf[i].Event.KeyEvent.bKeyDown);
+				}
+			}
+
+			// Fix for mouse forward and backward not generating events :
+			UpdateKey((int)Key::MouseForward, (GetAsyncKeyState((int)Key::MouseForward) & 0x8000));
+			UpdateKey((int)Key::MouseBackward, (GetAsyncKeyState((int)Key::MouseBackward) & 0x8000));
+
+			m_mouseDeltaX = m_mouseX - mx;
+			m_mouseDeltaY = m_mouseY - my;
+		}
+
+		// Is the key pressed now ?
+		bool IsPressed(Key key) const { return m_keys[(int)key].isDown; }
+		// Was the key pressed since the last call to PollInputs() ?
+		bool WasJustPressed(Key key) const { return m_keys[(int)key].justDown; }
+		// Was the key released since the last call to PollInputs() ?
+		bool WasJustReleased(Key key) const { return m_keys[(int)key].justUp; }
+
+		// Distance traveled by the mouse since the last call to PollInputs()
+		int MouseDeltaX() const { return m_mouseDeltaX; }
+		// Distance traveled by the mouse since the last call to PollInputs()
+		int MouseDeltaY() const { return m_mouseDeltaY; }
+		// Position of the mouse on the screen, in charaters
+		int MouseX() const { return m_mouseX; }
+		// Position of the mouse on the screen, in charaters
+		int MouseY() const { return m_mouseY; }
+
+		// If > 0 the user scrolled up, if < 0 the user scrolled down
+		int ScrollDelta() const { return m_scrollDelta; }
+
+
+		// Convert RGB values to Color
+		static Color RGBToColor(UINT8* rgb) { return (Color)CellRaster::Nearest(rgb[0], rgb[1], rgb[2]); }
+
+	private:
+		// Swap a and b
+		template<class T>
+		static void Swap(T& a, T& b)
+		{
+			T temp = a;
+			a = b;
+			b = temp;
+		}
+
+		// Run the command now, or record it with parallel rendering. text is the storage of the UTF-8 strings of the Text commands (see DrawCommand::x2)
+		// The command and bounds are moved by the offset, the command is dropped when its bounds are outside the clip rect
+		void Submit(DrawCommand command, Rect bounds, const char* text = nullptr)
+		{
+			bounds = { (std::max)(bounds.x1 + m_offsetX, m_clip.x1), (std::max)(bounds.y1 + m_offsetY, m_clip.y1),
+				(std::min)(bounds.x2 + m_offsetX, m_clip.x2), (std::min)(bounds.y2 + m_offsetY, m_clip.y2) };
+			if (bounds.x1 >= bounds.x2 || bounds.y1 >= bounds.y2)
+				return;
+
+			command.x1 += m_offsetX;
+			command.y1 += m_offsetY;
+			if (command.type == DrawCommand::Type::Line || command.type == DrawCommand::Type::Fill) // x2,y2 are a position
+			{
+				command.x2 += m_offsetX;
+				command.y2 += m_offsetY;
+			}
+
+			const UINT16* cells = nullptr;
+			if (command.type == DrawCommand::Type::Text) // Decode the string : ASCII is widened, the rest goes through the cache
+			{
+				const char* str = text + command.x2;
+				const std::vector<UINT16>* decoded = &m_textScratch;
+				if (Utf8::IsAscii(str, command.y2))
+				{
+					m_textScratch.resize(command.y2);
+					Utf8::Widen(str, command.y2, m_textScratch.data());
+				}
+				else
+					decoded = &m_textCache.Get(str, command.y2);
+
+				cells = decoded->data();
+				command.x2 = 0;
+				command.y2 = (int)decoded->size();
+			}
+
+			if (!m_deferred)
+			{
+				Execute(command, cells, m_clip);
+				return;
+			}
+
+			// The Fill commands are already cut by the bounds, the others keep the clip rect for RasterizeTile()
+			if (command.type == DrawCommand::Type::Fill)
+			{
+				command.x1 = bounds.x1;
+				command.y1 = bounds.y1;
+				command.x2 = bounds.x2;
+				command.y2 = bounds.y2;
+			}
+			else
+				command.clip = ClipIndex(); // Can flush, before the cells are stored
+
+			if (command.type == DrawCommand::Type::Text) // Keep a copy of the cells until the flush
+			{
+				command.x2 = (int)m_textStorage.size();
+				m_textStorage.insert(m_textStorage.end(), cells, cells + command.y2);
+			}
+			Record(command, bounds);
+		}
+
+
+		// Add a command to the bins of all the tiles touched by bounds
+		void Record(const DrawCommand& command, const Rect& bounds)
+		{
+			if (bounds.x2 <= 0 || bounds.y2 <= 0 || bounds.x1 >= m_width || bounds.y1 >= m_height) // Off screen
+				return;
+
+			int tx1 = (std::max)(bounds.x1, 0) / m_tileSize, ty1 = (std::max)(bounds.y1, 0) / m_tileSize;
+			int tx2 = ((std::min)(bounds.x2, m_width) - 1) / m_tileSize, ty2 = ((std::min)(bounds.y2, m_height) - 1) / m_tileSize;
+
+			UINT32 index = (UINT32)m_commands.size();
+			m_commands.push_back(command);
+
+			if (command.type == DrawCommand::Type::Line) // Only bin the tiles close to the line, not its whole bounding box
+			{
+				bool alongX = abs(command.x2 - command.x1) > abs(command.y2 - command.y1);
+				float x1 = (float)command.x1, y1 = (float)command.y1, x2 = (float)command.x2, y2 = (float)command.y2;
+				if (!alongX)
+				{
+					Swap(x1, y1);
+					Swap(x2, y2);
+				}
+				float m = x1 == x2 ? 0.0f : (y2 - y1) / (x2 - x1);
+
+				// Strips of tiles along the major axis
+				for (int t = alongX ? tx1 : ty1; t <= (alongX ? tx2 : ty2); t++)
+				{
+					float start = (std::max)((float)(t * m_tileSize), (std::min)(x1, x2));
+					float end = (std::min)((float)((t + 1) * m_tileSize - 1), (std::max)(x1, x2));
+					float a = y1 + m * (start - x1), b = y1 + m * (end - x1);
+					int minor1 = (std::max)((int)floorf((std::min)(a, b)) - 1, 0) / m_tileSize; // 1 cell margin for the rounding
+					int minor2 = (std::min)((int)ceilf((std::max)(a, b)) + 1, (alongX ? m_height : m_width) - 1) / m_tileSize;
+					for (int minor = (std::max)(minor1, alongX ? ty1 : tx1); minor <= (std::min)(minor2, alongX ? ty2 : tx2); minor++)
+						m_tileBins[alongX ? minor * m_tilesX + t : t * m_tilesX + minor].push_back(index);
+				}
+				return;
+			}
+
+			for (int ty = ty1; ty <= ty2; ty++)
+			{
+				for (int tx = tx1; tx <= tx2; tx++)
+					m_tileBins[ty * m_tilesX + tx].push_back(index);
+			}
+		}
+
+		// Index of the clip rect in m_clipRects, the consecutive commands with the same clip rect share it
+		UINT16 ClipIndex()
+		{
+			const Rect& last = m_clipRects.back();
+			if (last.x1 == m_clip.x1 && last.y1 == m_clip.y1 && last.x2 == m_clip.x2 && last.y2 == m_clip.y2)
+				return (UINT16)(m_clipRects.size() - 1);
+
+			if (m_clipRects.size() > 0xFFFF)
+				Flush(); // Out of indices, starts again from the screen
+
+			m_clipRects.push_back(m_clip);
+			return (UINT16)(m_clipRects.size() - 1);
+		}
+
+		void ClearCommands()
+		{
+			m_commands.clear();
+			m_textStorage.clear();
+			m_clipRects.resize(1);
+			for (auto& bin : m_tileBins)
+				bin.clear();
+		}
+
+		// Rasterize the recorded commands, one tile per thread at a time
+		void Flush()
+		{
+			if (!m_deferred || m_commands.empty())
+				return;
+
+			JobSystem::ParallelFor(0, m_tilesX * m_tilesY, 1, [this](int tile) { RasterizeTile(tile); });
+			ClearCommands();
+		}
+
+		// Replay the bin of a tile, clipped to the tile and to the clip rect of each command
+		void RasterizeTile(int tile)
+		{
+			int x = (tile % m_tilesX) * m_tileSize, y = (tile / m_tilesX) * m_tileSize;
+			const Rect tileRect = { x, y, (std::min)(x + m_tileSize, m_width), (std::min)(y + m_tileSize, m_height) };
+			for (UINT32 index : m_tileBins[tile])
+			{
+				const DrawCommand& command = m_commands[index];
+				const Rect& rect = m_clipRects[command.clip];
+				const Rect clip = { (std::max)(tileRect.x1, rect.x1), (std::max)(tileRect.y1, rect.y1), (std::min)(tileRect.x2, rect.x2), (std::min)(tileRect.y2, rect.y2) };
+				Execute(command, m_textStorage.data(), clip);
+			}
+		}
+
+		// Rasterize a command, only the cells inside clip are written
+		void Execute(const DrawCommand& command, const UINT16* text, const Rect& clip)
+		{
+			switch (command.type)
+			{
+			case DrawCommand::Type::Point:
+				if (command.x1 >= clip.x1 && command.x1 < clip.x2 && command.y1 >= clip.y1 && command.y1 < clip.y2)
+					Set(command.x1, command.y1, command.pixel);
+				break;
+
+			case DrawCommand::Type::Line:
+				ExecuteLine(command, clip);
+				break;
+
+			case DrawCommand::Type::Fill:
+			{
+				int x1 = (std::max)(command.x1, clip.x1), x2 = (std::min)(command.x2, clip.x2);
+				int y1 = (std::max)(command.y1, clip.y1), y2 = (std::min)(command.y2, clip.y2);
+				for (int y = y1; y < y2 && x1 < x2; y++)
+					FillRow(&m_bufScreen[y * m_width + x1], x2 - x1, command.pixel);
+				break;
+			}
+
+			case DrawCommand::Type::Blit:
+			{
+				int x1 = (std::max)(command.x1, clip.x1), x2 = (std::min)(command.x1 + command.x2, clip.x2);
+				int y1 = (std::max)(command.y1, clip.y1), y2 = (std::min)(command.y1 + command.y2, clip.y2);
+				for (int y = y1; y < y2; y++)
+				{
+					for (int x = x1; x < x2; x++)
+						Set(x, y, command.colors[(y - command.y1) * command.x2 + (x - command.x1)]);
+				}
+				break;
+			}
+
+			case DrawCommand::Type::Cells:
+			{
+				int x1 = (std::max)(command.x1, clip.x1), x2 = (std::min)(command.x1 + command.x2, clip.x2);
+				int y1 = (std::max)(command.y1, clip.y1), y2 = (std::min)(command.y1 + command.y2, clip.y2);
+				for (int y = y1; y < y2 && x1 < x2; y++)
+					FrameBuffer<ScreenCell>::CopyRow(&m_bufScreen[y * m_width + x1], &command.cells[(y - command.y1) * command.x2 + (x1 - command.x1)], x2 - x1);
+				break;
+			}
+
+			case DrawCommand::Type::Text:
+			{
+				const UINT16* cells = text + command.x2; // command.x2 is the offset of the cells in text
+				const short attributes = (short)command.pixel.color;
+				int x = command.x1, y = command.y1;
+				for (int i = 0; i < command.y2; i++)
+				{
+					if (cells[i] == '\n')
+					{
+						x = command.x1;
+						y++;
+						continue;
+					}
+
+					const bool inside = y >= clip.y1 && y < clip.y2;
+					if (i + 1 < command.y2 && cells[i + 1] == Utf8::WideTrail) // Same glyph in both cells, flagged as its two halves (CompactCell drops the flags)
+					{
+						if (inside && x >= clip.x1 && x < clip.x2)
+							Set(x, y, Pixel((Color)(attributes | COMMON_LVB_LEADING_BYTE), (Pixel::Type)cells[i]));
+						if (inside && x + 1 >= clip.x1 && x + 1 < clip.x2)
+							Set(x + 1, y, Pixel((Color)(attributes | COMMON_LVB_TRAILING_BYTE), (Pixel::Type)cells[i]));
+						x += 2;
+						i++;
+					}
+					else
+					{
+						if (inside && x >= clip.x1 && x < clip.x2)
+							Set(x, y, Pixel((Color)attributes, (Pixel::Type)cells[i]));
+						x++;
+					}
+				}
+				break;
+			}
+			}
+		}
+
+		// Uses the y = mx+b and x = my+b equations to draw, only the part of the line inside clip is computed
+		void ExecuteLine(const DrawCommand& command, const Rect& clip)
+		{
+			int x1 = command.x1, y1 = command.y1, x2 = command.x2, y2 = command.y2;
+			if (x1 == x2 && y1 == y2) // Single point (m would be NaN)
+			{
+				if (x1 >= clip.x1 && x1 < clip.x2 && y1 >= clip.y1 && y1 < clip.y2)
+					Set(x1, y1, command.pixel);
+				return;
+			}
+
+			if (abs(x2 - x1) > abs(y2 - y1)) // dx > dy then plot along the x axis (this is to reduce/remove gaps)
+			{
+				if (x1 > x2) // Swap both points if x1 > x2
+				{
+					Swap<int>(x1, x2);
+					Swap<int>(y1, y2);
+				}
+
+				float m = (float)(y2 - y1) / (float)(x2 - x1);
+				float b = y1 - (m * x1);
+
+				for (int x = (std::max)(x1, clip.x1); x <= x2 && x < clip.x2; x++)
+				{
+					int y = (int)roundf(m * x + b);
+					if (y >= clip.y1 && y < clip.y2)
+						Set(x, y, command.pixel);
+				}
+			}
+			else // plot along the y axis
+			{
+				if (y1 > y2) // Swap both points if y1 > y2
+				{
+					Swap<int>(x1, x2);
+					Swap<int>(y1, y2);
+				}
+
+				float m = (float)(x2 - x1) / (float)(y2 - y1);
+				float b = x1 - (m * y1);
+
+				for (int y = (std::max)(y1, clip.y1); y <= y2 && y < clip.y2; y++)
+				{
+					int x = (int)roundf(m * y + b);
+					if (x >= clip.x1 && x < clip.x2)
+						Set(x, y, command.pixel);
+				}
+			}
+		}
+
+		// Write a horizontal span from x1 to x2 (included) on row y, in screen coordinates and clipped to the clip rect
+		void Span(int y, int x1, int x2, const Pixel& pixel)
+		{
+			x1 = (std::max)(x1, m_clip.x1);
+			x2 = (std::min)(x2, m_clip.x2 - 1);
+			if (y < m_clip.y1 || y >= m_clip.y2 || x1 > x2)
+				return;
+
+			if (m_deferred)
+				Record({ DrawCommand::Type::Fill, x1, y, x2 + 1, y + 1, pixel, nullptr }, { x1, y, x2 + 1, y + 1 });
+			else
+				FillRow(&m_bufScreen[y * m_width + x1], x2 - x1 + 1, pixel);
+		}
+
+		// Write the same pixel in count consecutive cells
+		static void FillRow(ScreenCell* row, int count, const Pixel& pixel)
+		{
+			FrameBuffer<ScreenCell>::FillRow(row, count, FrameBuffer<ScreenCell>::MakeCell((WCHAR)pixel.type, (UINT16)pixel.color));
+		}
+
+		// Integer midpoint ellipse (J. Kennedy), calls plot(dx, dy) for the points of the first quadrant
+		template<class Plot>
+		static void Ellipse(int rx, int ry, Plot&& plot)
+		{
+			if (rx == 0 || ry == 0) // Flat, the regions below would never end
+			{
+				for (int i = 0; i <= rx; i++)
+					plot(i, 0);
+				for (int i = 1; i <= ry; i++)
+					plot(0, i);
+				return;
+			}
+
+			const INT64 twoASquare = 2 * (INT64)rx * rx, twoBSquare = 2 * (INT64)ry * ry;
+
+			// Region where the slope is > -1, y always moves
+			INT64 x = rx, y = 0;
+			INT64 xChange = (INT64)ry * ry * (1 - 2 * (INT64)rx), yChange = (INT64)rx * rx;
+			INT64 error = 0, stoppingX = twoBSquare * rx, stoppingY = 0;
+			while (stoppingX >= stoppingY)
+			{
+				plot((int)x, (int)y);
+				y++;
+				stoppingY += twoASquare;
+				error += yChange;
+				yChange += twoASquare;
+				if (2 * error + xChange > 0)
+				{
+					x--;
+					stoppingX -= twoBSquare;
+					error += xChange;
+					xChange += twoBSquare;
+				}
+			}
+
+			// Region where the slope is < -1, x always moves
+			x = 0;
+			y = ry;
+			xChange = (INT64)ry * ry;
+			yChange = (INT64)rx * rx * (1 - 2 * (INT64)ry);
+			error = 0;
+			stoppingX = 0;
+			stoppingY = twoASquare * ry;
+			while (stoppingX <= stoppingY)
+			{
+				plot((int)x, (int)y);
+				x++;
+				stoppingX += twoBSquare;
+				error += xChange;
+				xChange += twoBSquare;
+				if (2 * error + yChange > 0)
+				{
+					y--;
+					stoppingY -= twoASquare;
+					error += yChange;
+					yChange += twoASquare;
+				}
+			}
+		}
+
+		// Write a pixel in the buffer, x,y must be on screen
+		void Set(int x, int y, const Pixel& pixel)
+		{
+			m_bufScreen[y * m_width + x] = FrameBuffer<ScreenCell>::MakeCell((WCHAR)pixel.type, (UINT16)pixel.color);
+		}
+
+		// Update the key using the new value
+		void UpdateKey(int keycode, bool down)
+		{
+			m_keys[keycode].justDown = !m_keys[keycode].isDown && down; // Was not already down, and is down not
+			m_keys[keycode].justUp = m_keys[keycode].isDown && !down; // Was down and now is up
+			m_keys[keycode].isDown = down;
+		}
+
+		// Idle rendering : wait for an input, Wake(), WakeIn() or the close button
+		void WaitForWork()
+		{
+			const HANDLE handles[3] = { m_hConsoleIn, m_wakeEvent, m_closeEvent };
+			const DWORD timeout = m_idleWake < 0.0f ? INFINITE : (DWORD)(m_idleWake * 1000.0f);
+			if (WaitForMultipleObjects(3, handles, FALSE, timeout) == WAIT_FAILED)
+				Error("Could not wait for the inputs");
+		}
+
+		// Handles the close button
+		static BOOL CloseHandler(DWORD event)
+		{
+			if (event == CTRL_CLOSE_EVENT)
+			{
+				std::unique_lock<std::mutex> lock(m_closeMutex);
+				m_shouldClose.exchange(true);
+				SetEvent(m_closeEvent);
+
+				m_closeCall.wait(lock);
+				return TRUE;
+			}
+
+			return FALSE; // Pass the event to the next handler
+		}
+
+		// Report an error
+		void PrintError(const std::string& str, int line)
+		{
+			m_shouldClose.exchange(true); // Tell the user to close
+			SetConsoleActiveScreenBuffer(m_hPreviousConsole); // Switch back to the old buffer
+			std::cout << "[Error] (RexConsoleEngine, line : " << line << ") : " << str << std::endl; // Print the error
+			std::cin.get(); // Wait for user feedback
+		}
+	};
+	inline std::atomic_bool Console::m_shouldClose(false);
+	inline HANDLE Console::m_closeEvent = NULL;
+	inline std::mutex Console::m_closeMutex;
+	inline std::condition_variable Console::m_closeCall;
+
+	/// <summary>
+	/// <para> A list of recorded draw calls that can be executed on a console any number of times (ex : a static scene recorded once). </para>
+	/// <para> The commands are sorted by layer (lowest first, same layer = recording order) and the ones that are off screen are skipped. </para>
+	/// <para> A buffer does not use the console while recording, so buffers can be built on other threads and executed on the main thread. </para>
+	/// </summary>
+	class CommandBuffer
+	{
+	private:
+		struct Entry
+		{
+			Console::DrawCommand command;
+			Console::Rect bounds; // Used to cull the command
+			int layer;
+			const Console::Drawable* drawable; // Set for drawable objects, command.x1 and command.y1 are the position
+			bool hasBounds; // False for drawables of unknown size, they are never culled
+		};
+
+		std::vector<Entry> m_entries;
+		std::vector<UINT32> m_order; // Index of the entries sorted by layer, rebuilt when the entries change
+		std::string m_text; // Strings of the Text commands
+		int m_layer = 0; // Layer of the next commands
+		bool m_sorted = true;
+
+	public:
+		// Set the layer of the next commands, higher layers are drawn on top
+		void SetLayer(int layer) { m_layer = layer; }
+		int Layer() const { return m_layer; }
+
+		// Remove all the commands
+		void Clear()
+		{
+			m_entries.clear();
+			m_order.clear();
+			m_text.clear();
+			m_sorted = true;
+		}
+
+		// Number of recorded commands
+		size_t Size() const { return m_entries.size(); }
+
+		void Draw(int x, int y, const Console::Pixel& pixel)
+		{
+			Add({ Console::DrawCommand::Type::Point, x, y, 0, 0, pixel, nullptr }, { x, y, x + 1, y + 1 });
+		}
+
+		// The drawable is kept by pointer, it must stay alive as long as it is in the buffer
+		void Draw(int x, int y, const Console::Drawable& drawable)
+		{
+			int width = 0, height = 0; // GetSize() leaves them unset when the drawable has no size
+			bool hasBounds = drawable.GetSize(width, height);
+			m_entries.push_back({ { Console::DrawCommand::Type::Point, x, y, 0, 0, Console::Color::Black, nullptr },
+				{ x, y, x + width, y + height }, m_layer, &drawable, hasBounds });
+			m_sorted = false;
+		}
+
+		void DrawLine(int x1, int y1, int x2, int y2, const Console::Pixel& pixel)
+		{
+			Add({ Console::DrawCommand::Type::Line, x1, y1, x2, y2, pixel, nullptr },
+				{ (std::min)(x1, x2), (std::min)(y1, y2), (std::max)(x1, x2) + 1, (std::max)(y1, y2) + 1 });
+		}
+
+		void Fill(int x, int y, int width, int height, const Console::Pixel& pixel)
+		{
+			if (width > 0 && height > 0)
+				Add({ Console::DrawCommand::Type::Fill, x, y, x + width, y + height, pixel, nullptr }, { x, y, x + width, y + height });
+		}
+
+		// The colors are kept by pointer, they must stay valid as long as they are in the buffer
+		void Blit(int x, int y, int width, int height, const Console::Color* colors)
+		{
+			if (width > 0 && height > 0)
+				Add({ Console::DrawCommand::Type::Blit, x, y, width, height, Console::Color::Black, colors }, { x, y, x + width, y + height });
+		}
+
+		// The cells are kept by pointer, they must stay valid as long as they are in the buffer
+		void DrawCells(int x, int y, int width, int height, const CHAR_INFO* cells)
+		{
+			if (width > 0 && height > 0)
+				Add({ Console::DrawCommand::Type::Cells, x, y, width, height, Console::Color::Black, nullptr, cells }, { x, y, x + width, y + height });
+		}
+
+		// The string is copied
+		void Print(int x, int y, const std::string& str, Console::Color foreground, Console::Color background)
+		{
+			int width, height;
+			Console::TextSize(str.c_str(), (int)str.length(), width, height);
+			Add({ Console::DrawCommand::Type::Text, x, y, (int)m_text.length(), (int)str.length(), Console::Pixel(foreground, background, Console::Pixel::Type::Empty), nullptr },
+				{ x, y, x + width, y + height });
+			m_text += str;
+		}
+
+		// Add the commands of another buffer at the end of this one (ex : merge the buffers built by worker threads)
+		void Append(const CommandBuffer& other)
+		{
+			const int textOffset = (int)m_text.length();
+			for (Entry entry : other.m_entries)
+			{
+				if (entry.drawable == nullptr && entry.command.type == Console::DrawCommand::Type::Text)
+					entry.command.x2 += textOffset;
+				m_entries.push_back(entry);
+			}
+			m_text += other.m_text;
+			m_sorted = false;
+		}
+
+		// Draw all the commands on the console, the buffer is not modified and can be executed again on the next frames
+		void Execute(Console& console)
+		{
+			if (!m_sorted)
+			{
+				m_order.resize(m_entries.size());
+				for (UINT32 i = 0; i < m_order.size(); i++)
+					m_order[i] = i;
+				std::stable_sort(m_order.begin(), m_order.end(), [this](UINT32 a, UINT32 b) { return m_entries[a].layer < m_entries[b].layer; });
+				m_sorted = true;
+			}
+
+			for (UINT32 index : m_order)
+			{
+				const Entry& entry = m_entries[index];
+				if (entry.hasBounds && !console.Visible(entry.bounds.x1, entry.bounds.y1, entry.bounds.x2 - entry.bounds.x1, entry.bounds.y2 - entry.bounds.y1))
+					continue; // Culled
+
+				if (entry.drawable != nullptr)
+					entry.drawable->Draw(entry.command.x1, entry.command.y1, console);
+				else
+					console.Submit(entry.command, entry.bounds, m_text.data());
+			}
+		}
+
+	private:
+		void Add(const Console::DrawCommand& command, const Console::Rect& bounds)
+		{
+			m_entries.push_back({ command, bounds, m_layer, nullptr, true });
+			m_sorted = false;
+		}
+	};
+
+	/// <summary>
+	/// A drawable string
+	/// </summary>
+	class DrawString : public Console::Drawable
+	{
+	private:
+		std::string m_str; // Only used when the string is owned
+		const char* m_view; // The string when it is not owned
+		int m_length;
+		Console::Color m_foreground, m_background;
+	public:
+		// Tag of the constructor that does not copy the string : DrawString(DrawString::View(), "Score:", ...)
+		struct View {};
+
+		// The string is copied (or moved)
+		DrawString(std::string str, Console::Color foreground, Console::Color background) 
+			: m_str(std::move(str)), m_view(nullptr), m_foreground(foreground), m_background(background) { m_length = (int)m_str.length(); }
+
+		// The string is not copied, it must outlive the DrawString (ex : a string literal)
+		DrawString(View, const char* str, Console::Color foreground, Console::Color background)
+			: m_view(str), m_length((int)strlen(str)), m_foreground(foreground), m_background(background) {}
+
+		void Draw(int x, int y, Console& console) const override
+		{
+			console.Print(x, y, Text(), m_length, m_foreground, m_background);
+		}
+
+		bool GetSize(int& width, int& height) const override
+		{
+			Console::TextSize(Text(), m_length, width, height);
+			return true;
+		}
+
+	private:
+		const char* Text() const { return m_view ? m_view : m_str.c_str(); }
+
+	};
+
+	/// <summary>
+	/// <para> The solid pixels of an image packed in 64-bit words, one bit per pixel and every row starting on a new word (ex : the pixels of a Sprite that are not its transparent color). </para>
+	/// <para> Overlaps() ANDs the words of the two masks, the words of the second one shifted to line up with the first : 64 pixels per operation instead of one. </para>
+	/// </summary>
+	class CollisionMask
+	{
+	private:
+		int m_width, m_height;
+		int m_wordsPerRow;
+		std::vector<UINT64> m_bits; // Bit i of word w of a row is the pixel w * 64 + i, the bits past the width are 0
+		int m_left, m_top, m_right, m_bottom; // Bounds of the solid pixels, right and bottom excluded (empty when left >= right)
+
+	public:
+		CollisionMask() : m_width(0), m_height(0), m_wordsPerRow(0), m_left(0), m_top(0), m_right(0), m_bottom(0) {}
+
+		// The pixels that are not the transparent color are solid
+		CollisionMask(int width, int height, const Console::Color* colors, Console::Color transparent)
+			: m_width((std::max)(width, 0)), m_height((std::max)(height, 0)), m_wordsPerRow((m_width + 63) / 64),
+			m_bits((size_t)m_wordsPerRow * m_height, 0), m_left(m_width), m_top(m_height), m_right(0), m_bottom(0)
+		{
+			for (int y = 0; y < m_height; y++)
+			{
+				for (int x = 0; x < m_width; x++)
+				{
+					if (colors[y * m_width + x] == transparent)
+						continue;
+
+					m_bits[(size_t)y * m_wordsPerRow + x / 64] |= 1ull << (x % 64);
+					m_left = (std::min)(m_left, x);
+					m_right = (std::max)(m_right, x + 1);
+					m_top = (std::min)(m_top, y);
+					m_bottom = (std::max)(m_bottom, y + 1);
+				}
+			}
+		}
+
+		int Width() const { return m_width; }
+		int Height() const { return m_height; }
+
+		// Bounds of the solid pixels relative to the top left corner, false when there are none
+		bool GetBounds(int& left, int& top, int& right, int& bottom) const
+		{
+			left = m_left;
+			top = m_top;
+			right = m_right;
+			bottom = m_bottom;
+			return m_left < m_right;
+		}
+
+		// Is the pixel x,y solid ? false outside of the mask
+		bool Test(int x, int y) const
+		{
+			if (x < 0 || x >= m_width || y < 0 || y >= m_height)
+				return false;
+			return (m_bits[(size_t)y * m_wordsPerRow + x / 64] >> (x % 64)) & 1;
+		}
+
+		// Does a solid pixel of a at xA,yA cover a solid pixel of b at xB,yB ?
+		static bool Overlaps(const CollisionMask& a, int xA, int yA, const CollisionMask& b, int xB, int yB)
+		{
+			// Overlap of the solid bounds, in the pixels of a
+			const int dx = xB - xA, dy = yB - yA;
+			const int left = (std::max)(a.m_left, b.m_left + dx), right = (std::min)(a.m_right, b.m_right + dx);
+			const int top = (std::max)(a.m_top, b.m_top + dy), bottom = (std::min)(a.m_bottom, b.m_bottom + dy);
+			if (left >= right || top >= bottom)
+				return false;
+
+			const UINT64* bitsA = a.m_bits.data();
+			const UINT64* bitsB = b.m_bits.data();
+			const int wordsA = a.m_wordsPerRow, wordsB = b.m_wordsPerRow;
+
+			// Most sprites fit in a word per row : shift the row of b by dx, less than 64 since the bounds overlap
+			if (wordsA == 1 && wordsB == 1)
+			{
+				for (int y = top; y < bottom; y++)
+				{
+					const UINT64 rowB = bitsB[y - dy];
+					if (bitsA[y] & (dx >= 0 ? rowB << dx : rowB >> -dx))
+						return true;
+				}
+				return false;
+			}
+
+			// The 64 pixels of b lined up with word w of a start at pixel w * 64 - dx of b, made of at most two words of b
+			for (int w = left / 64; w <= (right - 1) / 64; w++)
+			{
+				const int x = w * 64 - dx, word = x >= 0 ? x / 64 : -((-x + 63) / 64), shift = x - word * 64;
+				const bool hasLow = word >= 0, hasHigh = shift != 0 && word + 1 < wordsB; // word is -1 when the words start left of b
+				for (int y = top; y < bottom; y++)
+				{
+					const UINT64* rowB = bitsB + (size_t)(y - dy) * wordsB;
+					UINT64 lined = 0;
+					if (hasLow)
+						lined = rowB[word] >> shift;
+					if (hasHigh)
+						lined |= rowB[word + 1] << (64 - shift);
+					if (bitsA[(size_t)y * wordsA + w] & lined)
+						return true;
+				}
+			}
+			return false;
+		}
+	};
+
+
+	/// <summary>
+	/// A sprite to be displayed
+	/// For now only 16 colors bmps are supported
+	/// </summary>
+	class Sprite : public Console::Drawable
+	{
+	public:
+		UINT32 m_width, m_height;
+		Console::Color* m_colors; // Pixel data
+		CollisionMask m_mask; // Pixels that are not the transparent color, see BuildMask()
+
+	public:
+		Sprite() : m_width(0), m_height(0), m_colors(nullptr) {}
+
+		~Sprite()
+		{
+			if (m_colors != nullptr)
+				delete[] m_colors;
+		}
+
+		void Draw(int x, int y, Console& console) const override
+		{
+			console.Blit(x, y, (int)m_width, (int)m_height, m_colors);
+		}
+
+		bool GetSize(int& width, int& height) const override
+		{
+			width = (int)m_width;
+			height = (int)m_height;
+			return true;
+		}
+
+		// Rebuild the collision mask after a change of the colors, the pixels of the transparent color do not collide
+		void BuildMask(Console::Color transparent)
+		{
+			m_mask = CollisionMask((int)m_width, (int)m_height, m_colors, transparent);
+		}
+
+		// Does a pixel of a at xA,yA that is not transparent cover one of b at xB,yB ? Compares 64 pixels at a time, see CollisionMask
+		static bool Overlaps(const Sprite& a, int xA, int yA, const Sprite& b, int xB, int yB)
+		{
+			return CollisionMask::Overlaps(a.m_mask, xA, yA, b.m_mask, xB, yB);
+		}
+
+		// Load from bitmap, only 16 color mode supported for now, returns false on errors
+		// The pixels of the transparent color are not in the collision mask
+		bool LoadBMP(const std::string& path, Console::Color transparent = Console::Color::Black)
+		{
+			// Usefull link for the bmp file format : 
+			// http://www.ece.ualberta.ca/~elliott/ee552/studentAppNotes/2003_w/misc/bmp_file_format/bmp_file_format.htm
+
+			std::FILE* f = std::fopen(path.c_str(), "rb"); // Open the file in binary mode
+			if (f == nullptr)
+				return false;
+
+			// Get the start offset of the pixel data, the width and the height
+			UINT32 offset;
+			std::fseek(f, 10, SEEK_CUR); // Skip to DataOffset
+			std::fread(&offset, sizeof(UINT32), 1, f);
+			std::fseek(f, 4, SEEK_CUR); // Skip to size
+			std::fread(&m_width, sizeof(UINT32), 1, f);
+			std::fread(&m_height, sizeof(UINT32), 1, f);
+
+			m_colors = new Console::Color[m_width * m_height];
+
+			std::fseek(f, 54, SEEK_SET); // Skip to the ColorTable
+			UINT8 colorTable[4 * 16]; // Color table
+			std::fread(&colorTable, sizeof(UINT8), 4 * 16, f);
+			for (int i = 0; i < 16; i++) // colors are saved as BGR, flip them to RGB
+			{
+				int B = colorTable[i * 4];
+				int R = colorTable[i * 4 + 2];
+				colorTable[i * 4] = R;
+				colorTable[i * 4 + 2] = B;
+			}
+
+			std::fseek(f, offset, SEEK_SET); // Skip to DataOffset
+			for (unsigned int y = 0; y < m_height; y++)
+			{
+				for (unsigned int x = 0; x < m_width / 2; x++)
+				{
+					UINT8 value;
+					std::fread(&value, sizeof(UINT8), 1, f);
+					m_colors[(m_height - 1 - y) * m_width + (x * 2)] = Console::RGBToColor(&colorTable[((value & 0b11110000)>>4) * 4]); // First pixel in the byte
+					m_colors[(m_height - 1 - y) * m_width + (x * 2 + 1)] = Console::RGBToColor(&colorTable[(value & 0b00001111) * 4]); // Second pixel in the byte
+				}
+
+				std::fseek(f, (4 - ((m_width / 2) % 4)) % 4, SEEK_CUR); // Each line is padded up to a multiple of 4 bytes
+			}
+
+			BuildMask(transparent);
+			return true;
+		}
+	};
+
+	/// <summary>
+	/// <para> Finds the entries that touch among many masks (ex : bullets, enemies and the player), entries are added every frame after they moved. </para>
+	/// <para> FindPairs() sorts the solid bounds on x and sweeps them, only the entries whose bounds overlap and whose layers collide are tested pixel by pixel. </para>
+	/// </summary>
+	class CollisionWorld
+	{
+	public:
+		struct Pair { int a, b; }; // Ids given to Add()
+
+	private:
+		struct EntryData
+		{
+			int left, top, right, bottom; // Solid bounds in the world
+			const CollisionMask* mask;
+			int x, y;
+			int id;
+			UINT32 layers, collidesWith;
+		};
+
+		std::vector<EntryData> m_entries;
+		std::vector<int> m_order; // Entries sorted by left
+		std::vector<int> m_active; // Sweep : entries whose right is past the current left
+		std::vector<Pair> m_pairs;
+		UINT64 m_tests; // Pixel tests of the last FindPairs()
+
+	public:
+		CollisionWorld() : m_tests(0) {}
+
+		// Remove every entry, once per frame before adding them again
+		void Clear() { m_entries.clear(); }
+
+		// The mask is kept by pointer until Clear(). Two entries can touch when the layers of one have a bit of the collidesWith of the other
+		void Add(int id, const CollisionMask& mask, int x, int y, UINT32 layers = 1, UINT32 collidesWith = 0xFFFFFFFF)
+		{
+			int left, top, right, bottom;
+			if (mask.GetBounds(left, top, right, bottom)) // Nothing solid : touches nothing
+				m_entries.push_back({ x + left, y + top, x + right, y + bottom, &mask, x, y, id, layers, collidesWith });
+		}
+
+		void Add(int id, const Sprite& sprite, int x, int y, UINT32 layers = 1, UINT32 collidesWith = 0xFFFFFFFF) { Add(id, sprite.m_mask, x, y, layers, collidesWith); }
+
+		int Count() const { return (int)m_entries.size(); }
+
+		// Every pair of entries with overlapping solid pixels, once
+		const std::vector<Pair>& FindPairs()
+		{
+			m_pairs.clear();
+			m_active.clear();
+			m_tests = 0;
+
+			m_order.resize(m_entries.size());
+			for (int i = 0; i < (int)m_order.size(); i++)
+				m_order[i] = i;
+			std::sort(m_order.begin(), m_order.end(), [&](int a, int b) { return m_entries[a].left < m_entries[b].left; });
+
+			for (int index : m_order)
+			{
+				const EntryData& entry = m_entries[index];
+
+				// The entries that end before this one starts can not touch it or the next ones
+				m_active.erase(std::remove_if(m_active.begin(), m_active.end(), [&](int other) { return m_entries[other].right <= entry.left; }), m_active.end());
+				for (int other : m_active)
+				{
+					if (Touch(m_entries[other], entry))
+						m_pairs.push_back({ m_entries[other].id, entry.id });
+				}
+				m_active.push_back(index);
+			}
+			return m_pairs;
+		}
+
+		// The entries whose solid pixels overlap a mask at x,y (ex : the area of an explosion), added to ids
+		void Query(const CollisionMask& mask, int x, int y, std::vector<int>& ids, UINT32 collidesWith = 0xFFFFFFFF)
+		{
+			int left, top, right, bottom;
+			if (!mask.GetBounds(left, top, right, bottom))
+				return;
+
+			const EntryData query = { x + left, y + top, x + right, y + bottom, &mask, x, y, -1, collidesWith, collidesWith };
+			for (const EntryData& entry : m_entries)
+			{
+				if (Touch(entry, query))
+					ids.push_back(entry.id);
+			}
+		}
+
+		// Pixel tests done by the last FindPairs(), the pairs of entries whose bounds overlapped
+		UINT64 Tests() const { return m_tests; }
+
+	private:
+		bool Touch(const EntryData& a, const EntryData& b)
+		{
+			if (!(a.layers & b.collidesWith) && !(b.layers & a.collidesWith))
+				return false;
+			if (a.left >= b.right || b.left >= a.right || a.top >= b.bottom || b.top >= a.bottom)
+				return false;
+
+			m_tests++;
+			return CollisionMask::Overlaps(*a.mask, a.x, a.y, *b.mask, b.x, b.y);
+		}
+	};
+
+	/// <summary>
+	/// <para> Plays sprite animations for many entities at once, every entity is an instance of a clip. </para>
+	/// <para> The frames of a clip are copied at AddClip() into one contiguous block of colors, drawing a frame is one Blit. </para>
+	/// <para> The instances are stored as a structure of arrays and advanced by Update() 4 at a time with SSE2, </para>
+	/// <para> only the instances that change frame are checked for events. </para>
+	/// </summary>
+	class Animator
+	{
+	public:
+		enum class Mode { Once, Loop, PingPong };
+
+		// Raised by Update() when an instance reaches a frame with an event, see AddEvent()
+		struct Event { int instance, clip, id; };
+
+	private:
+		struct FrameData
+		{
+			size_t offset; // First color in m_pixels
+			int width, height;
+			int event; // -1 when the frame has no event
+		};
+
+		struct ClipData
+		{
+			int firstFrame, frameCount; // In m_frames
+			float rate; // Frames per second
+			Mode mode;
+		};
+
+		static constexpr float Never = 1e30f; // Period and limit of the clips that do not wrap or stop
+
+		std::vector<Console::Color> m_pixels; // Frames of every clip
+		std::vector<FrameData> m_frames;
+		std::vector<ClipData> m_clips;
+		int m_eventCount; // Frames with an event, Update() skips the checks when there are none
+
+		// Instances, structure of arrays sized to a multiple of 4 so Update() never needs a scalar tail
+		int m_count;
+		std::vector<float> m_phase; // Position in the clip, in frames
+		std::vector<float> m_step; // Frames per second, clip rate * speed
+		std::vector<float> m_period; // Frames before the phase wraps : frame count (Loop), 2 * frame count - 2 (PingPong) or Never (Once)
+		std::vector<float> m_mirror; // PingPong : frames past the last one play backwards, Never otherwise
+		std::vector<float> m_last; // Last frame of the clip
+		std::vector<float> m_limit; // Once : the phase stops at the frame count, Never otherwise
+		std::vector<int> m_firstFrame; // First frame of the clip in m_frames
+		std::vector<int> m_frame; // Current frame in m_frames, -1 right after Play() so the first frame raises its event
+		std::vector<int> m_clip;
+		std::vector<float> m_speed;
+		std::vector<int> m_instance; // Handle of the instance at each index
+
+		std::vector<int> m_index; // Index of each handle in the arrays, -1 for free handles
+		std::vector<int> m_freeHandles;
+
+		std::vector<Event> m_events;
+
+	public:
+		Animator() : m_eventCount(0), m_count(0) {}
+
+		// Add a clip cut from an atlas : count frames of frameWidth*frameHeight starting at frame first,
+		// the frames are read left to right then top to bottom. Returns the clip index, or -1 if the atlas is empty or no frame fits in it
+		int AddClip(const Sprite& atlas, int frameWidth, int frameHeight, int first, int count, float framesPerSecond, Mode mode = Mode::Loop)
+		{
+			if (atlas.m_colors == nullptr)
+				return -1;
+
+			const int columns = frameWidth > 0 ? (int)atlas.m_width / frameWidth : 0;
+			const int rows = frameHeight > 0 ? (int)atlas.m_height / frameHeight : 0;
+			if (first < 0 || count <= 0 || first + count > columns * rows)
+				return -1;
+
+			const int firstFrame = (int)m_frames.size();
+			for (int frame = first; frame < first + count; frame++)
+			{
+				const Console::Color* source = atlas.m_colors + (size_t)(frame / columns) * frameHeight * atlas.m_width + (size_t)(frame % columns) * frameWidth;
+				m_frames.push_back({ m_pixels.size(), frameWidth, frameHeight, -1 });
+				for (int y = 0; y < frameHeight; y++)
+					m_pixels.insert(m_pixels.end(), source + (size_t)y * atlas.m_width, source + (size_t)y * atlas.m_width + frameWidth);
+			}
+
+			m_clips.push_back({ firstFrame, count, (std::max)(framesPerSecond, 0.0f), mode });
+			return (int)m_clips.size() - 1;
+		}
+
+		// Add a clip made of a sequence of sprites, they are copied. Returns the clip index, or -1 if there are no frames
+		int AddClip(const std::vector<const Sprite*>& sprites, float framesPerSecond, Mode mode = Mode::Loop)
+		{
+			const int firstFrame = (int)m_frames.size();
+			for (const Sprite* sprite : sprites)
+			{
+				if (sprite == nullptr || sprite->m_colors == nullptr)
+					continue;
+
+				m_frames.push_back({ m_pixels.size(), (int)sprite->m_width, (int)sprite->m_height, -1 });
+				m_pixels.insert(m_pixels.end(), sprite->m_colors, sprite->m_colors + (size_t)sprite->m_width * sprite->m_height);
+			}
+
+			if ((int)m_frames.size() == firstFrame)
+				return -1;
+
+			m_clips.push_back({ firstFrame, (int)m_frames.size() - firstFrame, (std::max)(framesPerSecond, 0.0f), mode });
+			return (int)m_clips.size() - 1;
+		}
+
+		// Raise the event id when an instance of the clip reaches frame, one event per frame (a new one replaces the old one)
+		void AddEvent(int clip, int frame, int id)
+		{
+			if (clip < 0 || clip >= (int)m_clips.size() || frame < 0 || frame >= m_clips[clip].frameCount)
+				return;
+
+			int& event = m_frames[m_clips[clip].firstFrame + frame].event;
+			if (event < 0)
+				m_eventCount++;
+			event = id;
+		}
+
+		// Create an instance playing clip from its first frame, returns its handle, or -1 if the clip does not exist
+		int Create(int clip, float speed = 1.0f)
+		{
+			if (clip < 0 || clip >= (int)m_clips.size())
+				return -1;
+
+			int instance;
+			if (!m_freeHandles.empty())
+			{
+				instance = m_freeHandles.back();
+				m_freeHandles.pop_back();
+			}
+			else
+			{
+				instance = (int)m_index.size();
+				m_index.push_back(-1);
+			}
+
+			Reserve(m_count + 1);
+			const int i = m_count++;
+			m_index[instance] = i;
+			m_instance[i] = instance;
+			m_speed[i] = (std::max)(speed, 0.0f);
+			SetClip(i, clip);
+			return instance;
+		}
+
+		// Remove an instance, its handle can be given to a new one
+		void Destroy(int instance)
+		{
+			if (!Valid(instance))
+				return;
+
+			const int i = m_index[instance], last = --m_count;
+			m_phase[i] = m_phase[last];
+			m_step[i] = m_step[last];
+			m_period[i] = m_period[last];
+			m_mirror[i] = m_mirror[last];
+			m_last[i] = m_last[last];
+			m_limit[i] = m_limit[last];
+			m_firstFrame[i] = m_firstFrame[last];
+			m_frame[i] = m_frame[last];
+			m_clip[i] = m_clip[last];
+			m_speed[i] = m_speed[last];
+			m_instance[i] = m_instance[last];
+			m_index[m_instance[i]] = i;
+
+			m_index[instance] = -1;
+			m_freeHandles.push_back(instance);
+		}
+
+		// Remove every instance
+		void Clear()
+		{
+			m_count = 0;
+			m_index.clear();
+			m_freeHandles.clear();
+			m_events.clear();
+		}
+
+		// Number of instances
+		int Count() const { return m_count; }
+
+		// Switch an instance to another clip, it starts from the first frame unless it already plays this clip and restart is false
+		// Returns false if the instance or the clip does not exist
+		bool Play(int instance, int clip, bool restart = true)
+		{
+			if (!Valid(instance) || clip < 0 || clip >= (int)m_clips.size())
+				return false;
+
+			if (restart || m_clip[m_index[instance]] != clip)
+				SetClip(m_index[instance], clip);
+			return true;
+		}
+
+		// Playback speed of an instance, 1 is the rate of the clip and 0 pauses it
+		void SetSpeed(int instance, float speed)
+		{
+			if (!Valid(instance))
+				return;
+
+			const int i = m_index[instance];
+			m_speed[i] = (std::max)(speed, 0.0f);
+			m_step[i] = m_clips[m_clip[i]].rate * m_speed[i];
+		}
+
+		// Clip played by an instance, -1 if the handle is invalid
+		int Clip(int instance) const { return Valid(instance) ? m_clip[m_index[instance]] : -1; }
+
+		// Frame shown by an instance, from 0 to the frame count of its clip - 1
+		int Frame(int instance) const { return Valid(instance) ? CurrentFrame(m_index[instance]) - m_firstFrame[m_index[instance]] : 0; }
+
+		// Has a Once clip reached its end ? Loop and PingPong clips never finish
+		bool Finished(int instance) const { return Valid(instance) && m_phase[m_index[instance]] >= m_limit[m_index[instance]]; }
+
+		// Advance every instance by deltaTime seconds, the events raised are in Events() until the next call
+		void Update(float deltaTime)
+		{
+			m_events.clear();
+
+			const __m128 dt = _mm_set1_ps(deltaTime);
+			for (int i = 0; i < m_count; i += 4) // The arrays are padded to a multiple of 4
+			{
+				// The phases are positive so truncating is flooring
+				const __m128 period = _mm_loadu_ps(&m_period[i]);
+				__m128 phase = _mm_min_ps(_mm_add_ps(_mm_loadu_ps(&m_phase[i]), _mm_mul_ps(_mm_loadu_ps(&m_step[i]), dt)), _mm_loadu_ps(&m_limit[i]));
+				phase = _mm_sub_ps(phase, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_div_ps(phase, period))), period));
+				_mm_storeu_ps(&m_phase[i], phase);
+
+				// Frame in the clip : the whole part of the phase, mirrored for PingPong and clamped for Once
+				const __m128 whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(phase));
+				const __m128 frame = _mm_min_ps(_mm_min_ps(whole, _mm_sub_ps(_mm_loadu_ps(&m_mirror[i]), whole)), _mm_loadu_ps(&m_last[i]));
+				const __m128i index = _mm_add_epi32(_mm_cvttps_epi32(frame), _mm_loadu_si128((const __m128i*)&m_firstFrame[i]));
+				const __m128i previous = _mm_loadu_si128((const __m128i*)&m_frame[i]);
+				_mm_storeu_si128((__m128i*)&m_frame[i], index);
+
+				if (m_eventCount == 0)
+					continue;
+
+				int changed = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(index, previous))) & 0xF;
+				if (i + 4 > m_count)
+					changed &= (1 << (m_count - i)) - 1; // Padding
+				for (int lane = 0; changed != 0; lane++, changed >>= 1)
+				{
+					if ((changed & 1) && m_frames[m_frame[i + lane]].event >= 0)
+						m_events.push_back({ m_instance[i + lane], m_clip[i + lane], m_frames[m_frame[i + lane]].event });
+				}
+			}
+		}
+
+		// Events raised by the last Update(), in no particular order. A frame skipped by a long frame time raises nothing
+		const std::vector<Event>& Events() const { return m_events; }
+
+		// Draw the current frame of an instance at x,y
+		// With parallel rendering the frame is read at BlipToScreen(), no clip can be added before then
+		void Draw(Console& console, int x, int y, int instance) const
+		{
+			if (!Valid(instance))
+				return;
+
+			const FrameData& frame = m_frames[CurrentFrame(m_index[instance])];
+			console.Blit(x, y, frame.width, frame.height, m_pixels.data() + frame.offset);
+		}
+
+		// Size of the current frame of an instance, returns false if the handle is invalid
+		bool GetSize(int instance, int& width, int& height) const
+		{
+			if (!Valid(instance))
+				return false;
+
+			const FrameData& frame = m_frames[CurrentFrame(m_index[instance])];
+			width = frame.width;
+			height = frame.height;
+			return true;
+		}
+
+	private:
+		bool Valid(int instance) const { return instance >= 0 && instance < (int)m_index.size() && m_index[instance] >= 0; }
+
+		int CurrentFrame(int i) const { return m_frame[i] < 0 ? m_firstFrame[i] : m_frame[i]; }
+
+		// Start the clip on the instance at index i
+		// The clip must exist, checked by Create() and Play()
+		void SetClip(int i, int clip)
+		{
+			const ClipData& c = m_clips[clip];
+			m_clip[i] = clip;
+			m_phase[i] = 0.0f;
+			m_step[i] = c.rate * m_speed[i];
+			m_period[i] = c.mode == Mode::Loop ? (float)c.frameCount : c.mode == Mode::PingPong ? (float)(std::max)(2 * c.frameCount - 2, 1) : Never;
+			m_mirror[i] = c.mode == Mode::PingPong ? (float)(2 * c.frameCount - 2) : Never;
+			m_last[i] = (float)(c.frameCount - 1);
+			m_limit[i] = c.mode == Mode::Once ? (float)c.frameCount : Never;
+			m_firstFrame[i] = c.firstFrame;
+			m_frame[i] = -1;
+		}
+
+		// Grow the arrays to hold count instances
+		void Reserve(int count)
+		{
+			if ((int)m_phase.size() >= count)
+				return;
+
+			const size_t size = (std::max)((size_t)(count + 3) & ~(size_t)3, m_phase.size() * 2);
+			for (auto* array : { &m_phase, &m_step, &m_mirror, &m_last, &m_limit, &m_speed })
+				array->resize(size, 0.0f);
+			m_period.resize(size, 1.0f); // The padding is divided by it
+			for (auto* array : { &m_firstFrame, &m_frame, &m_clip, &m_instance })
+				array->resize(size, 0);
+		}
+	};
+
+	/// <summary>
+	/// An instance of an Animator, as a drawable object
+	/// </summary>
+	class AnimatedSprite : public Console::Drawable
+	{
+	private:
+		const Animator* m_animator;
+		int m_instance;
+
+	public:
+		// The animator is kept by pointer, it must outlive the AnimatedSprite
+		AnimatedSprite(const Animator& animator, int instance) : m_animator(&animator), m_instance(instance) {}
+
+		void Draw(int x, int y, Console& console) const override
+		{
+			m_animator->Draw(console, x, y, m_instance);
+		}
+
+		bool GetSize(int& width, int& height) const override
+		{
+			return m_animator->GetSize(m_instance, width, height);
+		}
+	};
+
+	/// <summary>
+	/// <para> A drawing surface with more pixels than cells : 1x2 pixels per cell (HalfBlock) or 2x2 pixels per cell (Quadrant). </para>
+	/// <para> The pixels are packed into cells when the canvas is drawn, every cell gets a block glyph and a foreground/background pair. </para>
+	/// <para> Quadrant mode needs a console font with the quadrant glyphs (U+2596 to U+259F), the 8x8 Terminal font only has the half blocks. </para>
+	/// <para> A Quadrant cell can only show two colors, when its 4 pixels use more the extra colors are replaced by the background. </para>
+	/// </summary>
+	class HiResCanvas : public Console::Drawable
+	{
+	public:
+		enum class Mode { HalfBlock, Quadrant };
+
+	private:
+		Mode m_mode;
+		int m_cellWidth, m_cellHeight; // Size in cells
+		int m_width, m_height; // Size in pixels
+		std::vector<UINT8> m_pixels; // One color (0-15) per pixel
+
+		// Glyph of every Quadrant pattern (bit 0 = top left, 1 = top right, 2 = bottom left, 3 = bottom right), split in low and high bytes for the lookup
+		static constexpr UINT16 QuadrantGlyphs[16] = { 0x0020, 0x2598, 0x259D, 0x2580, 0x2596, 0x258C, 0x259E, 0x259B, 0x2597, 0x259A, 0x2590, 0x259C, 0x2584, 0x2599, 0x259F, 0x2588 };
+		static constexpr UINT16 UpperHalf = 0x2580, FullBlock = 0x2588;
+
+	public:
+		HiResCanvas(int cellWidth, int cellHeight, Mode mode)
+			: m_mode(mode), m_cellWidth(cellWidth), m_cellHeight(cellHeight),
+			m_width(mode == Mode::Quadrant ? cellWidth * 2 : cellWidth), m_height(cellHeight * 2),
+			m_pixels((size_t)m_width * m_height, 0)
+		{}
+
+		// Size in pixels
+		int Width() const { return m_width; }
+		int Height() const { return m_height; }
+
+		void Clear(Console::Color color) { memset(m_pixels.data(), (int)color & 0xF, m_pixels.size()); }
+
+		void Draw(int x, int y, Console::Color color)
+		{
+			if (x >= 0 && x < m_width && y >= 0 && y < m_height)
+				m_pixels[y * m_width + x] = (UINT8)color & 0xF;
+		}
+
+		void Fill(int x, int y, int width, int height, Console::Color color)
+		{
+			int x1 = (std::max)(x, 0), x2 = (std::min)(x + width, m_width);
+			for (int row = (std::max)(y, 0); row < y + height && row < m_height && x1 < x2; row++)
+				memset(&m_pixels[row * m_width + x1], (int)color & 0xF, x2 - x1);
+		}
+
+		// Bresenham line
+		void DrawLine(int x1, int y1, int x2, int y2, Console::Color color)
+		{
+			int dx = abs(x2 - x1), dy = -abs(y2 - y1);
+			int sx = x1 < x2 ? 1 : -1, sy = y1 < y2 ? 1 : -1;
+			int error = dx + dy;
+			while (true)
+			{
+				Draw(x1, y1, color);
+				if (x1 == x2 && y1 == y2)
+					break;
+				int e2 = 2 * error;
+				if (e2 >= dy)
+				{
+					error += dy;
+					x1 += sx;
+				}
+				if (e2 <= dx)
+				{
+					error += dx;
+					y1 += sy;
+				}
+			}
+		}
+
+		// Pack the pixels and draw the cells at x,y (in cells)
+		// The cells are packed in the frame arena of the console : they stay valid until BlipToScreen() reads them, and every draw has its own
+		void Draw(int x, int y, Console& console) const override
+		{
+			if (m_cellWidth <= 0 || m_cellHeight <= 0)
+				return;
+
+			CHAR_INFO* cells = console.FrameArena().Allocate<CHAR_INFO>((size_t)m_cellWidth * m_cellHeight);
+			for (int row = 0; row < m_cellHeight; row++)
+			{
+				const UINT8* top = &m_pixels[(row * 2) * m_width];
+				const UINT8* bottom = top + m_width;
+				CHAR_INFO* out = &cells[row * m_cellWidth];
+				if (m_mode == Mode::HalfBlock)
+					PackHalfBlocks(top, bottom, out, m_cellWidth);
+				else
+					PackQuadrants(top, bottom, out, m_cellWidth);
+			}
+			console.DrawCells(x, y, m_cellWidth, m_cellHeight, cells);
+		}
+
+		bool GetSize(int& width, int& height) const override
+		{
+			width = m_cellWidth;
+			height = m_cellHeight;
+			return true;
+		}
+
+	private:
+		// Write 16 cells from their glyphs (low bytes, the high byte is given) and attributes
+		static void StoreCells(CHAR_INFO* out, __m128i glyphLow, __m128i glyphHigh, __m128i attributes)
+		{
+			const __m128i zero = _mm_setzero_si128();
+			__m128i glyphs0 = _mm_unpacklo_epi8(glyphLow, glyphHigh), glyphs1 = _mm_unpackhi_epi8(glyphLow, glyphHigh);
+			__m128i attributes0 = _mm_unpacklo_epi8(attributes, zero), attributes1 = _mm_unpackhi_epi8(attributes, zero);
+			_mm_storeu_si128((__m128i*)(out + 0), _mm_unpacklo_epi16(glyphs0, attributes0));
+			_mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi16(glyphs0, attributes0));
+			_mm_storeu_si128((__m128i*)(out + 8), _mm_unpacklo_epi16(glyphs1, attributes1));
+			_mm_storeu_si128((__m128i*)(out + 12), _mm_unpackhi_epi16(glyphs1, attributes1));
+		}
+
+		// Upper half block with the top pixel as foreground and the bottom one as background, 16 cells at a time
+		static void PackHalfBlocks(const UINT8* top, const UINT8* bottom, CHAR_INFO* out, int count)
+		{
+			const __m128i highNibble = _mm_set1_epi8((char)0xF0);
+			const __m128i upperLow = _mm_set1_epi8((char)(UpperHalf & 0xFF)), fullBit = _mm_set1_epi8((char)((FullBlock ^ UpperHalf) & 0xFF));
+			const __m128i glyphHigh = _mm_set1_epi8((char)(UpperHalf >> 8));
+
+			int i = 0;
+			for (; i + 16 <= count; i += 16)
+			{
+				__m128i t = _mm_loadu_si128((const __m128i*)(top + i)), b = _mm_loadu_si128((const __m128i*)(bottom + i));
+				__m128i attributes = _mm_or_si128(t, _mm_and_si128(_mm_slli_epi16(b, 4), highNibble));
+				__m128i glyphLow = _mm_or_si128(upperLow, _mm_and_si128(_mm_cmpeq_epi8(t, b), fullBit)); // Full block when both are the same
+				StoreCells(out + i, glyphLow, glyphHigh, attributes);
+			}
+
+			for (; i < count; i++)
+			{
+				out[i].Char.UnicodeChar = top[i] == bottom[i] ? FullBlock : UpperHalf;
+				out[i].Attributes = top[i] | (bottom[i] << 4);
+			}
+		}
+
+		// The top left pixel is the foreground, the first other color is the background, the glyph comes from a 16 entries table
+		static void PackQuadrants(const UINT8* top, const UINT8* bottom, CHAR_INFO* out, int count)
+		{
+			alignas(16) UINT8 lowTable[16], highTable[16];
+			for (int i = 0; i < 16; i++)
+			{
+				lowTable[i] = QuadrantGlyphs[i] & 0xFF;
+				highTable[i] = QuadrantGlyphs[i] >> 8;
+			}
+			const __m128i glyphsLow = _mm_load_si128((const __m128i*)lowTable), glyphsHigh = _mm_load_si128((const __m128i*)highTable);
+			const __m128i evenBytes = _mm_set1_epi16(0x00FF), highNibble = _mm_set1_epi8((char)0xF0);
+			const __m128i bit0 = _mm_set1_epi8(1), bit1 = _mm_set1_epi8(2), bit2 = _mm_set1_epi8(4), bit3 = _mm_set1_epi8(8);
+
+			int i = 0;
+			for (; i + 16 <= count; i += 16)
+			{
+				// Split the even (left) and odd (right) pixels of both rows
+				__m128i top0 = _mm_loadu_si128((const __m128i*)(top + i * 2)), top1 = _mm_loadu_si128((const __m128i*)(top + i * 2 + 16));
+				__m128i bottom0 = _mm_loadu_si128((const __m128i*)(bottom + i * 2)), bottom1 = _mm_loadu_si128((const __m128i*)(bottom + i * 2 + 16));
+				__m128i tl = _mm_packus_epi16(_mm_and_si128(top0, evenBytes), _mm_and_si128(top1, evenBytes));
+				__m128i tr = _mm_packus_epi16(_mm_srli_epi16(top0, 8), _mm_srli_epi16(top1, 8));
+				__m128i bl = _mm_packus_epi16(_mm_and_si128(bottom0, evenBytes), _mm_and_si128(bottom1, evenBytes));
+				__m128i br = _mm_packus_epi16(_mm_srli_epi16(bottom0, 8), _mm_srli_epi16(bottom1, 8));
+
+				__m128i trSame = _mm_cmpeq_epi8(tr, tl), blSame = _mm_cmpeq_epi8(bl, tl), brSame = _mm_cmpeq_epi8(br, tl);
+				__m128i background = _mm_or_si128(_mm_andnot_si128(trSame, tr), _mm_and_si128(trSame, _mm_or_si128(_mm_andnot_si128(blSame, bl), _mm_and_si128(blSame, br))));
+				__m128i pattern = _mm_or_si128(_mm_or_si128(bit0, _mm_and_si128(trSame, bit1)), _mm_or_si128(_mm_and_si128(blSame, bit2), _mm_and_si128(brSame, bit3)));
+
+				__m128i attributes = _mm_or_si128(tl, _mm_and_si128(_mm_slli_epi16(background, 4), highNibble));
+				StoreCells(out + i, _mm_shuffle_epi8(glyphsLow, pattern), _mm_shuffle_epi8(glyphsHigh, pattern), attributes);
+			}
+
+			for (; i < count; i++)
+			{
+				UINT8 tl = top[i * 2], tr = top[i * 2 + 1], bl = bottom[i * 2], br = bottom[i * 2 + 1];
+				UINT8 background = tr != tl ? tr : (bl != tl ? bl : br);
+				int pattern = 1 | (tr == tl) << 1 | (bl == tl) << 2 | (br == tl) << 3;
+				out[i].Char.UnicodeChar = QuadrantGlyphs[pattern];
+				out[i].Attributes = tl | (background << 4);
+			}
+		}
+	};
+
+	/// <summary>
+	/// <para>Bitmap font for big text (titles, scoreboards) : loaded from a BDF file, from a glyph sheet or the built-in 5x7 font (Default())</para>
+	/// <para>The glyphs are rasterized once into runs of cells, drawing is one SIMD row fill per run, scaled by repeating rows and columns</para>
+	/// <para>The layout of a string (glyph positions, kerning, size) is computed by every Draw() of the string, BitmapText computes it once</para>
+	/// <para>Nothing is written while drawing : a font can be drawn from several threads (ex : Default())</para>
+	/// </summary>
+	class BitmapFont
+	{
+	private:
+		struct Run { INT16 x, y, length; }; // In font pixels, y from the top of the line
+
+		struct Glyph
+		{
+			int advance;
+			std::vector<Run> runs;
+			std::vector<INT16> left, right; // Leftmost and rightmost ink of every row of the line, used by the kerning (left > right when the row is empty)
+			int inkRight; // Right of the ink + 1
+		};
+
+		struct Placement { const Glyph* glyph; int x, y; };
+
+	public:
+		// Glyph positions of a string, from MakeLayout(). Only valid with the font that made it, as long as no glyph is added
+		struct Layout
+		{
+			std::vector<Placement> placements;
+			int width, height; // In font pixels
+		};
+
+	private:
+		std::vector<Glyph> m_glyphs;
+		std::unordered_map<UINT32, int> m_index; // Code point -> index in m_glyphs
+		int m_lineHeight, m_ascent;
+		bool m_kerning;
+
+		static constexpr int MinimumGap = 1; // Kerning never brings two glyphs closer than this
+
+	public:
+		BitmapFont() : m_lineHeight(0), m_ascent(0), m_kerning(true) {}
+
+		// The built-in 5x7 font (ASCII)
+		static const BitmapFont& Default()
+		{
+			static const BitmapFont font = []
+			{
+				BitmapFont font;
+				font.m_lineHeight = font.m_ascent = 7;
+				for (int c = 0; c < 95; c++)
+				{
+					std::vector<UINT8> bits(5 * 7);
+					for (int y = 0; y < 7; y++)
+					{
+						for (int x = 0; x < 5; x++)
+							bits[y * 5 + x] = (CellRaster::Ascii5x7[c][y] >> (4 - x)) & 1;
+					}
+					font.AddGlyph(32 + c, 6, bits.data(), 5, 7, 0, 0);
+				}
+				return font;
+			}();
+			return font;
+		}
+
+		// Load a BDF font, returns false on errors
+		bool LoadBDF(const std::string& path)
+		{
+			std::ifstream file(path);
+			if (!file.is_open())
+				return false;
+
+			Reset();
+			int descent = 0, boundingHeight = 0, boundingY = 0, unused;
+			int encoding = -1, advance = 0, width = 0, height = 0, xOffset = 0, yOffset = 0;
+			std::vector<UINT8> bits;
+			std::string line;
+			while (std::getline(file, line))
+			{
+				const char* str = line.c_str();
+				if (sscanf(str, "FONTBOUNDINGBOX %d %d %d %d", &unused, &boundingHeight, &unused, &boundingY) == 4) {}
+				else if (sscanf(str, "FONT_ASCENT %d", &m_ascent) == 1) {}
+				else if (sscanf(str, "FONT_DESCENT %d", &descent) == 1) {}
+				else if (sscanf(str, "ENCODING %d", &encoding) == 1) {}
+				else if (sscanf(str, "DWIDTH %d", &advance) == 1) {}
+				else if (sscanf(str, "BBX %d %d %d %d", &width, &height, &xOffset, &yOffset) == 4) {}
+				else if (line.compare(0, 6, "BITMAP") == 0)
+				{
+					if (m_ascent == 0) // No FONT_ASCENT / FONT_DESCENT properties
+					{
+						m_ascent = boundingHeight + boundingY;
+						descent = -boundingY;
+					}
+					m_lineHeight = m_ascent + descent;
+
+					// One line of hex per row, the leftmost pixel is the high bit of the first byte
+					bits.assign((size_t)(std::max)(width, 0) * (std::max)(height, 0), 0);
+					for (int y = 0; y < height && std::getline(file, line); y++)
+					{
+						for (int x = 0; x < width && (size_t)(x / 4) < line.length(); x++)
+						{
+							int digit = HexDigit(line[x / 4]);
+							bits[y * width + x] = (digit >> (3 - x % 4)) & 1;
+						}
+					}
+
+					if (encoding >= 0)
+						AddGlyph(encoding, advance, bits.data(), width, height, xOffset, m_ascent - (yOffset + height));
+					encoding = -1;
+				}
+			}
+
+			return !m_glyphs.empty() && m_lineHeight > 0;
+		}
+
+		// Load a glyph sheet : a grid of glyphWidth*glyphHeight glyphs starting at firstCharacter, left to right then top to bottom
+		// Every pixel that is not background is ink, the glyphs are not trimmed (the spacing must be in the sheet)
+		bool LoadSheet(const Sprite& sheet, int glyphWidth, int glyphHeight, UINT32 firstCharacter, Console::Color background = Console::Color::Black)
+		{
+			if (sheet.m_colors == nullptr || glyphWidth <= 0 || glyphHeight <= 0)
+				return false;
+
+			Reset();
+			m_lineHeight = m_ascent = glyphHeight;
+			const int columns = (int)sheet.m_width / glyphWidth, rows = (int)sheet.m_height / glyphHeight;
+			std::vector<UINT8> bits((size_t)glyphWidth * glyphHeight);
+			for (int i = 0; i < columns * rows; i++)
+			{
+				const int left = (i % columns) * glyphWidth, top = (i / columns) * glyphHeight;
+				for (int y = 0; y < glyphHeight; y++)
+				{
+					for (int x = 0; x < glyphWidth; x++)
+						bits[y * glyphWidth + x] = sheet.m_colors[(top + y) * sheet.m_width + left + x] != background;
+				}
+				AddGlyph(firstCharacter + i, glyphWidth, bits.data(), glyphWidth, glyphHeight, 0, 0);
+			}
+			return !m_glyphs.empty();
+		}
+
+		// Height of a line, in font pixels
+		int LineHeight() const { return m_lineHeight; }
+
+		// Kerning moves the glyphs closer when their shapes allow it (ex : "To"), enabled by default
+		void SetKerning(bool enabled)
+		{
+			m_kerning = enabled;
+		}
+
+		// Size of a UTF-8 string drawn at this scale, in cells
+		void Measure(const std::string& text, int scale, int& width, int& height) const
+		{
+			const Layout layout = MakeLayout(text);
+			width = layout.width * scale;
+			height = layout.height * scale;
+		}
+
+		// Draw a UTF-8 string with its top left corner at x,y, only the glyphs are drawn
+		void Draw(Console& console, int x, int y, const std::string& text, Console::Color foreground, int scale = 1) const
+		{
+			Draw(console, x, y, MakeLayout(text), foreground, scale);
+		}
+
+		// Draw a UTF-8 string over a background rectangle covering the whole text
+		void Draw(Console& console, int x, int y, const std::string& text, Console::Color foreground, Console::Color background, int scale = 1) const
+		{
+			Draw(console, x, y, MakeLayout(text), foreground, background, scale);
+		}
+
+		// Draw a layout made by this font, only the glyphs are drawn
+		void Draw(Console& console, int x, int y, const Layout& layout, Console::Color foreground, int scale = 1) const
+		{
+			const Console::Pixel pixel(foreground);
+			for (const Placement& placement : layout.placements)
+			{
+				for (const Run& run : placement.glyph->runs)
+					console.Fill(x + (placement.x + run.x) * scale, y + (placement.y + run.y) * scale, run.length * scale, scale, pixel);
+			}
+		}
+
+		// Draw a layout made by this font over a background rectangle covering the whole text
+		void Draw(Console& console, int x, int y, const Layout& layout, Console::Color foreground, Console::Color background, int scale = 1) const
+		{
+			console.Fill(x, y, layout.width * scale, layout.height * scale, Console::Pixel(background));
+			Draw(console, x, y, layout, foreground, scale);
+		}
+
+		// Glyph positions of a UTF-8 string, keep it to draw the same string again without computing the kerning
+		Layout MakeLayout(const std::string& text) const
+		{
+			Layout layout;
+			layout.width = 0;
+			layout.height = m_lineHeight;
+
+			int x = 0, y = 0;
+			const Glyph* previous = nullptr;
+			const char* str = text.c_str(), *end = str + text.length();
+			while (str < end)
+			{
+				UINT32 codePoint = Utf8::Next(str, end);
+				if (codePoint == '\n')
+				{
+					x = 0;
+					y += m_lineHeight + 1;
+					layout.height = y + m_lineHeight;
+					previous = nullptr;
+					continue;
+				}
+
+				const Glyph* glyph = Find(codePoint);
+				if (glyph == nullptr)
+					continue;
+
+				if (previous != nullptr && m_kerning)
+					x -= Kerning(*previous, *glyph);
+				layout.placements.push_back({ glyph, x, y });
+				layout.width = (std::max)(layout.width, x + glyph->inkRight);
+				x += glyph->advance;
+				previous = glyph;
+			}
+			return layout;
+		}
+
+	private:
+		void Reset()
+		{
+			m_glyphs.clear();
+			m_index.clear();
+			m_lineHeight = m_ascent = 0;
+		}
+
+		static int HexDigit(char c)
+		{
+			if (c >= '0' && c <= '9') return c - '0';
+			if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			return 0;
+		}
+
+		// Rasterize a glyph into runs, bits is width*height, its top left corner is at left,top in the line
+		void AddGlyph(UINT32 codePoint, int advance, const UINT8* bits, int width, int height, int left, int top)
+		{
+			Glyph glyph;
+			glyph.advance = advance;
+			glyph.inkRight = 0;
+			glyph.left.assign(m_lineHeight, INT16_MAX);
+			glyph.right.assign(glyph.left.size(), INT16_MIN);
+
+			for (int y = 0; y < height; y++)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					if (!bits[y * width + x])
+						continue;
+
+					int start = x;
+					while (x < width && bits[y * width + x])
+						x++;
+					glyph.runs.push_back({ (INT16)(left + start), (INT16)(top + y), (INT16)(x - start) });
+					glyph.inkRight = (std::max)(glyph.inkRight, left + x);
+
+					int row = top + y;
+					if (row >= 0 && row < (int)glyph.left.size())
+					{
+						glyph.left[row] = (std::min)(glyph.left[row], (INT16)(left + start));
+						glyph.right[row] = (std::max)(glyph.right[row], (INT16)(left + x - 1));
+					}
+				}
+			}
+
+			m_index[codePoint] = (int)m_glyphs.size();
+			m_glyphs.push_back(std::move(glyph));
+		}
+
+		const Glyph* Find(UINT32 codePoint) const
+		{
+			auto it = m_index.find(codePoint);
+			if (it == m_index.end())
+				it = m_index.find('?');
+			return it != m_index.end() ? &m_glyphs[it->second] : nullptr;
+		}
+
+		// How much closer b can be to a, in font pixels
+		static int Kerning(const Glyph& a, const Glyph& b)
+		{
+			int gap = INT_MAX;
+			for (size_t row = 0; row < a.right.size() && row < b.left.size(); row++)
+			{
+				if (a.right[row] != INT16_MIN && b.left[row] != INT16_MAX)
+					gap = (std::min)(gap, a.advance + b.left[row] - a.right[row] - 1);
+			}
+			if (gap == INT_MAX) // No row with ink in both
+				return 0;
+			return (std::max)(0, (std::min)(gap - MinimumGap, a.advance / 3));
+		}
+	};
+
+	/// <summary>
+	/// A string drawn with a BitmapFont, the font must outlive it
+	/// The layout is made once by the constructor (with the kerning setting of the font at that time)
+	/// </summary>
+	class BitmapText : public Console::Drawable
+	{
+	private:
+		const BitmapFont* m_font;
+		BitmapFont::Layout m_layout;
+		Console::Color m_foreground, m_background;
+		bool m_opaque; // Draw the background ?
+		int m_scale;
+
+	public:
+		// Only the glyphs are drawn
+		BitmapText(const BitmapFont& font, const std::string& text, Console::Color foreground, int scale = 1)
+			: m_font(&font), m_layout(font.MakeLayout(text)), m_foreground(foreground), m_background(Console::Color::Black), m_opaque(false), m_scale(scale) {}
+
+		// The glyphs are drawn over a background rectangle
+		BitmapText(const BitmapFont& font, const std::string& text, Console::Color foreground, Console::Color background, int scale = 1)
+			: m_font(&font), m_layout(font.MakeLayout(text)), m_foreground(foreground), m_background(background), m_opaque(true), m_scale(scale) {}
+
+		void Draw(int x, int y, Console& console) const override
+		{
+			if (m_opaque)
+				m_font->Draw(console, x, y, m_layout, m_foreground, m_background, m_scale);
+			else
+				m_font->Draw(console, x, y, m_layout, m_foreground, m_scale);
+		}
+
+		bool GetSize(int& width, int& height) const override
+		{
+			width = m_layout.width * m_scale;
+			height = m_layout.height * m_scale;
+			return true;
+		}
+	};
+
+	/// <summary>
+	/// A 3 components vector, used by the 3D renderer
+	/// </summary>
+	struct Vector3
+	{
+		float x, y, z;
+
+		Vector3 operator+(const Vector3& v) const { return { x + v.x, y + v.y, z + v.z }; }
+		Vector3 operator-(const Vector3& v) const { return { x - v.x, y - v.y, z - v.z }; }
+		Vector3 operator*(float f) const { return { x * f, y * f, z * f }; }
+
+		float Dot(const Vector3& v) const { return x * v.x + y * v.y + z * v.z; }
+		Vector3 Cross(const Vector3& v) const { return { y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x }; }
+		float Length() const { return sqrtf(Dot(*this)); }
+		Vector3 Normalized() const { float l = Length(); return l > 0.0f ? *this * (1.0f / l) : *this; }
+	};
+
+	/// <summary>
+	/// A 4x4 matrix stored row by row, vectors are columns : v' = M * v
+	/// </summary>
+	struct Matrix4
+	{
+		float m[16];
+
+		float& operator()(int row, int column) { return m[row * 4 + column]; }
+		float operator()(int row, int column) const { return m[row * 4 + column]; }
+
+		Matrix4 operator*(const Matrix4& other) const
+		{
+			Matrix4 result;
+			for (int row = 0; row < 4; row++)
+			{
+				for (int column = 0; column < 4; column++)
+				{
+					result(row, column) = (*this)(row, 0) * other(0, column) + (*this)(row, 1) * other(1, column)
+						+ (*this)(row, 2) * other(2, column) + (*this)(row, 3) * other(3, column);
+				}
+			}
+			return result;
+		}
+
+		// Transform a direction (the translation is ignored)
+		Vector3 TransformDirection(const Vector3& v) const
+		{
+			return { m[0] * v.x + m[1] * v.y + m[2] * v.z, m[4] * v.x + m[5] * v.y + m[6] * v.z, m[8] * v.x + m[9] * v.y + m[10] * v.z };
+		}
+
+		// Matrix for the normals with TransformDirection() : the cofactors of the 3x3 part, the inverse transpose scaled by the determinant (normalize the results)
+		Matrix4 NormalMatrix() const
+		{
+			const Vector3 a = { m[0], m[1], m[2] }, b = { m[4], m[5], m[6] }, c = { m[8], m[9], m[10] };
+			const Vector3 r0 = b.Cross(c), r1 = c.Cross(a), r2 = a.Cross(b);
+			return { r0.x,r0.y,r0.z,0, r1.x,r1.y,r1.z,0, r2.x,r2.y,r2.z,0, 0,0,0,1 };
+		}
+
+		static Matrix4 Identity() { return { 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 }; }
+		static Matrix4 Translation(float x, float y, float z) { return { 1,0,0,x, 0,1,0,y, 0,0,1,z, 0,0,0,1 }; }
+		static Matrix4 Scale(float x, float y, float z) { return { x,0,0,0, 0,y,0,0, 0,0,z,0, 0,0,0,1 }; }
+		static Matrix4 RotationX(float a) { float c = cosf(a), s = sinf(a); return { 1,0,0,0, 0,c,-s,0, 0,s,c,0, 0,0,0,1 }; }
+		static Matrix4 RotationY(float a) { float c = cosf(a), s = sinf(a); return { c,0,s,0, 0,1,0,0, -s,0,c,0, 0,0,0,1 }; }
+		static Matrix4 RotationZ(float a) { float c = cosf(a), s = sinf(a); return { c,-s,0,0, s,c,0,0, 0,0,1,0, 0,0,0,1 }; }
+
+		// Right handed perspective projection (the camera looks towards -z), the visible depth is mapped to [-1, 1]
+		static Matrix4 Perspective(float fovY, float aspect, float zNear, float zFar)
+		{
+			float f = 1.0f / tanf(fovY * 0.5f);
+			return { f / aspect,0,0,0, 0,f,0,0, 0,0,(zFar + zNear) / (zNear - zFar),(2.0f * zFar * zNear) / (zNear - zFar), 0,0,-1,0 };
+		}
+
+		// View matrix of a camera at eye looking at target
+		static Matrix4 LookAt(const Vector3& eye, const Vector3& target, const Vector3& up)
+		{
+			Vector3 f = (target - eye).Normalized();
+			Vector3 s = f.Cross(up).Normalized();
+			Vector3 u = s.Cross(f);
+			return { s.x,s.y,s.z,-s.Dot(eye), u.x,u.y,u.z,-u.Dot(eye), -f.x,-f.y,-f.z,f.Dot(eye), 0,0,0,1 };
+		}
+	};
+
+	/// <summary>
+	/// <para> A triangle mesh, the positions are stored as separate x, y and z arrays so they can be transformed 4 at a time. </para>
+	/// <para> Triangles are counter-clockwise when seen from the front, every triangle has its own color. </para>
+	/// </summary>
+	class Mesh
+	{
+	public:
+		std::vector<float> m_x, m_y, m_z; // Vertex positions
+		std::vector<UINT32> m_indices; // 3 vertex indices per triangle
+		std::vector<Console::Color> m_colors; // Color of each triangle
+		Vector3 m_min = { FLT_MAX, FLT_MAX, FLT_MAX }, m_max = { -FLT_MAX, -FLT_MAX, -FLT_MAX }; // Bounding box, updated by AddVertex()
+
+	public:
+		// Returns the index of the vertex
+		UINT32 AddVertex(float x, float y, float z)
+		{
+			m_x.push_back(x);
+			m_y.push_back(y);
+			m_z.push_back(z);
+			m_min = { (std::min)(m_min.x, x), (std::min)(m_min.y, y), (std::min)(m_min.z, z) };
+			m_max = { (std::max)(m_max.x, x), (std::max)(m_max.y, y), (std::max)(m_max.z, z) };
+			return (UINT32)m_x.size() - 1;
+		}
+
+		void AddTriangle(UINT32 a, UINT32 b, UINT32 c, Console::Color color)
+		{
+			m_indices.push_back(a);
+			m_indices.push_back(b);
+			m_indices.push_back(c);
+			m_colors.push_back(color);
+		}
+
+		size_t VertexCount() const { return m_x.size(); }
+		size_t TriangleCount() const { return m_colors.size(); }
+
+		// Cube of size 1 centered on the origin, one color per face (Color + 1 for every face)
+		static Mesh Cube(Console::Color color)
+		{
+			Mesh mesh;
+			for (int i = 0; i < 8; i++)
+				mesh.AddVertex(i & 1 ? 0.5f : -0.5f, i & 2 ? 0.5f : -0.5f, i & 4 ? 0.5f : -0.5f);
+
+			static const UINT32 faces[6][4] = { { 0,4,6,2 }, { 1,3,7,5 }, { 0,1,5,4 }, { 2,6,7,3 }, { 0,2,3,1 }, { 4,5,7,6 } };
+			for (int face = 0; face < 6; face++)
+			{
+				Console::Color faceColor = (Console::Color)(((int)color + face) % 16);
+				mesh.AddTriangle(faces[face][0], faces[face][1], faces[face][2], faceColor);
+				mesh.AddTriangle(faces[face][0], faces[face][2], faces[face][3], faceColor);
+			}
+			return mesh;
+		}
+
+		// Torus around the y axis, 2 * rings * sides triangles
+		static Mesh Torus(float radius, float thickness, int rings, int sides, Console::Color color)
+		{
+			Mesh mesh;
+			for (int ring = 0; ring < rings; ring++)
+			{
+				float u = ring * 6.2831853f / rings;
+				for (int side = 0; side < sides; side++)
+				{
+					float v = side * 6.2831853f / sides;
+					float r = radius + thickness * cosf(v);
+					mesh.AddVertex(r * cosf(u), thickness * sinf(v), r * sinf(u));
+				}
+			}
+
+			for (int ring = 0; ring < rings; ring++)
+			{
+				for (int side = 0; side < sides; side++)
+				{
+					UINT32 a = ring * sides + side, b = ((ring + 1) % rings) * sides + side;
+					UINT32 c = ((ring + 1) % rings) * sides + (side + 1) % sides, d = ring * sides + (side + 1) % sides;
+					mesh.AddTriangle(a, d, c, color);
+					mesh.AddTriangle(a, c, b, color);
+				}
+			}
+			return mesh;
+		}
+	};
+
+	/// <summary>
+	/// <para> Draws meshes on a console with a per cell depth buffer and flat shading. </para>
+	/// <para> Call Begin() every frame before drawing, the shading uses the shade glyphs over the dark and bright version of the triangle color. </para>
+	/// </summary>
+	class Renderer3D
+	{
+	private:
+		// A vertex after the projection, x,y,z are divided by w
+		struct ScreenVertex { float x, y, z; };
+		// A vertex before the perspective divide
+		struct ClipVertex { float x, y, z, w; };
+
+		std::vector<float> m_depth; // Depth of every cell, smaller is closer
+		int m_width = 0, m_height = 0;
+
+		Matrix4 m_view = Matrix4::Identity();
+		Matrix4 m_projection = Matrix4::Identity();
+		Vector3 m_light = { 0.0f, -1.0f, 0.0f }; // Direction the light goes to, in world space
+		float m_ambient = 0.2f;
+
+		std::vector<float> m_clipX, m_clipY, m_clipZ, m_clipW; // Transformed vertices of the current mesh
+		UINT64 m_trianglesDrawn = 0; // Triangles that reached the rasterizer since Begin()
+
+	public:
+		// Clear the depth buffer (resized to the console if needed)
+		void Begin(const Console& console)
+		{
+			m_width = console.Width();
+			m_height = console.Height();
+			m_depth.assign((size_t)m_width * m_height, FLT_MAX);
+			m_trianglesDrawn = 0;
+		}
+
+		void SetCamera(const Matrix4& view, const Matrix4& projection)
+		{
+			m_view = view;
+			m_projection = projection;
+		}
+
+		// direction is where the light goes to, ambient is the minimum intensity
+		void SetLight(const Vector3& direction, float ambient = 0.2f)
+		{
+			m_light = direction.Normalized();
+			m_ambient = ambient;
+		}
+
+		UINT64 TrianglesDrawn() const { return m_trianglesDrawn; }
+
+		// Draw a mesh transformed by model, wireframe draws the edges of the visible triangles without depth test
+		void DrawMesh(Console& console, const Mesh& mesh, const Matrix4& model, bool wireframe = false)
+		{
+			const Matrix4 mvp = m_projection * m_view * model;
+			if (mesh.VertexCount() == 0 || IsCulled(mvp, mesh))
+				return;
+			const Matrix4 normals = model.NormalMatrix(); // Stays perpendicular to the faces under non-uniform scale
+
+			// Transform all the vertices to clip space
+			const size_t count = mesh.VertexCount();
+			m_clipX.resize(count);
+			m_clipY.resize(count);
+			m_clipZ.resize(count);
+			m_clipW.resize(count);
+			Transform(mvp, mesh.m_x.data(), mesh.m_y.data(), mesh.m_z.data(), count, m_clipX.data(), m_clipY.data(), m_clipZ.data(), m_clipW.data());
+
+			for (size_t triangle = 0; triangle < mesh.TriangleCount(); triangle++)
+			{
+				const UINT32* index = &mesh.m_indices[triangle * 3];
+				ClipVertex v[3];
+				int outside = 0x3F; // Planes all the vertices are outside of
+				for (int i = 0; i < 3; i++)
+				{
+					v[i] = { m_clipX[index[i]], m_clipY[index[i]], m_clipZ[index[i]], m_clipW[index[i]] };
+					outside &= OutCode(v[i]);
+				}
+				if (outside != 0) // Outside of the frustum
+					continue;
+
+				// Flat shading with the world space normal
+				Vector3 a = { mesh.m_x[index[0]], mesh.m_y[index[0]], mesh.m_z[index[0]] };
+				Vector3 b = { mesh.m_x[index[1]], mesh.m_y[index[1]], mesh.m_z[index[1]] };
+				Vector3 c = { mesh.m_x[index[2]], mesh.m_y[index[2]], mesh.m_z[index[2]] };
+				Vector3 normal = normals.TransformDirection((b - a).Cross(c - a)).Normalized();
+				float intensity = m_ambient + (1.0f - m_ambient) * (std::max)(0.0f, -normal.Dot(m_light));
+				Console::Pixel pixel = wireframe ? Console::Pixel(mesh.m_colors[triangle]) : Shade(mesh.m_colors[triangle], intensity);
+
+				// Clip against the near plane (z > -w), the other planes are handled by the rasterizer
+				ClipVertex polygon[4];
+				int vertexCount = ClipNear(v, polygon);
+				ScreenVertex screen[4];
+				for (int i = 0; i < vertexCount; i++)
+					screen[i] = ToScreen(polygon[i]);
+
+				for (int i = 1; i + 1 < vertexCount; i++)
+				{
+					if (wireframe)
+						DrawEdges(console, screen[0], screen[i], screen[i + 1], pixel);
+					else
+						Rasterize(console, screen[0], screen[i], screen[i + 1], pixel);
+				}
+			}
+		}
+
+		// Shade of a color for an intensity in [0, 1] : black, then the dark color, then the bright color using the shade glyphs
+		static Console::Pixel Shade(Console::Color color, float intensity)
+		{
+			using Type = Console::Pixel::Type;
+			static const Type glyphs[4] = { Type::Quarter, Type::Half, Type::ThreeQuarters, Type::Full };
+
+			int base = (int)color & 7;
+			Console::Color dark = (Console::Color)(base == 7 || base == 0 ? 8 : base); // Grey and black use dark grey as their dark version
+			Console::Color bright = (Console::Color)(base == 0 ? 7 : base | 8);
+
+			int level = (int)((std::min)((std::max)(intensity, 0.0f), 1.0f) * 8.0f + 0.5f);
+			if (level == 0)
+				return Console::Pixel(Console::Color::Black, Console::Color::Black, Type::Full);
+			if (level <= 4)
+				return Console::Pixel(dark, Console::Color::Black, glyphs[level - 1]);
+			return Console::Pixel(bright, dark, glyphs[level - 5]);
+		}
+
+		// Transform count positions by m, 4 at a time using SSE
+		static void Transform(const Matrix4& m, const float* x, const float* y, const float* z, size_t count, float* outX, float* outY, float* outZ, float* outW)
+		{
+			__m128 rows[4][4];
+			for (int row = 0; row < 4; row++)
+			{
+				for (int column = 0; column < 4; column++)
+					rows[row][column] = _mm_set1_ps(m(row, column));
+			}
+
+			size_t i = 0;
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+				float* outputs[4] = { outX, outY, outZ, outW };
+				for (int row = 0; row < 4; row++)
+				{
+					__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rows[row][0], vx), _mm_mul_ps(rows[row][1], vy)),
+						_mm_add_ps(_mm_mul_ps(rows[row][2], vz), rows[row][3]));
+					_mm_storeu_ps(outputs[row] + i, r);
+				}
+			}
+
+			for (; i < count; i++)
+			{
+				outX[i] = m(0, 0) * x[i] + m(0, 1) * y[i] + m(0, 2) * z[i] + m(0, 3);
+				outY[i] = m(1, 0) * x[i] + m(1, 1) * y[i] + m(1, 2) * z[i] + m(1, 3);
+				outZ[i] = m(2, 0) * x[i] + m(2, 1) * y[i] + m(2, 2) * z[i] + m(2, 3);
+				outW[i] = m(3, 0) * x[i] + m(3, 1) * y[i] + m(3, 2) * z[i] + m(3, 3);
+			}
+		}
+
+	private:
+		// Is the bounding sphere of the mesh outside of one of the frustum planes ? (planes extracted from the matrix)
+		static bool IsCulled(const Matrix4& mvp, const Mesh& mesh)
+		{
+			Vector3 center = (mesh.m_min + mesh.m_max) * 0.5f;
+			float radius = (mesh.m_max - mesh.m_min).Length() * 0.5f;
+			for (int plane = 0; plane < 6; plane++)
+			{
+				// Planes are row 3 +/- row 0, 1 or 2
+				float sign = plane & 1 ? -1.0f : 1.0f;
+				int row = plane / 2;
+				Vector3 normal = { mvp(3, 0) + sign * mvp(row, 0), mvp(3, 1) + sign * mvp(row, 1), mvp(3, 2) + sign * mvp(row, 2) };
+				float d = mvp(3, 3) + sign * mvp(row, 3);
+				if (normal.Dot(center) + d < -radius * normal.Length())
+					return true;
+			}
+			return false;
+		}
+
+		// One bit per frustum plane the vertex is outside of
+		static int OutCode(const ClipVertex& v)
+		{
+			return (v.x < -v.w) | (v.x > v.w) << 1 | (v.y < -v.w) << 2 | (v.y > v.w) << 3 | (v.z < -v.w) << 4 | (v.z > v.w) << 5;
+		}
+
+		// Sutherland-Hodgman against z = -w, returns the number of vertices in out (0, 3 or 4)
+		static int ClipNear(const ClipVertex* in, ClipVertex* out)
+		{
+			int count = 0;
+			for (int i = 0; i < 3; i++)
+			{
+				const ClipVertex& a = in[i];
+				const ClipVertex& b = in[(i + 1) % 3];
+				float da = a.z + a.w, db = b.z + b.w; // >= 0 when inside
+				if (da >= 0.0f)
+					out[count++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+				{
+					float t = da / (da - db);
+					out[count++] = { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t };
+				}
+			}
+			return count;
+		}
+
+		// Perspective divide and viewport (y goes down on the console)
+		ScreenVertex ToScreen(const ClipVertex& v) const
+		{
+			float invW = 1.0f / (std::max)(v.w, 1e-6f);
+			return { (v.x * invW * 0.5f + 0.5f) * m_width, (0.5f - v.y * invW * 0.5f) * m_height, v.z * invW };
+		}
+
+		// Edge function, > 0 when p is on the right of a->b on the screen
+		static float Edge(const ScreenVertex& a, const ScreenVertex& b, float px, float py)
+		{
+			return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+		}
+
+		// Fill the cells whose center is inside the triangle and closer than the depth buffer
+		void Rasterize(Console& console, ScreenVertex v0, ScreenVertex v1, ScreenVertex v2, const Console::Pixel& pixel)
+		{
+			float area = Edge(v0, v1, v2.x, v2.y);
+			if (area >= 0.0f) // Back face (counter-clockwise triangles are clockwise once y points down) or degenerate
+				return;
+			std::swap(v1, v2);
+			area = -area;
+			m_trianglesDrawn++;
+
+			int x1 = (std::max)((int)floorf((std::min)({ v0.x, v1.x, v2.x })), 0), x2 = (std::min)((int)ceilf((std::max)({ v0.x, v1.x, v2.x })), m_width - 1);
+			int y1 = (std::max)((int)floorf((std::min)({ v0.y, v1.y, v2.y })), 0), y2 = (std::min)((int)ceilf((std::max)({ v0.y, v1.y, v2.y })), m_height - 1);
+
+			// The edge functions change by a constant for every step in x
+			const float invArea = 1.0f / area;
+			const float step0 = -(v2.y - v1.y), step1 = -(v0.y - v2.y), step2 = -(v1.y - v0.y);
+			for (int y = y1; y <= y2; y++)
+			{
+				float py = y + 0.5f, px = x1 + 0.5f;
+				float w0 = Edge(v1, v2, px, py), w1 = Edge(v2, v0, px, py), w2 = Edge(v0, v1, px, py);
+				for (int x = x1; x <= x2; x++, w0 += step0, w1 += step1, w2 += step2)
+				{
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+						continue;
+
+					float z = (w0 * v0.z + w1 * v1.z + w2 * v2.z) * invArea;
+					float& depth = m_depth[y * m_width + x];
+					if (z < depth && z >= -1.0f && z <= 1.0f) // Between the near and far planes
+					{
+						depth = z;
+						console.Draw(x, y, pixel);
+					}
+				}
+			}
+		}
+
+		void DrawEdges(Console& console, const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2, const Console::Pixel& pixel)
+		{
+			if (Edge(v0, v1, v2.x, v2.y) >= 0.0f) // Back face
+				return;
+			m_trianglesDrawn++;
+
+			const ScreenVertex* v[3] = { &v0, &v1, &v2 };
+			for (int i = 0; i < 3; i++)
+			{
+				const ScreenVertex& a = *v[i];
+				const ScreenVertex& b = *v[(i + 1) % 3];
+				console.DrawLine((int)floorf(a.x), (int)floorf(a.y), (int)floorf(b.x), (int)floorf(b.y), pixel);
+			}
+		}
+	};
+
+
+	/// <summary>
+	/// <para>Grid of occupied cells packed in 64-bit words, one bit per console cell (ex : the cells covered by the snake, the walls, the enemies)</para>
+	/// <para>Point queries and moves are O(1), rectangle queries AND and popcount whole words and do not depend on how many entities are in the grid</para>
+	/// </summary>
+	class OccupancyGrid
+	{
+	private:
+		int m_width, m_height;
+		int m_wordsPerRow; // Every row starts on a new word
+		std::vector<UINT64> m_bits;
+
+	public:
+		OccupancyGrid(int width, int height)
+			: m_width((std::max)(width, 0)), m_height((std::max)(height, 0)), m_wordsPerRow((m_width + 63) / 64),
+			m_bits((size_t)m_wordsPerRow * m_height, 0) {}
+
+		int Width() const { return m_width; }
+		int Height() const { return m_height; }
+
+		// Free every cell
+		void Clear() { std::fill(m_bits.begin(), m_bits.end(), 0); }
+
+		// Is x,y occupied ? false when x,y is outside of the grid
+		bool Test(int x, int y) const
+		{
+			if (!Inside(x, y))
+				return false;
+			return (m_bits[Word(x, y)] >> (x & 63)) & 1;
+		}
+
+		// Occupy x,y (ignored outside of the grid)
+		void Set(int x, int y)
+		{
+			if (Inside(x, y))
+				m_bits[Word(x, y)] |= 1ull << (x & 63);
+		}
+
+		// Free x,y (ignored outside of the grid)
+		void Reset(int x, int y)
+		{
+			if (Inside(x, y))
+				m_bits[Word(x, y)] &= ~(1ull << (x & 63));
+		}
+
+		// Move an occupant from one cell to another
+		void Move(int fromX, int fromY, int toX, int toY)
+		{
+			Reset(fromX, fromY);
+			Set(toX, toY);
+		}
+
+		// Occupy every cell of the rectangle
+		void SetRect(int x, int y, int width, int height) { ForEachWord(x, y, width, height, [&](size_t word, UINT64 mask) { m_bits[word] |= mask; return false; }); }
+
+		// Free every cell of the rectangle
+		void ResetRect(int x, int y, int width, int height) { ForEachWord(x, y, width, height, [&](size_t word, UINT64 mask) { m_bits[word] &= ~mask; return false; }); }
+
+		// Number of occupied cells in the rectangle
+		int Count(int x, int y, int width, int height) const
+		{
+			int count = 0;
+			ForEachWord(x, y, width, height, [&](size_t word, UINT64 mask) { count += PopCount(m_bits[word] & mask); return false; });
+			return count;
+		}
+
+		// Is any cell of the rectangle occupied ? Stops at the first occupied word
+		bool Any(int x, int y, int width, int height) const
+		{
+			return ForEachWord(x, y, width, height, [&](size_t word, UINT64 mask) { return (m_bits[word] & mask) != 0; });
+		}
+
+		// Number of cells of the rectangle occupied in both grids, the grids must have the same size
+		int CountOverlap(const OccupancyGrid& other, int x, int y, int width, int height) const
+		{
+			if (other.m_width != m_width || other.m_height != m_height)
+				return 0;
+
+			int count = 0;
+			ForEachWord(x, y, width, height, [&](size_t word, UINT64 mask) { count += PopCount(m_bits[word] & other.m_bits[word] & mask); return false; });
+			return count;
+		}
+
+		// Is a cell of the rectangle occupied in both grids ? The grids must have the same size
+		bool Overlaps(const OccupancyGrid& other, int x, int y, int width, int height) const
+		{
+			if (other.m_width != m_width || other.m_height != m_height)
+				return false;
+
+			return ForEachWord(x, y, width, height, [&](size_t word, UINT64 mask) { return (m_bits[word] & other.m_bits[word] & mask) != 0; });
+		}
+
+		// Occupancy of the 64 cells x to x + 63 of row y, bit i is x + i. The cells outside of the grid are free
+		UINT64 Bits(int x, int y) const
+		{
+			if (y < 0 || y >= m_height || x >= m_width || x <= -64)
+				return 0;
+
+			const size_t row = (size_t)y * m_wordsPerRow;
+			auto word = [&](int w) { return w >= 0 && w < m_wordsPerRow ? m_bits[row + w] : 0ull; };
+			const int first = x >= 0 ? x / 64 : -1, shift = x - first * 64;
+			return shift == 0 ? word(first) : (word(first) >> shift) | (word(first + 1) << (64 - shift));
+		}
+
+	private:
+		bool Inside(int x, int y) const { return x >= 0 && x < m_width && y >= 0 && y < m_height; }
+		size_t Word(int x, int y) const { return (size_t)y * m_wordsPerRow + (x >> 6); }
+
+		// Calls function(word index, mask) for every word touched by the rectangle (clipped to the grid), mask selects the bits inside of the rectangle
+		// Stops and returns true as soon as function returns true
+		template<class Function>
+		bool ForEachWord(int x, int y, int width, int height, Function&& function) const
+		{
+			int x1 = (std::max)(x, 0), x2 = (std::min)(x + width, m_width); // x2 and y2 are excluded
+			int y1 = (std::max)(y, 0), y2 = (std::min)(y + height, m_height);
+			if (x1 >= x2 || y1 >= y2)
+				return false;
+
+			const int firstWord = x1 >> 6, lastWord = (x2 - 1) >> 6;
+			const UINT64 firstMask = ~0ull << (x1 & 63);
+			const UINT64 lastMask = ~0ull >> (63 - ((x2 - 1) & 63));
+
+			for (int row = y1; row < y2; row++)
+			{
+				const size_t rowStart = (size_t)row * m_wordsPerRow;
+				for (int w = firstWord; w <= lastWord; w++)
+				{
+					UINT64 mask = ~0ull;
+					if (w == firstWord)
+						mask &= firstMask;
+					if (w == lastWord)
+						mask &= lastMask;
+					if (function(rowStart + w, mask))
+						return true;
+				}
+			}
+			return false;
+		}
+
+		static int PopCount(UINT64 value)
+		{
+#ifdef _MSC_VER
+			return (int)(__popcnt((unsigned int)value) + __popcnt((unsigned int)(value >> 32))); // __popcnt64 does not exist in 32-bit builds
+#else
+			return __builtin_popcountll(value);
+#endif
+		}
+	};
+
+
+	/// <summary>
+	/// <para> Shortest paths on a grid whose occupied cells (an OccupancyGrid) are walls : A* or jump point search, one query or a batch run in parallel on the JobSystem. </para>
+	/// <para> Moves go to the 4 or 8 neighbors, a straight step costs StraightCost and a diagonal one DiagonalCost. Diagonals never cut the corner of a wall. </para>
+	/// <para> A search works on flat arrays with one node per cell (12 bytes) and a binary heap, reused by the next searches : a node is valid when it was stamped by the current search, so nothing is cleared between searches. </para>
+	/// </summary>
+	class Pathfinder
+	{
+	public:
+		enum class Moves { Four, Eight };
+		enum class Algorithm
+		{
+			AStar,
+			JumpPoint // Skips the straight lines of open cells, much faster on open maps. Needs Moves::Eight, it is A* with Moves::Four
+		};
+
+		struct Point
+		{
+			int x, y;
+
+			bool operator==(const Point& other) const { return x == other.x && y == other.y; }
+			bool operator!=(const Point& other) const { return !(*this == other); }
+		};
+
+		struct Query { Point start, goal; };
+
+		static constexpr UINT32 StraightCost = 10;
+		static constexpr UINT32 DiagonalCost = 14;
+
+		// Neighbor offsets, the first 4 are straight
+		static constexpr int DirectionX[8] = { 1, 0, -1, 0, 1, -1, -1, 1 };
+		static constexpr int DirectionY[8] = { 0, 1, 0, -1, 1, 1, -1, -1 };
+
+	private:
+		struct NodeData
+		{
+			UINT32 stamp; // Generation of the search when open, generation + 1 when closed
+			UINT32 cost; // From the start
+			UINT32 parent;
+		};
+
+		struct OpenData
+		{
+			UINT64 key; // (estimated total cost << 32) | estimate to the goal : ties go to the node closest to the goal
+			UINT32 node;
+
+			bool operator>(const OpenData& other) const { return key > other.key; }
+		};
+
+		struct SearchData
+		{
+			std::vector<NodeData> nodes;
+			std::vector<OpenData> open; // Binary heap
+			std::vector<Point> points; // Path of jump points before it is filled
+			UINT32 generation = 0;
+		};
+
+		const OccupancyGrid& m_walls;
+		Moves m_moves;
+		SearchData m_search; // Of FindPath()
+		std::vector<std::unique_ptr<SearchData>> m_batchSearches; // Of FindPaths(), one per thread
+
+	public:
+		// The walls are read by every search, they can change between searches
+		Pathfinder(const OccupancyGrid& walls, Moves moves = Moves::Four) : m_walls(walls), m_moves(moves) {}
+
+		int Width() const { return m_walls.Width(); }
+		int Height() const { return m_walls.Height(); }
+		Moves GetMoves() const { return m_moves; }
+
+		// Can x,y be walked on ? false outside of the grid
+		bool Free(int x, int y) const { return x >= 0 && x < m_walls.Width() && y >= 0 && y < m_walls.Height() && !m_walls.Test(x, y); }
+
+		// Can a move go from x,y to x + dx,y + dy ? (x,y must be free) Diagonals need both cells of the corner free
+		bool CanMove(int x, int y, int dx, int dy) const
+		{
+			return Free(x + dx, y + dy) && (dx == 0 || dy == 0 || (Free(x + dx, y) && Free(x, y + dy)));
+		}
+
+		// Cheapest cost between two cells on an empty grid (admissible heuristic)
+		UINT32 Estimate(Point from, Point to) const
+		{
+			const UINT32 dx = (UINT32)std::abs(to.x - from.x), dy = (UINT32)std::abs(to.y - from.y);
+			if (m_moves == Moves::Four)
+				return (dx + dy) * StraightCost;
+			return (std::max)(dx, dy) * StraightCost + (std::min)(dx, dy) * (DiagonalCost - StraightCost);
+		}
+
+		// Find a shortest path, with the start and the goal. Returns false (and an empty path) when the goal can not be reached
+		bool FindPath(Point start, Point goal, std::vector<Point>& path, Algorithm algorithm = Algorithm::AStar)
+		{
+			return Search(m_search, start, goal, path, algorithm);
+		}
+
+		/// <summary>
+		/// <para> Run the queries on every thread of the JobSystem, paths[i] is the path of queries[i] (empty when the goal can not be reached). </para>
+		/// <para> Each thread has its own nodes, 12 bytes per cell, kept for the next batches. Do not call FindPath() at the same time. </para>
+		/// </summary>
+		void FindPaths(const std::vector<Query>& queries, std::vector<std::vector<Point>>& paths, Algorithm algorithm = Algorithm::AStar)
+		{
+			paths.resize(queries.size());
+			const int runners = (int)(std::min)((size_t)JobSystem::ThreadCount(), queries.size());
+			while ((int)m_batchSearches.size() < runners)
+				m_batchSearches.push_back(std::make_unique<SearchData>());
+
+			// Every runner takes the next query until there are none left, so long searches do not leave threads idle
+			std::atomic<size_t> next = 0;
+			JobSystem::ParallelFor(0, runners, 1, [&](int runner)
+			{
+				for (size_t i = next++; i < queries.size(); i = next++)
+					Search(*m_batchSearches[runner], queries[i].start, queries[i].goal, paths[i], algorithm);
+			});
+		}
+
+	private:
+		UINT32 Index(int x, int y) const { return (UINT32)(y * m_walls.Width() + x); }
+		Point PointOf(UINT32 index) const { return { (int)(index % m_walls.Width()), (int)(index / m_walls.Width()) }; }
+
+		bool Search(SearchData& search, Point start, Point goal, std::vector<Point>& path, Algorithm algorithm) const
+		{
+			path.clear();
+			if (!Free(start.x, start.y) || !Free(goal.x, goal.y))
+				return false;
+			if (start == goal)
+			{
+				path.push_back(start);
+				return true;
+			}
+
+			// New generation, the stamps are only cleared when it wraps
+			const size_t size = (size_t)m_walls.Width() * m_walls.Height();
+			if (search.nodes.size() != size || search.generation >= 0xFFFFFFFD)
+			{
+				search.nodes.assign(size, { 0, 0, 0 });
+				search.generation = 0;
+			}
+			search.generation += 2;
+			search.open.clear();
+			const UINT32 open = search.generation, closed = search.generation + 1;
+			const bool jump = algorithm == Algorithm::JumpPoint && m_moves == Moves::Eight;
+
+			const UINT32 startIndex = Index(start.x, start.y), goalIndex = Index(goal.x, goal.y);
+			search.nodes[startIndex] = { open, 0, startIndex };
+			Push(search, startIndex, 0, Estimate(start, goal));
+
+			while (!search.open.empty())
+			{
+				const UINT32 index = Pop(search);
+				NodeData& node = search.nodes[index];
+				if (node.stamp == closed) // Already reached with a lower cost, the heap keeps the old entries
+					continue;
+				node.stamp = closed;
+
+				if (index == goalIndex)
+				{
+					BuildPath(search, goalIndex, path);
+					return true;
+				}
+
+				const Point point = PointOf(index);
+				auto reach = [&](int x, int y)
+				{
+					const UINT32 next = Index(x, y);
+					NodeData& neighbor = search.nodes[next];
+					if (neighbor.stamp == closed)
+						return;
+
+					const UINT32 cost = node.cost + Estimate(point, { x, y }); // Exact for a straight or diagonal line
+					if (neighbor.stamp != open || cost < neighbor.cost)
+					{
+						neighbor = { open, cost, index };
+						Push(search, next, cost, Estimate({ x, y }, goal));
+					}
+				};
+
+				if (jump)
+					JumpSuccessors(point, node.parent == index ? point : PointOf(node.parent), goal, reach);
+				else
+				{
+					const int directions = m_moves == Moves::Four ? 4 : 8;
+					for (int d = 0; d < directions; d++)
+						if (CanMove(point.x, point.y, DirectionX[d], DirectionY[d]))
+							reach(point.x + DirectionX[d], point.y + DirectionY[d]);
+				}
+			}
+			return false;
+		}
+
+		static void Push(SearchData& search, UINT32 index, UINT32 cost, UINT32 estimate)
+		{
+			search.open.push_back({ ((UINT64)(cost + estimate) << 32) | estimate, index });
+			std::push_heap(search.open.begin(), search.open.end(), std::greater<OpenData>());
+		}
+
+		static UINT32 Pop(SearchData& search)
+		{
+			std::pop_heap(search.open.begin(), search.open.end(), std::greater<OpenData>());
+			const UINT32 index = search.open.back().node;
+			search.open.pop_back();
+			return index;
+		}
+
+		// Follow the parents back to the start, then fill the straight and diagonal lines between the jump points
+		void BuildPath(SearchData& search, UINT32 goalIndex, std::vector<Point>& path) const
+		{
+			search.points.clear();
+			for (UINT32 index = goalIndex;; index = search.nodes[index].parent)
+			{
+				search.points.push_back(PointOf(index));
+				if (search.nodes[index].parent == index)
+					break;
+			}
+
+			path.push_back(search.points.back());
+			for (size_t i = search.points.size() - 1; i > 0; i--)
+			{
+				const Point from = search.points[i], to = search.points[i - 1];
+				const int dx = (to.x > from.x) - (to.x < from.x), dy = (to.y > from.y) - (to.y < from.y);
+				for (Point p = from; p != to;)
+				{
+					p.x += dx;
+					p.y += dy;
+					path.push_back(p);
+				}
+			}
+		}
+
+		// Jump point search with no corner cutting : the neighbors that can not be reached as cheaply without going through point are jumped to
+		template<class Reach>
+		void JumpSuccessors(Point point, Point parent, Point goal, Reach&& reach) const
+		{
+			const int x = point.x, y = point.y;
+			auto jumpTo = [&](int dx, int dy)
+			{
+				Point next;
+				if (Jump(x, y, dx, dy, goal, next))
+					reach(next.x, next.y);
+			};
+
+			if (point == parent) // Start : every direction
+			{
+				for (int d = 0; d < 8; d++)
+					jumpTo(DirectionX[d], DirectionY[d]);
+				return;
+			}
+
+			const int dx = (x > parent.x) - (x < parent.x), dy = (y > parent.y) - (y < parent.y);
+			if (dx != 0 && dy != 0)
+			{
+				jumpTo(dx, 0);
+				jumpTo(0, dy);
+				jumpTo(dx, dy);
+			}
+			else if (dx != 0)
+			{
+				jumpTo(dx, 0);
+				jumpTo(dx, 1);
+				jumpTo(dx, -1);
+				jumpTo(0, 1);
+				jumpTo(0, -1);
+			}
+			else
+			{
+				jumpTo(0, dy);
+				jumpTo(1, dy);
+				jumpTo(-1, dy);
+				jumpTo(1, 0);
+				jumpTo(-1, 0);
+			}
+		}
+
+		// Step from x,y in the direction until the goal, a cell with a forced neighbor (straight) or a cell whose straight jumps find one (diagonal)
+		bool Jump(int x, int y, int dx, int dy, Point goal, Point& result) const
+		{
+			if (dx != 0 && dy != 0)
+			{
+				while (CanMove(x, y, dx, dy))
+				{
+					x += dx;
+					y += dy;
+					Point straight;
+					if ((x == goal.x && y == goal.y) || Jump(x, y, dx, 0, goal, straight) || Jump(x, y, 0, dy, goal, straight))
+					{
+						result = { x, y };
+						return true;
+					}
+				}
+				return false;
+			}
+
+			if (dx != 0)
+				return JumpRow(x, y, dx, goal, result);
+
+			while (Free(x + dx, y + dy))
+			{
+				x += dx;
+				y += dy;
+				const bool forced = (Free(x - 1, y) && !Free(x - 1, y - dy)) || (Free(x + 1, y) && !Free(x + 1, y - dy));
+				if ((x == goal.x && y == goal.y) || forced)
+				{
+					result = { x, y };
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Horizontal jump 64 cells at a time : the first forced neighbor (a free cell above or below with a wall behind it) or the goal before the first wall of the row
+		bool JumpRow(int x, int y, int dx, Point goal, Point& result) const
+		{
+			for (int start = dx > 0 ? x + 1 : x - 64;; start += dx * 64) // Cells start to start + 63, the grid edges are walls so the loop ends
+			{
+				const int behind = start - dx;
+				const UINT64 walls = Blocked(start, y);
+				UINT64 stops = (~Blocked(start, y - 1) & Blocked(behind, y - 1)) | (~Blocked(start, y + 1) & Blocked(behind, y + 1));
+				if (goal.y == y && goal.x >= start && goal.x < start + 64)
+					stops |= 1ull << (goal.x - start);
+
+				if (dx > 0)
+				{
+					stops &= walls ? (walls ^ (walls - 1)) >> 1 : ~0ull; // Before the first wall
+					if (stops)
+					{
+						result = { start + LowestBit(stops), y };
+						return true;
+					}
+				}
+				else
+				{
+					const int wall = walls ? HighestBit(walls) : -1;
+					stops &= wall == 63 ? 0 : ~0ull << (wall + 1); // After the last wall
+					if (stops)
+					{
+						result = { start + HighestBit(stops), y };
+						return true;
+					}
+				}
+				if (walls)
+					return false;
+			}
+		}
+
+		// Walls of the 64 cells x to x + 63 of row y, bit i is x + i. The cells outside of the grid are walls
+		UINT64 Blocked(int x, int y) const
+		{
+			const int width = m_walls.Width();
+			if (y < 0 || y >= m_walls.Height())
+				return ~0ull;
+
+			UINT64 outside = 0;
+			if (x < 0)
+				outside |= x <= -64 ? ~0ull : ~0ull >> (64 + x);
+			if (x > width - 64)
+				outside |= x >= width ? ~0ull : ~0ull << (width - x);
+			return m_walls.Bits(x, y) | outside;
+		}
+
+		static int LowestBit(UINT64 value)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+#ifdef _WIN64
+			_BitScanForward64(&index, value);
+#else
+			if (!_BitScanForward(&index, (unsigned long)value)) // _BitScanForward64 does not exist in 32-bit builds
+			{
+				_BitScanForward(&index, (unsigned long)(value >> 32));
+				index += 32;
+			}
+#endif
+			return (int)index;
+#else
+			return __builtin_ctzll(value);
+#endif
+		}
+
+		static int HighestBit(UINT64 value)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+#ifdef _WIN64
+			_BitScanReverse64(&index, value);
+#else
+			if (_BitScanReverse(&index, (unsigned long)(value >> 32)))
+				index += 32;
+			else
+				_BitScanReverse(&index, (unsigned long)value);
+#endif
+			return (int)index;
+#else
+			return 63 - __builtin_clzll(value);
+#endif
+		}
+	};
+
+
+	/// <summary>
+	/// <para> Directions toward the closest goal from every cell of a grid, for many agents going to the same place (ex : enemies chasing the player). </para>
+	/// <para> Build() is a breadth-first search (Moves::Four) or a Dijkstra with a bucket queue (Moves::Eight) from the goals, the directions are then picked on the JobSystem. Each agent then only reads its cell with Next(). </para>
+	/// </summary>
+	class FlowField
+	{
+	public:
+		static constexpr UINT32 Unreachable = 0xFFFFFFFF;
+
+	private:
+		static constexpr UINT8 NoDirection = 0xFF;
+
+		Pathfinder m_grid; // Walls and moves, its searches are not used
+		std::vector<UINT32> m_distances; // Cost to the closest goal
+		std::vector<UINT8> m_directions; // Index in Pathfinder::DirectionX/Y, NoDirection at the goals and the unreachable cells
+		std::vector<UINT32> m_open; // Cells to visit (Moves::Four)
+		std::vector<UINT32> m_buckets[Pathfinder::DiagonalCost + 1]; // Cells to visit by cost modulo the bucket count (Moves::Eight), the step costs are small so they wrap without overlapping
+
+	public:
+		FlowField(const OccupancyGrid& walls, Pathfinder::Moves moves = Pathfinder::Moves::Four) : m_grid(walls, moves) {}
+
+		void Build(Pathfinder::Point goal) { Build(std::vector<Pathfinder::Point>{ goal }); }
+
+		// Compute the directions to the closest goal, call it again when the walls or the goals change
+		void Build(const std::vector<Pathfinder::Point>& goals)
+		{
+			const int width = m_grid.Width(), height = m_grid.Height();
+			m_distances.assign((size_t)width * height, Unreachable);
+			m_directions.assign((size_t)width * height, NoDirection);
+			m_open.clear();
+			for (const Pathfinder::Point& goal : goals)
+			{
+				if (m_grid.Free(goal.x, goal.y) && m_distances[goal.y * width + goal.x] != 0)
+				{
+					m_distances[goal.y * width + goal.x] = 0;
+					m_open.push_back(goal.y * width + goal.x);
+				}
+			}
+			const size_t goalCount = m_open.size();
+
+			if (m_grid.GetMoves() == Pathfinder::Moves::Four)
+			{
+				// Every step costs the same : the cells are reached in order of distance
+				for (size_t head = 0; head < m_open.size(); head++)
+				{
+					const int cell = (int)m_open[head], x = cell % width, y = cell / width;
+					for (int d = 0; d < 4; d++)
+					{
+						const int next = cell + Pathfinder::DirectionY[d] * width + Pathfinder::DirectionX[d];
+						if (m_grid.Free(x + Pathfinder::DirectionX[d], y + Pathfinder::DirectionY[d]) && m_distances[next] == Unreachable)
+						{
+							m_distances[next] = m_distances[cell] + Pathfinder::StraightCost;
+							m_open.push_back(next);
+						}
+					}
+				}
+			}
+			else
+			{
+				const UINT32 bucketCount = Pathfinder::DiagonalCost + 1;
+				m_buckets[0].swap(m_open);
+				size_t pending = goalCount;
+				for (UINT32 cost = 0; pending > 0; cost++)
+				{
+					std::vector<UINT32>& bucket = m_buckets[cost % bucketCount]; // Only the next buckets get new cells
+					for (size_t i = 0; i < bucket.size(); i++)
+					{
+						pending--;
+						const int cell = (int)bucket[i], x = cell % width, y = cell / width;
+						if (m_distances[cell] != cost) // Reached again with a lower cost
+							continue;
+
+						for (int d = 0; d < 8; d++)
+						{
+							if (!m_grid.CanMove(x, y, Pathfinder::DirectionX[d], Pathfinder::DirectionY[d]))
+								continue;
+
+							const int next = cell + Pathfinder::DirectionY[d] * width + Pathfinder::DirectionX[d];
+							const UINT32 nextCost = cost + (d < 4 ? Pathfinder::StraightCost : Pathfinder::DiagonalCost);
+							if (nextCost < m_distances[next])
+							{
+								m_distances[next] = nextCost;
+								m_buckets[nextCost % bucketCount].push_back(next);
+								pending++;
+							}
+						}
+					}
+					bucket.clear();
+				}
+			}
+
+			// Each cell goes to the neighbor on its shortest path, rows in parallel
+			const int directions = m_grid.GetMoves() == Pathfinder::Moves::Four ? 4 : 8;
+			JobSystem::ParallelFor(0, height, 16, [&](int y)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					const int cell = y * width + x;
+					if (m_distances[cell] == 0 || m_distances[cell] == Unreachable)
+						continue;
+
+					for (int d = 0; d < directions; d++)
+					{
+						const UINT32 step = d < 4 ? Pathfinder::StraightCost : Pathfinder::DiagonalCost;
+						if (m_grid.CanMove(x, y, Pathfinder::DirectionX[d], Pathfinder::DirectionY[d]) &&
+							m_distances[cell + Pathfinder::DirectionY[d] * width + Pathfinder::DirectionX[d]] + step == m_distances[cell])
+						{
+							m_directions[cell] = (UINT8)d;
+							break;
+						}
+					}
+				}
+			});
+		}
+
+		int Width() const { return m_grid.Width(); }
+		int Height() const { return m_grid.Height(); }
+
+		// Cost from x,y to the closest goal (Pathfinder::StraightCost per straight step), Unreachable for the walls, the cells outside and the cells with no path
+		UINT32 Distance(int x, int y) const
+		{
+			if (x < 0 || x >= Width() || y < 0 || y >= Height() || m_distances.empty())
+				return Unreachable;
+			return m_distances[y * Width() + x];
+		}
+
+		// The next cell toward the closest goal, false at a goal and when no goal can be reached
+		bool Next(int x, int y, Pathfinder::Point& next) const
+		{
+			if (x < 0 || x >= Width() || y < 0 || y >= Height() || m_directions.empty())
+				return false;
+
+			const UINT8 d = m_directions[y * Width() + x];
+			if (d == NoDirection)
+				return false;
+			next = { x + Pathfinder::DirectionX[d], y + Pathfinder::DirectionY[d] };
+			return true;
+		}
+	};
+
+
+	/// <summary>
+	/// <para> A derivable class to allow objects to be serialized and deserialized. </para>
+	/// <para> The Pop() and Push() functions work from the same starting point : you need to pop in the same order you pushed </para>
+	/// <para> The output format is : "arg1,arg2,arg3,..." with a trailing comma. </para>
+	/// </summary>
+	class UserData
+	{
+	private:
+		std::vector<std::string> m_data; // The strings are reused between calls, only the first m_size are used
+		size_t m_size = 0;
+		size_t m_next = 0; // Next string returned by Pop()
+
+	public:
+		// Convert the object to a string
+		bool ToString(std::string& out) 
+		{
+			m_size = m_next = 0; // clear the data
+			bool success = Serialize();
+
+			// Copy the data to the output string
+			out.clear();
+			for (size_t i = 0; i < m_size; i++)
+			{
+				out += m_data[i];
+				out += ',';
+			}
+
+			return success;
+		}
+
+		// Update this object using a string
+		bool FromString(const std::string& in)
+		{
+			m_size = m_next = 0; // Clear the data
+
+			// Split the input
+			size_t start = 0;
+			for (size_t i = 0; i < in.length(); i++)
+			{
+				if (in[i] == ',')
+				{
+					Next().assign(in, start, i - start);
+					start = i + 1;
+				}
+			}
+
+			return Deserialize();
+		}
+
+	protected:
+		virtual bool Serialize() = 0; // Use Push() to serialize the object
+		virtual bool Deserialize() = 0; // Use Pop() to form the object
+
+		// Push a new argument
+		void Push(const std::string& value)
+		{
+			Next().assign(value);
+		}
+
+		// Pop the next argument, a view of the string read by FromString() : valid until the next FromString() or ToString()
+		std::string_view Pop()
+		{
+			if (m_next >= m_size)
+				return {};
+			return m_data[m_next++];
+		}
+
+		// Pop the next argument as a number, returns false if it is not one
+		template<class T>
+		bool Pop(T& value)
+		{
+			const std::string_view text = Pop();
+			return std::from_chars(text.data(), text.data() + text.size(), value).ec == std::errc();
+		}
+
+	private:
+		// Slot for a new argument, reuses the strings of the previous calls
+		std::string& Next()
+		{
+			if (m_size == m_data.size())
+				m_data.emplace_back();
+			return m_data[m_size++];
+		}
+	};
+
+	// Int UserData type
+	class IntData : public UserData
+	{
+	public:
+		int value;
+
+		IntData(int v) : value (v){}
+
+	protected:
+		bool Serialize() override
+		{
+			Push(std::to_string(value));
+			return true;
+		}
+
+		bool Deserialize() override
+		{
+			return Pop(value);
+		}
+	};
+
+	// Float UserData type
+	class FloatData : public UserData
+	{
+	public:
+		float value;
+
+		FloatData(float v) : value(v) {}
+	protected:
+		bool Serialize() override
+		{
+			Push(std::to_string(value));
+			return true;
+		}
+
+		bool Deserialize() override
+		{
+			return Pop(value);
+		}
+	};
+	
+	// String UserData type
+	class StringData : public UserData
+	{
+	public:
+		std::string value;
+
+		StringData(std::string v) : value(v) {}
+	protected:
+		bool Serialize() override
+		{
+			Push(value);
+			return true;
+		}
+
+		bool Deserialize() override
+		{
+			value.assign(Pop()); // Reuses the capacity of value
+			return true;
+		}
+	};
+
+	/// <summary>
+	/// <para> A very primitive way to store and load user data. The data is stored in a (key,value) pair. </para>
+	/// <para> Both the key and the value are string and should not contain newlines (\n) or commas (,): See UserData::SanitizeString. </para>
+	/// <para> The output file will contain the data a the key=value format. </para>
+	/// </summary>
+	class Archive
+	{
+	public:
+		// The file extention used to create and access the files
+		static std::string m_fileExtension; // ".userdata"
+	private:
+		std::wstring m_filePath; // Path to the file to use
+
+		std::map<std::string, std::string> m_cache; // Cached values
+
+		constexpr static char KeyValueSeparator = '='; // Separator used in the output file
+
+	public:
+		Archive(const std::string& appName, const std::string& fileName)
+		{
+			m_filePath = GetFolder(appName) + L"\\" + StringToWString(fileName) + StringToWString(m_fileExtension);
+			GetCache();
+		}
+
+		// The folder of the files of an app (LocalAppData\RexConsoleEngine\appName), created if needed
+		static std::wstring GetFolder(const std::string& appName)
+		{
+			wchar_t* appDataPath = 0;
+			SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, NULL, &appDataPath);
+
+			std::wstring folder = appDataPath;
+			folder += L"\\RexConsoleEngine";
+			CreateDirectory(folder.c_str(), NULL); // Make the RexGameEngine folder (if it does not exist)
+			folder += L"\\" + StringToWString(appName);
+			CreateDirectory(folder.c_str(), NULL); // Make the app specific folder (if it does not exist)
+			CoTaskMemFree(static_cast<void*>(appDataPath)); // Free the memory used by GetKnownFolderPath
+			return folder;
+		}
+
+		// Get the value at the key, returns true for success
+		bool Get(const std::string& key, UserData& outValue)
+		{
+			auto iterator = m_cache.find(key);
+			if (iterator == m_cache.end()) // Not found in cache, reload it
+			{
+				GetCache();
+				iterator = m_cache.find(key);
+			}
+
+			if (iterator == m_cache.end()) // Not found again
+				return false;
+
+			return outValue.FromString(iterator->second);
+		}
+
+		// Get all of the data in the Archive as strings, valid until the next call
+		const std::map<std::string, std::string>& GetAll(bool reloadCache = true)
+		{
+			if (reloadCache)
+				GetCache();
+			return m_cache;
+		}
+
+		// Returns true for success, the key and value are sanitized
+		bool Set(std::string& key, UserData& value)
+		{
+			std::string strValue;
+			if (!value.ToString(strValue))
+				return false;
+
+			SanitizeString(key);
+			SanitizeString(strValue);
+
+			GetCache(); // Update the cache before any save operations
+
+
+			if (m_cache.find(key) == m_cache.end()) // Not in cache, so also not in the file
+			{
+				std::ofstream file(m_filePath, std::ios::app);
+				if (!file.is_open())
+					return false;
+
+				m_cache.insert({ key, strValue }); // Keep the cache updated
+				file.seekp(file.end); // Add to the end of the file
+				file << key << KeyValueSeparator << strValue << std::endl;
+				file.close();
+			}
+			else if (strValue != m_cache[key]) // Not in the cache, write the file from scratch
+			{
+				// Copy the file
+				const std::wstring tempPath = m_filePath + L".temp";
+				std::ifstream src(m_filePath);
+				std::ofstream dst(tempPath);
+				if (!src.is_open() || !dst.is_open())
+					return false;
+
+				dst << src.rdbuf();
+				src.close();
+				dst.close();
+
+				// Copy the data back, but change the value
+				std::ifstream temp(tempPath);
+				std::ofstream file(m_filePath, std::ios::trunc);
+				if (!temp.is_open() || !file.is_open())
+					return false;
+
+				std::string line;
+				while (getline(temp, line))
+				{
+					auto foundPos = line.find(key);
+					if (foundPos == 0) // If the key was found at the start of the line (so it's not a value)
+					{
+						file << key << KeyValueSeparator << strValue << std::endl;
+					}
+					else
+						file << line << std::endl;
+				}
+
+				temp.close();
+				file.close();
+
+				// Delete the temp file
+				DeleteFile(tempPath.c_str());
+			} // else : the new value was the same as the old
+
+			return true;
+		}
+
+		static void SanitizeString(std::string& str)
+		{
+			// Change \n to spaces and , to .
+			for (int i = 0; i < str.length(); i++)
+			{
+				if (str[i] == '\n')
+					str[i] = ' ';
+				else if (str[i] == ',')
+					str[i] = '.';
+			}
+		}
+
+	private:
+
+		void GetCache()
+		{
+			std::ifstream file(m_filePath);
+
+			if (!file.is_open())
+				return;
+
+			m_cache.clear();
+
+			for (std::string line; getline(file, line); )
+			{
+				std::size_t splitPos = line.find(KeyValueSeparator);
+				if (splitPos != std::string::npos)
+				{
+					// Dont include spaces either side of the =
+					std::string key = line.substr(0, line[splitPos - 1] == ' ' ? splitPos - 1 : splitPos);
+					std::string value = line.substr(line[splitPos + 1] == ' ' ? splitPos + 2 : splitPos + 1);
+					if (!key.empty() && !value.empty())
+						m_cache.insert({ key, value });
+				}
+			}
+			file.close();
+		}
+	};
+	inline std::string Archive::m_fileExtension(".userdata");
+
+
+	/// <summary>
+	/// <para> The best score of every player in rank order : Submit(), Rank() and Get() cost O(log n), Top() and Range() O(log n + count). </para>
+	/// <para> The scores are in a treap (a search tree kept balanced by random priorities) where every node knows the size of its subtree : the rank of a node is the number of nodes left of it. </para>
+	/// <para> The file, next to the Archives of the app, is a log : a better score appends a record instead of rewriting the file like Archive::Set(). </para>
+	/// <para> The log is rewritten in rank order when it holds twice as many records as players (or on open, when most records were appended) : records in rank order open without sorting. </para>
+	/// </summary>
+	class Leaderboard
+	{
+	public:
+		// The file extention used to create and access the files
+		static std::string m_fileExtension; // ".leaderboard"
+
+		struct Entry
+		{
+			std::string name;
+			INT64 score;
+			size_t rank; // 0 is the best score
+		};
+
+	private:
+		struct NodeData
+		{
+			INT64 score;
+			UINT64 order; // Record of the score in the log, the first player to reach a score ranks higher
+			UINT32 priority; // Higher than the priorities of the subtree
+			UINT32 size; // Nodes in the subtree
+			UINT32 left, right;
+		};
+
+		static constexpr UINT32 None = 0xFFFFFFFF;
+		static constexpr UINT64 Empty = ~0ull;
+		static constexpr UINT32 FileMagic = 0x424C5852; // "RXLB"
+		static constexpr size_t MinCompactRecords = 1024; // Small logs are never rewritten
+
+		std::wstring m_filePath;
+		std::ofstream m_log; // Open at the end of the file
+
+		std::vector<NodeData> m_nodes;
+		std::vector<std::string> m_names; // Name of each node
+		std::vector<UINT64> m_players; // Node of each name : open addressing on HashName(), high 32 bits of the hash then node (Empty when unused), at most half full
+		UINT32 m_root;
+		UINT64 m_records; // Records in the file, the order of the next one
+		UINT32 m_seed; // Priorities (xorshift32)
+
+		std::vector<UINT32> m_stack; // Reused by Range(), Build() and Compact()
+
+	public:
+		Leaderboard(const std::string& appName, const std::string& fileName)
+			: m_root(None), m_records(0), m_seed(0x9E3779B9)
+		{
+			m_filePath = Archive::GetFolder(appName) + L"\\" + StringToWString(fileName) + StringToWString(m_fileExtension);
+			Load();
+		}
+
+		size_t Count() const { return m_nodes.size(); }
+
+		// Keep the score if it is the best of the player, returns true if it was
+		bool Submit(const std::string& name, INT64 score)
+		{
+			const UINT64 hash = HashName(name);
+			UINT32 node = Find(name, hash);
+			if (node != None)
+			{
+				if (score <= m_nodes[node].score)
+					return false;
+
+				m_root = Erase(m_root, node);
+			}
+			else
+				node = Add(name, hash);
+
+			Place(node, score, m_records);
+			Append(name, score);
+
+			if (m_records >= MinCompactRecords && m_records > 2 * m_nodes.size())
+				Compact();
+			return true;
+		}
+
+		// The best score of the player, false if the player has none
+		bool Get(const std::string& name, Entry& out) const
+		{
+			const UINT32 node = Find(name, HashName(name));
+			if (node == None)
+				return false;
+
+			out.name = name;
+			out.score = m_nodes[node].score;
+			out.rank = RankOf(node);
+			return true;
+		}
+
+		// Rank of the player (0 is the best score), -1 if the player has no score
+		INT64 Rank(const std::string& name) const
+		{
+			const UINT32 node = Find(name, HashName(name));
+			return node == None ? -1 : (INT64)RankOf(node);
+		}
+
+		// The count best scores, best first
+		void Top(size_t count, std::vector<Entry>& out) { Range(0, count, out); }
+
+		// The scores of rank first to first + count - 1, or less at the end of the board (ex : the players around one, from Rank())
+		void Range(size_t first, size_t count, std::vector<Entry>& out)
+		{
+			out.clear();
+			if (first >= m_nodes.size() || count == 0)
+				return;
+
+			// Go down to the node of rank first, keeping the nodes after it on the way (the ones left of the path are before it)
+			m_stack.clear();
+			size_t index = first;
+			for (UINT32 node = m_root; ; )
+			{
+				const size_t before = Size(m_nodes[node].left);
+				if (index < before)
+				{
+					m_stack.push_back(node);
+					node = m_nodes[node].left;
+				}
+				else if (index > before)
+				{
+					index -= before + 1;
+					node = m_nodes[node].right;
+				}
+				else
+				{
+					m_stack.push_back(node);
+					break;
+				}
+			}
+
+			// In order from there
+			while (!m_stack.empty() && out.size() < count)
+			{
+				const UINT32 node = m_stack.back();
+				m_stack.pop_back();
+				out.push_back({ m_names[node], m_nodes[node].score, first + out.size() });
+
+				for (UINT32 next = m_nodes[node].right; next != None; next = m_nodes[next].left)
+					m_stack.push_back(next);
+			}
+		}
+
+	private:
+		// FNV-1a style hash, 8 bytes at a time (like TextCache)
+		static UINT64 HashName(const std::string& name)
+		{
+			UINT64 hash = 14695981039346656037ull ^ name.length();
+			size_t i = 0;
+			for (; i + 8 <= name.length(); i += 8)
+			{
+				UINT64 word;
+				memcpy(&word, name.data() + i, 8);
+				hash = (hash ^ word) * 1099511628211ull;
+				hash ^= hash >> 29;
+			}
+			for (; i < name.length(); i++)
+				hash = (hash ^ (UINT8)name[i]) * 1099511628211ull;
+			return hash ^ (hash >> 32); // The low bits pick the slot, they only depend on the low bits of the bytes before the mix
+		}
+
+		// Node of the player, None if the player has no score
+		UINT32 Find(const std::string& name, UINT64 hash) const
+		{
+			if (m_players.empty())
+				return None;
+
+			const UINT64 tag = hash >> 32 << 32;
+			for (size_t slot = (size_t)hash & (m_players.size() - 1); m_players[slot] != Empty; slot = (slot + 1) & (m_players.size() - 1))
+			{
+				const UINT32 node = (UINT32)m_players[slot];
+				if ((m_players[slot] & 0xFFFFFFFF00000000ull) == tag && m_names[node] == name)
+					return node;
+			}
+			return None;
+		}
+
+		// New player, not in the tree yet
+		UINT32 Add(std::string name, UINT64 hash)
+		{
+			const UINT32 node = (UINT32)m_nodes.size();
+			m_nodes.push_back({});
+			m_names.push_back(std::move(name));
+
+			if (m_nodes.size() * 2 > m_players.size())
+				Reindex(m_nodes.size() * 2);
+			else
+				Index(node, hash);
+			return node;
+		}
+
+		void Index(UINT32 node, UINT64 hash)
+		{
+			size_t slot = (size_t)hash & (m_players.size() - 1);
+			while (m_players[slot] != Empty)
+				slot = (slot + 1) & (m_players.size() - 1);
+			m_players[slot] = (hash >> 32 << 32) | node;
+		}
+
+		// Room for players without growing, every name is hashed again
+		void Reindex(size_t players)
+		{
+			size_t size = 16;
+			while (size < players * 2)
+				size *= 2;
+			m_players.assign(size, Empty);
+
+			// The slots are random accesses in a table bigger than the cache : prefetch them a few names ahead so the misses overlap
+			constexpr UINT32 Ahead = 16;
+			const UINT32 count = (UINT32)m_nodes.size();
+			std::vector<UINT64> hashes(count);
+			for (UINT32 node = 0; node < count; node++)
+				hashes[node] = HashName(m_names[node]);
+			for (UINT32 node = 0; node < count; node++)
+			{
+				if (node + Ahead < count)
+					_mm_prefetch((const char*)&m_players[(size_t)hashes[node + Ahead] & (size - 1)], _MM_HINT_T0);
+				Index(node, hashes[node]);
+			}
+		}
+
+		UINT32 Size(UINT32 node) const { return node == None ? 0 : m_nodes[node].size; }
+
+		void Update(UINT32 node) { m_nodes[node].size = 1 + Size(m_nodes[node].left) + Size(m_nodes[node].right); }
+
+		// Is a ranked before b ?
+		bool Before(UINT32 a, UINT32 b) const
+		{
+			return m_nodes[a].score != m_nodes[b].score ? m_nodes[a].score > m_nodes[b].score : m_nodes[a].order < m_nodes[b].order;
+		}
+
+		size_t RankOf(UINT32 node) const
+		{
+			size_t rank = Size(m_nodes[node].left);
+			for (UINT32 at = m_root; at != node; )
+			{
+				if (Before(node, at))
+					at = m_nodes[at].left;
+				else
+				{
+					rank += Size(m_nodes[at].left) + 1;
+					at = m_nodes[at].right;
+				}
+			}
+			return rank;
+		}
+
+		UINT32 NextPriority()
+		{
+			m_seed ^= m_seed << 13;
+			m_seed ^= m_seed >> 17;
+			m_seed ^= m_seed << 5;
+			return m_seed;
+		}
+
+		// Give the node its new score and insert it in the tree
+		void Place(UINT32 node, INT64 score, UINT64 order)
+		{
+			m_nodes[node] = { score, order, NextPriority(), 1, None, None };
+			m_root = Insert(m_root, node);
+		}
+
+		UINT32 Insert(UINT32 root, UINT32 node)
+		{
+			if (root == None)
+				return node;
+
+			if (m_nodes[node].priority > m_nodes[root].priority) // The node becomes the root of this subtree
+			{
+				Split(root, node, m_nodes[node].left, m_nodes[node].right);
+				Update(node);
+				return node;
+			}
+
+			if (Before(node, root))
+				m_nodes[root].left = Insert(m_nodes[root].left, node);
+			else
+				m_nodes[root].right = Insert(m_nodes[root].right, node);
+			m_nodes[root].size++;
+			return root;
+		}
+
+		UINT32 Erase(UINT32 root, UINT32 node)
+		{
+			if (root == node)
+				return Merge(m_nodes[node].left, m_nodes[node].right);
+
+			if (Before(node, root))
+				m_nodes[root].left = Erase(m_nodes[root].left, node);
+			else
+				m_nodes[root].right = Erase(m_nodes[root].right, node);
+			m_nodes[root].size--;
+			return root;
+		}
+
+		// Split the subtree in the nodes ranked before node and the ones after it
+		void Split(UINT32 root, UINT32 node, UINT32& before, UINT32& after)
+		{
+			if (root == None)
+			{
+				before = after = None;
+				return;
+			}
+
+			if (Before(root, node))
+			{
+				Split(m_nodes[root].right, node, m_nodes[root].right, after);
+				before = root;
+			}
+			else
+			{
+				Split(m_nodes[root].left, node, before, m_nodes[root].left);
+				after = root;
+			}
+			Update(root);
+		}
+
+		// Join two subtrees, every node of before is ranked before the nodes of after
+		UINT32 Merge(UINT32 before, UINT32 after)
 		{
-			bool isDown = false;
-			bool justDown = false;
-			bool justUp = false;
-		};
+			if (before == None || after == None)
+				return before == None ? after : before;
 
-		// Graphics
-		HANDLE m_hPreviousConsole; // Handle to the initial console buffer
-		HANDLE m_hConsole; // Handle to the new console buffer (the one used)
-		HWND m_console; // Window index (actual window, not console)
+			if (m_nodes[before].priority > m_nodes[after].priority)
+			{
+				m_nodes[before].right = Merge(m_nodes[before].right, after);
+				Update(before);
+				return before;
+			}
+			m_nodes[after].left = Merge(before, m_nodes[after].left);
+			Update(after);
+			return after;
+		}
 
-		CHAR_INFO* m_bufScreen; // The screen buffer
-		SMALL_RECT m_displaySize; // Size of the display area, used by WriteConsoleOutput()
+		// The nodes are in rank order : build the treap in O(n) and the index
+		void Build()
+		{
+			// The stack is the right edge of the tree, a node leaves it when its subtree is complete
+			m_stack.clear();
+			for (UINT32 node = 0; node < (UINT32)m_nodes.size(); node++)
+			{
+				UINT32 last = None;
+				while (!m_stack.empty() && m_nodes[m_stack.back()].priority < m_nodes[node].priority)
+				{
+					last = m_stack.back();
+					m_stack.pop_back();
+					Update(last);
+				}
+				m_nodes[node].left = last;
+				if (!m_stack.empty())
+					m_nodes[m_stack.back()].right = node;
+				m_stack.push_back(node);
+			}
+			m_root = m_stack.empty() ? None : m_stack.front();
+			for (auto node = m_stack.rbegin(); node != m_stack.rend(); node++)
+				Update(*node);
 
-		int m_width, m_height; // the size of the screen, in characters
-		std::wstring m_title; // The title set by the user
+			Reindex(m_nodes.size());
+		}
 
+		void Load()
+		{
+			std::vector<char> data;
+			{
+				std::ifstream file(m_filePath, std::ios::binary | std::ios::ate);
+				if (file.is_open())
+				{
+					data.resize((size_t)file.tellg());
+					file.seekg(0);
+					file.read(data.data(), data.size());
+					if (!file)
+						data.clear();
+				}
+			}
 
-		// Inputs 
-		static const int KeyCount = 254; // max index of the Key enum
-		HANDLE m_hConsoleIn; // Handle to the input buffer
-		KeyData* m_keys; // Key data
-		int m_mouseDeltaX, m_mouseDeltaY, m_mouseX, m_mouseY;
-		int m_scrollDelta;
+			// Header : magic, records in rank order. Then the records : score, name length, name
+			UINT32 magic = 0;
+			UINT64 sorted = 0;
+			size_t at = 0;
+			const auto read = [&](void* out, size_t size) {
+				if (data.size() - at < size)
+					return false;
+				memcpy(out, data.data() + at, size);
+				at += size;
+				return true;
+			};
+			bool valid = read(&magic, sizeof(magic)) && magic == FileMagic && read(&sorted, sizeof(sorted));
+			if (valid)
+			{
+				const size_t players = (std::min)((size_t)sorted, data.size() / 12); // Records are at least 12 bytes
+				m_nodes.reserve(players);
+				m_names.reserve(players);
+			}
 
+			while (valid && at < data.size())
+			{
+				INT64 score;
+				UINT32 length;
+				if (!read(&score, sizeof(score)) || !read(&length, sizeof(length)) || data.size() - at < length)
+				{
+					valid = false; // Cut in the middle of a record
+					break;
+				}
+				std::string name(data.data() + at, length);
+				at += length;
 
-		// Time
-		std::chrono::steady_clock::time_point m_timeLastDraw; // Time of the last draw call (used for m_deltaDrawTime)
-		float m_deltaDrawTime; // Delta time since last draw call, in seconds
+				if (m_records < sorted) // Unique and in rank order
+				{
+					m_nodes.push_back({ score, m_records++, NextPriority(), 1, None, None });
+					m_names.push_back(std::move(name));
+					continue;
+				}
 
-		// Close events
-		static std::atomic_bool m_shouldClose;
-		static std::mutex m_closeMutex;
-		static std::condition_variable m_closeCall;
+				// Appended after the last rewrite : keep the best score of each player, sorted once they are all read
+				if (m_records == sorted)
+					Reindex(m_nodes.size());
+				const UINT64 hash = HashName(name);
+				UINT32 node = Find(name, hash);
+				if (node == None)
+				{
+					node = Add(std::move(name), hash);
+					m_nodes[node] = { score, m_records, NextPriority(), 1, None, None };
+				}
+				else if (score > m_nodes[node].score)
+				{
+					m_nodes[node].score = score;
+					m_nodes[node].order = m_records;
+				}
+				m_records++;
+			}
 
-	public:
+			if (m_records > sorted) // Put the nodes in rank order
+			{
+				std::vector<UINT32> ranked(m_nodes.size());
+				for (UINT32 node = 0; node < (UINT32)ranked.size(); node++)
+					ranked[node] = node;
+				std::sort(ranked.begin(), ranked.end(), [&](UINT32 a, UINT32 b) { return Before(a, b); });
+
+				std::vector<NodeData> nodes(ranked.size());
+				std::vector<std::string> names(ranked.size());
+				for (size_t rank = 0; rank < ranked.size(); rank++)
+				{
+					nodes[rank] = m_nodes[ranked[rank]];
+					names[rank] = std::move(m_names[ranked[rank]]);
+				}
+				m_nodes = std::move(nodes);
+				m_names = std::move(names);
+			}
+			Build();
 
-		Console(unsigned int width, unsigned int height, const std::string& title)
-			: m_width(width), m_height(height),
-			m_displaySize({ 0, 0, (SHORT)width - 1, (SHORT)height - 1 }),
-			m_mouseDeltaX(0), m_mouseDeltaY(0), m_scrollDelta(0)
+			// New or damaged file : write what could be read. More records appended than in rank order : the next open will not sort them again
+			if (!valid || data.empty() || (m_records - sorted >= MinCompactRecords && m_records - sorted > sorted))
+				Compact();
+			else
+				m_log.open(m_filePath, std::ios::binary | std::ios::app);
+		}
+
+		static void Write(std::ofstream& file, const std::string& name, INT64 score)
 		{
-			// Convert the title from string to wstring
-			m_title = StringToWString(title);
+			const UINT32 length = (UINT32)name.length();
+			file.write((const char*)&score, sizeof(score));
+			file.write((const char*)&length, sizeof(length));
+			file.write(name.data(), length);
+		}
 
-			// Create the key array and the screen buffer
-			m_keys = new KeyData[KeyCount];
-			m_bufScreen = new CHAR_INFO[m_width * m_height];
+		void Append(const std::string& name, INT64 score)
+		{
+			Write(m_log, name, score);
+			m_log.flush();
+			m_records++;
+		}
 
-			// Get the window HWND
-			m_console = GetConsoleWindow();
-			if (m_console == NULL)
-				Error("Could not get the window HWND");
+		// Rewrite the file with one record per player in rank order
+		void Compact()
+		{
+			m_log.close();
 
-			// Save the console handle for the destructor
-			m_hPreviousConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-			if (m_hPreviousConsole == INVALID_HANDLE_VALUE)
-				Error("Could not get the output handle");
+			const std::wstring tempPath = m_filePath + L".temp";
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+			{
+				m_log.open(m_filePath, std::ios::binary | std::ios::app);
+				return;
+			}
 
+			const UINT64 count = m_nodes.size();
+			file.write((const char*)&FileMagic, sizeof(FileMagic));
+			file.write((const char*)&count, sizeof(count));
 
-			// Create the new output buffer
-			memset(m_bufScreen, 0, sizeof(CHAR_INFO) * m_width * m_height);
-			m_hConsole = CreateConsoleScreenBuffer(GENERIC_READ | GENERIC_WRITE, 0, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
-			if (m_hConsole == INVALID_HANDLE_VALUE)
-				Error("Could not create the new output buffer");
+			// In order, the order of a score becomes its rank : the same ties, and the index of its record
+			UINT64 rank = 0;
+			m_stack.clear();
+			for (UINT32 node = m_root; node != None || !m_stack.empty(); )
+			{
+				if (node != None)
+				{
+					m_stack.push_back(node);
+					node = m_nodes[node].left;
+					continue;
+				}
 
-			if (!SetConsoleActiveScreenBuffer(m_hConsole))
-				Error("Could not set the screen buffer");
+				node = m_stack.back();
+				m_stack.pop_back();
+				m_nodes[node].order = rank++;
+				Write(file, m_names[node], m_nodes[node].score);
+				node = m_nodes[node].right;
+			}
+			file.close();
 
-			// Hack to be able to reduce the buffer size :
-			SMALL_RECT const minimalWindow = { 0, 0, 1, 1 };
-			if (!SetConsoleWindowInfo(m_hConsole, TRUE, &minimalWindow))
-				Error("Could not resize the window");
+			if (!file || !MoveFileEx(tempPath.c_str(), m_filePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+				DeleteFile(tempPath.c_str()); // Keep the log, the orders are only renumbered
+			else
+				m_records = count;
+			m_log.open(m_filePath, std::ios::binary | std::ios::app);
+		}
+	};
+	inline std::string Leaderboard::m_fileExtension(".leaderboard");
 
-			if (!SetConsoleScreenBufferSize(m_hConsole, { (SHORT)m_width, (SHORT)m_height }))
-				Error("Could not set the size of the screen buffer");
 
-			// Set font to 8x8 Terminal (Raster fonts) -> after resizing
-			CONSOLE_FONT_INFOEX font {0}; // {0} is to prevent Local variable is not initialized...
-			font.cbSize = sizeof(CONSOLE_FONT_INFOEX);
-			font.nFont = 0;
-			font.dwFontSize = { 8,8 };
-			font.FontFamily = FF_DONTCARE;
-			font.FontWeight = FW_NORMAL;
-			wcscpy_s(font.FaceName, L"Terminal");
-			if (!SetCurrentConsoleFontEx(m_hConsole, FALSE, &font))
-				Error("Could not set the font");
+	/// <summary>
+	/// <para> A world too big to be loaded at once, split in chunks of chunkSize*chunkSize tiles saved in their own file ("x_y.chunk" in the directory). </para>
+	/// <para> Update() asks for the chunks around the camera every frame : an I/O thread loads them closest first (or makes them with the generator when they have no file yet) </para>
+	/// <para> and saves the modified chunks that leave the cache (least recently used first). The chunks go between the threads through lock-free queues, the game thread never waits on a file. </para>
+	/// </summary>
+	template<class Tile>
+	class ChunkStreamer
+	{
+		static_assert(std::is_trivially_copyable_v<Tile>, "The tiles are saved as raw bytes");
 
-			// Prevent user from resizing
-			if (!SetWindowLong(m_console, GWL_STYLE, GetWindowLong(m_console, GWL_STYLE) & ~WS_MAXIMIZEBOX & ~WS_SIZEBOX))
-				Error("Could not set the window parameters");
+	public:
+		struct Chunk
+		{
+			int x, y; // In chunks
+			std::vector<Tile> tiles; // Row by row
+			bool dirty; // Modified since it was loaded, saved when it leaves the cache or on Save()
 
-			// Set the final size
-			SMALL_RECT const rectWindow = { 0, 0, (SHORT)m_width - 1, (SHORT)m_height - 1 };
-			if (!SetConsoleWindowInfo(m_hConsole, TRUE, &rectWindow))
-				Error("Could not set the window info");
+			// Game thread, least recently used list
+			Chunk* newer;
+			Chunk* older;
+		};
 
-			// Init last draw time
-			m_timeLastDraw = std::chrono::high_resolution_clock::now();
-			m_deltaDrawTime = 0.0f;
+		// Makes the tiles of a chunk that has no file yet, called on the I/O thread
+		using Generator = std::function<void(int chunkX, int chunkY, Tile* tiles)>;
 
-			// Inputs
-			m_hConsoleIn = GetStdHandle(STD_INPUT_HANDLE);
-			if (m_hConsoleIn == INVALID_HANDLE_VALUE)
-				Error("Could not get the input handle");
-			if (!SetConsoleMode(m_hConsoleIn, ENABLE_EXTENDED_FLAGS | ENABLE_MOUSE_INPUT)) // ENABLE_EXTENDED_FLAGS = no text selection with the mouse
-				Error("Could not set the console mode");
+	private:
+		struct Request
+		{
+			enum class Type { Load, Release }; // Release : the game thread gives the chunk back, saved first if it is dirty
+			Type type;
+			int x, y;
+			Chunk* chunk;
+		};
 
-			// Disable the cursor
-			CONSOLE_CURSOR_INFO cursorInfo {0}; // {0} is to prevent Local variable is not initialized...
-			cursorInfo.dwSize = 1;
-			cursorInfo.bVisible = false;
-			if (!SetConsoleCursorInfo(m_hConsole, &cursorInfo))
-				Error("Could not remove the cursor");
+		struct Result
+		{
+			int x, y;
+			Chunk* chunk; // nullptr : the load was cancelled because the camera went away
+		};
 
-			// Set the close button handler
-			if (!SetConsoleCtrlHandler((PHANDLER_ROUTINE)CloseHandler, TRUE))
-				Error("Could not set the close handler");
+		static constexpr UINT32 FileMagic = 0x4B435852; // "RXCK"
+
+		const std::string m_directory;
+		const int m_chunkSize;
+		const size_t m_capacity; // Chunks kept loaded
+		const Generator m_generator;
+
+		SpscQueue<Request> m_requests; // Game thread -> I/O thread
+		SpscQueue<Result> m_results; // I/O thread -> game thread
+		HANDLE m_wakeEvent; // Set when there are new requests
+		HANDLE m_resultsEvent; // Set when the game thread takes results, the I/O thread waits for it when m_results is full
+		std::atomic<UINT64> m_center; // Camera chunk, read by the I/O thread to pick the closest load
+		std::atomic<int> m_radius;
+		std::atomic_bool m_running;
+		std::thread m_thread;
+
+		// Game thread
+		std::unordered_map<UINT64, Chunk*> m_chunks; // Loaded chunks, nullptr while the load is queued
+		Chunk* m_newest;
+		Chunk* m_oldest;
+		size_t m_loaded;
+		std::vector<Request> m_unsent; // Requests the full queue did not take, sent first on the next Update()
+
+		// I/O thread
+		std::vector<Request> m_loads, m_saves;
+		std::vector<Chunk*> m_free; // Recycled chunks
+		std::atomic<UINT64> m_filesRead, m_filesWritten, m_generated;
+
+	public:
+		// The directory is created if its parent exists, capacity is the number of chunks kept loaded (at least the (2 * radius + 1)^2 chunks around the camera)
+		ChunkStreamer(const std::string& directory, int chunkSize = 32, size_t capacity = 256, Generator generator = nullptr)
+			: m_directory(directory), m_chunkSize((std::max)(chunkSize, 1)), m_capacity((std::max)(capacity, (size_t)1)), m_generator(std::move(generator)),
+			m_requests(m_capacity * 2 + 64), m_results(m_capacity * 2 + 64), m_center(0), m_radius(0), m_running(true),
+			m_newest(nullptr), m_oldest(nullptr), m_loaded(0), m_filesRead(0), m_filesWritten(0), m_generated(0)
+		{
+			CreateDirectory(StringToWString(m_directory).c_str(), NULL);
+			m_chunks.reserve(m_capacity * 2);
+
+			m_wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+			m_resultsEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+			m_thread = std::thread([this] { Stream(); });
+			SetThreadPriority(m_thread.native_handle(), THREAD_PRIORITY_BELOW_NORMAL); // Never takes the core of the game thread
 		}
 
-		~Console()
+		// Saves the modified chunks, waits for the I/O thread to write them
+		~ChunkStreamer()
 		{
-			if (!SetConsoleActiveScreenBuffer(m_hPreviousConsole))// Switch back to the old buffer
-				Error("Could not set the screen buffer");
-			if (!CloseHandle(m_hConsole)) // Close the new buffer that was opened 
-				Error("Could not delete the screen buffer");
-			delete[] m_bufScreen;
-			delete[] m_keys;
-			m_closeCall.notify_all(); // Tell the close handler that it can close (if it was called)
+			while (m_oldest != nullptr)
+				Release(m_oldest);
+			for (const Request& request : m_unsent)
+			{
+				while (!m_requests.Push(request)) // The I/O thread may be asleep, or waiting for room in the results
+				{
+					SetEvent(m_wakeEvent);
+					DeleteResults();
+					std::this_thread::yield();
+				}
+			}
 
-			// Wait for the close thread to finish
-			m_closeMutex.lock();
-			m_closeMutex.unlock();
+			m_running = false;
+			SetEvent(m_wakeEvent);
+			SetEvent(m_resultsEvent);
+			m_thread.join();
+			CloseHandle(m_wakeEvent);
+			CloseHandle(m_resultsEvent);
+			DeleteResults();
 		}
 
-		// Width of the console, in characters
-		int Width() const { return m_width; }
-		// Height of the console, in characters
-		int Height() const { return m_height; }
-		// Time since the last BlipToScreen() call, in seconds
-		float DeltaTime() const { return m_deltaDrawTime; }
+		ChunkStreamer(const ChunkStreamer&) = delete;
+		ChunkStreamer& operator=(const ChunkStreamer&) = delete;
 
-		// Set the title of the window
-		void SetTitle(const std::string& title) { m_title = StringToWString(title); }
+		/// <summary>
+		/// <para> Game thread, once per frame : take the chunks loaded since the last call and ask for the chunks within radius chunks of the tile x,y (ex : the camera). </para>
+		/// <para> The loads that are more than radius + 1 chunks away when the I/O thread gets to them are cancelled. Costs (2 * radius + 1)^2 lookups, no file access. </para>
+		/// </summary>
+		void Update(int x, int y, int radius)
+		{
+			const int centerX = FloorDiv(x, m_chunkSize), centerY = FloorDiv(y, m_chunkSize);
+			m_center.store(Key(centerX, centerY), std::memory_order_relaxed);
+			m_radius.store(radius, std::memory_order_relaxed);
 
-		// Should the app close ? (ex : close button was pressed)
-		bool ShouldClose() const { return m_shouldClose.load(); }
+			Result result;
+			bool received = false;
+			while (m_results.Pop(result))
+			{
+				auto iterator = m_chunks.find(Key(result.x, result.y));
+				if (result.chunk == nullptr)
+					m_chunks.erase(iterator);
+				else
+				{
+					iterator->second = result.chunk;
+					PushNewest(result.chunk);
+					m_loaded++;
+				}
+				received = true;
+			}
+			if (received)
+				SetEvent(m_resultsEvent);
+
+			bool sent = SendUnsent();
+			for (int cy = centerY - radius; cy <= centerY + radius; cy++)
+			{
+				for (int cx = centerX - radius; cx <= centerX + radius; cx++)
+				{
+					auto iterator = m_chunks.find(Key(cx, cy));
+					if (iterator == m_chunks.end())
+					{
+						Send({ Request::Type::Load, cx, cy, nullptr }); // Behind the saves not sent yet, the chunk is read once its file is written
+						m_chunks.emplace(Key(cx, cy), nullptr);
+						sent = true;
+					}
+					else if (iterator->second != nullptr) // Used : newest
+					{
+						Unlink(iterator->second);
+						PushNewest(iterator->second);
+					}
+				}
+			}
 
+			// Give back the least recently used chunks, the ones around the camera were just used so they are the newest
+			while (m_loaded > m_capacity && m_oldest != nullptr && Distance(m_oldest->x, m_oldest->y, centerX, centerY) > radius)
+			{
+				Release(m_oldest);
+				sent = true;
+			}
 
+			if (sent)
+				SetEvent(m_wakeEvent);
+		}
 
-		/* ----- Graphics ------ */
+		// A loaded chunk, nullptr when it is not loaded (yet)
+		Chunk* GetChunk(int chunkX, int chunkY)
+		{
+			auto iterator = m_chunks.find(Key(chunkX, chunkY));
+			return iterator == m_chunks.end() ? nullptr : iterator->second;
+		}
 
-		// Fill the buffer with a pixel
-		void Clear(const Pixel& pixel)
+		// The tile x,y of the world, nullptr when its chunk is not loaded
+		Tile* GetTile(int x, int y)
+		{
+			Chunk* chunk = GetChunk(FloorDiv(x, m_chunkSize), FloorDiv(y, m_chunkSize));
+			if (chunk == nullptr)
+				return nullptr;
+			return &chunk->tiles[(y - chunk->y * m_chunkSize) * m_chunkSize + (x - chunk->x * m_chunkSize)];
+		}
+
+		// Change the tile x,y and mark its chunk to be saved, returns false when its chunk is not loaded
+		bool SetTile(int x, int y, const Tile& tile)
+		{
+			Tile* target = GetTile(x, y);
+			if (target == nullptr)
+				return false;
+
+			*target = tile;
+			GetChunk(FloorDiv(x, m_chunkSize), FloorDiv(y, m_chunkSize))->dirty = true;
+			return true;
+		}
+
+		// Save the modified chunks now (ex : a checkpoint), they stay loaded : a copy of each is given to the I/O thread
+		void Save()
 		{
-			for (int i = 0; i < m_width * m_height; i++)
+			for (Chunk* chunk = m_oldest; chunk != nullptr; chunk = chunk->newer)
 			{
-				m_bufScreen[i].Char.UnicodeChar = (short)pixel.type;
-				m_bufScreen[i].Attributes = (short)pixel.color;
+				if (!chunk->dirty)
+					continue;
+
+				Send({ Request::Type::Release, chunk->x, chunk->y, new Chunk{ chunk->x, chunk->y, chunk->tiles, true, nullptr, nullptr } });
+				chunk->dirty = false;
 			}
+			SetEvent(m_wakeEvent);
 		}
 
-		// Set a pixel at x,y
-		void Draw(int x, int y, const Pixel& pixel)
+		// Are all the chunks asked for by the last Update() loaded ? (ex : to show a loading screen at the start)
+		bool Ready() const { return m_chunks.size() == m_loaded; }
+
+		int ChunkSize() const { return m_chunkSize; }
+		size_t Loaded() const { return m_loaded; }
+		size_t Pending() const { return m_chunks.size() - m_loaded; }
+
+		// I/O thread statistics
+		UINT64 FilesRead() const { return m_filesRead.load(std::memory_order_relaxed); }
+		UINT64 FilesWritten() const { return m_filesWritten.load(std::memory_order_relaxed); }
+		UINT64 Generated() const { return m_generated.load(std::memory_order_relaxed); }
+
+	private:
+		static UINT64 Key(int x, int y) { return ((UINT64)(UINT32)x << 32) | (UINT32)y; }
+		static int KeyX(UINT64 key) { return (int)(UINT32)(key >> 32); }
+		static int KeyY(UINT64 key) { return (int)(UINT32)key; }
+		static int FloorDiv(int value, int divisor) { return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor); }
+		static int Distance(int x1, int y1, int x2, int y2) { return (std::max)(std::abs(x1 - x2), std::abs(y1 - y2)); }
+
+		std::string PathOf(int x, int y) const { return m_directory + "\\" + std::to_string(x) + "_" + std::to_string(y) + ".chunk"; }
+
+		void PushNewest(Chunk* chunk)
 		{
-			if (x >= 0 && x < m_width && y >= 0 && y < m_height)
+			chunk->newer = nullptr;
+			chunk->older = m_newest;
+			if (m_newest != nullptr)
+				m_newest->newer = chunk;
+			m_newest = chunk;
+			if (m_oldest == nullptr)
+				m_oldest = chunk;
+		}
+
+		void Unlink(Chunk* chunk)
+		{
+			(chunk->newer != nullptr ? chunk->newer->older : m_newest) = chunk->older;
+			(chunk->older != nullptr ? chunk->older->newer : m_oldest) = chunk->newer;
+		}
+
+		// Give a chunk back to the I/O thread, queued for the next Update() if the queue is full
+		void Release(Chunk* chunk)
+		{
+			Unlink(chunk);
+			m_chunks.erase(Key(chunk->x, chunk->y));
+			m_loaded--;
+
+			Send({ Request::Type::Release, chunk->x, chunk->y, chunk });
+		}
+
+		void Send(const Request& request)
+		{
+			if (!m_unsent.empty() || !m_requests.Push(request)) // After the unsent ones, to keep the order of the requests
+				m_unsent.push_back(request);
+		}
+
+		bool SendUnsent()
+		{
+			size_t sent = 0;
+			while (sent < m_unsent.size() && m_requests.Push(m_unsent[sent]))
+				sent++;
+			m_unsent.erase(m_unsent.begin(), m_unsent.begin() + sent);
+			return sent > 0;
+		}
+
+		// Destructor : the loads finished are not used
+		void DeleteResults()
+		{
+			Result result;
+			bool received = false;
+			while (m_results.Pop(result))
 			{
-				m_bufScreen[y * m_width + x].Char.UnicodeChar = (short)pixel.type;
-				m_bufScreen[y * m_width + x].Attributes = (short)pixel.color;
+				delete result.chunk;
+				received = true;
 			}
+			if (received)
+				SetEvent(m_resultsEvent);
 		}
 
-		// Draw a drawable object at x,y
-		void Draw(int x, int y, const Drawable& drawable) { drawable.Draw(x,y, *this); }
+		/* ----- I/O thread ----- */
 
-		// Draw a line from (x1,y1) to (x2,y2)
-		void DrawLine(int x1, int y1, int x2, int y2, const Pixel& pixel) // Very bad and slow, uses the y = mx+b and x = my+b equations to draw
+		void Stream()
 		{
-			if (abs(x2 - x1) > abs(y2 - y1)) // dx > dy then plot along the x axis (this is to reduce/remove gaps)
+			for (;;)
 			{
-				if (x1 > x2) // Swap both points if x1 > x2
+				const bool running = m_running; // Read before the queue : the destructor pushes its last saves before it clears m_running, they are all popped below
+				Request request;
+				while (m_requests.Pop(request))
+					(request.type == Request::Type::Load ? m_loads : m_saves).push_back(request);
+
+				if (!m_saves.empty()) // Saves first : a chunk given back then asked for again is read from its new file
 				{
-					Swap<int>(x1, x2);
-					Swap<int>(y1, y2);
+					Chunk* chunk = m_saves.front().chunk;
+					m_saves.erase(m_saves.begin());
+					if (chunk->dirty)
+						Write(*chunk);
+					m_free.push_back(chunk);
+					continue;
 				}
 
-				float m = (float)(y2 - y1) / (float)(x2 - x1);
-				float b = y1 - (m * x1);
+				if (!running)
+					break;
+
+				if (!m_loads.empty())
+				{
+					LoadClosest();
+					continue;
+				}
+
+				WaitForSingleObject(m_wakeEvent, INFINITE);
+			}
+
+			for (Chunk* chunk : m_free)
+				delete chunk;
+		}
+
+		void LoadClosest()
+		{
+			const UINT64 center = m_center.load(std::memory_order_relaxed);
+			const int centerX = KeyX(center), centerY = KeyY(center), radius = m_radius.load(std::memory_order_relaxed);
 
-				for (int x = x1; x <= x2; x++)
-					Draw(x, (int)roundf(m * x + b), pixel);
-			}
-			else // plot along the y axis
+			size_t closest = 0;
+			INT64 closestDistance = LLONG_MAX;
+			for (size_t i = 0; i < m_loads.size(); i++)
 			{
-				if (y1 > y2) // Swap both points if y1 > y2
+				const INT64 dx = m_loads[i].x - centerX, dy = m_loads[i].y - centerY;
+				if (dx * dx + dy * dy < closestDistance)
 				{
-					Swap<int>(x1, x2);
-					Swap<int>(y1, y2);
+					closestDistance = dx * dx + dy * dy;
+					closest = i;
 				}
+			}
+			const Request load = m_loads[closest];
+			m_loads[closest] = m_loads.back();
+			m_loads.pop_back();
 
-				float m = (float)(x2 - x1) / (float)(y2 - y1);
-				float b = x1 - (m * y1);
+			Result result = { load.x, load.y, nullptr };
+			if (Distance(load.x, load.y, centerX, centerY) <= radius + 1)
+			{
+				if (m_free.empty())
+					result.chunk = new Chunk();
+				else
+				{
+					result.chunk = m_free.back();
+					m_free.pop_back();
+				}
+				Read(*result.chunk, load.x, load.y);
+			}
 
-				for (int y = y1; y <= y2; y++)
-					Draw((int)roundf(m * y + b), y, pixel);
+			while (!m_results.Push(result)) // Full until the next Update()
+			{
+				if (!m_running) // The destructor does not take the results anymore
+				{
+					delete result.chunk;
+					return;
+				}
+				WaitForSingleObject(m_resultsEvent, INFINITE);
 			}
 		}
 
-		// Fill the area formed by x,y and width,height using the pixel
-		void Fill(int x, int y, int width, int height, const Pixel& pixel)
+		void Read(Chunk& chunk, int x, int y)
 		{
-			for (int xPos = x; xPos < x + width; xPos++)
+			chunk.x = x;
+			chunk.y = y;
+			chunk.dirty = false;
+			chunk.tiles.resize((size_t)m_chunkSize * m_chunkSize);
+
+			// Header : magic, chunk size, tile size
+			std::FILE* file = std::fopen(PathOf(x, y).c_str(), "rb");
+			UINT32 header[3];
+			const bool valid = file != nullptr && std::fread(header, sizeof(header), 1, file) == 1
+				&& header[0] == FileMagic && header[1] == (UINT32)m_chunkSize && header[2] == sizeof(Tile)
+				&& std::fread(chunk.tiles.data(), sizeof(Tile), chunk.tiles.size(), file) == chunk.tiles.size();
+			if (file != nullptr)
+				std::fclose(file);
+
+			if (valid)
+				m_filesRead++;
+			else // New chunk (or a damaged file)
 			{
-				for (int yPos = y; yPos < y + height; yPos++)
-					Draw(xPos, yPos, pixel);
+				std::fill(chunk.tiles.begin(), chunk.tiles.end(), Tile());
+				if (m_generator)
+					m_generator(x, y, chunk.tiles.data());
+				m_generated++;
 			}
 		}
 
-		// Print the buffer to screen
-		void BlipToScreen()
+		void Write(Chunk& chunk)
 		{
-			// Delta time
-			auto now = std::chrono::high_resolution_clock::now();
-			m_deltaDrawTime = std::chrono::duration<float>(now - m_timeLastDraw).count();
-			m_timeLastDraw = now;
-
-			// Title - fps
-			wchar_t s[256];
-			swprintf_s(s, 256, L"%s - %d fps", m_title.c_str(), (int)(1.0f / m_deltaDrawTime));
-			if (!SetConsoleTitle(s))
-				Error("Could not set the title");
+			std::FILE* file = std::fopen(PathOf(chunk.x, chunk.y).c_str(), "wb");
+			if (file == nullptr)
+				return;
 
-			// Blip tot screen
-			if (!WriteConsoleOutput(m_hConsole, m_bufScreen, { (short)m_width, (short)m_height }, { 0,0 }, &m_displaySize))
-				Error("Could not write to the output buffer");
+			const UINT32 header[3] = { FileMagic, (UINT32)m_chunkSize, sizeof(Tile) };
+			std::fwrite(header, sizeof(header), 1, file);
+			std::fwrite(chunk.tiles.data(), sizeof(Tile), chunk.tiles.size(), file);
+			std::fclose(file);
+			chunk.dirty = false;
+			m_filesWritten++;
 		}
+	};
 
 
 
-		/* ----- Inputs ----- */
-
-		// Check for new inputs
-		void PollInputs()
+	/// <summary>
+	/// <para> A fast random number generator (xoshiro256**), a new random seed is automatically set at application launch. </para>
+	/// <para> Every thread draws from its own stream, all streams are derived from the same master seed (see Seed()). </para>
+	/// <para> Streams are assigned in order of first use, call SetStream() from a worker to make its sequence reproducible. </para>
+	/// </summary>
+	class Random
+	{
+	private:
+		// xoshiro256** state, see https://prng.di.unimi.it/
+		struct Xoshiro
 		{
-			m_scrollDelta = 0;
+			UINT64 s[4];
 
-			// Catch console events
-			int mx = m_mouseX, my = m_mouseY;
-			INPUT_RECORD inBuf[32];
-			DWORD events = 0;
-			if (!GetNumberOfConsoleInputEvents(m_hConsoleIn, &events))
-				Error("Could not get the number of input events");
+			static UINT64 Rotl(UINT64 x, int k) { return (x << k) | (x >> (64 - k)); }
 
-			if (events > 0)
+			// Expand a 64 bits seed into the full state (SplitMix64)
+			void Seed(UINT64 seed)
 			{
-				if (!ReadConsoleInput(m_hConsoleIn, inBuf, events, &events))
-					Error("Could not read the input events");
+				for (int i = 0; i < 4; i++)
+				{
+					UINT64 z = (seed += 0x9E3779B97F4A7C15ull);
+					z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+					z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+					s[i] = z ^ (z >> 31);
+				}
 			}
 
-			for (DWORD i = 0; i < events; i++)
+			UINT64 Next()
 			{
-				if (inBuf[i].EventType == MOUSE_EVENT) // Mouse
+				const UINT64 result = Rotl(s[1] * 5, 7) * 9;
+				const UINT64 t = s[1] << 17;
+				s[2] ^= s[0];
+				s[3] ^= s[1];
+				s[1] ^= s[2];
+				s[0] ^= s[3];
+				s[2] ^= t;
+				s[3] = Rotl(s[3], 45);
+				return result;
+			}
+
+			// Advance the state by 2^128 calls to Next(), used to create non-overlapping streams
+			void Jump()
+			{
+				static const UINT64 jump[] = { 0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull, 0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull };
+				UINT64 r[4] = { 0, 0, 0, 0 };
+				for (int i = 0; i < 4; i++)
 				{
-					switch (inBuf[i].Event.MouseEvent.dwEventFlags)
+					for (int b = 0; b < 64; b++)
 					{
-					case MOUSE_MOVED: // Mouse movements
-						m_mouseX = inBuf[i].Event.MouseEvent.dwMousePosition.X;
-						m_mouseY = inBuf[i].Event.MouseEvent.dwMousePosition.Y;
-						break;
-					case MOUSE_WHEELED: // Scroll wheel
-						m_scrollDelta = (int)inBuf[i].Event.MouseEvent.dwButtonState >> 16;
-						break;
-					case 0: // Mouse click
-						UpdateKey((int)Key::MouseLeft, inBuf[i].Event.MouseEvent.dwButtonState & FROM_LEFT_1ST_BUTTON_PRESSED);
-						UpdateKey((int)Key::MouseMiddle, inBuf[i].Event.MouseEvent.dwButtonState & FROM_LEFT_2ND_BUTTON_PRESSED);
-						UpdateKey((int)Key::MouseRight, inBuf[i].Event.MouseEvent.dwButtonState & RIGHTMOST_BUTTON_PRESSED);
-						// Mouse forward and backward are not creating an event ?
-						break;
-					default:
-						break;
+						if (jump[i] & (1ull << b))
+						{
+							r[0] ^= s[0];
+							r[1] ^= s[1];
+							r[2] ^= s[2];
+							r[3] ^= s[3];
+						}
+						Next();
 					}
 				}
-				else if (inBuf[i].EventType == KEY_EVENT) // Keyboard
-				{
-					UpdateKey(inBuf[i].Event.KeyEvent.wVirtualKeyCode, inBuf[i].Event.KeyEvent.bKeyDown);
-				}
+				memcpy(s, r, sizeof(s));
 			}
+		};
 
-			// Fix for mouse forward and backward not generating events :
-			UpdateKey((int)Key::MouseForward, (GetAsyncKeyState((int)Key::MouseForward) & 0x8000));
-			UpdateKey((int)Key::MouseBackward, (GetAsyncKeyState((int)Key::MouseBackward) & 0x8000));
-
-			m_mouseDeltaX = m_mouseX - mx;
-			m_mouseDeltaY = m_mouseY - my;
-		}
-
-		// Is the key pressed now ?
-		bool IsPressed(Key key) const { return m_keys[(int)key].isDown; }
-		// Was the key pressed since the last call to PollInputs() ?
-		bool WasJustPressed(Key key) const { return m_keys[(int)key].justDown; }
-		// Was the key released since the last call to PollInputs() ?
-		bool WasJustReleased(Key key) const { return m_keys[(int)key].justUp; }
-
-		// Distance traveled by the mouse since the last call to PollInputs()
-		int MouseDeltaX() const { return m_mouseDeltaX; }
-		// Distance traveled by the mouse since the last call to PollInputs()
-		int MouseDeltaY() const { return m_mouseDeltaY; }
-		// Position of the mouse on the screen, in charaters
-		int MouseX() const { return m_mouseX; }
-		// Position of the mouse on the screen, in charaters
-		int MouseY() const { return m_mouseY; }
-
-		// If > 0 the user scrolled up, if < 0 the user scrolled down
-		int ScrollDelta() const { return m_scrollDelta; }
+		// Per thread generator
+		struct ThreadState
+		{
+			Xoshiro gen;
+			__m128i lanes[4]; // Two more xoshiro states interleaved (s0..s3 of lane 0 and 1), used by the bulk functions
+			UINT32 generation = 0; // Value of m_generation when gen was seeded, 0 = never seeded
+			UINT32 stream = 0;
+			bool hasStream = false;
+		};
 
+		static std::atomic<UINT64> m_masterSeed;
+		static std::atomic<UINT32> m_generation; // Incremented by Seed(), tells the threads to reseed their streams
+		static std::atomic<UINT32> m_nextStream; // Next stream index given to a thread, a thread keeps its index for its whole life
+		static thread_local ThreadState m_state;
 
-		// Convert RGB values to Color
-		static Color RGBToColor(UINT8* rgb)
-		{
-			static const UINT8 colorRGB[16][3] = {
-				{0,0,0}, // Black
-				{0,0,128}, // Dark Blue
-				{0,128,0}, // Dark Green
-				{0,128,128}, // Dark Cyan
-				{128,0,0}, // Dark Red
-				{128,0,128}, // Dark Magenta
-				{128,128,0}, // Dark Yellow
-				{192,192,192}, // Grey
-				{128,128,128}, // Dark Grey
-				{0,0,255}, // Bright Blue
-				{0,255,0}, // Bright Green
-				{0,255,255}, // Bright Cyan
-				{255,0,0}, // Bright Red
-				{255,0,255}, // Bright Magenta
-				{255,255,0}, // Bright Yellow
-				{255,255,255}, // White
-			};
+	public:
+		// Set the master seed, every thread restarts its stream from this seed
+		static void Seed(int seed)
+		{
+			m_masterSeed.store((UINT64)(UINT32)seed);
+			m_generation.fetch_add(1);
+		}
 
-			// Calculate the distance between the R, G and B values (3d vector distance function)
-			float minDistance = FLT_MAX; // The min distance found
-			int color = -1; // the color linked with the minDistance
-			for (int i = 0; i < 16; i++)
-			{
-				float dist = (float)pow(colorRGB[i][0] - rgb[0], 2) + (float)pow(colorRGB[i][1] - rgb[1], 2) + (float)pow(colorRGB[i][2] - rgb[2], 2);
-				if (dist < minDistance)
-				{
-					minDistance = dist;
-					color = i;
-				}
-			}
+		// Use a specific stream for the calling thread (ex : the index of a worker thread), this resets the thread's sequence
+		static void SetStream(UINT32 stream)
+		{
+			m_state.stream = stream;
+			m_state.hasStream = true;
+			m_state.generation = 0; // Reseed on the next call
+		}
 
-			return (Color)color;
+		// Random 64 bits value
+		static UINT64 Next()
+		{
+			return State().gen.Next();
 		}
 
-	private:
-		// Swap a and b
-		template<class T>
-		static void Swap(T& a, T& b)
+		// Random float in [min, max]
+		static float Get(float min, float max)
 		{
-			T temp = a;
-			a = b;
-			b = temp;
+			return min + (float)(State().gen.Next() >> 40) * (1.0f / 16777215.0f) * (max - min);
 		}
 
-		// Update the key using the new value
-		void UpdateKey(int keycode, bool down)
+		// Random int in [min, max]
+		static int Get(int min, int max)
 		{
-			m_keys[keycode].justDown = !m_keys[keycode].isDown && down; // Was not already down, and is down not
-			m_keys[keycode].justUp = m_keys[keycode].isDown && !down; // Was down and now is up
-			m_keys[keycode].isDown = down;
+			UINT32 range = (UINT32)max - (UINT32)min + 1;
+			return (int)((UINT32)min + Bounded(State().gen, range));
 		}
 
-		// Handles the close button
-		static BOOL CloseHandler(DWORD event)
+		// Fill out with n random floats in [min, max], 4 values per iteration using SSE2
+		static void Fill(float* out, size_t n, float min, float max)
 		{
-			if (event == CTRL_CLOSE_EVENT)
-			{
-				std::unique_lock<std::mutex> lock(m_closeMutex);
-				m_shouldClose.exchange(true);
+			ThreadState& state = State();
+			const __m128 scale = _mm_set1_ps((1.0f / 16777215.0f) * (max - min));
+			const __m128 offset = _mm_set1_ps(min);
 
-				m_closeCall.wait(lock);
-				return TRUE;
+			size_t i = 0;
+			for (; i + 4 <= n; i += 4)
+			{
+				// Each 64 bits lane gives two 32 bits values, keep their top 24 bits
+				__m128i bits = _mm_srli_epi32(NextLanes(state.lanes), 8);
+				__m128 values = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(bits), scale), offset);
+				_mm_storeu_ps(out + i, values);
 			}
 
-			return FALSE; // Pass the event to the next handler
+			for (; i < n; i++)
+				out[i] = min + (float)(state.gen.Next() >> 40) * (1.0f / 16777215.0f) * (max - min);
 		}
 
-		// Report an error
-		void PrintError(const std::string& str, int line)
+		// Fill out with n random ints in [min, max]
+		static void Fill(int* out, size_t n, int min, int max)
 		{
-			m_shouldClose.exchange(true); // Tell the user to close
-			SetConsoleActiveScreenBuffer(m_hPreviousConsole); // Switch back to the old buffer
-			std::cout << "[Error] (RexConsoleEngine, line : " << line << ") : " << str << std::endl; // Print the error
-			std::cin.get(); // Wait for user feedback
+			ThreadState& state = State();
+			UINT32 range = (UINT32)max - (UINT32)min + 1;
+			for (size_t i = 0; i < n; i++)
+				out[i] = (int)((UINT32)min + Bounded(state.gen, range));
 		}
-	};
-	inline std::atomic_bool Console::m_shouldClose(false);
-	inline std::mutex Console::m_closeMutex;
-	inline std::condition_variable Console::m_closeCall;
 
-	/// <summary>
-	/// A drawable string
-	/// </summary>
-	class DrawString : public Console::Drawable
-	{
 	private:
-		std::string m_str;
-		Console::Color m_foreground, m_background;
-	public:
-		DrawString(const std::string& str, Console::Color foreground, Console::Color background) 
-			: m_str(str), m_foreground(foreground), m_background(background) {}
-
-		void Draw(int x, int y, Console& console) const override
+		// Get the state of the calling thread, (re)seeds it if needed
+		static ThreadState& State()
 		{
-			int dx = x;
-			for (int i = 0; i < m_str.length(); i++)
+			ThreadState& state = m_state;
+			UINT32 generation = m_generation.load(std::memory_order_relaxed);
+			if (state.generation != generation)
 			{
-				if (m_str[i] == '\n')
+				if (!state.hasStream)
 				{
-					dx = x;
-					y++;
+					state.stream = m_nextStream.fetch_add(1);
+					state.hasStream = true;
 				}
-				else
+
+				// Stream n starts n * 3 jumps after the master state : one for gen and two for the bulk lanes
+				state.gen.Seed(m_masterSeed.load());
+				for (UINT32 i = 0; i < state.stream * 3; i++)
+					state.gen.Jump();
+
+				Xoshiro lane0 = state.gen;
+				lane0.Jump();
+				Xoshiro lane1 = lane0;
+				lane1.Jump();
+				for (int i = 0; i < 4; i++)
+					state.lanes[i] = _mm_set_epi64x((long long)lane1.s[i], (long long)lane0.s[i]);
+
+				state.generation = generation;
+			}
+			return state;
+		}
+
+		// Unbiased random value in [0, range), range == 0 means the full 32 bits range
+		// Lemire's multiply-shift method, the modulo is only computed in the (rare) rejection case
+		static UINT32 Bounded(Xoshiro& gen, UINT32 range)
+		{
+			if (range == 0)
+				return (UINT32)(gen.Next() >> 32);
+
+			UINT64 m = (gen.Next() >> 32) * (UINT64)range;
+			UINT32 low = (UINT32)m;
+			if (low < range)
+			{
+				UINT32 threshold = (0u - range) % range;
+				while (low < threshold)
 				{
-					console.Draw(dx, y, Console::Pixel(m_foreground, m_background, m_str[i]));
-					dx++;
+					m = (gen.Next() >> 32) * (UINT64)range;
+					low = (UINT32)m;
 				}
 			}
+			return (UINT32)(m >> 32);
 		}
 
+		static __m128i Rotl(__m128i x, int k) { return _mm_or_si128(_mm_slli_epi64(x, k), _mm_srli_epi64(x, 64 - k)); }
+
+		// xoshiro256** step on two interleaved states, *5 and *9 are done with shifts and adds (no 64 bits multiply in SSE2)
+		static __m128i NextLanes(__m128i* s)
+		{
+			__m128i x5 = _mm_add_epi64(_mm_slli_epi64(s[1], 2), s[1]);
+			__m128i r = Rotl(x5, 7);
+			__m128i result = _mm_add_epi64(_mm_slli_epi64(r, 3), r);
+
+			__m128i t = _mm_slli_epi64(s[1], 17);
+			s[2] = _mm_xor_si128(s[2], s[0]);
+			s[3] = _mm_xor_si128(s[3], s[1]);
+			s[1] = _mm_xor_si128(s[1], s[2]);
+			s[0] = _mm_xor_si128(s[0], s[3]);
+			s[2] = _mm_xor_si128(s[2], t);
+			s[3] = Rotl(s[3], 45);
+			return result;
+		}
 	};
+	inline std::atomic<UINT64> Random::m_masterSeed = [] 
+	{
+		// Seed the random engine
+		std::random_device rd;
+		return ((UINT64)rd() << 32) | rd();
+	}();
+	inline std::atomic<UINT32> Random::m_generation(1);
+	inline std::atomic<UINT32> Random::m_nextStream(0);
+	inline thread_local Random::ThreadState Random::m_state;
 
 	/// <summary>
-	/// A sprite to be displayed
-	/// For now only 16 colors bmps are supported
+	/// <para>Particle system (sparks, rain, explosions...) stored as a structure of arrays</para>
+	/// <para>Update() integrates 4 particles per iteration with SSE2 and removes the dead ones by swapping them with the last one</para>
+	/// <para>Draw() clips 4 particles at a time and writes them straight into the screen buffer</para>
 	/// </summary>
-	class Sprite : public Console::Drawable
+	class ParticleSystem : public Console::Drawable
 	{
 	public:
-		UINT32 m_width, m_height;
-		Console::Color* m_colors; // Pixel data
-
-	public:
-
-		~Sprite()
+		// How the particles of an emitter are born
+		struct Emitter
 		{
-			if (m_colors != nullptr)
-				delete[] m_colors;
-		}
+			float speedMin = 5.0f, speedMax = 10.0f; // In cells per second
+			float angleMin = 0.0f, angleMax = 6.2831853f; // Direction, in radians (0 is right, positive is down)
+			float lifeMin = 0.5f, lifeMax = 1.0f; // In seconds
+			float spread = 0.0f; // Random offset of the birth position, in cells
+			std::vector<Console::Color> colors = { Console::Color::White }; // Color over life, from birth to death
+			Console::Pixel::Type type = Console::Pixel::Type::Full;
+			float rate = 100.0f; // Particles per second, used by Emit()
+		};
 
-		void Draw(int x, int y, Console& console) const override
+	private:
+		struct EmitterData
 		{
-			for (unsigned int dx = 0; dx < m_width; dx++)
-			{
-				for (unsigned int dy = 0; dy < m_height; dy++)
-				{
-					console.Draw(dx + x, dy + y, m_colors[dy * m_width + dx]);
-				}
-			}
-		}
+			Emitter emitter;
+			int paletteOffset; // First cell of its colors in m_palette
+			float accumulator; // Fraction of particle not emitted yet by Emit()
+		};
 
-		// Load from bitmap, only 16 color mode supported for now, returns false on errors
-		bool LoadBMP(const std::string& path)
-		{
-			// Usefull link for the bmp file format : 
-			// http://www.ece.ualberta.ca/~elliott/ee552/studentAppNotes/2003_w/misc/bmp_file_format/bmp_file_format.htm
+		int m_count; // Alive particles
+		int m_maxParticles;
 
-			std::FILE* f = std::fopen(path.c_str(), "rb"); // Open the file in binary mode
-			if (f == nullptr)
-				return false;
+		// Structure of arrays, sized to a multiple of 4 so Update() never needs a scalar tail
+		std::vector<float> m_x, m_y, m_vx, m_vy, m_age, m_life;
+		std::vector<float> m_colorScale; // Colors of the emitter / life
+		std::vector<int> m_colorOffset; // paletteOffset of the emitter
+		std::vector<int> m_color; // Index of the current cell in m_palette, updated by Update()
 
-			// Get the start offset of the pixel data, the width and the height
-			UINT32 offset;
-			std::fseek(f, 10, SEEK_CUR); // Skip to DataOffset
-			std::fread(&offset, sizeof(UINT32), 1, f);
-			std::fseek(f, 4, SEEK_CUR); // Skip to size
-			std::fread(&m_width, sizeof(UINT32), 1, f);
-			std::fread(&m_height, sizeof(UINT32), 1, f);
+		std::vector<EmitterData> m_emitters;
+		std::vector<ScreenCell> m_palette; // Colors of every emitter, the last one is repeated so age == life stays in range
+		std::vector<float> m_random; // Scratch for Burst()
 
-			m_colors = new Console::Color[m_width * m_height];
+		float m_gravityX, m_gravityY, m_drag;
 
-			std::fseek(f, 54, SEEK_SET); // Skip to the ColorTable
-			UINT8 colorTable[4 * 16]; // Color table
-			std::fread(&colorTable, sizeof(UINT8), 4 * 16, f);
-			for (int i = 0; i < 16; i++) // colors are saved as BGR, flip them to RGB
-			{
-				int B = colorTable[i * 4];
-				int R = colorTable[i * 4 + 2];
-				colorTable[i * 4] = R;
-				colorTable[i * 4 + 2] = B;
-			}
+	public:
+		ParticleSystem(int maxParticles = 1 << 20)
+			: m_count(0), m_maxParticles(maxParticles), m_gravityX(0.0f), m_gravityY(0.0f), m_drag(0.0f) {}
 
-			std::fseek(f, offset, SEEK_SET); // Skip to DataOffset
-			for (unsigned int y = 0; y < m_height; y++)
-			{
-				for (unsigned int x = 0; x < m_width / 2; x++)
-				{
-					UINT8 value;
-					std::fread(&value, sizeof(UINT8), 1, f);
-					m_colors[(m_height - 1 - y) * m_width + (x * 2)] = Console::RGBToColor(&colorTable[((value & 0b11110000)>>4) * 4]); // First pixel in the byte
-					m_colors[(m_height - 1 - y) * m_width + (x * 2 + 1)] = Console::RGBToColor(&colorTable[(value & 0b00001111) * 4]); // Second pixel in the byte
-				}
+		// Register an emitter, returns its index
+		int AddEmitter(const Emitter& emitter)
+		{
+			EmitterData data { emitter, (int)m_palette.size(), 0.0f };
+			if (data.emitter.colors.empty())
+				data.emitter.colors.push_back(Console::Color::White);
 
-				std::fseek(f, (4 - ((m_width / 2) % 4)) % 4, SEEK_CUR); // Each line is padded up to a multiple of 4 bytes
-			}
+			for (Console::Color color : data.emitter.colors)
+				m_palette.push_back(FrameBuffer<ScreenCell>::MakeCell((WCHAR)data.emitter.type, (UINT16)color));
+			m_palette.push_back(m_palette.back());
 
-			return true;
+			m_emitters.push_back(std::move(data));
+			return (int)m_emitters.size() - 1;
+		}
+
+		// Forces applied to every particle : gravity in cells per second squared, drag in 1 / second
+		void SetForces(float gravityX, float gravityY, float drag)
+		{
+			m_gravityX = gravityX;
+			m_gravityY = gravityY;
+			m_drag = (std::max)(drag, 0.0f);
 		}
-	};
 
+		// Number of alive particles
+		int Count() const { return m_count; }
 
-	/// <summary>
-	/// <para> A derivable class to allow objects to be serialized and deserialized. </para>
-	/// <para> The Pop() and Push() functions work from the same starting point : you need to pop in the same order you pushed </para>
-	/// <para> The output format is : "arg1,arg2,arg3,..." with a trailing comma. </para>
-	/// </summary>
-	class UserData
-	{
-	private:
-		std::deque<std::string> m_data;
+		// Kill every particle
+		void Clear() { m_count = 0; }
+
+		// Emit count particles at once at x,y
+		void Burst(int emitter, float x, float y, int count)
+		{
+			if (emitter < 0 || emitter >= (int)m_emitters.size())
+				return;
+
+			count = (std::min)(count, m_maxParticles - m_count);
+			if (count <= 0)
+				return;
+			Reserve(m_count + count);
+
+			const EmitterData& data = m_emitters[emitter];
+			const Emitter& e = data.emitter;
+
+			// All the random values in one go : angle, speed, life, offset angle, offset distance
+			m_random.resize((size_t)count * 5);
+			float* angles = m_random.data(), *speeds = angles + count, *lives = speeds + count, *offsetAngles = lives + count, *offsets = offsetAngles + count;
+			Random::Fill(angles, count, e.angleMin, e.angleMax);
+			Random::Fill(speeds, count, e.speedMin, e.speedMax);
+			Random::Fill(lives, count, (std::max)(e.lifeMin, 0.001f), (std::max)(e.lifeMax, 0.001f));
+			Random::Fill(offsetAngles, count, 0.0f, 6.2831853f);
+			Random::Fill(offsets, count, 0.0f, e.spread);
+
+			const float colors = (float)e.colors.size();
+			for (int i = 0; i < count; i++)
+			{
+				const int p = m_count + i;
+				m_x[p] = x + cosf(offsetAngles[i]) * offsets[i];
+				m_y[p] = y + sinf(offsetAngles[i]) * offsets[i];
+				m_vx[p] = cosf(angles[i]) * speeds[i];
+				m_vy[p] = sinf(angles[i]) * speeds[i];
+				m_age[p] = 0.0f;
+				m_life[p] = lives[i];
+				m_colorScale[p] = colors / lives[i];
+				m_colorOffset[p] = data.paletteOffset;
+				m_color[p] = data.paletteOffset;
+			}
+			m_count += count;
+		}
 
-	public:
-		// Convert the object to a string
-		bool ToString(std::string& out) 
+		// Continuous emission at the rate of the emitter, call it every frame
+		void Emit(int emitter, float x, float y, float deltaTime)
 		{
-			m_data.clear(); // clear the data
-			bool success = Serialize();
-
-			// Copy the data to the output string
-			out = ""; 
-			for (auto& str : m_data)
-				out += str + ",";
+			if (emitter < 0 || emitter >= (int)m_emitters.size())
+				return;
 
-			return success;
+			EmitterData& data = m_emitters[emitter];
+			data.accumulator += data.emitter.rate * deltaTime;
+			const int count = (int)data.accumulator;
+			data.accumulator -= count;
+			Burst(emitter, x, y, count);
 		}
 
-		// Update this object using a string
-		bool FromString(const std::string& in)
+		// Move the particles, age them and remove the dead ones
+		void Update(float deltaTime)
 		{
-			m_data.clear(); // Clear the data
+			const __m128 dt = _mm_set1_ps(deltaTime);
+			const __m128 damping = _mm_set1_ps(1.0f / (1.0f + m_drag * deltaTime));
+			const __m128 gravityX = _mm_set1_ps(m_gravityX * deltaTime), gravityY = _mm_set1_ps(m_gravityY * deltaTime);
 
-			// Split the input
-			std::string temp;
-			for (const char& c : in)
+			for (int i = 0; i < m_count; i += 4) // The arrays are padded to a multiple of 4
 			{
-				if (c == ',')
+				__m128 vx = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m_vx[i]), damping), gravityX);
+				__m128 vy = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&m_vy[i]), damping), gravityY);
+				__m128 age = _mm_add_ps(_mm_loadu_ps(&m_age[i]), dt);
+
+				_mm_storeu_ps(&m_vx[i], vx);
+				_mm_storeu_ps(&m_vy[i], vy);
+				_mm_storeu_ps(&m_x[i], _mm_add_ps(_mm_loadu_ps(&m_x[i]), _mm_mul_ps(vx, dt)));
+				_mm_storeu_ps(&m_y[i], _mm_add_ps(_mm_loadu_ps(&m_y[i]), _mm_mul_ps(vy, dt)));
+				_mm_storeu_ps(&m_age[i], age);
+
+				// Color over life
+				__m128i color = _mm_cvttps_epi32(_mm_mul_ps(age, _mm_loadu_ps(&m_colorScale[i])));
+				_mm_storeu_si128((__m128i*)&m_color[i], _mm_add_epi32(color, _mm_loadu_si128((const __m128i*)&m_colorOffset[i])));
+			}
+
+			// Swap-remove the dead particles, groups of 4 alive particles are skipped with one compare
+			int i = 0;
+			while (i < m_count)
+			{
+				if ((i & 3) == 0 && i + 4 <= m_count && _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(&m_age[i]), _mm_loadu_ps(&m_life[i]))) == 0)
 				{
-					m_data.push_back(temp);
-					temp = "";
+					i += 4;
+					continue;
 				}
+
+				if (m_age[i] >= m_life[i])
+					Remove(i); // The last particle is now at i, check it too
 				else
-					temp += c;
+					i++;
 			}
-
-			return Deserialize();
-		}
-
-	protected:
-		virtual bool Serialize() = 0; // Use Push() to serialize the object
-		virtual bool Deserialize() = 0; // Use Pop() to form the object
-
-		// Push a new argument
-		void Push(const std::string& value)
-		{
-			m_data.push_back(value);
 		}
 
-		// Pop the next argument
-		std::string Pop()
+		// Draw the particles, offset by x,y
+		void Draw(int x, int y, Console& console) const override
 		{
-			if (m_data.size() == 0)
-				return "";
-			std::string str = m_data.front(); // Save the string
-			m_data.pop_front(); // Remove it from the vector
-			return str;
-		}
-	};
+			if (console.m_deferred) // Keep the order of the draw calls, the particles are written directly
+				console.Flush();
 
-	// Int UserData type
-	class IntData : public UserData
-	{
-	public:
-		int value;
+			const int width = console.m_width;
+			const Console::Rect& clip = console.m_clip;
+			const __m128 offsetX = _mm_set1_ps((float)(x + console.m_offsetX)), offsetY = _mm_set1_ps((float)(y + console.m_offsetY));
+			const __m128 minX = _mm_set1_ps((float)clip.x1), minY = _mm_set1_ps((float)clip.y1);
+			const __m128 maxX = _mm_set1_ps((float)clip.x2), maxY = _mm_set1_ps((float)clip.y2);
+			const __m128 widthF = _mm_set1_ps((float)width);
 
-		IntData(int v) : value (v){}
+			for (int i = 0; i < m_count; i += 4)
+			{
+				__m128 px = _mm_add_ps(_mm_loadu_ps(&m_x[i]), offsetX);
+				__m128 py = _mm_add_ps(_mm_loadu_ps(&m_y[i]), offsetY);
+
+				// Clip the 4 particles at once, truncating is flooring once they are known to be positive
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(px, minX), _mm_cmplt_ps(px, maxX)), _mm_and_ps(_mm_cmpge_ps(py, minY), _mm_cmplt_ps(py, maxY)));
+				int mask = _mm_movemask_ps(inside);
+				if (i + 4 > m_count)
+					mask &= (1 << (m_count - i)) - 1; // Padding
+				if (mask == 0)
+					continue;
+
+				__m128 row = _mm_cvtepi32_ps(_mm_cvttps_epi32(py));
+				__m128 column = _mm_cvtepi32_ps(_mm_cvttps_epi32(px));
+				alignas(16) int index[4];
+				_mm_store_si128((__m128i*)index, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(row, widthF), column)));
+
+				for (int lane = 0; lane < 4; lane++)
+				{
+					if (mask & (1 << lane))
+						console.m_bufScreen[index[lane]] = m_palette[m_color[i + lane]];
+				}
+			}
+		}
 
-	protected:
-		bool Serialize() override
+	private:
+		// Grow the arrays to hold count particles
+		void Reserve(int count)
 		{
-			Push(std::to_string(value));
-			return true;
+			if ((int)m_x.size() >= count)
+				return;
+
+			size_t size = (std::max)((size_t)(count + 3) & ~(size_t)3, m_x.size() * 2);
+			for (auto* array : { &m_x, &m_y, &m_vx, &m_vy, &m_age, &m_life, &m_colorScale })
+				array->resize(size, 0.0f);
+			m_colorOffset.resize(size, 0);
+			m_color.resize(size, 0);
 		}
 
-		bool Deserialize() override
+		// Replace particle i by the last one
+		void Remove(int i)
 		{
-			value = std::stoi(Pop());
-			return true;
+			const int last = --m_count;
+			m_x[i] = m_x[last];
+			m_y[i] = m_y[last];
+			m_vx[i] = m_vx[last];
+			m_vy[i] = m_vy[last];
+			m_age[i] = m_age[last];
+			m_life[i] = m_life[last];
+			m_colorScale[i] = m_colorScale[last];
+			m_colorOffset[i] = m_colorOffset[last];
+			m_color[i] = m_color[last];
 		}
 	};
 
-	// Float UserData type
-	class FloatData : public UserData
+#ifdef __cpp_impl_coroutine // C++20
+	class Scheduler;
+
+	/// <summary>
+	/// <para>Game logic written as a coroutine : a function returning Script that waits with co_await WaitSeconds(), NextFrame() or KeyPressed(), run by a Scheduler</para>
+	/// <para>The parameters are copied in the coroutine, the objects given by reference or pointer must outlive the script</para>
+	/// </summary>
+	class Script
 	{
 	public:
-		float value;
-
-		FloatData(float v) : value(v) {}
-	protected:
-		bool Serialize() override
+		struct promise_type
 		{
-			Push(std::to_string(value));
-			return true;
-		}
+			Scheduler* scheduler = nullptr;
+			int script = -1; // Handle in the scheduler
+
+			Script get_return_object() { return Script(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			std::suspend_always initial_suspend() noexcept { return {}; } // Runs when given to Scheduler::Start()
+			std::suspend_always final_suspend() noexcept { return {}; } // Destroyed by the scheduler
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
 
-		bool Deserialize() override
-		{
-			value = std::stof(Pop());
-			return true;
-		}
-	};
-	
-	// String UserData type
-	class StringData : public UserData
-	{
-	public:
-		std::string value;
+	private:
+		friend class Scheduler;
+		std::coroutine_handle<promise_type> m_coroutine;
 
-		StringData(std::string v) : value(v) {}
-	protected:
-		bool Serialize() override
-		{
-			Push(value);
-			return true;
-		}
+		explicit Script(std::coroutine_handle<promise_type> coroutine) : m_coroutine(coroutine) {}
 
-		bool Deserialize() override
+	public:
+		Script(Script&& other) noexcept : m_coroutine(other.m_coroutine) { other.m_coroutine = nullptr; }
+		Script& operator=(Script&&) = delete;
+
+		// A script that was never started
+		~Script()
 		{
-			value = Pop();
-			return true;
+			if (m_coroutine)
+				m_coroutine.destroy();
 		}
 	};
 
+	class WaitSeconds;
+	class NextFrame;
+	class KeyPressed;
+
 	/// <summary>
-	/// <para> A very primitive way to store and load user data. The data is stored in a (key,value) pair. </para>
-	/// <para> Both the key and the value are string and should not contain newlines (\n) or commas (,): See UserData::SanitizeString. </para>
-	/// <para> The output file will contain the data a the key=value format. </para>
+	/// <para>Runs Scripts inside the frame loop : Update() once per frame resumes the scripts whose wait is over, each at most once</para>
+	/// <para>The waits are in a TimerWheel (1 ms ticks) and in lists per key, so a frame costs the scripts that resume, not all the scripts waiting</para>
 	/// </summary>
-	class Archive
+	class Scheduler
 	{
 	public:
-		// The file extention used to create and access the files
-		static std::string m_fileExtension; // ".userdata"
+		static constexpr double TicksPerSecond = 1000.0; // Resolution of WaitSeconds()
+
 	private:
-		std::wstring m_filePath; // Path to the file to use
+		friend class WaitSeconds;
+		friend class NextFrame;
+		friend class KeyPressed;
 
-		std::map<std::string, std::string> m_cache; // Cached values
+		static constexpr UINT32 NoTimer = UINT32_MAX;
 
-		constexpr static char KeyValueSeparator = '='; // Separator used in the output file
+		struct ScriptData
+		{
+			std::coroutine_handle<Script::promise_type> coroutine; // Null when the handle is free
+			double wakeTime; // When the script was meant to resume, WaitSeconds() counts from it so periodic scripts do not drift
+			UINT32 timer; // Of WaitSeconds()
+			UINT32 wait; // Counts the waits, the NextFrame() and KeyPressed() entries of older waits are ignored
+			int key; // Of KeyPressed(), -1 otherwise
+			bool running;
+			bool stopped; // Stop() was called while running, destroyed when it suspends
+		};
 
-	public:
-		Archive(const std::string& appName, const std::string& fileName)
+		struct Waiter
 		{
-			// Get the file path and create the folder if needed
-			wchar_t* appDataPath = 0;
-			SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, NULL, &appDataPath);
+			int script;
+			UINT32 wait;
+		};
 
-			m_filePath = appDataPath;
-			m_filePath += L"\\RexConsoleEngine";
-			CreateDirectory(m_filePath.c_str(), NULL); // Make the RexGameEngine folder (if it does not exist)
-			m_filePath += L"\\" + StringToWString(appName);
-			CreateDirectory(m_filePath.c_str(), NULL); // Make the app specific folder (if it does not exist)
-			m_filePath += L"\\" + StringToWString(fileName) + StringToWString(m_fileExtension);
-			CoTaskMemFree(static_cast<void*>(appDataPath)); // Free the memory used by GetKnownFolderPath
+		TimerWheel m_wheel; // Values are script handles
+		std::vector<ScriptData> m_scripts;
+		std::vector<int> m_freeHandles;
+		int m_count;
+		double m_time; // Sum of the delta times, in seconds
 
-			GetCache();
-		}
+		std::vector<Waiter> m_nextFrame;
+		std::vector<Waiter> m_keyWaiters[256];
+		std::vector<int> m_waitedKeys; // Keys with waiters
+		std::vector<UINT32> m_expired;
+		std::vector<Waiter> m_resume; // Scripts resumed by Update()
 
-		// Get the value at the key, returns true for success
-		bool Get(const std::string& key, UserData& outValue)
+	public:
+		Scheduler() : m_count(0), m_time(0.0) {}
+		~Scheduler() { Clear(); }
+
+		Scheduler(const Scheduler&) = delete;
+		Scheduler& operator=(const Scheduler&) = delete;
+
+		// Run a script until its first co_await, returns its handle. The handle can be given to a new script once this one ends or is stopped
+		int Start(Script script)
 		{
-			auto iterator = m_cache.find(key);
-			if (iterator == m_cache.end()) // Not found in cache, reload it
+			int handle;
+			if (!m_freeHandles.empty())
 			{
-				GetCache();
-				iterator = m_cache.find(key);
+				handle = m_freeHandles.back();
+				m_freeHandles.pop_back();
+			}
+			else
+			{
+				handle = (int)m_scripts.size();
+				m_scripts.push_back({ nullptr, 0.0, NoTimer, 0, -1, false, false });
 			}
 
-			if (iterator == m_cache.end()) // Not found again
-				return false;
+			ScriptData& data = m_scripts[handle];
+			data.coroutine = script.m_coroutine;
+			data.wakeTime = m_time;
+			script.m_coroutine = nullptr;
+			data.coroutine.promise().scheduler = this;
+			data.coroutine.promise().script = handle;
+			m_count++;
 
-			return outValue.FromString(iterator->second);
+			Resume(handle);
+			return handle;
 		}
 
-		// Get all of the data in the Archive as strings
-		std::map<std::string, std::string> GetAll(bool reloadCache = true)
+		// Destroy a script where it waits (a script can stop itself, it is destroyed at its next co_await)
+		void Stop(int script)
 		{
-			if (reloadCache)
-				GetCache();
-			return m_cache;
+			if (!Running(script))
+				return;
+
+			if (m_scripts[script].running)
+				m_scripts[script].stopped = true;
+			else
+				Destroy(script);
 		}
 
-		// Returns true for success, the key and value are sanitized
-		bool Set(std::string& key, UserData& value)
+		// Is the script still running ?
+		bool Running(int script) const
 		{
-			std::string strValue;
-			if (!value.ToString(strValue))
-				return false;
+			return script >= 0 && script < (int)m_scripts.size() && m_scripts[script].coroutine && !m_scripts[script].stopped;
+		}
 
-			SanitizeString(key);
-			SanitizeString(strValue);
+		// Number of scripts running
+		int Count() const { return m_count; }
 
-			GetCache(); // Update the cache before any save operations
+		// Time of the scheduler, in seconds
+		double Time() const { return m_time; }
 
+		// Advance by the delta time of the console and resume the scripts, KeyPressed() uses the inputs of the console
+		void Update(const Console& console) { Update(console.DeltaTime(), &console); }
 
-			if (m_cache.find(key) == m_cache.end()) // Not in cache, so also not in the file
-			{
-				std::ofstream file(m_filePath, std::ios::app);
-				if (!file.is_open())
-					return false;
+		// Advance by deltaTime seconds and resume the scripts, KeyPressed() never resumes without a console
+		void Update(float deltaTime, const Console* console = nullptr)
+		{
+			m_time += (std::max)(deltaTime, 0.0f);
+			m_resume.clear();
 
-				m_cache.insert({ key, strValue }); // Keep the cache updated
-				file.seekp(file.end); // Add to the end of the file
-				file << key << KeyValueSeparator << strValue << std::endl;
-				file.close();
-			}
-			else if (strValue != m_cache[key]) // Not in the cache, write the file from scratch
+			// Timers, by expiry
+			m_expired.clear();
+			m_wheel.Advance((UINT64)(m_time * TicksPerSecond), m_expired);
+			for (UINT32 script : m_expired)
 			{
-				// Copy the file
-				const std::wstring tempPath = m_filePath + L".temp";
-				std::ifstream src(m_filePath);
-				std::ofstream dst(tempPath);
-				if (!src.is_open() || !dst.is_open())
-					return false;
-
-				dst << src.rdbuf();
-				src.close();
-				dst.close();
+				m_scripts[script].timer = NoTimer;
+				m_resume.push_back({ (int)script, m_scripts[script].wait });
+			}
 
-				// Copy the data back, but change the value
-				std::ifstream temp(tempPath);
-				std::ofstream file(m_filePath, std::ios::trunc);
-				if (!temp.is_open() || !file.is_open())
-					return false;
+			for (const Waiter& waiter : m_nextFrame)
+			{
+				if (Current(waiter))
+				{
+					m_scripts[waiter.script].wakeTime = m_time;
+					m_resume.push_back(waiter);
+				}
+			}
+			m_nextFrame.clear();
 
-				std::string line;
-				while (getline(temp, line))
+			for (size_t i = 0; console != nullptr && i < m_waitedKeys.size();)
+			{
+				const int key = m_waitedKeys[i];
+				if (console->WasJustPressed((Console::Key)key))
 				{
-					auto foundPos = line.find(key);
-					if (foundPos == 0) // If the key was found at the start of the line (so it's not a value)
+					for (const Waiter& waiter : m_keyWaiters[key])
 					{
-						file << key << KeyValueSeparator << strValue << std::endl;
+						if (Current(waiter))
+						{
+							m_scripts[waiter.script].wakeTime = m_time;
+							m_scripts[waiter.script].key = -1;
+							m_resume.push_back(waiter);
+						}
 					}
-					else
-						file << line << std::endl;
+					m_keyWaiters[key].clear();
 				}
 
-				temp.close();
-				file.close();
-
-				// Delete the temp file
-				DeleteFile(tempPath.c_str());
-			} // else : the new value was the same as the old
+				if (m_keyWaiters[key].empty())
+				{
+					m_waitedKeys[i] = m_waitedKeys.back();
+					m_waitedKeys.pop_back();
+				}
+				else
+					i++;
+			}
 
-			return true;
+			// The waits started while resuming go to the next frames
+			for (size_t i = 0; i < m_resume.size(); i++)
+			{
+				if (Current(m_resume[i]))
+					Resume(m_resume[i].script);
+			}
 		}
 
-		static void SanitizeString(std::string& str)
+		// Destroy every script
+		void Clear()
 		{
-			// Change \n to spaces and , to .
-			for (int i = 0; i < str.length(); i++)
+			for (int script = 0; script < (int)m_scripts.size(); script++)
 			{
-				if (str[i] == '\n')
-					str[i] = ' ';
-				else if (str[i] == ',')
-					str[i] = '.';
+				if (m_scripts[script].coroutine && !m_scripts[script].running)
+					Destroy(script);
 			}
 		}
 
 	private:
-
-		void GetCache()
+		// Is this the current wait of its script ?
+		bool Current(const Waiter& waiter) const
 		{
-			std::ifstream file(m_filePath);
+			const ScriptData& data = m_scripts[waiter.script];
+			return data.coroutine && !data.stopped && data.wait == waiter.wait;
+		}
 
-			if (!file.is_open())
-				return;
+		void Resume(int script)
+		{
+			const std::coroutine_handle<Script::promise_type> coroutine = m_scripts[script].coroutine;
+			m_scripts[script].running = true;
+			coroutine.resume(); // Can start scripts, m_scripts can grow
+			m_scripts[script].running = false;
 
-			m_cache.clear();
+			if (coroutine.done() || m_scripts[script].stopped)
+				Destroy(script);
+		}
 
-			for (std::string line; getline(file, line); )
+		void Destroy(int script)
+		{
+			ScriptData& data = m_scripts[script];
+			if (data.timer != NoTimer)
+				m_wheel.Cancel(data.timer);
+			if (data.key >= 0) // The waiters of a key are only checked when it is pressed
 			{
-				std::size_t splitPos = line.find(KeyValueSeparator);
-				if (splitPos != std::string::npos)
-				{
-					// Dont include spaces either side of the =
-					std::string key = line.substr(0, line[splitPos - 1] == ' ' ? splitPos - 1 : splitPos);
-					std::string value = line.substr(line[splitPos + 1] == ' ' ? splitPos + 2 : splitPos + 1);
-					if (!key.empty() && !value.empty())
-						m_cache.insert({ key, value });
-				}
+				std::vector<Waiter>& waiters = m_keyWaiters[data.key];
+				waiters.erase(std::remove_if(waiters.begin(), waiters.end(), [&](const Waiter& waiter) { return waiter.script == script; }), waiters.end());
 			}
-			file.close();
+
+			const std::coroutine_handle<Script::promise_type> coroutine = data.coroutine;
+			data.coroutine = nullptr;
+			data.timer = NoTimer;
+			data.wait++;
+			data.key = -1;
+			data.stopped = false;
+			m_freeHandles.push_back(script);
+			m_count--;
+
+			coroutine.destroy(); // Last, the destructors of the coroutine can use the scheduler
+		}
+
+		// Used by the awaitables when a script suspends
+		void SuspendFor(int script, float seconds)
+		{
+			ScriptData& data = m_scripts[script];
+			data.wait++;
+			data.wakeTime = data.wakeTime + seconds >= m_time ? data.wakeTime + seconds : m_time; // Late by more than a wait : no catching up
+			data.timer = m_wheel.Schedule((UINT64)ceil(data.wakeTime * TicksPerSecond), (UINT32)script);
 		}
-	};
-	inline std::string Archive::m_fileExtension(".userdata");
 
+		void SuspendFrame(int script)
+		{
+			m_nextFrame.push_back({ script, ++m_scripts[script].wait });
+		}
 
+		void SuspendKey(int script, Console::Key key)
+		{
+			ScriptData& data = m_scripts[script];
+			data.key = (int)key & 0xFF;
+			if (m_keyWaiters[data.key].empty() && std::find(m_waitedKeys.begin(), m_waitedKeys.end(), data.key) == m_waitedKeys.end())
+				m_waitedKeys.push_back(data.key);
+			m_keyWaiters[data.key].push_back({ script, ++data.wait });
+		}
+	};
 
 	/// <summary>
-	/// A simple random number generator, a new random seed is automatically set at application launch
+	/// co_await WaitSeconds(seconds) : resume seconds after the script last woke up (periodic waits do not drift), or in the next frame when it is already late
 	/// </summary>
-	class Random
+	class WaitSeconds
 	{
 	private:
-		static std::mt19937 m_randEngine;
+		float m_seconds;
 
 	public:
-		static void Seed(int seed)
-		{
-			m_randEngine.seed(seed);
-		}
+		explicit WaitSeconds(float seconds) : m_seconds(seconds) {}
 
-		static float Get(float min, float max)
-		{
-			std::uniform_real_distribution<float> dist(min, std::nextafter(max, FLT_MAX));
-			return dist(m_randEngine);
-		}
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<Script::promise_type> coroutine) const { coroutine.promise().scheduler->SuspendFor(coroutine.promise().script, m_seconds); }
+		void await_resume() const noexcept {}
+	};
 
-		static int Get(int min, int max)
-		{
-			std::uniform_int_distribution<int> dist(min, max);
-			return dist(m_randEngine);
-		}
+	/// <summary>
+	/// co_await NextFrame() : resume in the next Scheduler::Update()
+	/// </summary>
+	class NextFrame
+	{
+	public:
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<Script::promise_type> coroutine) const { coroutine.promise().scheduler->SuspendFrame(coroutine.promise().script); }
+		void await_resume() const noexcept {}
 	};
-	inline std::mt19937 Random::m_randEngine = [] 
+
+	/// <summary>
+	/// co_await KeyPressed(key) : resume in the next frame where the key is pressed (Console::WasJustPressed())
+	/// </summary>
+	class KeyPressed
 	{
-		// Seed the random engine
-		std::random_device rd;
-		Seed(rd());
-		return m_randEngine;
-	}();
+	private:
+		Console::Key m_key;
+
+	public:
+		explicit KeyPressed(Console::Key key) : m_key(key) {}
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<Script::promise_type> coroutine) const { coroutine.promise().scheduler->SuspendKey(coroutine.promise().script, m_key); }
+		void await_resume() const noexcept {}
+	};
+#endif
 
 }
 
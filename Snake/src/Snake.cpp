@@ -1,7 +1,6 @@
 // A simple snake program using the RexConsoleEngine
 #include "RexConsoleEngine.h"
 
-#include <deque>
 #include <time.h>
 #include <algorithm>
 #include <string>
@@ -12,21 +11,31 @@ constexpr int UIWidth = 28; // The width of the ui
 
 using namespace RexConsoleEngine;
 
+// Width of a UTF-8 string in characters
+int TextWidth(const std::string& str)
+{
+	int width, height;
+	Console::TextSize(str.c_str(), (int)str.length(), width, height);
+	return width;
+}
+
 class Snake
 {
 public:
 	enum class Direction { Up, Right, Down, Left};
 
 private:
-	std::deque<std::pair<int, int>> m_body;
+	RingBuffer<std::pair<int, int>> m_body; // Front is the tail, back is the head
+	OccupancyGrid m_cells; // The cells covered by the body
 
 	Direction m_dir;
 
 public:
 	// Start position
-	Snake(int x, int y, Direction dir)
+	Snake(int x, int y, Direction dir) : m_body(MapSize * MapSize), m_cells(MapSize, MapSize)
 	{
-		m_body.push_back({x,y});
+		m_body.PushBack({x,y});
+		m_cells.Set(x, y);
 		m_dir = dir;
 	}
 	
@@ -56,14 +65,18 @@ public:
 			break;
 		}
 
-		std::pair<int, int> newHead = { (m_body.back().first + dx + MapSize) % MapSize, (m_body.back().second + dy + MapSize) % MapSize };
+		std::pair<int, int> newHead = { (m_body.Back().first + dx + MapSize) % MapSize, (m_body.Back().second + dy + MapSize) % MapSize };
 		// Check if the snake ate itself
 		if (Contains(newHead.first, newHead.second))
 			return false; // Dead
 
-		m_body.push_back(newHead);
 		if (!grow)
-			m_body.pop_front();
+		{
+			m_cells.Reset(m_body.Front().first, m_body.Front().second);
+			m_body.PopFront();
+		}
+		m_body.PushBack(newHead); // Never full : the snake dies before covering the whole map
+		m_cells.Set(newHead.first, newHead.second);
 
 		return true; // Alive
 	}
@@ -76,44 +89,105 @@ public:
 			c.Draw(p.first, p.second, Console::Color::Dark_Green);
 		}
 
-		c.Draw(m_body.back().first, m_body.back().second, Console::Color::Green); // Draw the head in a different green
+		c.Draw(m_body.Back().first, m_body.Back().second, Console::Color::Green); // Draw the head in a different green
 	}
 
 	// Is this coord inside the snake
-	bool Contains(int x, int y)
+	bool Contains(int x, int y) const
 	{
-		return (std::find(m_body.begin(), m_body.end(), std::pair<int,int>(x,y)) != m_body.end());
+		return m_cells.Test(x, y);
 	}
 };
 
-int main()
+// State of a game, updated by the Play() script and drawn by the main loop
+struct Game
+{
+	Snake snake = Snake(MapSize / 2, MapSize / 2, Snake::Direction::Up);
+	int appleX = Random::Get(0, MapSize - 1), appleY = Random::Get(0, MapSize - 1);
+	int score = 0;
+};
+
+// Move the snake every 75 ms, ends with a fade out when the snake dies
+Script Play(Game& game, Console& console)
+{
+	for (;;)
+	{
+		co_await WaitSeconds(0.075f);
+
+		bool ateApple = game.snake.Contains(game.appleX, game.appleY);
+		if (!game.snake.Update(ateApple))
+			break; // Dead
+
+		if (ateApple)
+		{
+			game.score++;
+			game.appleX = Random::Get(0, MapSize - 1);
+			game.appleY = Random::Get(0, MapSize - 1);
+		}
+	}
+
+	for (int step = 1; step <= 10; step++)
+	{
+		console.SetColorRemap(ColorRemap::FadeToBlack(step / 10.0f));
+		co_await WaitSeconds(0.05f);
+	}
+}
+
+// Snake --spectators : the game can be watched with the Viewer
+int main(int argc, char** argv)
 {
 	std::cout << "Enter Name : ";
 	std::string name;
 	std::cin >> name;
 
 	Console* c = new Console(MapSize + UIWidth, MapSize, "Snake");
-	Archive scores("Snake", "HighScores");
-	
-	Snake s(MapSize/2, MapSize/2, Snake::Direction::Up);
-
-	float time = 0;
-	int appleX = Random::Get(0, MapSize - 1), appleY = Random::Get(0, MapSize - 1);
-	int score = 0;
-
-	std::vector<std::string> scoreTable;
-	auto scoreMap = scores.GetAll();
+	if (argc > 1 && std::string(argv[1]) == "--spectators")
+		c->StartStreaming();
+	Leaderboard scores("Snake", "HighScores");
+	if (scores.Count() == 0) // Scores saved in an Archive by the older versions
+	{
+		Archive archive("Snake", "HighScores");
+		IntData score(0);
+		for (auto& entry : archive.GetAll())
+			if (score.FromString(entry.second))
+				scores.Submit(entry.first, score.value);
+	}
 	
-	for (auto& score : scoreMap)
+	Game game;
+	Scheduler scripts;
+	const int gameScript = scripts.Start(Play(game, *c));
+
+	// Title, drawn with the built-in bitmap font
+	BitmapText title(BitmapFont::Default(), "Snake", Console::Color::Green);
+	int titleWidth, titleHeight;
+	title.GetSize(titleWidth, titleHeight);
+
+	// The 10 best scores, and the rank of the player below them. Only changes at the end of the game : the lines and their positions are made once
+	std::vector<Leaderboard::Entry> best;
+	scores.Top(10, best);
+	Leaderboard::Entry player;
+	if (scores.Get(name, player) && player.rank >= best.size())
+		best.push_back(player);
+
+	std::vector<std::pair<int, std::string>> scoreTable; // x, line
+	for (auto& score : best)
 	{
-		score.second = score.second.substr(0, score.second.length() - 1);
-		std::string entry = score.first + ' ' + score.second;
-		if (entry.length() > UIWidth) // Reduce the name size and add ... at the end
+		const std::string rank = std::to_string(score.rank + 1) + ". ", value = ' ' + std::to_string(score.score);
+		std::string entry = rank + score.name + value;
+		if (TextWidth(entry) > UIWidth) // Reduce the name size and add ... at the end
 		{
-			entry = entry.substr(0, score.first.length() - (entry.length() - UIWidth) - 3) + "... " + score.second;
+			std::string name = score.name;
+			do
+			{
+				while (!name.empty() && ((unsigned char)name.back() & 0xC0) == 0x80) // Remove a whole UTF-8 character
+					name.pop_back();
+				if (!name.empty())
+					name.pop_back();
+				entry = rank + name + "..." + value;
+			} while (!name.empty() && TextWidth(entry) > UIWidth);
 		}
 
-		scoreTable.push_back(entry);
+		scoreTable.push_back({ (UIWidth / 2) - (TextWidth(entry) / 2), entry });
 	}
 
 
@@ -122,64 +196,44 @@ int main()
 		c->PollInputs();
 
 		if (c->IsPressed(Console::Key::Up))
-			s.SetDir(Snake::Direction::Up);
+			game.snake.SetDir(Snake::Direction::Up);
 		else if (c->IsPressed(Console::Key::Right))
-			s.SetDir(Snake::Direction::Right);
+			game.snake.SetDir(Snake::Direction::Right);
 		else if (c->IsPressed(Console::Key::Down))
-			s.SetDir(Snake::Direction::Down);
+			game.snake.SetDir(Snake::Direction::Down);
 		else if (c->IsPressed(Console::Key::Left))
-			s.SetDir(Snake::Direction::Left);
+			game.snake.SetDir(Snake::Direction::Left);
 
-		time += c->DeltaTime();
-		if (time >= 0.075f)
+		scripts.Update(*c);
+		if (!scripts.Running(gameScript))
 		{
-			time = 0;
-			bool ateApple = s.Contains(appleX, appleY);
-			
-			if (!s.Update(ateApple))
-			{
-				// Dead
-				IntData maxScore(-1);
-				std::string str;
-				scores.Get(name, maxScore);
-
-				if (score > maxScore.value)
-				{
-					maxScore.value = score;
-					scores.Set(name, maxScore);
-				}
-
-				break;
-			}
-			
-			if (ateApple)
-			{
-				score++;
-				appleX = Random::Get(0, MapSize - 1);
-				appleY = Random::Get(0, MapSize - 1);
-			}
+			// Dead, only the best score of the player is kept
+			scores.Submit(name, game.score);
+			break;
 		}
 
 		c->Clear(Console::Color::Dark_Grey);
 
 
 
-		s.Draw(*c); // Drawn the snake
-		c->Draw(appleX, appleY, Console::Color::Red); // Draw the apple
+		game.snake.Draw(*c); // Drawn the snake
+		c->Draw(game.appleX, game.appleY, Console::Color::Red); // Draw the apple
 
-		// UI
-		c->Fill(MapSize, 0, UIWidth, MapSize, Console::Color::Black);
+		// UI, in its own viewport : 0,0 is the top left corner of the panel
+		c->PushViewport(MapSize, 0, UIWidth, MapSize);
+		c->Fill(0, 0, UIWidth, MapSize, Console::Color::Black);
 
 		// Snake logo
-		c->Draw(MapSize, 1, DrawString(" _____             _\n/  ___|           | |\n\\ `--. _ __   __ _| | _____\n `--. \\ '_ \\ / _` | |/ / _ \\\n/\\__/ / | | | (_| |   <  __/\n\\____/|_| |_|\\__,_|_|\\_\\___|", Console::Color::Green, Console::Color::Black));
+		c->Draw((UIWidth - titleWidth) / 2, 1, title);
 
-		c->Draw(MapSize + 11, 10, DrawString("Score:", Console::Color::White, Console::Color::Black));
-		c->Draw(MapSize + (UIWidth / 2) - (int)std::to_wstring(score).length(), 12, DrawString(std::to_string(score), Console::Color::White, Console::Color::Black));
+		c->Draw(11, 10, DrawString(DrawString::View(), "Score:", Console::Color::White, Console::Color::Black));
+		c->Draw((UIWidth / 2) - (int)std::to_wstring(game.score).length(), 12, DrawString(std::to_string(game.score), Console::Color::White, Console::Color::Black));
 
 		// Scores
-		c->Draw(MapSize + 8, 15, DrawString("High Scores:", Console::Color::White, Console::Color::Black));
+		c->Draw(8, 15, DrawString(DrawString::View(), "High Scores:", Console::Color::White, Console::Color::Black));
 		for (int i = 0; i < scoreTable.size(); i++)
-			c->Draw(MapSize + (UIWidth / 2) - ((int)scoreTable[i].length() / 2), 17 + i, DrawString(scoreTable[i], Console::Color::White, Console::Color::Black));
+			c->Draw(scoreTable[i].first, 17 + i, DrawString(DrawString::View(), scoreTable[i].second.c_str(), Console::Color::White, Console::Color::Black));
+		c->PopViewport();
 
 		c->BlipToScreen();
 	}
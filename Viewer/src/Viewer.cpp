@@ -0,0 +1,63 @@
+// Watch a game streamed with Console::StartStreaming() on this computer
+// Usage : Viewer [port]
+#include "RexConsoleEngine.h"
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace RexConsoleEngine;
+
+int main(int argc, char** argv)
+{
+	const UINT16 port = argc > 1 ? (UINT16)std::atoi(argv[1]) : SpectatorServer::DefaultPort;
+
+	SpectatorClient client;
+	if (!client.Connect(port))
+	{
+		std::cout << "No game is streaming on port " << port << std::endl;
+		std::cin.get();
+		return 1;
+	}
+
+	// The size of the console is the size of the stream, known with the first frame
+	while (client.Connected() && client.Width() == 0)
+	{
+		client.Receive();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if (!client.Connected())
+	{
+		std::cout << "The game stopped streaming" << std::endl;
+		std::cin.get();
+		return 1;
+	}
+
+	Console* c = new Console(client.Width(), client.Height(), "Spectator");
+	c->DrawCells(0, 0, client.Width(), client.Height(), client.Cells());
+	c->BlipToScreen();
+
+	while (client.Connected())
+	{
+		c->PollInputs();
+		if (c->IsPressed(Console::Key::Escape) || c->ShouldClose())
+			break;
+
+		if (!client.Receive()) // Nothing new, do not redraw
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		if (client.Width() != c->Width() || client.Height() != c->Height()) // The game console was recreated
+		{
+			delete c;
+			c = new Console(client.Width(), client.Height(), "Spectator");
+		}
+
+		c->DrawCells(0, 0, client.Width(), client.Height(), client.Cells());
+		c->BlipToScreen();
+	}
+
+	delete c;
+	return 0;
+}